@@ -24,6 +24,7 @@
 
 #include "Socket.h"
 
+#include <algorithm>
 #include <stdexcept>
 #include <cstdio>
 #include <cstring>
@@ -31,6 +32,9 @@
 #include <fcntl.h>
 #include <poll.h>
 #include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
 
 namespace Socket {
 
@@ -784,7 +788,8 @@ void TCPSocket::listen(int port, const string& name)
         }
 #endif
 
-        int ret = ::listen(m_sock, 0);
+        // Several destinations can connect at the same time
+        int ret = ::listen(m_sock, SOMAXCONN);
         if (ret == -1) {
             throw std::runtime_error(string("Could not listen: ") + strerror(errno));
         }
@@ -986,70 +991,24 @@ void TCPClient::reconnect()
     m_sock.connect(m_hostname, m_port, true);
 }
 
-TCPConnection::TCPConnection(TCPSocket&& sock) :
-            queue(),
-            m_running(true),
-            m_sender_thread(),
-            m_sock(move(sock))
+void SendStats::record_sent(chrono::steady_clock::duration latency)
 {
-#if MISSING_OWN_ADDR
-    auto own_addr = m_sock.getOwnAddress();
-    auto addr = m_sock.getRemoteAddress();
-    etiLog.level(debug) << "New TCP Connection on port " <<
-        own_addr.getPort() << " from " <<
-        addr.getHostAddress() << ":" << addr.getPort();
-#endif
-    m_sender_thread = std::thread(&TCPConnection::process, this);
+    num_sent++;
+    latency_total += latency;
+    latency_max = std::max(latency_max, latency);
 }
 
-TCPConnection::~TCPConnection()
+chrono::steady_clock::duration SendStats::latency_avg() const
 {
-    m_running = false;
-    vector<uint8_t> termination_marker;
-    queue.push(termination_marker);
-    if (m_sender_thread.joinable()) {
-        m_sender_thread.join();
+    if (num_sent == 0) {
+        return {};
     }
+    return latency_total / (long)num_sent;
 }
 
-void TCPConnection::process()
+TCPConnection::TCPConnection(TCPSocket&& socket) :
+            sock(move(socket))
 {
-    while (m_running) {
-        vector<uint8_t> data;
-        queue.wait_and_pop(data);
-
-        if (data.empty()) {
-            // empty vector is the termination marker
-            m_running = false;
-            break;
-        }
-
-        try {
-            ssize_t remaining = data.size();
-            const uint8_t *buf = reinterpret_cast<const uint8_t*>(data.data());
-            const int timeout_ms = 10; // Less than one ETI frame
-
-            while (m_running and remaining > 0) {
-                const ssize_t sent = m_sock.send(buf, remaining, timeout_ms);
-                if (sent < 0 or sent > remaining) {
-                    throw std::logic_error("Invalid TCPSocket::send() return value");
-                }
-                remaining -= sent;
-                buf += sent;
-            }
-        }
-        catch (const std::runtime_error& e) {
-            m_running = false;
-        }
-    }
-
-#if MISSING_OWN_ADDR
-    auto own_addr = m_sock.getOwnAddress();
-    auto addr = m_sock.getRemoteAddress();
-    etiLog.level(debug) << "Dropping TCP Connection on port " <<
-        own_addr.getPort() << " from " <<
-        addr.getHostAddress() << ":" << addr.getPort();
-#endif
 }
 
 
@@ -1062,10 +1021,24 @@ TCPDataDispatcher::TCPDataDispatcher(size_t max_queue_size, size_t buffers_to_pr
 TCPDataDispatcher::~TCPDataDispatcher()
 {
     m_running = false;
+    if (m_event_fd != -1) {
+        const uint64_t one = 1;
+        ssize_t ret = ::write(m_event_fd, &one, sizeof(one));
+        (void)ret;
+    }
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
     m_connections.clear();
     m_listener_socket.close();
-    if (m_listener_thread.joinable()) {
-        m_listener_thread.join();
+
+    if (m_epoll_fd != -1) {
+        ::close(m_epoll_fd);
+    }
+    if (m_event_fd != -1) {
+        ::close(m_event_fd);
     }
 }
 
@@ -1073,50 +1046,155 @@ void TCPDataDispatcher::start(int port, const string& address)
 {
     m_listener_socket.listen(port, address);
 
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll_fd == -1) {
+        throw runtime_error(string("Can't create TCPDataDispatcher epoll: ") + strerror(errno));
+    }
+
+    m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_event_fd == -1) {
+        throw runtime_error(string("Can't create TCPDataDispatcher eventfd: ") + strerror(errno));
+    }
+
+    // The listener and the eventfd are told apart from the connections by
+    // their event data
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &m_listener_socket;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_listener_socket.get_sockfd(), &ev) == -1) {
+        throw runtime_error(string("Can't add TCPDataDispatcher listener: ") + strerror(errno));
+    }
+
+    ev.data.ptr = &m_event_fd;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_event_fd, &ev) == -1) {
+        throw runtime_error(string("Can't add TCPDataDispatcher eventfd: ") + strerror(errno));
+    }
+
     m_running = true;
-    m_listener_thread = std::thread(&TCPDataDispatcher::process, this);
+    m_thread = std::thread(&TCPDataDispatcher::process, this);
 }
 
 void TCPDataDispatcher::write(const vector<uint8_t>& data)
+{
+    write(make_shared<const vector<uint8_t> >(data));
+}
+
+void TCPDataDispatcher::write(shared_buffer_t buffer)
 {
     if (not m_running) {
         throw runtime_error(m_exception_data);
     }
 
-    auto lock = unique_lock<mutex>(m_mutex);
+    if (buffer->empty()) {
+        return;
+    }
+
+    {
+        const auto now = chrono::steady_clock::now();
+        auto lock = unique_lock<mutex>(m_mutex);
+
+        if (m_buffers_to_preroll > 0) {
+            m_preroll_queue.push_back(buffer);
+            if (m_preroll_queue.size() > m_buffers_to_preroll) {
+                m_preroll_queue.pop_front();
+            }
+        }
 
-    if (m_buffers_to_preroll > 0) {
-        m_preroll_queue.push_back(data);
-        if (m_preroll_queue.size() > m_buffers_to_preroll) {
-            m_preroll_queue.pop_front();
+        for (auto& conn : m_connections) {
+            if (conn.closed) {
+                continue;
+            }
+
+            conn.queue.push_back({buffer, now});
+
+            // The connection gets closed by the dispatcher thread
+            if (conn.queue.size() > m_max_queue_size) {
+                conn.closed = true;
+                m_stats.num_dropped += conn.queue.size();
+                conn.queue.clear();
+            }
         }
     }
 
-    for (auto& connection : m_connections) {
-        connection.queue.push(data);
+    const uint64_t one = 1;
+    ssize_t ret = ::write(m_event_fd, &one, sizeof(one));
+    (void)ret;
+}
+
+size_t TCPDataDispatcher::num_connections()
+{
+    auto lock = unique_lock<mutex>(m_mutex);
+    size_t num = 0;
+    for (const auto& conn : m_connections) {
+        if (not conn.closed) {
+            num++;
+        }
     }
+    return num;
+}
 
-    m_connections.remove_if( [&](const TCPConnection& conn){ return conn.queue.size() > m_max_queue_size; });
+SendStats TCPDataDispatcher::collect_stats()
+{
+    auto lock = unique_lock<mutex>(m_mutex);
+    SendStats stats = m_stats;
+    m_stats = SendStats();
+
+    for (const auto& conn : m_connections) {
+        stats.queue_depth = std::max(stats.queue_depth, conn.queue.size());
+    }
+    return stats;
 }
 
 void TCPDataDispatcher::process()
 {
     try {
-        const int timeout_ms = 1000;
+        constexpr size_t MAX_EVENTS = 64;
+        struct epoll_event events[MAX_EVENTS];
 
         while (m_running) {
-            // Add a new TCPConnection to the list, constructing it from the client socket
-            auto sock = m_listener_socket.accept(timeout_ms);
-            if (sock.valid()) {
-                auto lock = unique_lock<mutex>(m_mutex);
-                m_connections.emplace(m_connections.begin(), move(sock));
-
-                if (m_buffers_to_preroll > 0) {
-                    for (const auto& buf : m_preroll_queue) {
-                        m_connections.front().queue.push(buf);
+            const int num_events = epoll_wait(m_epoll_fd, events, MAX_EVENTS, -1);
+            if (num_events == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw runtime_error(string("TCPDataDispatcher epoll error: ") + strerror(errno));
+            }
+
+            auto lock = unique_lock<mutex>(m_mutex);
+
+            for (int i = 0; i < num_events; i++) {
+                if (events[i].data.ptr == &m_listener_socket) {
+                    accept_connection();
+                }
+                else if (events[i].data.ptr == &m_event_fd) {
+                    uint64_t count = 0;
+                    ssize_t ret = ::read(m_event_fd, &count, sizeof(count));
+                    (void)ret;
+                }
+                else {
+                    auto& conn = *reinterpret_cast<TCPConnection*>(events[i].data.ptr);
+                    if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+                        conn.closed = true;
+                    }
+                    else if (events[i].events & EPOLLIN) {
+                        receive(conn);
+                    }
+
+                    if (not conn.closed and (events[i].events & EPOLLOUT)) {
+                        wait_for_output(conn, false);
                     }
                 }
             }
+
+            for (auto& conn : m_connections) {
+                if (not conn.closed and not conn.waiting_for_output) {
+                    flush(conn);
+                }
+            }
+
+            // Only remove the connections once all events are handled, an
+            // event can refer to a connection that was closed before it
+            m_connections.remove_if([](const TCPConnection& conn) { return conn.closed; });
         }
     }
     catch (const std::runtime_error& e) {
@@ -1125,6 +1203,144 @@ void TCPDataDispatcher::process()
     }
 }
 
+void TCPDataDispatcher::accept_connection()
+{
+    auto sock = m_listener_socket.accept(0);
+    if (not sock.valid()) {
+        return;
+    }
+
+    const int fd = sock.get_sockfd();
+    const int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 or fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        return;
+    }
+
+    m_connections.emplace_back(move(sock));
+    auto& conn = m_connections.back();
+    m_stats.num_reconnects++;
+
+    // The latency of the preroll buffers counts from the connection
+    const auto now = chrono::steady_clock::now();
+    for (const auto& buffer : m_preroll_queue) {
+        conn.queue.push_back({buffer, now});
+    }
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = &conn;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        conn.closed = true;
+    }
+}
+
+void TCPDataDispatcher::receive(TCPConnection& conn)
+{
+    // Nothing is expected from the destinations, discard what they send
+    // and detect the disconnections
+    uint8_t buf[512];
+    const ssize_t ret = ::recv(conn.sock.get_sockfd(), buf, sizeof(buf), 0);
+    if (ret == 0) {
+        conn.closed = true;
+    }
+    else if (ret == SOCKET_ERROR) {
+        // This suppresses the -Wlogical-op warning
+#if EAGAIN == EWOULDBLOCK
+        if (errno != EAGAIN and errno != EINTR)
+#else
+        if (errno != EAGAIN and errno != EWOULDBLOCK and errno != EINTR)
+#endif
+        {
+            conn.closed = true;
+        }
+    }
+}
+
+void TCPDataDispatcher::flush(TCPConnection& conn)
+{
+    /* On Linux, the MSG_NOSIGNAL flag ensures that the process would not
+     * receive a SIGPIPE and die.
+     * Other systems have SO_NOSIGPIPE set on the socket for the same effect. */
+#if defined(HAVE_MSG_NOSIGNAL)
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+
+    constexpr size_t MAX_IOV = 64;
+    struct iovec iov[MAX_IOV];
+
+    while (not conn.queue.empty()) {
+        size_t num_iov = 0;
+        for (auto it = conn.queue.begin(); it != conn.queue.end() and num_iov < MAX_IOV; ++it) {
+            const size_t skip = (num_iov == 0) ? conn.offset : 0;
+            iov[num_iov].iov_base = const_cast<uint8_t*>(it->buffer->data()) + skip;
+            iov[num_iov].iov_len = it->buffer->size() - skip;
+            num_iov++;
+        }
+
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = num_iov;
+        const ssize_t ret = ::sendmsg(conn.sock.get_sockfd(), &msg, flags);
+
+        if (ret == SOCKET_ERROR) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // This suppresses the -Wlogical-op warning
+#if EAGAIN == EWOULDBLOCK
+            if (errno == EAGAIN)
+#else
+            if (errno == EAGAIN or errno == EWOULDBLOCK)
+#endif
+            {
+                wait_for_output(conn, true);
+            }
+            else {
+                conn.closed = true;
+            }
+            return;
+        }
+
+        // Drop the buffers that are completely sent
+        const auto now = chrono::steady_clock::now();
+        size_t sent = ret;
+        while (sent > 0) {
+            const size_t remaining = conn.queue.front().buffer->size() - conn.offset;
+            if (sent >= remaining) {
+                sent -= remaining;
+                m_stats.record_sent(now - conn.queue.front().queued_at);
+                conn.queue.pop_front();
+                conn.offset = 0;
+            }
+            else {
+                conn.offset += sent;
+                sent = 0;
+            }
+        }
+    }
+}
+
+void TCPDataDispatcher::wait_for_output(TCPConnection& conn, bool wait)
+{
+    if (conn.waiting_for_output == wait) {
+        return;
+    }
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    if (wait) {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.ptr = &conn;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, conn.sock.get_sockfd(), &ev) == -1) {
+        conn.closed = true;
+    }
+    conn.waiting_for_output = wait;
+}
+
 TCPReceiveServer::TCPReceiveServer(size_t blocksize) :
     m_blocksize(blocksize)
 {
@@ -1205,9 +1421,12 @@ void TCPReceiveServer::process()
     }
 }
 
-TCPSendClient::TCPSendClient(const std::string& hostname, int port) :
+TCPSendClient::TCPSendClient(const std::string& hostname, int port,
+        size_t max_queue_size, OverflowPolicy overflow_policy) :
     m_hostname(hostname),
     m_port(port),
+    m_max_queue_size(max_queue_size),
+    m_overflow_policy(overflow_policy),
     m_running(true)
 {
     m_sender_thread = std::thread(&TCPSendClient::process, this);
@@ -1223,16 +1442,34 @@ TCPSendClient::~TCPSendClient()
 }
 
 TCPSendClient::ErrorStats TCPSendClient::sendall(const std::vector<uint8_t>& buffer)
+{
+    return sendall(make_shared<const vector<uint8_t> >(buffer));
+}
+
+TCPSendClient::ErrorStats TCPSendClient::sendall(shared_buffer_t buffer)
 {
     if (not m_running) {
         throw runtime_error(m_exception_data);
     }
 
-    m_queue.push(buffer);
+    queued_buffer_t queued = {move(buffer), chrono::steady_clock::now()};
 
-    if (m_queue.size() > MAX_QUEUE_SIZE) {
-        vector<uint8_t> discard;
-        m_queue.try_pop(discard);
+    switch (m_overflow_policy) {
+        case OverflowPolicy::DropOldest:
+            if (m_queue.push_overflow(move(queued), m_max_queue_size).overflowed) {
+                m_num_dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            break;
+        case OverflowPolicy::DropNewest:
+            // Only the sender thread removes elements, the queue cannot
+            // fill up between the check and the push
+            if (m_queue.size() >= m_max_queue_size) {
+                m_num_dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            else {
+                m_queue.push(move(queued));
+            }
+            break;
     }
 
     TCPSendClient::ErrorStats es;
@@ -1241,23 +1478,46 @@ TCPSendClient::ErrorStats TCPSendClient::sendall(const std::vector<uint8_t>& buf
     es.has_seen_new_errors = es.num_reconnects != m_num_reconnects_prev;
     m_num_reconnects_prev = es.num_reconnects;
 
-    auto lock = unique_lock<mutex>(m_error_mutex);
-    es.last_error = m_last_error;
+    if (es.has_seen_new_errors) {
+        auto lock = unique_lock<mutex>(m_error_mutex);
+        es.last_error = m_last_error;
+    }
 
     return es;
 }
 
+SendStats TCPSendClient::collect_stats()
+{
+    auto lock = unique_lock<mutex>(m_stats_mutex);
+    SendStats stats = m_stats;
+    m_stats = SendStats();
+
+    stats.queue_depth = m_queue.size();
+    stats.num_dropped += m_num_dropped.exchange(0);
+
+    const size_t num_reconnects = m_num_reconnects.load();
+    stats.num_reconnects = num_reconnects - m_num_reconnects_collected;
+    m_num_reconnects_collected = num_reconnects;
+    return stats;
+}
+
 void TCPSendClient::process()
 {
     try {
         while (m_running) {
             if (m_is_connected) {
                 try {
-                    vector<uint8_t> incoming;
+                    queued_buffer_t incoming;
                     m_queue.wait_and_pop(incoming);
-                    if (m_sock.sendall(incoming.data(), incoming.size()) == -1) {
+                    const auto& data = *incoming.buffer;
+                    if (m_sock.sendall(data.data(), data.size()) == -1) {
                         m_is_connected = false;
                         m_sock = TCPSocket();
+                        m_num_dropped.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    else {
+                        auto lock = unique_lock<mutex>(m_stats_mutex);
+                        m_stats.record_sent(chrono::steady_clock::now() - incoming.queued_at);
                     }
                 }
                 catch (const ThreadsafeQueueWakeup&) {
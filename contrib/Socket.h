@@ -31,6 +31,8 @@
 #include "ThreadsafeQueue.h"
 #include <cstdlib>
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <string>
 #include <list>
 #include <memory>
@@ -238,28 +240,66 @@ class TCPClient {
         int m_port;
 };
 
-/* Helper class for TCPDataDispatcher, contains a queue of pending data and
- * a sender thread. */
+/* Immutable buffer that the TCPDataDispatcher shares between all its
+ * connections and its preroll queue, instead of copying it for each. */
+using shared_buffer_t = std::shared_ptr<const std::vector<uint8_t> >;
+
+/* A buffer waiting in the queue of a destination, with the time it was
+ * queued to measure the send latency. */
+struct queued_buffer_t {
+    shared_buffer_t buffer;
+    std::chrono::steady_clock::time_point queued_at;
+};
+
+/* Statistics of the transmission to one destination, gathered between two
+ * calls to collect_stats() */
+struct SendStats {
+    /* Buffers waiting to be sent when the statistics were collected */
+    size_t queue_depth = 0;
+
+    size_t num_sent = 0;
+
+    /* Buffers discarded because the queue was full or the send failed */
+    size_t num_dropped = 0;
+
+    size_t num_reconnects = 0;
+
+    /* Time from queueing a buffer to the end of its transmission */
+    std::chrono::steady_clock::duration latency_total = {};
+    std::chrono::steady_clock::duration latency_max = {};
+
+    void record_sent(std::chrono::steady_clock::duration latency);
+    std::chrono::steady_clock::duration latency_avg() const;
+};
+
+/* Helper class for TCPDataDispatcher, contains the socket of one client and
+ * the buffers not yet sent to it. */
 class TCPConnection
 {
     public:
         TCPConnection(TCPSocket&& sock);
         TCPConnection(const TCPConnection&) = delete;
         TCPConnection& operator=(const TCPConnection&) = delete;
-        ~TCPConnection();
 
-        ThreadsafeQueue<std::vector<uint8_t> > queue;
+        TCPSocket sock;
+        std::deque<queued_buffer_t> queue;
 
-    private:
-        std::atomic<bool> m_running;
-        std::thread m_sender_thread;
-        TCPSocket m_sock;
+        // Number of bytes of the first buffer of the queue already sent
+        size_t offset = 0;
 
-        void process(void);
+        // The socket send buffer is full, wait for EPOLLOUT before sending
+        bool waiting_for_output = false;
+
+        // The client disconnected, or too many buffers are queued for it
+        bool closed = false;
 };
 
 /* Send a TCP stream to several destinations, and automatically disconnect destinations
  * whose buffer overflows.
+ *
+ * All connections are served by one thread that waits on epoll, and sends
+ * the queued buffers with one gathering sendmsg() call. A destination is
+ * disconnected when more than max_queue_size buffers are queued for it.
  */
 class TCPDataDispatcher
 {
@@ -270,10 +310,29 @@ class TCPDataDispatcher
         TCPDataDispatcher& operator=(const TCPDataDispatcher&) = delete;
 
         void start(int port, const std::string& address);
+
+        /* Copy the data once into a shared buffer, and send it to all
+         * destinations */
         void write(const std::vector<uint8_t>& data);
 
+        /* Send the buffer to all destinations, without copying it */
+        void write(shared_buffer_t buffer);
+
+        size_t num_connections();
+
+        /* Return the statistics of all connections since the previous
+         * call, and reset them. The queue depth is the one of the most
+         * loaded connection, the reconnects count the accepted
+         * connections, and the drops the buffers discarded when a slow
+         * connection is disconnected. */
+        SendStats collect_stats();
+
     private:
         void process();
+        void accept_connection();
+        void receive(TCPConnection& conn);
+        void flush(TCPConnection& conn);
+        void wait_for_output(TCPConnection& conn, bool wait);
 
         size_t m_max_queue_size;
         size_t m_buffers_to_preroll;
@@ -281,12 +340,16 @@ class TCPDataDispatcher
 
         std::atomic<bool> m_running = ATOMIC_VAR_INIT(false);
         std::string m_exception_data;
-        std::thread m_listener_thread;
+        std::thread m_thread;
         TCPSocket m_listener_socket;
+        int m_epoll_fd = -1;
+        int m_event_fd = -1;
 
+        // Protects the preroll queue, and the connections and their queues
         std::mutex m_mutex;
-        std::deque<std::vector<uint8_t> > m_preroll_queue;
+        std::deque<shared_buffer_t> m_preroll_queue;
         std::list<TCPConnection> m_connections;
+        SendStats m_stats;
 };
 
 struct TCPReceiveMessage { virtual ~TCPReceiveMessage() {}; };
@@ -324,10 +387,22 @@ class TCPReceiveServer {
 };
 
 /* A TCP client that abstracts the handling of connects and disconnects.
+ *
+ * The buffers are sent by a thread of its own, so that a slow or unreachable
+ * destination never blocks the caller. At most max_queue_size buffers wait
+ * in the queue, the overflow policy decides which buffer gets dropped when
+ * it is full.
  */
 class TCPSendClient {
     public:
-        TCPSendClient(const std::string& hostname, int port);
+        enum class OverflowPolicy {
+            DropOldest, // Keep the most recent data, the stream has a gap
+            DropNewest, // Keep the queued data, refuse the new buffer
+        };
+
+        TCPSendClient(const std::string& hostname, int port,
+                size_t max_queue_size = 512,
+                OverflowPolicy overflow_policy = OverflowPolicy::DropOldest);
         ~TCPSendClient();
         TCPSendClient(const TCPSendClient&) = delete;
         TCPSendClient& operator=(const TCPSendClient&) = delete;
@@ -339,9 +414,18 @@ class TCPSendClient {
             bool has_seen_new_errors = false;
         };
 
-        /* Throws a runtime_error when the process thread isn't running */
+        /* Throws a runtime_error when the process thread isn't running.
+         * last_error is only filled when has_seen_new_errors is set. */
         ErrorStats sendall(const std::vector<uint8_t>& buffer);
 
+        /* Queue the buffer without copying it. Must always be called from
+         * the same thread, never blocks. */
+        ErrorStats sendall(shared_buffer_t buffer);
+
+        /* Return the statistics since the previous call, and reset them.
+         * Can be called from any thread. */
+        SendStats collect_stats();
+
     private:
         void process();
 
@@ -351,8 +435,9 @@ class TCPSendClient {
         bool m_is_connected = false;
 
         TCPSocket m_sock;
-        static constexpr size_t MAX_QUEUE_SIZE = 512;
-        ThreadsafeQueue<std::vector<uint8_t> > m_queue;
+        const size_t m_max_queue_size;
+        const OverflowPolicy m_overflow_policy;
+        ThreadsafeQueue<queued_buffer_t> m_queue;
         std::atomic<bool> m_running;
         std::string m_exception_data;
         std::thread m_sender_thread;
@@ -360,8 +445,15 @@ class TCPSendClient {
 
         std::atomic<size_t> m_num_reconnects = ATOMIC_VAR_INIT(0);
         size_t m_num_reconnects_prev = 0;
+        size_t m_num_reconnects_collected = 0;
         std::mutex m_error_mutex;
         std::string m_last_error = "";
+
+        std::atomic<size_t> m_num_dropped = ATOMIC_VAR_INIT(0);
+
+        // Protects the statistics of the sent buffers
+        std::mutex m_stats_mutex;
+        SendStats m_stats;
 };
 
 }
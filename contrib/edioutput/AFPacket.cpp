@@ -44,26 +44,19 @@ const uint8_t AFHEADER_PT_TAG = 'T';
 // AF Packet Major (3 bits) and Minor (4 bits) version
 const uint8_t AFHEADER_VERSION = 0x10; // MAJ=1, MIN=0
 
-AFPacket AFPacketiser::Assemble(TagPacket tag_packet)
+void AFPacketiser::Assemble(TagPacket& tag_packet, AFPacket& packet)
 {
-    std::vector<uint8_t> payload = tag_packet.Assemble();
-
     if (m_verbose)
         std::cerr << "Assemble AFPacket " << m_seq << std::endl;
 
     std::string pack_data("AF"); // SYNC
-    std::vector<uint8_t> packet(pack_data.begin(), pack_data.end());
-
-    uint32_t taglength = payload.size();
-
-    if (m_verbose)
-        std::cerr << "         AFPacket payload size " << payload.size() << std::endl;
+    packet.assign(pack_data.begin(), pack_data.end());
 
-    // write length into packet
-    packet.push_back((taglength >> 24) & 0xFF);
-    packet.push_back((taglength >> 16) & 0xFF);
-    packet.push_back((taglength >> 8) & 0xFF);
-    packet.push_back(taglength & 0xFF);
+    // Placeholder for length
+    packet.push_back(0);
+    packet.push_back(0);
+    packet.push_back(0);
+    packet.push_back(0);
 
     // fill rest of header
     packet.push_back(m_seq >> 8);
@@ -72,8 +65,21 @@ AFPacket AFPacketiser::Assemble(TagPacket tag_packet)
     packet.push_back((m_have_crc ? 0x80 : 0) | AFHEADER_VERSION); // ar_cf: CRC=1
     packet.push_back(AFHEADER_PT_TAG);
 
+    const size_t header_len = packet.size();
+
     // insert payload, must have a length multiple of 8 bytes
-    packet.insert(packet.end(), payload.begin(), payload.end());
+    tag_packet.Assemble(packet);
+
+    uint32_t taglength = packet.size() - header_len;
+
+    if (m_verbose)
+        std::cerr << "         AFPacket payload size " << taglength << std::endl;
+
+    // write length into packet
+    packet[2] = (taglength >> 24) & 0xFF;
+    packet[3] = (taglength >> 16) & 0xFF;
+    packet[4] = (taglength >> 8) & 0xFF;
+    packet[5] = taglength & 0xFF;
 
     // calculate CRC over AF Header and payload
     uint16_t crc = 0xffff;
@@ -88,8 +94,6 @@ AFPacket AFPacketiser::Assemble(TagPacket tag_packet)
 
     if (m_verbose)
         std::cerr << "         AFPacket length " << packet.size() << std::endl;
-
-    return packet;
 }
 
 void AFPacketiser::OverrideSeq(uint16_t seq)
@@ -46,7 +46,9 @@ class AFPacketiser
         AFPacketiser(bool verbose) :
             m_verbose(verbose) {};
 
-        AFPacket Assemble(TagPacket tag_packet);
+        // Assemble the TAG packet into the AF packet, whose previous
+        // content is replaced
+        void Assemble(TagPacket& tag_packet, AFPacket& packet);
 
         void OverrideSeq(uint16_t seq);
 
@@ -58,11 +58,18 @@ struct tcp_server_t : public destination_t {
     size_t tcp_server_preroll_buffers = 0;
 };
 
+// What a destination with a full queue does with a new frame
+enum class overflow_policy_t {
+    drop_oldest,    // Discard the oldest queued frame to make room
+    drop_newest,    // Discard the new frame
+};
+
 // TCP client that connects to one endpoint
 struct tcp_client_t : public destination_t {
     std::string dest_addr;
     unsigned int dest_port = 0;
     size_t max_frames_queued = 1024;
+    overflow_policy_t overflow_policy = overflow_policy_t::drop_oldest;
 };
 
 struct configuration_t {
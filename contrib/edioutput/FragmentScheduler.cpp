@@ -0,0 +1,271 @@
+/*
+   Copyright (C) 2022
+   Matthias P. Braendli, matthias.braendli@mpb.li
+
+    http://www.opendigitalradio.org
+
+   EDI output,
+   Scheduler that sends the PFT fragments at their planned times.
+
+   */
+/*
+   This file is part of the ODR-mmbTools.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as
+   published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "FragmentScheduler.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace edi {
+
+// The eventfd and the timerfd are non-blocking, a failed read or write
+// means the counter is already cleared or set, which is what we want
+static void signal_fd(int fd)
+{
+    const uint64_t one = 1;
+    ssize_t ret = ::write(fd, &one, sizeof(one));
+    (void)ret;
+}
+
+static void clear_fd(int fd)
+{
+    uint64_t count = 0;
+    ssize_t ret = ::read(fd, &count, sizeof(count));
+    (void)ret;
+}
+
+FragmentScheduler::FragmentScheduler(send_function_t send_function,
+        size_t handoff_capacity, size_t max_fragment_size) :
+    m_send_function(send_function),
+    m_max_fragment_size(max_fragment_size),
+    m_handoff(handoff_capacity)
+{
+    // Reserve the buffers of the ring and of the nodes of the pending
+    // fragments, enough for several AF packets
+    for (auto& slot : m_handoff.slots()) {
+        slot.fragment.reserve(m_max_fragment_size);
+    }
+
+    m_free_nodes.reserve(handoff_capacity);
+    m_due_nodes.reserve(handoff_capacity);
+    m_due_fragments.reserve(handoff_capacity);
+    for (size_t i = 0; i < handoff_capacity; i++) {
+        PFTFragment frag;
+        frag.reserve(m_max_fragment_size);
+        auto it = m_pending.emplace(clock::time_point(), move(frag));
+        m_free_nodes.push_back(m_pending.extract(it));
+    }
+
+    // steady_clock is CLOCK_MONOTONIC, the timer is armed with its
+    // time points
+    m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timer_fd == -1) {
+        throw runtime_error(string("Can't create EDI scheduler timer: ") + strerror(errno));
+    }
+
+    m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_event_fd == -1) {
+        close(m_timer_fd);
+        throw runtime_error(string("Can't create EDI scheduler eventfd: ") + strerror(errno));
+    }
+
+    m_running = true;
+    m_thread = thread(&FragmentScheduler::run, this);
+}
+
+FragmentScheduler::~FragmentScheduler()
+{
+    m_running = false;
+    signal_fd(m_event_fd);
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
+    close(m_timer_fd);
+    close(m_event_fd);
+}
+
+size_t FragmentScheduler::schedule(const vector<PFTFragmentRef>& fragments,
+        clock::time_point start, clock::duration spread)
+{
+    using namespace std::chrono;
+
+    const size_t num_fragments = fragments.size();
+    const double spread_us = duration<double, micro>(spread).count();
+
+    size_t num_scheduled = 0;
+    for (; num_scheduled < num_fragments; num_scheduled++) {
+        auto slot = m_handoff.write_slot();
+        if (slot == nullptr) {
+            break;
+        }
+
+        // Every send time is computed from start, so that the rounding
+        // errors do not accumulate
+        const auto& frag = fragments[num_scheduled];
+        slot->send_time = start +
+            microseconds(llrint(spread_us * num_scheduled / num_fragments));
+        slot->fragment.assign(frag.data, frag.data + frag.size);
+        m_handoff.commit_write();
+    }
+
+    const size_t num_dropped = num_fragments - num_scheduled;
+    if (num_dropped > 0) {
+        m_num_dropped.fetch_add(num_dropped, memory_order_relaxed);
+    }
+
+    signal_fd(m_event_fd);
+
+    return num_dropped;
+}
+
+FragmentScheduler::stats_t FragmentScheduler::collect_stats()
+{
+    lock_guard<mutex> lock(m_stats_mutex);
+    stats_t stats = m_stats;
+    m_stats = stats_t();
+    stats.num_dropped = m_num_dropped.exchange(0);
+    return stats;
+}
+
+size_t FragmentScheduler::num_pending() const
+{
+    return m_num_pending.load(memory_order_relaxed);
+}
+
+void FragmentScheduler::run()
+{
+    while (m_running) {
+        receive_handoff();
+        send_due_fragments();
+        m_num_pending.store(m_pending.size(), memory_order_relaxed);
+        wait_for_next_deadline();
+    }
+}
+
+void FragmentScheduler::receive_handoff()
+{
+    // Move the fragments out of the ring by swapping buffers, both the
+    // ring slot and the pending node keep a reserved buffer
+    while (auto slot = m_handoff.read_slot()) {
+        if (not m_free_nodes.empty()) {
+            auto node = move(m_free_nodes.back());
+            m_free_nodes.pop_back();
+            node.key() = slot->send_time;
+            swap(node.mapped(), slot->fragment);
+            m_pending.insert(move(node));
+        }
+        else {
+            PFTFragment frag;
+            frag.reserve(m_max_fragment_size);
+            swap(frag, slot->fragment);
+            m_pending.emplace(slot->send_time, move(frag));
+        }
+        m_handoff.commit_read();
+    }
+}
+
+void FragmentScheduler::send_due_fragments()
+{
+    using namespace std::chrono;
+
+    // Take all the fragments that are due out of the pending ones, and
+    // send them in one go
+    stats_t sent;
+    const auto now = clock::now();
+    while (not m_pending.empty() and m_pending.begin()->first <= now) {
+        auto node = m_pending.extract(m_pending.begin());
+
+        const auto jitter = now - node.key();
+        const auto jitter_us = duration_cast<microseconds>(jitter).count();
+        size_t bucket = 0;
+        while (bucket + 1 < NUM_JITTER_BUCKETS and (jitter_us >> bucket) > 0) {
+            bucket++;
+        }
+        sent.jitter_histogram[bucket]++;
+        sent.max_jitter = std::max(sent.max_jitter, jitter);
+        sent.num_sent++;
+
+        m_due_fragments.push_back(&node.mapped());
+        m_due_nodes.push_back(move(node));
+    }
+
+    if (not m_due_fragments.empty()) {
+        m_send_function(m_due_fragments);
+
+        m_due_fragments.clear();
+        for (auto& node : m_due_nodes) {
+            m_free_nodes.push_back(move(node));
+        }
+        m_due_nodes.clear();
+    }
+
+    if (sent.num_sent > 0) {
+        lock_guard<mutex> lock(m_stats_mutex);
+        m_stats.num_sent += sent.num_sent;
+        for (size_t i = 0; i < NUM_JITTER_BUCKETS; i++) {
+            m_stats.jitter_histogram[i] += sent.jitter_histogram[i];
+        }
+        m_stats.max_jitter = std::max(m_stats.max_jitter, sent.max_jitter);
+    }
+}
+
+void FragmentScheduler::wait_for_next_deadline()
+{
+    using namespace std::chrono;
+
+    // Arm the timer at the send time of the next fragment, or disarm it
+    // when there is nothing pending
+    struct itimerspec spec = {};
+    if (not m_pending.empty()) {
+        const auto ns = duration_cast<nanoseconds>(
+                m_pending.begin()->first.time_since_epoch()).count();
+        spec.it_value.tv_sec = ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+    }
+    if (timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+        throw runtime_error(string("Can't arm EDI scheduler timer: ") + strerror(errno));
+    }
+
+    struct pollfd fds[2] = {
+        { m_timer_fd, POLLIN, 0 },
+        { m_event_fd, POLLIN, 0 } };
+
+    int ret = poll(fds, 2, -1);
+    if (ret == -1 and errno != EINTR) {
+        throw runtime_error(string("EDI scheduler poll failed: ") + strerror(errno));
+    }
+
+    if (fds[0].revents & POLLIN) {
+        clear_fd(m_timer_fd);
+    }
+    if (fds[1].revents & POLLIN) {
+        clear_fd(m_event_fd);
+    }
+}
+
+}
+
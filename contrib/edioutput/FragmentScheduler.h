@@ -0,0 +1,143 @@
+/*
+   Copyright (C) 2022
+   Matthias P. Braendli, matthias.braendli@mpb.li
+
+    http://www.opendigitalradio.org
+
+   EDI output,
+   Scheduler that sends the PFT fragments at their planned times.
+
+   The fragments of an AF packet are handed over from the thread calling
+   schedule() to the scheduler thread through a lock-free ring. The
+   scheduler thread sleeps on a timerfd armed at the absolute send time of
+   the next fragment, and on an eventfd that schedule() signals when new
+   fragments are available. It does not wake up when there is nothing to do.
+
+   */
+/*
+   This file is part of the ODR-mmbTools.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as
+   published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "PFT.h"
+#include "FrameRing.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+namespace edi {
+
+class FragmentScheduler
+{
+    public:
+        using clock = std::chrono::steady_clock;
+
+        // Called in the scheduler thread with all the fragments that are
+        // due together, in the order of their send times
+        using send_function_t =
+            std::function<void(const std::vector<const PFTFragment*>& fragments)>;
+
+        // Number of buckets of the jitter histogram. Bucket 0 counts the
+        // fragments sent less than 1us after their planned time, bucket k
+        // those sent between 2^(k-1) and 2^k us late, and the last bucket
+        // everything later.
+        static constexpr size_t NUM_JITTER_BUCKETS = 16;
+
+        struct stats_t {
+            size_t num_sent = 0;
+
+            // Fragments dropped because the handoff ring was full
+            size_t num_dropped = 0;
+
+            std::array<size_t, NUM_JITTER_BUCKETS> jitter_histogram = {};
+            clock::duration max_jitter = {};
+        };
+
+        // handoff_capacity is the number of fragments that can be scheduled
+        // before the scheduler thread picks them up, it must be a power of
+        // two. Fragments are never larger than max_fragment_size, this
+        // much is reserved for every fragment so that scheduling does not
+        // allocate.
+        FragmentScheduler(send_function_t send_function,
+                size_t handoff_capacity = 256, size_t max_fragment_size = 1500);
+        FragmentScheduler(const FragmentScheduler&) = delete;
+        FragmentScheduler& operator=(const FragmentScheduler&) = delete;
+        ~FragmentScheduler();
+
+        // Schedule the fragments of one AF packet, spreading them evenly
+        // over spread starting at start: fragment i is sent at
+        // start + spread * i / fragments.size(), rounded to the
+        // microsecond. Must always be called from the same thread, never
+        // blocks. Returns the number of fragments dropped because the
+        // handoff ring was full.
+        size_t schedule(const std::vector<PFTFragmentRef>& fragments,
+                clock::time_point start, clock::duration spread);
+
+        // Return the statistics gathered since the previous call, and
+        // reset them. Can be called from any thread.
+        stats_t collect_stats();
+
+        // Return the number of fragments waiting for their send time. Can
+        // be called from any thread.
+        size_t num_pending() const;
+
+    private:
+        void run();
+        void receive_handoff();
+        void send_due_fragments();
+        void wait_for_next_deadline();
+
+        send_function_t m_send_function;
+        const size_t m_max_fragment_size;
+
+        struct handoff_t {
+            clock::time_point send_time;
+            PFTFragment fragment;
+        };
+        FrameRing<handoff_t> m_handoff;
+
+        // Only used by the scheduler thread. The pending fragments are
+        // ordered by send time, fragments that are sent leave their node
+        // to be reused.
+        using pending_t = std::multimap<clock::time_point, PFTFragment>;
+        pending_t m_pending;
+        std::vector<pending_t::node_type> m_free_nodes;
+
+        // The nodes of the fragments being sent, and the fragments
+        std::vector<pending_t::node_type> m_due_nodes;
+        std::vector<const PFTFragment*> m_due_fragments;
+
+        int m_timer_fd = -1;
+        int m_event_fd = -1;
+
+        std::atomic<bool> m_running = {false};
+        std::thread m_thread;
+
+        std::atomic<size_t> m_num_dropped = {0};
+        std::atomic<size_t> m_num_pending = {0};
+        std::mutex m_stats_mutex;
+        stats_t m_stats;
+};
+
+}
+
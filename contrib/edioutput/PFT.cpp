@@ -31,6 +31,7 @@
  */
 
 #include <vector>
+#include <algorithm>
 #include <list>
 #include <cstdio>
 #include <cstring>
@@ -40,7 +41,6 @@
 #include <sstream>
 #include "PFT.h"
 #include "crc.h"
-#include "ReedSolomon.h"
 
 namespace edi {
 
@@ -49,6 +49,12 @@ using namespace std;
 // An integer division that rounds up, i.e. ceil(a/b)
 #define CEIL_DIV(a, b) (a % b == 0  ? a / b : a / b + 1)
 
+// Length of the PF header: Psync, Pseq, Findex, Fcount, FEC, Addr, Plen and
+// HCRC, then RSk and RSz with FEC, then Source and Dest with Addr
+static const size_t PF_HEADER_LEN = 14;
+static const size_t PF_HEADER_RS_LEN = 2;
+static const size_t PF_HEADER_ADDR_LEN = 4;
+
 PFT::PFT() { }
 
 PFT::PFT(const configuration_t &conf) :
@@ -72,93 +78,130 @@ PFT::PFT(const configuration_t &conf) :
         }
     }
 
-RSBlock PFT::Protect(AFPacket af_packet)
+void PFT::ReserveArena(size_t len)
 {
-    RSBlock rs_block;
+    if (m_arena.size() < len) {
+        m_arena.resize(len);
+    }
+}
 
-    // number of chunks is ceil(afpacketsize / m_k)
-    // TS 102 821 7.2.2: c = ceil(l / k_max)
-    m_num_chunks = CEIL_DIV(af_packet.size(), m_k);
+size_t PFT::HeaderLength() const
+{
+    return PF_HEADER_LEN +
+        (m_m > 0 ? PF_HEADER_RS_LEN : 0) +
+        (m_transport_header ? PF_HEADER_ADDR_LEN : 0);
+}
 
-    if (m_verbose) {
-        fprintf(stderr, "Protect %zu chunks of size %zu\n",
-                m_num_chunks, af_packet.size());
+void PFT::Protect(const AFPacket& af_packet, size_t chunk_len)
+{
+    // Copy chunk_len bytes into every chunk, the last one gets
+    // zero padded. The parity follows each chunk.
+    uint8_t *rs_block = m_arena.data();
+    const size_t stride = chunk_len + PARITYBYTES;
+    for (size_t c = 0; c < m_num_chunks; c++) {
+        const size_t i = c * chunk_len;
+        const size_t len = i < af_packet.size() ?
+            std::min(chunk_len, af_packet.size() - i) : 0;
+        memcpy(rs_block + stride * c, af_packet.data() + i, len);
+        memset(rs_block + stride * c + len, 0, chunk_len - len);
     }
 
-    // calculate size of chunk:
-    // TS 102 821 7.2.2: k = ceil(l / c)
-    // chunk_len does not include the 48 bytes of protection.
-    const size_t chunk_len = CEIL_DIV(af_packet.size(), m_num_chunks);
-    if (chunk_len > 207) {
-        std::stringstream ss;
-        ss << "Chunk length " << chunk_len << " too large (>207)";
-        throw std::runtime_error(ss.str());
-    }
+    // calculate RS for all chunks, padded to 207 bytes
+    m_rs_encoder.encode(rs_block, m_num_chunks, chunk_len);
+}
 
-    // The last RS chunk is zero padded
-    // TS 102 821 7.2.2: z = c*k - l
-    const size_t zero_pad = m_num_chunks * chunk_len - af_packet.size();
-
-    // Create the RS(k+p,k) encoder
-    const int firstRoot = 1; // Discovered by analysing EDI dump
-    const int gfPoly = 0x11d;
-    const bool reverse = false;
-    // The encoding has to be 255, 207 always, because the chunk has to
-    // be padded at the end, and not at the beginning as libfec would
-    // do
-    ReedSolomon rs_encoder(255, 207, reverse, gfPoly, firstRoot);
-
-    // add zero padding to last chunk
-    for (size_t i = 0; i < zero_pad; i++) {
-        af_packet.push_back(0);
-    }
+void PFT::WriteHeader(uint8_t *packet, size_t findex, size_t fcount,
+        size_t plen, size_t chunk_len, size_t zero_pad) const
+{
+    const bool enable_RS = (m_m > 0);
+    uint8_t *p = packet;
+
+    // Psync
+    *p++ = 'P';
+    *p++ = 'F';
+
+    // Pseq
+    *p++ = m_pseq >> 8;
+    *p++ = m_pseq & 0xFF;
+
+    // Findex
+    *p++ = findex >> 16;
+    *p++ = findex >> 8;
+    *p++ = findex & 0xFF;
 
-    if (m_verbose) {
-        fprintf(stderr, "        add %zu zero padding\n", zero_pad);
+    // Fcount
+    *p++ = fcount >> 16;
+    *p++ = fcount >> 8;
+    *p++ = fcount & 0xFF;
+
+    // RS (1 bit), transport (1 bit) and Plen (14 bits)
+    if (enable_RS) {
+        plen |= 0x8000; // Set FEC bit
     }
 
-    // Calculate RS for each chunk and assemble RS block
-    for (size_t i = 0; i < af_packet.size(); i+= chunk_len) {
-        vector<uint8_t> chunk(207);
-        vector<uint8_t> protection(PARITYBYTES);
+    if (m_transport_header) {
+        plen |= 0x4000; // Set ADDR bit
+    }
 
-        // copy chunk_len bytes into new chunk
-        memcpy(&chunk.front(), &af_packet[i], chunk_len);
+    *p++ = plen >> 8;
+    *p++ = plen & 0xFF;
 
-        // calculate RS for chunk with padding
-        rs_encoder.encode(&chunk.front(), &protection.front(), 207);
+    if (enable_RS) {
+        *p++ = chunk_len;   // RSk
+        *p++ = zero_pad;    // RSz
+    }
 
-        // Drop the padding
-        chunk.resize(chunk_len);
+    if (m_transport_header) {
+        // Source (16 bits)
+        *p++ = m_addr_source >> 8;
+        *p++ = m_addr_source & 0xFF;
 
-        // append new chunk and protection to the RS Packet
-        rs_block.insert(rs_block.end(), chunk.begin(), chunk.end());
-        rs_block.insert(rs_block.end(), protection.begin(), protection.end());
+        // Dest (16 bits)
+        *p++ = m_dest_port >> 8;
+        *p++ = m_dest_port & 0xFF;
     }
 
-    return rs_block;
+    // calculate CRC over PF Header
+    uint16_t crc = 0xffff;
+    crc = crc16(crc, packet, p - packet);
+    crc ^= 0xffff;
+
+    *p++ = (crc >> 8) & 0xFF;
+    *p++ = crc & 0xFF;
 }
 
-vector< vector<uint8_t> > PFT::ProtectAndFragment(AFPacket af_packet)
+const vector<PFTFragmentRef>& PFT::Assemble(const AFPacket& af_packet)
 {
     const bool enable_RS = (m_m > 0);
+    const size_t header_len = HeaderLength();
 
     if (enable_RS) {
-        RSBlock rs_block = Protect(af_packet);
+        // number of chunks is ceil(afpacketsize / m_k)
+        // TS 102 821 7.2.2: c = ceil(l / k_max)
+        m_num_chunks = CEIL_DIV(af_packet.size(), m_k);
 
-#if 0
-        fprintf(stderr, "  af_packet (%zu):", af_packet.size());
-        for (size_t i = 0; i < af_packet.size(); i++) {
-            fprintf(stderr, "%02x ", af_packet[i]);
+        if (m_verbose) {
+            fprintf(stderr, "Protect %zu chunks of size %zu\n",
+                    m_num_chunks, af_packet.size());
         }
-        fprintf(stderr, "\n");
 
-        fprintf(stderr, "  rs_block (%zu):", rs_block.size());
-        for (size_t i = 0; i < rs_block.size(); i++) {
-            fprintf(stderr, "%02x ", rs_block[i]);
+        // calculate size of chunk:
+        // TS 102 821 7.2.2: k = ceil(l / c)
+        // chunk_len does not include the 48 bytes of protection.
+        const size_t chunk_len = CEIL_DIV(af_packet.size(), m_num_chunks);
+        if (chunk_len > 207) {
+            std::stringstream ss;
+            ss << "Chunk length " << chunk_len << " too large (>207)";
+            throw std::runtime_error(ss.str());
+        }
+
+        // The last RS chunk is zero padded
+        // TS 102 821 7.2.2: z = c*k - l
+        const size_t zero_pad = m_num_chunks * chunk_len - af_packet.size();
+
+        if (m_verbose) {
+            fprintf(stderr, "        add %zu zero padding\n", zero_pad);
         }
-        fprintf(stderr, "\n");
-#endif
 
         // TS 102 821 7.2.2: s_max = MIN(floor(c*p/(m+1)), MTU - h))
         const size_t max_payload_size = ( m_num_chunks * PARITYBYTES ) / (m_m + 1);
@@ -166,31 +209,41 @@ vector< vector<uint8_t> > PFT::ProtectAndFragment(AFPacket af_packet)
         // Calculate fragment count and size
         // TS 102 821 7.2.2: ceil((l + c*p + z) / s_max)
         // l + c*p + z = length of RS block
-        const size_t num_fragments = CEIL_DIV(rs_block.size(), max_payload_size);
+        const size_t rs_block_len = m_num_chunks * (chunk_len + PARITYBYTES);
+        const size_t num_fragments = CEIL_DIV(rs_block_len, max_payload_size);
 
         // TS 102 821 7.2.2: ceil((l + c*p + z) / f)
-        const size_t fragment_size = CEIL_DIV(rs_block.size(), num_fragments);
+        const size_t fragment_size = CEIL_DIV(rs_block_len, num_fragments);
 
         if (m_verbose)
             fprintf(stderr, "  PnF fragment_size %zu, num frag %zu\n",
                     fragment_size, num_fragments);
 
-        vector< vector<uint8_t> > fragments(num_fragments);
+        // The RS block is padded with zeros to fill all fragments
+        const size_t padded_len = num_fragments * fragment_size;
+        const size_t packet_len = header_len + fragment_size;
+        ReserveArena(padded_len + num_fragments * packet_len);
+
+        Protect(af_packet, chunk_len);
+        const uint8_t *rs_block = m_arena.data();
+        memset(m_arena.data() + rs_block_len, 0, padded_len - rs_block_len);
 
+        uint8_t *packets = m_arena.data() + padded_len;
+        m_fragments.resize(num_fragments);
         for (size_t i = 0; i < num_fragments; i++) {
-            fragments[i].resize(fragment_size);
-            for (size_t j = 0; j < fragment_size; j++) {
-                const size_t ix = j*num_fragments + i;
-                if (ix < rs_block.size()) {
-                    fragments[i][j] = rs_block[ix];
-                }
-                else {
-                    fragments[i][j] = 0;
-                }
-            }
+            uint8_t *packet = packets + i * packet_len;
+            WriteHeader(packet, i, num_fragments, fragment_size, chunk_len, zero_pad);
+            m_fragments[i] = {packet, packet_len};
         }
 
-        return fragments;
+        // Interleave the RS block into the fragments, reading it in order
+        for (size_t j = 0; j < fragment_size; j++) {
+            const uint8_t *in = rs_block + j * num_fragments;
+            uint8_t *out = packets + header_len + j;
+            for (size_t i = 0; i < num_fragments; i++) {
+                out[i * packet_len] = in[i];
+            }
+        }
     }
     else { // No RS, only fragmentation
         // TS 102 821 7.2.2: s_max = MTU - h
@@ -205,118 +258,32 @@ vector< vector<uint8_t> > PFT::ProtectAndFragment(AFPacket af_packet)
 
         // TS 102 821 7.2.2: ceil((l + c*p + z) / f)
         const size_t fragment_size = CEIL_DIV(af_packet.size(), num_fragments);
-        vector< vector<uint8_t> > fragments(num_fragments);
-
-        for (size_t i = 0; i < num_fragments; i++) {
-            fragments[i].reserve(fragment_size);
-
-            for (size_t j = 0; j < fragment_size; j++) {
-                const size_t ix = i*fragment_size + j;
-                if (ix < af_packet.size()) {
-                    fragments[i].push_back(af_packet.at(ix));
-                }
-                else {
-                    break;
-                }
-            }
-        }
-
-        return fragments;
-    }
-}
-
-std::vector< PFTFragment > PFT::Assemble(AFPacket af_packet)
-{
-    vector< vector<uint8_t> > fragments = ProtectAndFragment(af_packet);
-    vector< vector<uint8_t> > pft_fragments; // These contain PF headers
 
-    const bool enable_RS = (m_m > 0);
-
-    unsigned int findex = 0;
-
-    unsigned fcount = fragments.size();
-
-    // calculate size of chunk:
-    // TS 102 821 7.2.2: k = ceil(l / c)
-    // chunk_len does not include the 48 bytes of protection.
-    const size_t chunk_len = enable_RS ?
-        CEIL_DIV(af_packet.size(), m_num_chunks) : 0;
-
-    // The last RS chunk is zero padded
-    // TS 102 821 7.2.2: z = c*k - l
-    const size_t zero_pad = enable_RS ?
-        m_num_chunks * chunk_len - af_packet.size() : 0;
-
-    for (const auto &fragment : fragments) {
-        // Psync
-        std::string psync("PF");
-        std::vector<uint8_t> packet(psync.begin(), psync.end());
-
-        // Pseq
-        packet.push_back(m_pseq >> 8);
-        packet.push_back(m_pseq & 0xFF);
-
-        // Findex
-        packet.push_back(findex >> 16);
-        packet.push_back(findex >> 8);
-        packet.push_back(findex & 0xFF);
-        findex++;
-
-        // Fcount
-        packet.push_back(fcount >> 16);
-        packet.push_back(fcount >> 8);
-        packet.push_back(fcount & 0xFF);
-
-        // RS (1 bit), transport (1 bit) and Plen (14 bits)
-        unsigned int plen = fragment.size();
-        if (enable_RS) {
-            plen |= 0x8000; // Set FEC bit
-        }
+        const size_t packet_len = header_len + fragment_size;
+        ReserveArena(num_fragments * packet_len);
 
-        if (m_transport_header) {
-            plen |= 0x4000; // Set ADDR bit
-        }
-
-        packet.push_back(plen >> 8);
-        packet.push_back(plen & 0xFF);
-
-        if (enable_RS) {
-            packet.push_back(chunk_len);   // RSk
-            packet.push_back(zero_pad);    // RSz
-        }
-
-        if (m_transport_header) {
-            // Source (16 bits)
-            packet.push_back(m_addr_source >> 8);
-            packet.push_back(m_addr_source & 0xFF);
+        m_fragments.resize(num_fragments);
+        for (size_t i = 0; i < num_fragments; i++) {
+            const size_t begin = std::min(i*fragment_size, af_packet.size());
+            const size_t end = std::min(begin + fragment_size, af_packet.size());
 
-            // Dest (16 bits)
-            packet.push_back(m_dest_port >> 8);
-            packet.push_back(m_dest_port & 0xFF);
+            uint8_t *packet = m_arena.data() + i * packet_len;
+            WriteHeader(packet, i, num_fragments, end - begin, 0, 0);
+            memcpy(packet + header_len, af_packet.data() + begin, end - begin);
+            m_fragments[i] = {packet, header_len + end - begin};
         }
-
-        // calculate CRC over AF Header and payload
-        uint16_t crc = 0xffff;
-        crc = crc16(crc, &(packet.front()), packet.size());
-        crc ^= 0xffff;
-
-        packet.push_back((crc >> 8) & 0xFF);
-        packet.push_back(crc & 0xFF);
-
-        // insert payload, must have a length multiple of 8 bytes
-        packet.insert(packet.end(), fragment.begin(), fragment.end());
-
-        pft_fragments.push_back(packet);
+    }
 
 #if 0
-        fprintf(stderr, "* PFT pseq %d, findex %d, fcount %d, plen %d\n",
-                m_pseq, findex, fcount, plen & ~0xC000);
-#endif
+    for (const auto& frag : m_fragments) {
+        fprintf(stderr, "* PFT pseq %d, fcount %zu, size %zu\n",
+                m_pseq, m_fragments.size(), frag.size);
     }
+#endif
 
     m_pseq++;
 
-    return pft_fragments;
+    return m_fragments;
 }
 
 void PFT::OverridePSeq(uint16_t pseq)
@@ -38,14 +38,20 @@
 #include <cstdint>
 #include "AFPacket.h"
 #include "Log.h"
-#include "ReedSolomon.h"
+#include "PFTReedSolomon.h"
 #include "EDIConfig.h"
 
 namespace edi {
 
-typedef std::vector<uint8_t> RSBlock;
 typedef std::vector<uint8_t> PFTFragment;
 
+// A PFT fragment with its PF header, inside the packet arena of the PFT.
+// It is valid until the next call to PFT::Assemble().
+struct PFTFragmentRef {
+    const uint8_t *data;
+    size_t size;
+};
+
 class PFT
 {
     public:
@@ -53,26 +59,47 @@ class PFT
 
         PFT();
         PFT(const configuration_t& conf);
+        PFT(const PFT&) = delete;
+        PFT& operator=(const PFT&) = delete;
 
-        // return a list of PFT fragments with the correct
-        // PFT headers
-        std::vector< PFTFragment > Assemble(AFPacket af_packet);
-
-        // Apply Reed-Solomon FEC to the AF Packet
-        RSBlock Protect(AFPacket af_packet);
-
-        // Cut a RSBlock into several fragments that can be transmitted
-        std::vector< std::vector<uint8_t> > ProtectAndFragment(AFPacket af_packet);
+        // Apply Reed-Solomon FEC to the AF Packet if enabled, cut it into
+        // fragments and add the PF headers. Everything is written into the
+        // packet arena, which only grows, so that this does not allocate
+        // once the largest AF packet has been seen. The returned fragments
+        // are valid until the next call.
+        const std::vector<PFTFragmentRef>& Assemble(const AFPacket& af_packet);
 
         void OverridePSeq(uint16_t pseq);
 
     private:
+        // Copy the AF packet into the chunks of the RS block at the start
+        // of the arena and write their parity
+        void Protect(const AFPacket& af_packet, size_t chunk_len);
+
+        // Write the PF header of fragment findex to packet, it is
+        // HeaderLength() bytes long
+        void WriteHeader(uint8_t *packet, size_t findex, size_t fcount,
+                size_t plen, size_t chunk_len, size_t zero_pad) const;
+
+        // Make sure the arena can hold len bytes
+        void ReserveArena(size_t len);
+
+        size_t HeaderLength() const;
+
         unsigned int m_k = 207; // length of RS data word
         unsigned int m_m = 3; // number of fragments that can be recovered if lost
         uint16_t m_pseq = 0;
         size_t m_num_chunks = 0;
         bool m_verbose = false;
 
+        PFTReedSolomon m_rs_encoder;
+
+        // The packet arena. With RS, it holds the RS block padded to a
+        // multiple of the number of fragments, followed by the fragments.
+        // Without RS, only the fragments.
+        std::vector<uint8_t> m_arena;
+        std::vector<PFTFragmentRef> m_fragments;
+
         // Transport header is always deactivated
         const bool m_transport_header = false;
         const uint16_t m_addr_source = 0;
@@ -0,0 +1,245 @@
+/*
+   Copyright (C) 2021
+   Matthias P. Braendli, matthias.braendli@mpb.li
+
+    http://www.opendigitalradio.org
+
+   EDI output,
+   Reed-Solomon RS(255, 207) encoder of the PFT layer.
+
+   */
+/*
+   This file is part of the ODR-mmbTools.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as
+   published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include "PFTReedSolomon.h"
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#  include <arm_neon.h>
+#endif
+
+namespace edi {
+
+using namespace std;
+
+static constexpr size_t NUM_PARITY = PFTReedSolomon::NUM_PARITY;
+static constexpr size_t MAX_CHUNK_LEN = PFTReedSolomon::MAX_CHUNK_LEN;
+
+using feedback_table_t = uint8_t[NUM_PARITY];
+
+// Multiplication in GF(2^8) with the polynomial 0x11d
+static uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    uint8_t product = 0;
+    while (b) {
+        if (b & 1) {
+            product ^= a;
+        }
+        a = (a << 1) ^ ((a & 0x80) ? 0x1d : 0);
+        b >>= 1;
+    }
+    return product;
+}
+
+// Encode one chunk, keeping the parity in six 64-bit words
+static void encode_scalar(uint8_t *chunk, size_t chunk_len, const feedback_table_t *table)
+{
+    constexpr size_t NUM_WORDS = NUM_PARITY / 8;
+    uint64_t p[NUM_WORDS] = {};
+
+    for (size_t i = 0; i < MAX_CHUNK_LEN; i++) {
+        const uint8_t data = i < chunk_len ? chunk[i] : 0;
+        const uint8_t fb = data ^ (p[0] & 0xff);
+        for (size_t w = 0; w < NUM_WORDS; w++) {
+            uint64_t product;
+            memcpy(&product, table[fb] + 8 * w, sizeof(product));
+            const uint64_t next = w + 1 < NUM_WORDS ? p[w + 1] << 56 : 0;
+            p[w] = ((p[w] >> 8) | next) ^ product;
+        }
+    }
+
+    for (size_t w = 0; w < NUM_WORDS; w++) {
+        for (size_t k = 0; k < 8; k++) {
+            chunk[chunk_len + 8 * w + k] = p[w] >> (8 * k);
+        }
+    }
+}
+
+// The SIMD kernels encode N chunks at once, the first one at first and the
+// following ones stride bytes apart. The parity of every chunk is held in
+// three registers of 16 bytes.
+#if defined(__x86_64__) || defined(__i386__)
+template<size_t N>
+__attribute__((target("ssse3")))
+static void encode_ssse3(uint8_t *first, size_t stride, size_t chunk_len,
+        const feedback_table_t *table)
+{
+    __m128i p0[N], p1[N], p2[N];
+    for (size_t n = 0; n < N; n++) {
+        p0[n] = p1[n] = p2[n] = _mm_setzero_si128();
+    }
+
+    for (size_t i = 0; i < MAX_CHUNK_LEN; i++) {
+        for (size_t n = 0; n < N; n++) {
+            const uint8_t data = i < chunk_len ? first[stride * n + i] : 0;
+            const uint8_t fb = data ^ _mm_cvtsi128_si32(p0[n]);
+            const __m128i *product = (const __m128i*)table[fb];
+            p0[n] = _mm_xor_si128(_mm_alignr_epi8(p1[n], p0[n], 1), _mm_load_si128(product));
+            p1[n] = _mm_xor_si128(_mm_alignr_epi8(p2[n], p1[n], 1), _mm_load_si128(product + 1));
+            p2[n] = _mm_xor_si128(_mm_srli_si128(p2[n], 1), _mm_load_si128(product + 2));
+        }
+    }
+
+    for (size_t n = 0; n < N; n++) {
+        __m128i *parity = (__m128i*)(first + stride * n + chunk_len);
+        _mm_storeu_si128(parity, p0[n]);
+        _mm_storeu_si128(parity + 1, p1[n]);
+        _mm_storeu_si128(parity + 2, p2[n]);
+    }
+}
+#endif
+
+#if defined(__aarch64__)
+template<size_t N>
+static void encode_neon(uint8_t *first, size_t stride, size_t chunk_len,
+        const feedback_table_t *table)
+{
+    const uint8x16_t zero = vdupq_n_u8(0);
+    uint8x16_t p0[N], p1[N], p2[N];
+    for (size_t n = 0; n < N; n++) {
+        p0[n] = p1[n] = p2[n] = zero;
+    }
+
+    for (size_t i = 0; i < MAX_CHUNK_LEN; i++) {
+        for (size_t n = 0; n < N; n++) {
+            const uint8_t data = i < chunk_len ? first[stride * n + i] : 0;
+            const uint8_t fb = data ^ vgetq_lane_u8(p0[n], 0);
+            const uint8_t *product = table[fb];
+            p0[n] = veorq_u8(vextq_u8(p0[n], p1[n], 1), vld1q_u8(product));
+            p1[n] = veorq_u8(vextq_u8(p1[n], p2[n], 1), vld1q_u8(product + 16));
+            p2[n] = veorq_u8(vextq_u8(p2[n], zero, 1), vld1q_u8(product + 32));
+        }
+    }
+
+    for (size_t n = 0; n < N; n++) {
+        uint8_t *parity = first + stride * n + chunk_len;
+        vst1q_u8(parity, p0[n]);
+        vst1q_u8(parity + 16, p1[n]);
+        vst1q_u8(parity + 32, p2[n]);
+    }
+}
+#endif
+
+// Encode all chunks, four at a time and the remaining ones together.
+// kernels[n - 1] encodes n chunks.
+using kernel_t = void (*)(uint8_t *first, size_t stride, size_t chunk_len,
+        const feedback_table_t *table);
+
+static void encode_chunks(uint8_t *rs_block, size_t num_chunks, size_t chunk_len,
+        const kernel_t kernels[4], const feedback_table_t *table)
+{
+    const size_t stride = chunk_len + NUM_PARITY;
+    for (size_t c = 0; c < num_chunks; c += 4) {
+        const size_t n = std::min<size_t>(4, num_chunks - c);
+        kernels[n - 1](rs_block + stride * c, stride, chunk_len, table);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static const kernel_t kernels_ssse3[4] = {
+    encode_ssse3<1>, encode_ssse3<2>, encode_ssse3<3>, encode_ssse3<4> };
+#endif
+
+#if defined(__aarch64__)
+static const kernel_t kernels_neon[4] = {
+    encode_neon<1>, encode_neon<2>, encode_neon<3>, encode_neon<4> };
+#endif
+
+PFTReedSolomon::PFTReedSolomon() :
+    PFTReedSolomon(best_variant())
+{ }
+
+PFTReedSolomon::PFTReedSolomon(variant_t variant) :
+    m_variant(variant)
+{
+    if (variant != variant_t::scalar and variant != best_variant()) {
+        throw invalid_argument("PFTReedSolomon variant not supported by this CPU");
+    }
+
+    // The generator polynomial has the roots alpha^1 to alpha^48, with
+    // alpha = 2. Multiply (x + alpha^i) into it, lowest coefficient first.
+    uint8_t genpoly[NUM_PARITY + 1] = {1};
+    uint8_t root = 2;
+    for (size_t i = 0; i < NUM_PARITY; i++) {
+        for (size_t j = i + 1; j > 0; j--) {
+            genpoly[j] = genpoly[j - 1] ^ gf_mul(genpoly[j], root);
+        }
+        genpoly[0] = gf_mul(genpoly[0], root);
+        root = gf_mul(root, 2);
+    }
+
+    // After the shift, parity byte k receives the product of the feedback
+    // with the coefficient of x^(NUM_PARITY - 1 - k)
+    for (size_t fb = 0; fb < 256; fb++) {
+        for (size_t k = 0; k < NUM_PARITY; k++) {
+            m_feedback[fb][k] = gf_mul(fb, genpoly[NUM_PARITY - 1 - k]);
+        }
+    }
+}
+
+PFTReedSolomon::variant_t PFTReedSolomon::best_variant()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("ssse3")) {
+        return variant_t::ssse3;
+    }
+#elif defined(__aarch64__)
+    return variant_t::neon;
+#endif
+    return variant_t::scalar;
+}
+
+void PFTReedSolomon::encode(uint8_t *rs_block, size_t num_chunks, size_t chunk_len) const
+{
+    if (chunk_len > MAX_CHUNK_LEN) {
+        throw invalid_argument("PFTReedSolomon chunk too long");
+    }
+
+    switch (m_variant) {
+#if defined(__x86_64__) || defined(__i386__)
+        case variant_t::ssse3:
+            encode_chunks(rs_block, num_chunks, chunk_len, kernels_ssse3, m_feedback);
+            break;
+#endif
+#if defined(__aarch64__)
+        case variant_t::neon:
+            encode_chunks(rs_block, num_chunks, chunk_len, kernels_neon, m_feedback);
+            break;
+#endif
+        default:
+            for (size_t c = 0; c < num_chunks; c++) {
+                encode_scalar(rs_block + (chunk_len + NUM_PARITY) * c, chunk_len, m_feedback);
+            }
+    }
+}
+
+}
+
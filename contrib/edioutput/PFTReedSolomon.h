@@ -0,0 +1,75 @@
+/*
+   Copyright (C) 2021
+   Matthias P. Braendli, matthias.braendli@mpb.li
+
+    http://www.opendigitalradio.org
+
+   EDI output,
+   Reed-Solomon RS(255, 207) encoder of the PFT layer.
+
+   The chunks of an RS block are encoded with one table that gives, for every
+   feedback byte, its contribution to all 48 parity bytes. The parity is kept
+   in vector registers, so that every data byte shifts it by one byte and adds
+   one row of the table. Several chunks are encoded together to hide the
+   latency of the feedback. All variants give the same parity as the libfec
+   encode_rs_char() used by the ReedSolomon class.
+
+   */
+/*
+   This file is part of the ODR-mmbTools.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as
+   published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace edi {
+
+class PFTReedSolomon
+{
+    public:
+        static constexpr size_t NUM_PARITY = 48;
+        static constexpr size_t MAX_CHUNK_LEN = 207;
+
+        enum class variant_t { scalar, ssse3, neon };
+
+        // Use the fastest variant this CPU supports
+        PFTReedSolomon();
+
+        // Use the given variant, which the CPU must support
+        explicit PFTReedSolomon(variant_t variant);
+
+        static variant_t best_variant();
+
+        variant_t variant() const { return m_variant; }
+
+        // Protect the num_chunks chunks of an RS block. Every chunk is made
+        // of chunk_len data bytes followed by NUM_PARITY bytes that receive
+        // the parity. The data is zero padded to MAX_CHUNK_LEN bytes for
+        // the encoding, as specified in TS 102 821 7.2.2.
+        void encode(uint8_t *rs_block, size_t num_chunks, size_t chunk_len) const;
+
+    private:
+        variant_t m_variant;
+
+        // Product of the feedback byte with the coefficients of the generator
+        // polynomial, for every parity byte
+        alignas(16) uint8_t m_feedback[256][NUM_PARITY];
+};
+
+}
+
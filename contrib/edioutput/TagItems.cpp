@@ -43,11 +43,11 @@ TagStarPTR::TagStarPTR(const std::string& protocol)
     }
 }
 
-std::vector<uint8_t> TagStarPTR::Assemble()
+void TagStarPTR::Assemble(std::vector<uint8_t>& packet)
 {
     //std::cerr << "TagItem *ptr" << std::endl;
     std::string pack_data("*ptr");
-    std::vector<uint8_t> packet(pack_data.begin(), pack_data.end());
+    packet.insert(packet.end(), pack_data.begin(), pack_data.end());
 
     packet.push_back(0);
     packet.push_back(0);
@@ -63,14 +63,13 @@ std::vector<uint8_t> TagStarPTR::Assemble()
     // Minor
     packet.push_back(0);
     packet.push_back(0);
-    return packet;
 }
 
-std::vector<uint8_t> TagDETI::Assemble()
+void TagDETI::Assemble(std::vector<uint8_t>& packet)
 {
     std::string pack_data("deti");
-    std::vector<uint8_t> packet(pack_data.begin(), pack_data.end());
-    packet.reserve(256);
+    const size_t start = packet.size();
+    packet.insert(packet.end(), pack_data.begin(), pack_data.end());
 
     // Placeholder for length
     packet.push_back(0);
@@ -120,13 +119,13 @@ std::vector<uint8_t> TagDETI::Assemble()
 
     // calculate and update size
     // remove TAG name and TAG length fields and convert to bits
-    uint32_t taglength = (packet.size() - 8) * 8;
+    uint32_t taglength = (packet.size() - start - 8) * 8;
 
     // write length into packet
-    packet[4] = (taglength >> 24) & 0xFF;
-    packet[5] = (taglength >> 16) & 0xFF;
-    packet[6] = (taglength >> 8) & 0xFF;
-    packet[7] = taglength & 0xFF;
+    packet[start + 4] = (taglength >> 24) & 0xFF;
+    packet[start + 5] = (taglength >> 16) & 0xFF;
+    packet[start + 6] = (taglength >> 8) & 0xFF;
+    packet[start + 7] = taglength & 0xFF;
 
     dlfc = (dlfc+1) % 5000;
 
@@ -135,7 +134,6 @@ std::vector<uint8_t> TagDETI::Assemble()
     std::cerr << "              fic length " << fic_length << std::endl;
     std::cerr << "              length " << taglength / 8 << std::endl;
     */
-    return packet;
 }
 
 void TagDETI::set_edi_time(const std::time_t t, int tai_utc_offset)
@@ -147,11 +145,11 @@ void TagDETI::set_edi_time(const std::time_t t, int tai_utc_offset)
     seconds = t - posix_timestamp_1_jan_2000 + utco;
 }
 
-std::vector<uint8_t> TagESTn::Assemble()
+void TagESTn::Assemble(std::vector<uint8_t>& packet)
 {
     std::string pack_data("est");
-    std::vector<uint8_t> packet(pack_data.begin(), pack_data.end());
-    packet.reserve(mst_length*8 + 16);
+    const size_t start = packet.size();
+    packet.insert(packet.end(), pack_data.begin(), pack_data.end());
 
     packet.push_back(id);
 
@@ -184,26 +182,25 @@ std::vector<uint8_t> TagESTn::Assemble()
 
     // calculate and update size
     // remove TAG name and TAG length fields and convert to bits
-    uint32_t taglength = (packet.size() - 8) * 8;
+    uint32_t taglength = (packet.size() - start - 8) * 8;
 
     // write length into packet
-    packet[4] = (taglength >> 24) & 0xFF;
-    packet[5] = (taglength >> 16) & 0xFF;
-    packet[6] = (taglength >> 8) & 0xFF;
-    packet[7] = taglength & 0xFF;
+    packet[start + 4] = (taglength >> 24) & 0xFF;
+    packet[start + 5] = (taglength >> 16) & 0xFF;
+    packet[start + 6] = (taglength >> 8) & 0xFF;
+    packet[start + 7] = taglength & 0xFF;
 
     /*
     std::cerr << "TagItem ESTn, length " << packet.size() << std::endl;
     std::cerr << "              mst_length " << mst_length << std::endl;
     */
-    return packet;
 }
 
-std::vector<uint8_t> TagDSTI::Assemble()
+void TagDSTI::Assemble(std::vector<uint8_t>& packet)
 {
     std::string pack_data("dsti");
-    std::vector<uint8_t> packet(pack_data.begin(), pack_data.end());
-    packet.reserve(256);
+    const size_t start = packet.size();
+    packet.insert(packet.end(), pack_data.begin(), pack_data.end());
 
     // Placeholder for length
     packet.push_back(0);
@@ -245,13 +242,13 @@ std::vector<uint8_t> TagDSTI::Assemble()
     }
     // calculate and update size
     // remove TAG name and TAG length fields and convert to bits
-    uint32_t taglength = (packet.size() - 8) * 8;
+    uint32_t taglength = (packet.size() - start - 8) * 8;
 
     // write length into packet
-    packet[4] = (taglength >> 24) & 0xFF;
-    packet[5] = (taglength >> 16) & 0xFF;
-    packet[6] = (taglength >> 8) & 0xFF;
-    packet[7] = taglength & 0xFF;
+    packet[start + 4] = (taglength >> 24) & 0xFF;
+    packet[start + 5] = (taglength >> 16) & 0xFF;
+    packet[start + 6] = (taglength >> 8) & 0xFF;
+    packet[start + 7] = taglength & 0xFF;
 
     dlfc = (dlfc+1) % 5000;
 
@@ -259,7 +256,6 @@ std::vector<uint8_t> TagDSTI::Assemble()
     std::cerr << "TagItem dsti, packet.size " << packet.size() << std::endl;
     std::cerr << "              length " << taglength / 8 << std::endl;
     */
-    return packet;
 }
 
 void TagDSTI::set_edi_time(const std::time_t t, int tai_utc_offset)
@@ -301,11 +297,11 @@ void TagDSTI::set_edi_time(const std::time_t t)
 }
 #endif
 
-std::vector<uint8_t> TagSSm::Assemble()
+void TagSSm::Assemble(std::vector<uint8_t>& packet)
 {
     std::string pack_data("ss");
-    std::vector<uint8_t> packet(pack_data.begin(), pack_data.end());
-    packet.reserve(istd_length + 16);
+    const size_t start = packet.size();
+    packet.insert(packet.end(), pack_data.begin(), pack_data.end());
 
     packet.push_back((id >> 8) & 0xFF);
     packet.push_back(id & 0xFF);
@@ -343,39 +339,37 @@ std::vector<uint8_t> TagSSm::Assemble()
 
     // calculate and update size
     // remove TAG name and TAG length fields and convert to bits
-    uint32_t taglength = (packet.size() - 8) * 8;
+    uint32_t taglength = (packet.size() - start - 8) * 8;
 
     // write length into packet
-    packet[4] = (taglength >> 24) & 0xFF;
-    packet[5] = (taglength >> 16) & 0xFF;
-    packet[6] = (taglength >> 8) & 0xFF;
-    packet[7] = taglength & 0xFF;
+    packet[start + 4] = (taglength >> 24) & 0xFF;
+    packet[start + 5] = (taglength >> 16) & 0xFF;
+    packet[start + 6] = (taglength >> 8) & 0xFF;
+    packet[start + 7] = taglength & 0xFF;
 
     /*
     std::cerr << "TagItem SSm, length " << packet.size() << std::endl;
     std::cerr << "             istd_length " << istd_length << std::endl;
     */
-    return packet;
 }
 
 
-std::vector<uint8_t> TagStarDMY::Assemble()
+void TagStarDMY::Assemble(std::vector<uint8_t>& packet)
 {
     std::string pack_data("*dmy");
-    std::vector<uint8_t> packet(pack_data.begin(), pack_data.end());
+    const size_t start = packet.size();
+    packet.insert(packet.end(), pack_data.begin(), pack_data.end());
 
-    packet.resize(4 + 4 + length_);
+    packet.resize(start + 4 + 4 + length_);
 
     const uint32_t length_bits = length_ * 8;
 
-    packet[4] = (length_bits >> 24) & 0xFF;
-    packet[5] = (length_bits >> 16) & 0xFF;
-    packet[6] = (length_bits >> 8) & 0xFF;
-    packet[7] = length_bits & 0xFF;
+    packet[start + 4] = (length_bits >> 24) & 0xFF;
+    packet[start + 5] = (length_bits >> 16) & 0xFF;
+    packet[start + 6] = (length_bits >> 8) & 0xFF;
+    packet[start + 7] = length_bits & 0xFF;
 
     // The remaining bytes in the packet are "undefined data"
-
-    return packet;
 }
 
 TagODRVersion::TagODRVersion(const std::string& version, uint32_t uptime_s) :
@@ -384,18 +378,19 @@ TagODRVersion::TagODRVersion(const std::string& version, uint32_t uptime_s) :
 {
 }
 
-std::vector<uint8_t> TagODRVersion::Assemble()
+void TagODRVersion::Assemble(std::vector<uint8_t>& packet)
 {
     std::string pack_data("ODRv");
-    std::vector<uint8_t> packet(pack_data.begin(), pack_data.end());
+    const size_t start = packet.size();
+    packet.insert(packet.end(), pack_data.begin(), pack_data.end());
 
     const size_t length = m_version.size() + sizeof(uint32_t);
 
-    packet.resize(4 + 4 + length);
+    packet.resize(start + 4 + 4 + length);
 
     const uint32_t length_bits = length * 8;
 
-    size_t i = 4;
+    size_t i = start + 4;
     packet[i++] = (length_bits >> 24) & 0xFF;
     packet[i++] = (length_bits >> 16) & 0xFF;
     packet[i++] = (length_bits >> 8) & 0xFF;
@@ -408,8 +403,6 @@ std::vector<uint8_t> TagODRVersion::Assemble()
     packet[i++] = (m_uptime >> 16) & 0xFF;
     packet[i++] = (m_uptime >> 8) & 0xFF;
     packet[i++] = m_uptime & 0xFF;
-
-    return packet;
 }
 
 TagODRAudioLevels::TagODRAudioLevels(int16_t audiolevel_left, int16_t audiolevel_right) :
@@ -418,18 +411,19 @@ TagODRAudioLevels::TagODRAudioLevels(int16_t audiolevel_left, int16_t audiolevel
 {
 }
 
-std::vector<uint8_t> TagODRAudioLevels::Assemble()
+void TagODRAudioLevels::Assemble(std::vector<uint8_t>& packet)
 {
     std::string pack_data("ODRa");
-    std::vector<uint8_t> packet(pack_data.begin(), pack_data.end());
+    const size_t start = packet.size();
+    packet.insert(packet.end(), pack_data.begin(), pack_data.end());
 
     constexpr size_t length = 2*sizeof(int16_t);
 
-    packet.resize(4 + 4 + length);
+    packet.resize(start + 4 + 4 + length);
 
     const uint32_t length_bits = length * 8;
 
-    size_t i = 4;
+    size_t i = start + 4;
     packet[i++] = (length_bits >> 24) & 0xFF;
     packet[i++] = (length_bits >> 16) & 0xFF;
     packet[i++] = (length_bits >> 8) & 0xFF;
@@ -440,9 +434,41 @@ std::vector<uint8_t> TagODRAudioLevels::Assemble()
 
     packet[i++] = (m_audio_right >> 8) & 0xFF;
     packet[i++] = m_audio_right & 0xFF;
+}
 
-    return packet;
+TagODRAudioLoudness::TagODRAudioLoudness(int16_t momentary, int16_t short_term,
+        int16_t integrated, int16_t range, int16_t true_peak) :
+    m_momentary(momentary),
+    m_short_term(short_term),
+    m_integrated(integrated),
+    m_range(range),
+    m_true_peak(true_peak)
+{
 }
 
+void TagODRAudioLoudness::Assemble(std::vector<uint8_t>& packet)
+{
+    std::string pack_data("ODRl");
+    const size_t start = packet.size();
+    packet.insert(packet.end(), pack_data.begin(), pack_data.end());
+
+    constexpr size_t length = 5*sizeof(int16_t);
+
+    packet.resize(start + 4 + 4 + length);
+
+    const uint32_t length_bits = length * 8;
+
+    size_t i = start + 4;
+    packet[i++] = (length_bits >> 24) & 0xFF;
+    packet[i++] = (length_bits >> 16) & 0xFF;
+    packet[i++] = (length_bits >> 8) & 0xFF;
+    packet[i++] = length_bits & 0xFF;
+
+    for (const int16_t value : {m_momentary, m_short_term, m_integrated,
+                                m_range, m_true_peak}) {
+        packet[i++] = (value >> 8) & 0xFF;
+        packet[i++] = value & 0xFF;
+    }
 }
 
+}
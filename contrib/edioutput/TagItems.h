@@ -39,7 +39,9 @@ namespace edi {
 class TagItem
 {
     public:
-        virtual std::vector<uint8_t> Assemble() = 0;
+        // Append the TAG item to the packet. Reusing the same packet
+        // vector avoids allocations once it has reached its final size.
+        virtual void Assemble(std::vector<uint8_t>& packet) = 0;
 };
 
 // ETSI TS 102 693, 5.1.1 Protocol type and revision
@@ -47,7 +49,7 @@ class TagStarPTR : public TagItem
 {
     public:
         TagStarPTR(const std::string& protocol);
-        std::vector<uint8_t> Assemble();
+        void Assemble(std::vector<uint8_t>& packet);
 
     private:
         std::string m_protocol = "";
@@ -57,7 +59,7 @@ class TagStarPTR : public TagItem
 class TagDETI : public TagItem
 {
     public:
-        std::vector<uint8_t> Assemble();
+        void Assemble(std::vector<uint8_t>& packet);
 
         /***** DATA in intermediary format ****/
         // For the ETI Header: must be defined !
@@ -121,7 +123,7 @@ class TagDETI : public TagItem
 class TagESTn : public TagItem
 {
     public:
-        std::vector<uint8_t> Assemble();
+        void Assemble(std::vector<uint8_t>& packet);
 
         // SSTCn
         uint8_t  scid;
@@ -141,7 +143,7 @@ class TagESTn : public TagItem
 class TagDSTI : public TagItem
 {
     public:
-        std::vector<uint8_t> Assemble();
+        void Assemble(std::vector<uint8_t>& packet);
 
         // dsti Header
         bool stihf = false;
@@ -197,7 +199,7 @@ class TagDSTI : public TagItem
 class TagSSm : public TagItem
 {
     public:
-        std::vector<uint8_t> Assemble();
+        void Assemble(std::vector<uint8_t>& packet);
 
         // SSTCn
         uint8_t rfa = 0;
@@ -220,7 +222,7 @@ class TagStarDMY : public TagItem
     public:
         /* length is the TAG value length in bytes */
         TagStarDMY(uint32_t length) : length_(length) {}
-        std::vector<uint8_t> Assemble();
+        void Assemble(std::vector<uint8_t>& packet);
 
     private:
         uint32_t length_;
@@ -231,7 +233,9 @@ class TagODRVersion : public TagItem
 {
     public:
         TagODRVersion(const std::string& version, uint32_t uptime_s);
-        std::vector<uint8_t> Assemble();
+        void Assemble(std::vector<uint8_t>& packet);
+
+        void set_uptime(uint32_t uptime_s) { m_uptime = uptime_s; }
 
     private:
         std::string m_version;
@@ -243,12 +247,30 @@ class TagODRAudioLevels : public TagItem
 {
     public:
         TagODRAudioLevels(int16_t audiolevel_left, int16_t audiolevel_right);
-        std::vector<uint8_t> Assemble();
+        void Assemble(std::vector<uint8_t>& packet);
 
     private:
         int16_t m_audio_left;
         int16_t m_audio_right;
 };
 
+// Custom TAG that carries EBU R 128 loudness metadata. All values are in
+// units of 0.01 LU (loudness) or 0.01 dB (true peak), -32768 means the value
+// is not available.
+class TagODRAudioLoudness : public TagItem
+{
+    public:
+        TagODRAudioLoudness(int16_t momentary, int16_t short_term,
+                int16_t integrated, int16_t range, int16_t true_peak);
+        void Assemble(std::vector<uint8_t>& packet);
+
+    private:
+        int16_t m_momentary;
+        int16_t m_short_term;
+        int16_t m_integrated;
+        int16_t m_range;
+        int16_t m_true_peak;
+};
+
 }
 
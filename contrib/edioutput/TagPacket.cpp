@@ -29,7 +29,6 @@
 #include <vector>
 #include <iostream>
 #include <string>
-#include <list>
 #include <cstdint>
 #include <cassert>
 
@@ -38,41 +37,38 @@ namespace edi {
 TagPacket::TagPacket(unsigned int alignment) : m_alignment(alignment)
 { }
 
-std::vector<uint8_t> TagPacket::Assemble()
+void TagPacket::Assemble(std::vector<uint8_t>& packet)
 {
     if (raw_tagpacket.size() > 0 and tag_items.size() > 0) {
         throw std::logic_error("TagPacket: both raw and items used!");
     }
 
     if (raw_tagpacket.size() > 0) {
-        return raw_tagpacket;
+        packet.insert(packet.end(), raw_tagpacket.begin(), raw_tagpacket.end());
+        return;
     }
 
-    std::vector<uint8_t> packet;
+    const size_t start = packet.size();
 
     for (auto tag : tag_items) {
-        std::vector<uint8_t> tag_data = tag->Assemble();
-        packet.insert(packet.end(), tag_data.begin(), tag_data.end());
+        tag->Assemble(packet);
     }
 
     if (m_alignment == 0) { /* no padding */ }
     else if (m_alignment == 8) {
         // Add padding inside TAG packet
-        while (packet.size() % 8 > 0) {
+        while ((packet.size() - start) % 8 > 0) {
             packet.push_back(0); // TS 102 821, 5.1, "padding shall be undefined"
         }
     }
     else if (m_alignment > 8) {
         TagStarDMY dmy(m_alignment - 8);
-        auto dmy_data = dmy.Assemble();
-        packet.insert(packet.end(), dmy_data.begin(), dmy_data.end());
+        dmy.Assemble(packet);
     }
     else {
         std::cerr << "Invalid alignment requirement " << m_alignment <<
             " defined in TagPacket" << std::endl;
     }
-
-    return packet;
 }
 
 }
@@ -29,7 +29,6 @@
 #include "TagItems.h"
 #include <vector>
 #include <string>
-#include <list>
 #include <cstdint>
 
 namespace edi {
@@ -46,9 +45,11 @@ class TagPacket
 {
     public:
         TagPacket(unsigned int alignment);
-        std::vector<uint8_t> Assemble();
 
-        std::list<TagItem*> tag_items;
+        // Append the TAG packet to the given buffer
+        void Assemble(std::vector<uint8_t>& packet);
+
+        std::vector<TagItem*> tag_items;
 
         std::vector<uint8_t> raw_tagpacket;
 
@@ -53,6 +53,8 @@ void configuration_t::print() const
         else if (auto tcp_dest = dynamic_pointer_cast<edi::tcp_client_t>(edi_dest)) {
             etiLog.level(info) << " TCP client connecting to " << tcp_dest->dest_addr << ":" << tcp_dest->dest_port;
             etiLog.level(info) << "  max frames queued    " << tcp_dest->max_frames_queued;
+            etiLog.level(info) << "  overflow policy      " <<
+                (tcp_dest->overflow_policy == overflow_policy_t::drop_oldest ? "drop oldest" : "drop newest");
         }
         else {
             throw logic_error("EDI destination not implemented");
@@ -69,41 +71,47 @@ Sender::Sender(const configuration_t& conf) :
         etiLog.level(info) << "Setup EDI Output";
     }
 
+    vector<shared_ptr<udp_destination_t> > udp_dests;
     for (const auto& edi_dest : m_conf.destinations) {
         if (const auto udp_dest = dynamic_pointer_cast<edi::udp_destination_t>(edi_dest)) {
-            auto udp_socket = std::make_shared<Socket::UDPSocket>(udp_dest->source_port);
-
-            if (not udp_dest->source_addr.empty()) {
-                udp_socket->setMulticastSource(udp_dest->source_addr.c_str());
-                udp_socket->setMulticastTTL(udp_dest->ttl);
-            }
-
-            udp_sockets.emplace(udp_dest.get(), udp_socket);
+            udp_dests.push_back(udp_dest);
+            m_udp_names.push_back("udp://" + udp_dest->dest_addr + ":" +
+                    to_string(udp_dest->dest_port));
         }
         else if (auto tcp_dest = dynamic_pointer_cast<edi::tcp_server_t>(edi_dest)) {
             auto dispatcher = make_shared<Socket::TCPDataDispatcher>(
                     tcp_dest->max_frames_queued, tcp_dest->tcp_server_preroll_buffers);
 
             dispatcher->start(tcp_dest->listen_port, "0.0.0.0");
-            tcp_dispatchers.emplace(tcp_dest.get(), dispatcher);
+            tcp_dispatchers.push_back({"tcp://0.0.0.0:" + to_string(tcp_dest->listen_port),
+                    dispatcher});
         }
         else if (auto tcp_dest = dynamic_pointer_cast<edi::tcp_client_t>(edi_dest)) {
-            auto tcp_send_client = make_shared<Socket::TCPSendClient>(tcp_dest->dest_addr, tcp_dest->dest_port);
-            tcp_senders.emplace(tcp_dest.get(), tcp_send_client);
+            const auto policy = tcp_dest->overflow_policy == overflow_policy_t::drop_oldest ?
+                Socket::TCPSendClient::OverflowPolicy::DropOldest :
+                Socket::TCPSendClient::OverflowPolicy::DropNewest;
+            auto tcp_send_client = make_shared<Socket::TCPSendClient>(
+                    tcp_dest->dest_addr, tcp_dest->dest_port,
+                    tcp_dest->max_frames_queued, policy);
+            tcp_senders.push_back({"tcp://" + tcp_dest->dest_addr + ":" +
+                    to_string(tcp_dest->dest_port), tcp_dest, tcp_send_client});
         }
         else {
             throw logic_error("EDI destination not implemented");
         }
     }
 
+    if (not udp_dests.empty()) {
+        m_udp_sender = make_unique<UDPBatchSender>(udp_dests);
+    }
+
     if (m_conf.dump) {
         edi_debug_file.open("./edi.debug");
     }
 
-    if (m_conf.enable_pft) {
-        unique_lock<mutex> lock(m_mutex);
-        m_running = true;
-        m_thread = thread(&Sender::run, this);
+    if (m_conf.enable_pft or m_udp_sender) {
+        m_scheduler = make_unique<FragmentScheduler>(
+                [this](const vector<const PFTFragment*>& edi_frags) { send_fragments(edi_frags); });
     }
 
     if (m_conf.verbose) {
@@ -113,61 +121,47 @@ Sender::Sender(const configuration_t& conf) :
 
 Sender::~Sender()
 {
-    {
-        unique_lock<mutex> lock(m_mutex);
-        m_running = false;
-    }
-
-    if (m_thread.joinable()) {
-        m_thread.join();
-    }
+    // Stop the scheduler thread before the destinations go away
+    m_scheduler.reset();
 }
 
-void Sender::write(const TagPacket& tagpacket)
+void Sender::write(TagPacket& tagpacket)
 {
     // Assemble into one AF Packet
-    edi::AFPacket af_packet = edi_afPacketiser.Assemble(tagpacket);
+    edi_afPacketiser.Assemble(tagpacket, m_af_packet);
 
-    write(af_packet);
+    write(m_af_packet);
 }
 
 void Sender::write(const AFPacket& af_packet)
 {
     if (m_conf.enable_pft) {
         // Apply PFT layer to AF Packet (Reed Solomon FEC and Fragmentation)
-        vector<edi::PFTFragment> edi_fragments = edi_pft.Assemble(af_packet);
+        const auto& pft_fragments = edi_pft.Assemble(af_packet);
+        const size_t num_fragments = pft_fragments.size();
 
-        if (m_conf.verbose and m_last_num_pft_fragments != edi_fragments.size()) {
+        if (m_conf.verbose and m_last_num_pft_fragments != num_fragments) {
             etiLog.log(debug, "EDI Output: Number of PFT fragments %zu\n",
-                    edi_fragments.size());
-            m_last_num_pft_fragments = edi_fragments.size();
+                    num_fragments);
+            m_last_num_pft_fragments = num_fragments;
         }
 
         /* Spread out the transmission of all fragments over part of the 24ms AF packet duration
          * to reduce the risk of losing a burst of fragments because of congestion. */
         using namespace std::chrono;
-        auto inter_fragment_wait_time = microseconds(1);
-        if (edi_fragments.size() > 1) {
-            if (m_conf.fragment_spreading_factor > 0) {
-                inter_fragment_wait_time =
-                    microseconds(
-                            llrint(m_conf.fragment_spreading_factor * 24000.0 / edi_fragments.size())
-                            );
-            }
+        steady_clock::duration spread = microseconds(num_fragments);
+        if (num_fragments > 1 and m_conf.fragment_spreading_factor > 0) {
+            spread = duration_cast<steady_clock::duration>(
+                    duration<double, micro>(m_conf.fragment_spreading_factor * 24000.0));
         }
 
-        /* Separate insertion into map and transmission so as to make spreading possible */
-        const auto now = steady_clock::now();
-        {
-            auto tp = now;
-            unique_lock<mutex> lock(m_mutex);
-            for (auto& edi_frag : edi_fragments) {
-                m_pending_frames[tp] = move(edi_frag);
-                tp += inter_fragment_wait_time;
-            }
+        const size_t num_dropped = m_scheduler->schedule(pft_fragments, steady_clock::now(), spread);
+        if (num_dropped > 0 and m_conf.verbose) {
+            etiLog.log(warn, "EDI Output: dropped %zu PFT fragments, scheduler is late\n",
+                    num_dropped);
         }
 
-        // Transmission done in run() function
+        // Transmission done in the scheduler thread
     }
     else /* PFT disabled */ {
         // Send over ethernet
@@ -176,37 +170,23 @@ void Sender::write(const AFPacket& af_packet)
             copy(af_packet.begin(), af_packet.end(), debug_iterator);
         }
 
-        for (auto& dest : m_conf.destinations) {
-            if (const auto& udp_dest = dynamic_pointer_cast<edi::udp_destination_t>(dest)) {
-                Socket::InetAddress addr;
-                addr.resolveUdpDestination(udp_dest->dest_addr, udp_dest->dest_port);
-
-                if (af_packet.size() > 1400 and not m_udp_fragmentation_warning_printed) {
-                    fprintf(stderr, "EDI Output: AF packet larger than 1400,"
-                            " consider using PFT to avoid UP fragmentation.\n");
-                    m_udp_fragmentation_warning_printed = true;
-                }
-
-                udp_sockets.at(udp_dest.get())->send(af_packet, addr);
+        if (m_udp_sender) {
+            if (af_packet.size() > 1400 and not m_udp_fragmentation_warning_printed) {
+                fprintf(stderr, "EDI Output: AF packet larger than 1400,"
+                        " consider using PFT to avoid UP fragmentation.\n");
+                m_udp_fragmentation_warning_printed = true;
             }
-            else if (auto tcp_dest = dynamic_pointer_cast<edi::tcp_server_t>(dest)) {
-                tcp_dispatchers.at(tcp_dest.get())->write(af_packet);
-            }
-            else if (auto tcp_dest = dynamic_pointer_cast<edi::tcp_client_t>(dest)) {
-                const auto error_stats = tcp_senders.at(tcp_dest.get())->sendall(af_packet);
-
-                if (m_conf.verbose and error_stats.has_seen_new_errors) {
-                    fprintf(stderr, "TCP output %s:%d has %zu reconnects: most recent error: %s\n",
-                            tcp_dest->dest_addr.c_str(),
-                            tcp_dest->dest_port,
-                            error_stats.num_reconnects,
-                            error_stats.last_error.c_str());
-                }
-            }
-            else {
-                throw logic_error("EDI destination not implemented");
+
+            // Sent right away by the scheduler thread
+            m_af_packet_ref[0] = {af_packet.data(), af_packet.size()};
+            const size_t num_dropped = m_scheduler->schedule(m_af_packet_ref,
+                    chrono::steady_clock::now(), chrono::steady_clock::duration::zero());
+            if (num_dropped > 0 and m_conf.verbose) {
+                etiLog.log(warn, "EDI Output: dropped AF packet, scheduler is late\n");
             }
         }
+
+        send_tcp(af_packet);
     }
 }
 
@@ -220,48 +200,103 @@ void Sender::override_pft_sequence(uint16_t pseq)
     edi_pft.OverridePSeq(pseq);
 }
 
-void Sender::run()
+FragmentScheduler::stats_t Sender::collect_scheduler_stats()
 {
-    while (m_running) {
-        unique_lock<mutex> lock(m_mutex);
-        const auto now = chrono::steady_clock::now();
+    if (m_scheduler) {
+        return m_scheduler->collect_stats();
+    }
+    return FragmentScheduler::stats_t();
+}
 
-        // Send over ethernet
-        for (auto it = m_pending_frames.begin(); it != m_pending_frames.end(); ) {
-            const auto& edi_frag = it->second;
-
-            if (it->first <= now) {
-                if (m_conf.dump) {
-                    ostream_iterator<uint8_t> debug_iterator(edi_debug_file);
-                    copy(edi_frag.begin(), edi_frag.end(), debug_iterator);
-                }
-
-                for (auto& dest : m_conf.destinations) {
-                    if (const auto& udp_dest = dynamic_pointer_cast<edi::udp_destination_t>(dest)) {
-                        Socket::InetAddress addr;
-                        addr.resolveUdpDestination(udp_dest->dest_addr, udp_dest->dest_port);
-
-                        udp_sockets.at(udp_dest.get())->send(edi_frag, addr);
-                    }
-                    else if (auto tcp_dest = dynamic_pointer_cast<edi::tcp_server_t>(dest)) {
-                        tcp_dispatchers.at(tcp_dest.get())->write(edi_frag);
-                    }
-                    else if (auto tcp_dest = dynamic_pointer_cast<edi::tcp_client_t>(dest)) {
-                        tcp_senders.at(tcp_dest.get())->sendall(edi_frag);
-                    }
-                    else {
-                        throw logic_error("EDI destination not implemented");
-                    }
-                }
-                it = m_pending_frames.erase(it);
-            }
-            else {
-                ++it;
-            }
+UDPBatchSender::stats_t Sender::collect_udp_stats()
+{
+    if (m_udp_sender) {
+        return m_udp_sender->collect_stats();
+    }
+    return UDPBatchSender::stats_t();
+}
+
+void Sender::refresh_udp_destinations()
+{
+    if (m_udp_sender) {
+        m_udp_sender->resolve_destinations();
+    }
+}
+
+void Sender::collect_destination_stats(vector<destination_stats_t>& stats)
+{
+    stats.resize(m_udp_names.size() + tcp_dispatchers.size() + tcp_senders.size());
+    size_t i = 0;
+
+    if (m_udp_sender) {
+        m_udp_sender->collect_destination_stats(m_udp_stats);
+        const size_t queue_depth = m_scheduler->num_pending();
+        for (size_t u = 0; u < m_udp_stats.size(); u++, i++) {
+            stats[i].name = m_udp_names[u];
+            stats[i].stats = m_udp_stats[u];
+            stats[i].stats.queue_depth = queue_depth;
+        }
+    }
+
+    for (auto& dispatcher : tcp_dispatchers) {
+        stats[i].name = dispatcher.name;
+        stats[i].stats = dispatcher.dispatcher->collect_stats();
+        i++;
+    }
+
+    for (auto& sender : tcp_senders) {
+        stats[i].name = sender.name;
+        stats[i].stats = sender.client->collect_stats();
+        i++;
+    }
+}
+
+void Sender::send_tcp(const vector<uint8_t>& packet)
+{
+    if (tcp_dispatchers.empty() and tcp_senders.empty()) {
+        return;
+    }
+
+    // One copy shared by all TCP destinations, that send it from their own
+    // thread
+    const auto buffer = make_shared<const vector<uint8_t> >(packet);
+    for (auto& dispatcher : tcp_dispatchers) {
+        dispatcher.dispatcher->write(buffer);
+    }
+
+    for (auto& sender : tcp_senders) {
+        const auto error_stats = sender.client->sendall(buffer);
+
+        if (m_conf.verbose and error_stats.has_seen_new_errors) {
+            fprintf(stderr, "TCP output %s:%d has %zu reconnects: most recent error: %s\n",
+                    sender.dest->dest_addr.c_str(),
+                    sender.dest->dest_port,
+                    error_stats.num_reconnects,
+                    error_stats.last_error.c_str());
+        }
+    }
+}
+
+void Sender::send_fragments(const vector<const PFTFragment*>& edi_frags)
+{
+    // Without PFT, the AF packets were already dumped and given to the TCP
+    // destinations by write()
+    if (m_conf.dump and m_conf.enable_pft) {
+        ostream_iterator<uint8_t> debug_iterator(edi_debug_file);
+        for (const auto edi_frag : edi_frags) {
+            copy(edi_frag->begin(), edi_frag->end(), debug_iterator);
         }
+    }
 
-        lock.unlock();
-        this_thread::sleep_for(chrono::microseconds(500));
+    // All fragments go out to all UDP destinations together
+    if (m_udp_sender) {
+        m_udp_sender->send(edi_frags);
+    }
+
+    if (m_conf.enable_pft) {
+        for (const auto edi_frag : edi_frags) {
+            send_tcp(*edi_frag);
+        }
     }
 }
 
@@ -30,18 +30,33 @@
 #include "EDIConfig.h"
 #include "AFPacket.h"
 #include "PFT.h"
+#include "FragmentScheduler.h"
+#include "UDPBatchSender.h"
 #include "Socket.h"
 #include <chrono>
-#include <map>
-#include <unordered_map>
+#include <memory>
+#include <vector>
 #include <fstream>
+#include <string>
 #include <cstdint>
-#include <thread>
-#include <mutex>
 
 namespace edi {
 
-/** STI sender for EDI output */
+// The transmission statistics of one destination
+struct destination_stats_t {
+    // udp://host:port, tcp://host:port for a TCP client, or
+    // tcp://0.0.0.0:port for a TCP server and all its connections
+    std::string name;
+    Socket::SendStats stats;
+};
+
+/** STI sender for EDI output
+ *
+ * Every destination has its own queue and is served by its own thread: the
+ * UDP destinations by the scheduler thread, that never waits for a socket,
+ * the TCP clients by their TCPSendClient, and the TCP servers by their
+ * TCPDataDispatcher. A slow destination only delays itself, write() only
+ * queues the packets. */
 
 class Sender {
     public:
@@ -52,7 +67,7 @@ class Sender {
 
         // Assemble the tagpacket into an AF packet, and if needed,
         // apply PFT and then schedule for transmission.
-        void write(const TagPacket& tagpacket);
+        void write(TagPacket& tagpacket);
 
         // Schedule an already assembled AF Packet for transmission,
         // applying PFT if needed.
@@ -64,8 +79,32 @@ class Sender {
         void override_af_sequence(uint16_t seq);
         void override_pft_sequence(uint16_t pseq);
 
+        // Return the scheduling statistics of the PFT fragments gathered
+        // since the previous call, empty if PFT is disabled
+        FragmentScheduler::stats_t collect_scheduler_stats();
+
+        // Return the UDP transmission statistics gathered since the
+        // previous call, empty if there is no UDP destination
+        UDPBatchSender::stats_t collect_udp_stats();
+
+        // Resolve the addresses of the UDP destinations again, they are
+        // otherwise only resolved at startup
+        void refresh_udp_destinations();
+
+        // Fill stats with the statistics of every destination gathered since
+        // the previous call: the UDP destinations, then the TCP servers, then
+        // the TCP clients. The queue depth of the UDP destinations is the
+        // number of packets waiting in the scheduler. Only allocates on the
+        // first call.
+        void collect_destination_stats(std::vector<destination_stats_t>& stats);
+
     private:
-        void run();
+        // Send the packets that are due to the UDP destinations, and the PFT
+        // fragments also to the TCP destinations, from the scheduler thread
+        void send_fragments(const std::vector<const PFTFragment*>& edi_frags);
+
+        // Hand one copy of the packet to the queues of all TCP destinations
+        void send_tcp(const std::vector<uint8_t>& packet);
 
         bool m_udp_fragmentation_warning_printed = false;
 
@@ -78,16 +117,35 @@ class Sender {
         // The AF Packet will be protected with reed-solomon and split in fragments
         edi::PFT edi_pft;
 
-        std::unordered_map<udp_destination_t*, std::shared_ptr<Socket::UDPSocket>> udp_sockets;
-        std::unordered_map<tcp_server_t*, std::shared_ptr<Socket::TCPDataDispatcher>> tcp_dispatchers;
-        std::unordered_map<tcp_client_t*, std::shared_ptr<Socket::TCPSendClient>> tcp_senders;
+        // Buffer reused for every AF packet
+        edi::AFPacket m_af_packet;
+
+        // Scheduling an AF packet without PFT
+        std::vector<PFTFragmentRef> m_af_packet_ref = std::vector<PFTFragmentRef>(1);
+
+        // The destinations by type, so that sending does not need to look
+        // at the configuration
+        std::unique_ptr<UDPBatchSender> m_udp_sender;
+        std::vector<std::string> m_udp_names;
+        std::vector<Socket::SendStats> m_udp_stats;
+
+        struct tcp_dispatcher_t {
+            std::string name;
+            std::shared_ptr<Socket::TCPDataDispatcher> dispatcher;
+        };
+        std::vector<tcp_dispatcher_t> tcp_dispatchers;
+
+        struct tcp_sender_t {
+            std::string name;
+            std::shared_ptr<tcp_client_t> dest;
+            std::shared_ptr<Socket::TCPSendClient> client;
+        };
+        std::vector<tcp_sender_t> tcp_senders;
 
         // PFT spreading requires sending UDP packets at specific time, independently of
-        // time when write() gets called
-        std::thread m_thread;
-        std::mutex m_mutex;
-        bool m_running = false;
-        std::map<std::chrono::steady_clock::time_point, edi::PFTFragment> m_pending_frames;
+        // time when write() gets called. Without PFT, the scheduler thread
+        // sends the AF packets to the UDP destinations right away.
+        std::unique_ptr<FragmentScheduler> m_scheduler;
 
         size_t m_last_num_pft_fragments = 0;
 };
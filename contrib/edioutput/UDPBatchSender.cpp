@@ -0,0 +1,185 @@
+/*
+   Copyright (C) 2022
+   Matthias P. Braendli, matthias.braendli@mpb.li
+
+    http://www.opendigitalradio.org
+
+   EDI output,
+   Sends batches of packets to all UDP destinations with sendmmsg().
+
+   */
+/*
+   This file is part of the ODR-mmbTools.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as
+   published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "UDPBatchSender.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <cerrno>
+#include <cstring>
+
+using namespace std;
+
+namespace edi {
+
+UDPBatchSender::UDPBatchSender(const vector<shared_ptr<udp_destination_t> >& destinations) :
+    m_destination_stats(destinations.size())
+{
+    for (size_t i = 0; i < destinations.size(); i++) {
+        const auto& dest = destinations[i];
+        auto group = find_if(m_groups.begin(), m_groups.end(),
+                [&](const socket_group_t& g) {
+                    const auto& first = g.destinations.front();
+                    return first->source_port == dest->source_port and
+                        first->source_addr == dest->source_addr and
+                        first->ttl == dest->ttl;
+                });
+
+        if (group == m_groups.end()) {
+            socket_group_t new_group;
+            new_group.socket = make_unique<Socket::UDPSocket>(dest->source_port);
+
+            if (not dest->source_addr.empty()) {
+                new_group.socket->setMulticastSource(dest->source_addr.c_str());
+                new_group.socket->setMulticastTTL(dest->ttl);
+            }
+
+            m_groups.push_back(move(new_group));
+            group = prev(m_groups.end());
+        }
+
+        group->destinations.push_back(dest);
+        group->stats_index.push_back(i);
+    }
+
+    resolve_destinations();
+}
+
+void UDPBatchSender::resolve_destinations()
+{
+    // Resolve without holding the lock, getaddrinfo can take long
+    vector<vector<Socket::InetAddress> > resolved(m_groups.size());
+    for (size_t g = 0; g < m_groups.size(); g++) {
+        for (const auto& dest : m_groups[g].destinations) {
+            Socket::InetAddress addr;
+            addr.resolveUdpDestination(dest->dest_addr, dest->dest_port);
+            resolved[g].push_back(addr);
+        }
+    }
+
+    lock_guard<mutex> lock(m_mutex);
+    for (size_t g = 0; g < m_groups.size(); g++) {
+        m_groups[g].addresses = move(resolved[g]);
+    }
+}
+
+void UDPBatchSender::send(const vector<const vector<uint8_t>*>& packets)
+{
+    m_iovecs.resize(packets.size());
+    for (size_t p = 0; p < packets.size(); p++) {
+        m_iovecs[p].iov_base = const_cast<uint8_t*>(packets[p]->data());
+        m_iovecs[p].iov_len = packets[p]->size();
+    }
+
+    const auto start = chrono::steady_clock::now();
+
+    lock_guard<mutex> lock(m_mutex);
+    for (auto& group : m_groups) {
+        const size_t num_addresses = group.addresses.size();
+        m_msgs.resize(packets.size() * num_addresses);
+
+        for (size_t p = 0; p < packets.size(); p++) {
+            for (size_t a = 0; a < num_addresses; a++) {
+                auto& hdr = m_msgs[p * num_addresses + a].msg_hdr;
+                memset(&hdr, 0, sizeof(hdr));
+                hdr.msg_name = group.addresses[a].as_sockaddr();
+                hdr.msg_namelen = sizeof(struct sockaddr_in);
+                hdr.msg_iov = &m_iovecs[p];
+                hdr.msg_iovlen = 1;
+            }
+        }
+
+        send_messages(group, m_msgs.data(), m_msgs.size(), start);
+    }
+}
+
+void UDPBatchSender::send_messages(socket_group_t& group, struct mmsghdr *msgs, size_t num_msgs,
+        chrono::steady_clock::time_point start)
+{
+    // Message i goes to the address i % num_addresses of the group
+    const size_t num_addresses = group.addresses.size();
+    const int sock = group.socket->getNativeSocket();
+
+    // sendmmsg() stops at the first error and returns the number of
+    // messages sent before it, the error is returned by the next call.
+    size_t num_sent = 0;
+    while (num_sent < num_msgs) {
+        const int ret = sendmmsg(sock, msgs + num_sent, num_msgs - num_sent, MSG_DONTWAIT);
+        m_num_syscalls.fetch_add(1, memory_order_relaxed);
+
+        if (ret == SOCKET_ERROR) {
+            if (errno == ECONNREFUSED) {
+                m_destination_stats[group.stats_index[num_sent % num_addresses]].num_dropped++;
+                num_sent++;
+            }
+            // This suppresses the -Wlogical-op warning
+#if EAGAIN == EWOULDBLOCK
+            else if (errno == EAGAIN or errno == ENOBUFS)
+#else
+            else if (errno == EAGAIN or errno == EWOULDBLOCK or errno == ENOBUFS)
+#endif
+            {
+                // The socket buffer is full, and shared by all destinations
+                // of the group: drop the remaining messages, never wait
+                for (; num_sent < num_msgs; num_sent++) {
+                    m_destination_stats[group.stats_index[num_sent % num_addresses]].num_dropped++;
+                }
+            }
+            else if (errno != EINTR) {
+                throw runtime_error(string("Can't send UDP packets: ") + strerror(errno));
+            }
+        }
+        else {
+            const auto latency = chrono::steady_clock::now() - start;
+            for (int i = 0; i < ret; i++) {
+                m_destination_stats[group.stats_index[(num_sent + i) % num_addresses]].record_sent(latency);
+            }
+            num_sent += ret;
+            m_num_packets.fetch_add(ret, memory_order_relaxed);
+        }
+    }
+}
+
+UDPBatchSender::stats_t UDPBatchSender::collect_stats()
+{
+    stats_t stats;
+    stats.num_syscalls = m_num_syscalls.exchange(0);
+    stats.num_packets = m_num_packets.exchange(0);
+    return stats;
+}
+
+void UDPBatchSender::collect_destination_stats(vector<Socket::SendStats>& stats)
+{
+    lock_guard<mutex> lock(m_mutex);
+    stats.resize(m_destination_stats.size());
+    for (size_t i = 0; i < m_destination_stats.size(); i++) {
+        stats[i] = m_destination_stats[i];
+        m_destination_stats[i] = Socket::SendStats();
+    }
+}
+
+}
+
@@ -0,0 +1,112 @@
+/*
+   Copyright (C) 2022
+   Matthias P. Braendli, matthias.braendli@mpb.li
+
+    http://www.opendigitalradio.org
+
+   EDI output,
+   Sends batches of packets to all UDP destinations with sendmmsg().
+
+   The destination addresses are resolved once, and not for every packet.
+   Destinations that share the same source port, source address and TTL
+   share one socket, so that a batch of packets goes out to all of them
+   in a single system call.
+
+   */
+/*
+   This file is part of the ODR-mmbTools.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as
+   published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "EDIConfig.h"
+#include "Socket.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace edi {
+
+class UDPBatchSender
+{
+    public:
+        struct stats_t {
+            size_t num_syscalls = 0;
+            size_t num_packets = 0;
+        };
+
+        // Open the sockets and resolve the addresses of the destinations
+        UDPBatchSender(const std::vector<std::shared_ptr<udp_destination_t> >& destinations);
+        UDPBatchSender(const UDPBatchSender&) = delete;
+        UDPBatchSender& operator=(const UDPBatchSender&) = delete;
+
+        // Resolve the destination addresses again, to follow a change of
+        // the DNS or of the destination configuration. Can be called while
+        // another thread calls send(). Throws a runtime_error and keeps the
+        // previous addresses if one destination cannot be resolved.
+        void resolve_destinations();
+
+        // Send all packets to all destinations, packet after packet.
+        // Never blocks: the packets that do not fit in the socket buffer
+        // are dropped, as well as those refused with ECONNREFUSED. Throws
+        // a runtime_error on other send errors.
+        void send(const std::vector<const std::vector<uint8_t>*>& packets);
+
+        // Return the statistics gathered since the previous call, and
+        // reset them. Can be called from any thread.
+        stats_t collect_stats();
+
+        // Fill stats with the statistics of every destination since the
+        // previous call, in the order given to the constructor, and reset
+        // them. The latency is the time send() took until the packet was
+        // handed to the kernel. Can be called from any thread.
+        void collect_destination_stats(std::vector<Socket::SendStats>& stats);
+
+    private:
+        // The destinations sharing one socket, with their resolved addresses
+        // and the index of their statistics
+        struct socket_group_t {
+            std::unique_ptr<Socket::UDPSocket> socket;
+            std::vector<std::shared_ptr<udp_destination_t> > destinations;
+            std::vector<Socket::InetAddress> addresses;
+            std::vector<size_t> stats_index;
+        };
+
+        void send_messages(socket_group_t& group, struct mmsghdr *msgs, size_t num_msgs,
+                std::chrono::steady_clock::time_point start);
+
+        std::vector<socket_group_t> m_groups;
+
+        // Protects the addresses of the groups and the destination
+        // statistics
+        std::mutex m_mutex;
+        std::vector<Socket::SendStats> m_destination_stats;
+
+        // Reused for every send()
+        std::vector<struct iovec> m_iovecs;
+        std::vector<struct mmsghdr> m_msgs;
+
+        std::atomic<size_t> m_num_syscalls = {0};
+        std::atomic<size_t> m_num_packets = {0};
+};
+
+}
+
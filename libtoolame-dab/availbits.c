@@ -28,13 +28,14 @@ struct slotinfo {
   double average;
   double frac;
   int whole;
-  double lag;
   int extra;
-} slots;
+};
 
 /* function returns the number of available bits */
-int available_bits (frame_header *header, options * glopts)
+int available_bits (frame_info *frame, options * glopts)
 {
+  frame_header *header = frame->header;
+  struct slotinfo slots;
   int adb;
 
   slots.extra = 0;		/* be default, no extra slots */
@@ -49,15 +50,15 @@ int available_bits (frame_header *header, options * glopts)
   /* never allow padding for a VBR frame. 
      Don't ask me why, I've forgotten why I set this */
   if (slots.frac != 0 && glopts->usepadbit && glopts->vbr == FALSE) {
-    if (slots.lag > (slots.frac - 1.0)) {	/* no padding for this frame */
-      slots.lag -= slots.frac;
+    if (frame->slot_lag > (slots.frac - 1.0)) {	/* no padding for this frame */
+      frame->slot_lag -= slots.frac;
       slots.extra = 0;
       header->padding = 0;
     } else {			/* padding */
 
       slots.extra = 1;
       header->padding = 1;
-      slots.lag += (1 - slots.frac);
+      frame->slot_lag += (1 - slots.frac);
     }
   }
 
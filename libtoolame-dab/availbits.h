@@ -1,2 +1,2 @@
 
-int available_bits (frame_header *header, options * glopts);
+int available_bits (frame_info *frame, options * glopts);
@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,6 +23,13 @@
   If the bit stream is opened in read mode only the get functions are
   available. If the bit stream is opened in write mode only the put
   functions are available.
+
+  The put functions collect the bits in a 64-bit accumulator, and store
+  them into the buffer 32 bits at a time. The buffer is filled from its
+  end towards its start, so a word goes to the four bytes below
+  buf_byte_idx, in little-endian order. Bits still in the accumulator are
+  not visible in buf: call bs_flush() before looking at buf_byte_idx or at
+  the buffer content.
  ********************************************************************/
 
 /*open_bit_stream_w(); open the device to write the bit stream into it    */
@@ -29,17 +37,15 @@
 /*alloc_buffer();      open and initialize the buffer;                    */
 /*desalloc_buffer();   empty and close the buffer                         */
 /*put1bit(); write 1 bit from the bit stream  */
-/*put1bit(); write 1 bit from the bit stream  */
 /*putbits(); write N bits from the bit stream */
+/*bs_flush(); write all complete bytes of the accumulator to the buffer */
 
 /* You must have one frame in memory if you are in DAB mode                 */
 /* in conformity of the norme ETS 300 401 http://www.etsi.org               */
 /* see toollame.c                                                           */
-int minimum = MINIMUM;
-
-void bs_set_minimum(int min)
+void bs_set_minimum(Bit_stream_struc * bs, int min)
 {
-    minimum = min;
+    bs->minimum = min;
 }
 
 /* empty the buffer to the output device when the buffer becomes full */
@@ -81,12 +87,16 @@ void open_bit_stream_w (Bit_stream_struc * bs, int size)
     bs->mode = WRITE_MODE;
     bs->eob = FALSE;
     bs->eobs = FALSE;
+    bs->minimum = MINIMUM;
+    bs->acc = 0;
+    bs->acc_bits = 0;
 }
 
 /*close the device containing the bit stream after a write process*/
 void close_bit_stream_w (Bit_stream_struc * bs)
 {
     putbits (bs, 0, 7);
+    bs_flush (bs);
     empty_buffer (bs, bs->buf_byte_idx + 1);
     desalloc_buffer (bs);
 }
@@ -103,49 +113,66 @@ void alloc_buffer (Bit_stream_struc * bs, int size)
 void desalloc_buffer (Bit_stream_struc * bs)
 {
     free (bs->buf);
+    bs->buf = NULL;
 }
 
-const int putmask[9] = { 0x0, 0x1, 0x3, 0x7, 0xf, 0x1f, 0x3f, 0x7f, 0xff };
-
-/*write 1 bit from the bit stream */
-void put1bit (Bit_stream_struc * bs, int bit)
+/* store one complete byte into the buffer */
+static void put_byte (Bit_stream_struc * bs, unsigned int byte)
 {
-    bs->totbit++;
+    bs->buf[bs->buf_byte_idx] = byte;
+    bs->buf_byte_idx--;
+    if (bs->buf_byte_idx < 0)
+        empty_buffer (bs, bs->minimum);
+}
 
-    bs->buf[bs->buf_byte_idx] |= (bit & 0x1) << (bs->buf_bit_idx - 1);
-    bs->buf_bit_idx--;
-    if (!bs->buf_bit_idx) {
-        bs->buf_bit_idx = 8;
-        bs->buf_byte_idx--;
+/* store 32 complete bits into the buffer, the first of them in the MSB */
+static void put_word (Bit_stream_struc * bs, uint32_t word)
+{
+    if (bs->buf_byte_idx >= 3) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap32 (word);
+#endif
+        memcpy (&bs->buf[bs->buf_byte_idx - 3], &word, 4);
+        bs->buf_byte_idx -= 4;
         if (bs->buf_byte_idx < 0)
-            empty_buffer (bs, minimum);
-        bs->buf[bs->buf_byte_idx] = 0;
+            empty_buffer (bs, bs->minimum);
+    }
+    else {
+        /* the buffer gets emptied in the middle of the word */
+        put_byte (bs, (word >> 24) & 0xff);
+        put_byte (bs, (word >> 16) & 0xff);
+        put_byte (bs, (word >> 8) & 0xff);
+        put_byte (bs, word & 0xff);
     }
 }
 
-/*write N bits into the bit stream */
-void putbits (Bit_stream_struc * bs, unsigned int val, int N)
+/*write 1 bit from the bit stream */
+void put1bit (Bit_stream_struc * bs, int bit)
 {
-    register int j = N;
-    register int k, tmp;
+    putbits (bs, bit, 1);
+}
 
-    /* if (N > MAX_LENGTH)
-       fprintf(stderr, "Cannot read or write more than %d bits at a time.\n", MAX_LENGTH); ignore check!! MFC Apr 00 */
+/*write N bits into the bit stream, N <= MAX_LENGTH */
+void putbits (Bit_stream_struc * bs, unsigned int val, int N)
+{
+    if (N <= 0)
+        return;
 
     bs->totbit += N;
-    while (j > 0) {
-        k = MIN (j, bs->buf_bit_idx);
-        tmp = val >> (j - k);
-        bs->buf[bs->buf_byte_idx] |= (tmp & putmask[k]) << (bs->buf_bit_idx - k);
-        bs->buf_bit_idx -= k;
-        if (!bs->buf_bit_idx) {
-            bs->buf_bit_idx = 8;
-            bs->buf_byte_idx--;
-            if (bs->buf_byte_idx < 0)
-                empty_buffer (bs, minimum);
-            bs->buf[bs->buf_byte_idx] = 0;
-        }
-        j -= k;
+    bs->acc = (bs->acc << N) | (val & (0xffffffffu >> (32 - N)));
+    bs->acc_bits += N;
+    if (bs->acc_bits >= 32) {
+        bs->acc_bits -= 32;
+        put_word (bs, (uint32_t) (bs->acc >> bs->acc_bits));
     }
 }
 
+/*write all complete bytes of the accumulator to the buffer, leaving at
+  most 7 bits in it */
+void bs_flush (Bit_stream_struc * bs)
+{
+    while (bs->acc_bits >= 8) {
+        bs->acc_bits -= 8;
+        put_byte (bs, (bs->acc >> bs->acc_bits) & 0xff);
+    }
+}
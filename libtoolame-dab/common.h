@@ -45,6 +45,7 @@
 #define         FFT_SIZE                1024
 #define         HAN_SIZE                512
 #define         SCALE_BLOCK             12
+#define         SB_FRAME_SAMPLES        36	/* 3 * SCALE_BLOCK samples of a subband per frame */
 #define         SCALE_RANGE             64
 #define         SCALE                   32768
 #define         CRC16_POLYNOMIAL        0x8005
@@ -86,6 +87,7 @@
 ***********************************************************************/
 
 #include "utils.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #if defined(JACK_INPUT)
@@ -137,6 +139,9 @@ typedef struct
   int nch;			/* num channels: 1 for mono, 2 for stereo */
   int jsbound;			/* first band of joint stereo coding */
   int sblimit;			/* total number of sub bands */
+  int vbrstats[15];		/* VBR: number of frames per bitrate index */
+  int vbrframes;		/* VBR: number of frames encoded */
+  double slot_lag;		/* padding: fraction of a slot carried over */
 }
 frame_info;
 
@@ -154,6 +159,9 @@ typedef struct bit_stream_struc
   int mode;			/* bit stream open in read or write mode */
   int eob;			/* end of buffer index */
   int eobs;			/* end of bit stream flag */
+  int minimum;			/* bytes kept in the buffer when emptying it */
+  uint64_t acc;			/* bits not yet written to buf, in the low */
+  int acc_bits;			/* acc_bits bits of acc, oldest bit first */
   char format;
 
   /* format of file in rd mode (BINARY/ASCII) */
@@ -594,7 +594,7 @@ void main_bit_allocation (double perm_smr[2][SBLIMIT],
   } else {			
     /* do the VBR bit allocation method */
     frame->header->bitrate_index = lower;
-    *adb = available_bits (frame->header, glopts);
+    *adb = available_bits (frame, glopts);
     {
       int brindex;
       int found = FALSE;
@@ -624,7 +624,7 @@ void main_bit_allocation (double perm_smr[2][SBLIMIT],
     }
 
     frame->header->bitrate_index = guessindex;
-    *adb = available_bits (frame->header, glopts);
+    *adb = available_bits (frame, glopts);
 
     /* update the statistics */
     vbrstats[frame->header->bitrate_index]++;
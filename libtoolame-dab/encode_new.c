@@ -1,14 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "common.h"
 #include "options.h"
 #include "bitstream.h"
 #include "availbits.h"
 #include "encode_new.h"
+#include "utils.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 #define NUMTABLES 5
-int vbrstats_new[15] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 
 /* There are really only 9 distinct lines in the allocation tables 
    each member of this table is an index into */
@@ -99,10 +106,8 @@ static double SNR[18] = { 0.00, 7.00, 11.00, 16.00, 20.84,
   80.03, 86.05, 92.01, 98.01
 };
 
-int tablenum=0;
-
 int encode_init(frame_info *frame) {
-  int ws, bsp, br_per_ch, sfrq;
+  int ws, bsp, br_per_ch, sfrq, tablenum;
 
   bsp = frame->header->bitrate_index;
   br_per_ch = bitrate[frame->header->version][bsp] / frame->nch;
@@ -122,6 +127,7 @@ int encode_init(frame_info *frame) {
   } else {                      /* MPEG-2 LSF */
     tablenum = 4;
   }
+  frame->tab_num = tablenum;
   fprintf(stderr,"toolame-dab encode_init(): using tablenum %i with sblimit %i\n",tablenum, table_sblimit[tablenum]);
 
 #define DUMPTABLESx
@@ -176,9 +182,98 @@ int encode_init(frame_info *frame) {
 */
 
 
-void scalefactor_calc_new (double sb_sample[][3][SCALE_BLOCK][SBLIMIT],
+/* The largest absolute value of each of the three groups of SCALE_BLOCK
+   samples of one subband. The maximum does not depend on the order of the
+   comparisons, so all variants give the same result. */
+static void max_abs_scalar (const double x[SB_FRAME_SAMPLES], double cur_max[3])
+{
+  int gr, j;
+  for (gr = 0; gr < 3; gr++) {
+    const double *xg = x + gr * SCALE_BLOCK;
+    double m = fabs (xg[SCALE_BLOCK - 1]);
+    for (j = SCALE_BLOCK - 1; j--;) {
+      double temp = fabs (xg[j]);
+      if (temp > m)
+        m = temp;
+    }
+    cur_max[gr] = m;
+  }
+}
+
+#if defined(__SSE2__)
+static void max_abs_sse2 (const double x[SB_FRAME_SAMPLES], double cur_max[3])
+{
+  const __m128d abs_mask = _mm_castsi128_pd (_mm_set1_epi64x (0x7fffffffffffffffLL));
+  int gr, j;
+  for (gr = 0; gr < 3; gr++) {
+    const double *xg = x + gr * SCALE_BLOCK;
+    __m128d m = _mm_and_pd (_mm_loadu_pd (xg), abs_mask);
+    for (j = 2; j < SCALE_BLOCK; j += 2)
+      m = _mm_max_pd (m, _mm_and_pd (_mm_loadu_pd (xg + j), abs_mask));
+    m = _mm_max_sd (m, _mm_unpackhi_pd (m, m));
+    cur_max[gr] = _mm_cvtsd_f64 (m);
+  }
+}
+
+#if defined(__GNUC__)
+__attribute__((target("avx")))
+static void max_abs_avx (const double x[SB_FRAME_SAMPLES], double cur_max[3])
+{
+  const __m256d abs_mask = _mm256_castsi256_pd (_mm256_set1_epi64x (0x7fffffffffffffffLL));
+  int gr;
+  for (gr = 0; gr < 3; gr++) {
+    const double *xg = x + gr * SCALE_BLOCK;
+    __m256d m = _mm256_and_pd (_mm256_loadu_pd (xg), abs_mask);
+    m = _mm256_max_pd (m, _mm256_and_pd (_mm256_loadu_pd (xg + 4), abs_mask));
+    m = _mm256_max_pd (m, _mm256_and_pd (_mm256_loadu_pd (xg + 8), abs_mask));
+    __m128d h = _mm_max_pd (_mm256_castpd256_pd128 (m), _mm256_extractf128_pd (m, 1));
+    h = _mm_max_sd (h, _mm_unpackhi_pd (h, h));
+    cur_max[gr] = _mm_cvtsd_f64 (h);
+  }
+}
+#endif
+#endif
+
+#if defined(__aarch64__)
+static void max_abs_neon (const double x[SB_FRAME_SAMPLES], double cur_max[3])
+{
+  int gr, j;
+  for (gr = 0; gr < 3; gr++) {
+    const double *xg = x + gr * SCALE_BLOCK;
+    float64x2_t m = vabsq_f64 (vld1q_f64 (xg));
+    for (j = 2; j < SCALE_BLOCK; j += 2)
+      m = vmaxq_f64 (m, vabsq_f64 (vld1q_f64 (xg + j)));
+    cur_max[gr] = vmaxvq_f64 (m);
+  }
+}
+#endif
+
+static void max_abs (int simd, const double x[SB_FRAME_SAMPLES], double cur_max[3])
+{
+  switch (simd) {
+#if defined(__SSE2__)
+#if defined(__GNUC__)
+    case SIMD_AVX:
+      max_abs_avx (x, cur_max);
+      break;
+#endif
+    case SIMD_SSE2:
+      max_abs_sse2 (x, cur_max);
+      break;
+#endif
+#if defined(__aarch64__)
+    case SIMD_NEON:
+      max_abs_neon (x, cur_max);
+      break;
+#endif
+    default:
+      max_abs_scalar (x, cur_max);
+  }
+}
+
+void scalefactor_calc_new (double sb_sample[][SBLIMIT][SB_FRAME_SAMPLES],
                         unsigned int sf_index[][3][SBLIMIT], int nch,
-                        int sblimit)
+                        int sblimit, int simd)
 {
   /* Optimized to use binary search instead of linear scan through the
      scalefactor table; guarantees to find scalefactor in only 5
@@ -186,34 +281,26 @@ void scalefactor_calc_new (double sb_sample[][3][SCALE_BLOCK][SBLIMIT],
      Scalefactors for subbands > sblimit are no longer computed.
      Uses a single sblimit-loop.
      Patrick De Smet Oct 1999.   */
-  int ch, gr;
-  /* Using '--' loops to avoid possible "cmp value + bne/beq" compiler  */
-  /* inefficiencies. Below loops should compile to "bne/beq" only code  */
-  for (ch = nch; ch--;)
-    for (gr = 3; gr--;) {
-      int sb;
-      for (sb = sblimit; sb--;) {
-        int j;
+  int ch, gr, sb;
+  for (ch = 0; ch < nch; ch++)
+    for (sb = 0; sb < sblimit; sb++) {
+      /* Determination of max. over each set of 12 subband samples,
+         which are contiguous in sb_sample */
+      double cur_max[3];
+      max_abs (simd, sb_sample[ch][sb], cur_max);
+
+      for (gr = 0; gr < 3; gr++) {
         unsigned int l;
-        register double temp;
         unsigned int scale_fac;
-        /* Determination of max. over each set of 12 subband samples:  */
-        /* PDS TODO: maybe this could/should ??!! be integrated into   */
-        /* the subband filtering routines?                             */
-        register double cur_max = fabs (sb_sample[ch][gr][SCALE_BLOCK - 1][sb]);
-        for (j = SCALE_BLOCK - 1; j--;) {
-          if ((temp = fabs (sb_sample[ch][gr][j][sb])) > cur_max)
-            cur_max = temp;
-        }
         /* PDS: binary search in the scalefactor table: */
         /* This is the real speed up: */
         for (l = 16, scale_fac = 32; l; l >>= 1) {
-          if (cur_max <= scalefactor[scale_fac])
+          if (cur_max[gr] <= scalefactor[scale_fac])
             scale_fac += l;
           else
             scale_fac -= l;
         }
-        if (cur_max > scalefactor[scale_fac])
+        if (cur_max[gr] > scalefactor[scale_fac])
           scale_fac--;
         sf_index[ch][gr][sb] = scale_fac;
         /* There is a direct way of working out the index, if the 
@@ -223,7 +310,6 @@ void scalefactor_calc_new (double sb_sample[][3][SCALE_BLOCK][SBLIMIT],
              the n'th entry = 2 / (cuberoot(2) ^ n)
            And so using a bit of maths you get:
           index = (int)(log(2.0/cur_max) / LNCUBEROOTTWO);
-          fprintf(stdout,"cur_max %.14lf scalefactorindex %i multiple %.14lf\n",cur_max, scale_fac, scalefactor[scale_fac]);
         */
       }
     }
@@ -234,15 +320,14 @@ double mod (double a)
 }
 
 /* Combine L&R channels into a mono joint stereo channel */
-void combine_LR_new (double sb_sample[2][3][SCALE_BLOCK][SBLIMIT],
-                     double joint_sample[3][SCALE_BLOCK][SBLIMIT], int sblimit) {
-  int sb, sample, gr;
+void combine_LR_new (double sb_sample[2][SBLIMIT][SB_FRAME_SAMPLES],
+                     double joint_sample[SBLIMIT][SB_FRAME_SAMPLES], int sblimit) {
+  int sb, sample;
 
   for (sb = 0; sb < sblimit; ++sb)
-    for (sample = 0; sample < SCALE_BLOCK; ++sample)
-      for (gr = 0; gr < 3; ++gr)
-        joint_sample[gr][sample][sb] =
-          .5 * (sb_sample[0][gr][sample][sb] + sb_sample[1][gr][sample][sb]);
+    for (sample = 0; sample < SB_FRAME_SAMPLES; ++sample)
+      joint_sample[sb][sample] =
+        .5 * (sb_sample[0][sb][sample] + sb_sample[1][sb][sample]);
 }
 
 /* PURPOSE:For each subband, puts the smallest scalefactor of the 3
@@ -391,10 +476,10 @@ void write_bit_alloc (unsigned int bit_alloc[2][SBLIMIT],
   for (sb = 0; sb < sblimit; sb++) {
     if (sb < jsbound) {
       for (ch = 0; ch < ((sb < jsbound) ? nch : 1); ch++)
-        putbits (bs, bit_alloc[ch][sb], nbal[ line[tablenum][sb] ]); // (*alloc)[sb][0].bits);
+        putbits (bs, bit_alloc[ch][sb], nbal[ line[frame->tab_num][sb] ]); // (*alloc)[sb][0].bits);
     }
     else
-      putbits (bs, bit_alloc[0][sb], nbal[ line[tablenum][sb] ]); //(*alloc)[sb][0].bits);
+      putbits (bs, bit_alloc[0][sb], nbal[ line[frame->tab_num][sb] ]); //(*alloc)[sb][0].bits);
   }
 }
 
@@ -476,74 +561,175 @@ static double b[18] = {
  negative number x is equivalent to adding 1 to it.
 
 ************************************************************************/
+/* Quantize the SCALE_BLOCK samples x of one group with the scalefactor sf
+   and the coefficients of step index qnt. Like the scalar code, the
+   variants divide by the scalefactor, and multiply and add without fused
+   multiply-add, so that they give bit-identical codes. The MSB is set by
+   converting the masked step count to an integer, as SSE2 has no 32-bit
+   blend. */
+static void quantize_scalar (const double *x, double sf, int qnt, unsigned int *q)
+{
+  int j;
+  for (j = 0; j < SCALE_BLOCK; j++) {
+    /* scale and quantize FLOATing point sample */
+    double d = x[j] / sf;
+    int sig;
+
+    /* Check that the wrong scale factor hasn't been chosen -
+       which would result in a scaled sample being > 1.0 
+       This error shouldn't ever happen *unless* something went wrong in 
+       scalefactor calc */
+
+    d = d * a[qnt] + b[qnt];
+
+    /* extract MSB N-1 bits from the FLOATing point sample */
+    if (d >= 0)
+      sig = 1;
+    else {
+      sig = 0;
+      d += 1.0;
+    }
+
+    q[j] = (unsigned int) (d * (double)steps2n[qnt]);
+    /* tag the inverted sign bit to sbband at position N */
+    /* The bit inversion is a must for grouping with 3,5,9 steps
+       so it is done for all subbands */
+    if (sig)
+      q[j] |= steps2n[qnt];
+  }
+}
+
+#if defined(__SSE2__)
+static void quantize_sse2 (const double *x, double sf, int qnt, unsigned int *q)
+{
+  const __m128d vsf = _mm_set1_pd (sf);
+  const __m128d va = _mm_set1_pd (a[qnt]);
+  const __m128d vb = _mm_set1_pd (b[qnt]);
+  const __m128d vsteps = _mm_set1_pd ((double)steps2n[qnt]);
+  const __m128d zero = _mm_setzero_pd ();
+  const __m128d one = _mm_set1_pd (1.0);
+  int j;
+  for (j = 0; j < SCALE_BLOCK; j += 2) {
+    __m128d d = _mm_div_pd (_mm_loadu_pd (x + j), vsf);
+    d = _mm_add_pd (_mm_mul_pd (d, va), vb);
+    const __m128d sig = _mm_cmpge_pd (d, zero);
+    d = _mm_add_pd (d, _mm_andnot_pd (sig, one));
+    const __m128i code = _mm_or_si128 (_mm_cvttpd_epi32 (_mm_mul_pd (d, vsteps)),
+                                       _mm_cvttpd_epi32 (_mm_and_pd (sig, vsteps)));
+    _mm_storel_epi64 ((__m128i *) (q + j), code);
+  }
+}
+
+#if defined(__GNUC__)
+__attribute__((target("avx")))
+static void quantize_avx (const double *x, double sf, int qnt, unsigned int *q)
+{
+  const __m256d vsf = _mm256_set1_pd (sf);
+  const __m256d va = _mm256_set1_pd (a[qnt]);
+  const __m256d vb = _mm256_set1_pd (b[qnt]);
+  const __m256d vsteps = _mm256_set1_pd ((double)steps2n[qnt]);
+  const __m256d zero = _mm256_setzero_pd ();
+  const __m256d one = _mm256_set1_pd (1.0);
+  int j;
+  for (j = 0; j < SCALE_BLOCK; j += 4) {
+    __m256d d = _mm256_div_pd (_mm256_loadu_pd (x + j), vsf);
+    d = _mm256_add_pd (_mm256_mul_pd (d, va), vb);
+    const __m256d sig = _mm256_cmp_pd (d, zero, _CMP_GE_OQ);
+    d = _mm256_add_pd (d, _mm256_andnot_pd (sig, one));
+    const __m128i code = _mm_or_si128 (_mm256_cvttpd_epi32 (_mm256_mul_pd (d, vsteps)),
+                                       _mm256_cvttpd_epi32 (_mm256_and_pd (sig, vsteps)));
+    _mm_storeu_si128 ((__m128i *) (q + j), code);
+  }
+}
+#endif
+#endif
+
+#if defined(__aarch64__)
+static void quantize_neon (const double *x, double sf, int qnt, unsigned int *q)
+{
+  const float64x2_t vsf = vdupq_n_f64 (sf);
+  const float64x2_t va = vdupq_n_f64 (a[qnt]);
+  const float64x2_t vb = vdupq_n_f64 (b[qnt]);
+  const float64x2_t vsteps = vdupq_n_f64 ((double)steps2n[qnt]);
+  const float64x2_t zero = vdupq_n_f64 (0.0);
+  const float64x2_t one = vdupq_n_f64 (1.0);
+  int j;
+  for (j = 0; j < SCALE_BLOCK; j += 2) {
+    float64x2_t d = vdivq_f64 (vld1q_f64 (x + j), vsf);
+    d = vaddq_f64 (vmulq_f64 (d, va), vb);
+    const uint64x2_t sig = vcgeq_f64 (d, zero);
+    d = vaddq_f64 (d, vreinterpretq_f64_u64 (vbicq_u64 (vreinterpretq_u64_f64 (one), sig)));
+    const int64x2_t code = vorrq_s64 (vcvtq_s64_f64 (vmulq_f64 (d, vsteps)),
+        vcvtq_s64_f64 (vreinterpretq_f64_u64 (vandq_u64 (sig, vreinterpretq_u64_f64 (vsteps)))));
+    vst1_u32 (q + j, vreinterpret_u32_s32 (vmovn_s64 (code)));
+  }
+}
+#endif
+
+static void quantize (int simd, const double *x, double sf, int qnt, unsigned int *q)
+{
+  switch (simd) {
+#if defined(__SSE2__)
+#if defined(__GNUC__)
+    case SIMD_AVX:
+      quantize_avx (x, sf, qnt, q);
+      break;
+#endif
+    case SIMD_SSE2:
+      quantize_sse2 (x, sf, qnt, q);
+      break;
+#endif
+#if defined(__aarch64__)
+    case SIMD_NEON:
+      quantize_neon (x, sf, qnt, q);
+      break;
+#endif
+    default:
+      quantize_scalar (x, sf, qnt, q);
+  }
+}
+
 void
 subband_quantization_new (unsigned int sf_index[2][3][SBLIMIT],
-                      double sb_samples[2][3][SCALE_BLOCK][SBLIMIT],
+                      double sb_samples[2][SBLIMIT][SB_FRAME_SAMPLES],
                       unsigned int j_scale[3][SBLIMIT],
-                      double j_samps[3][SCALE_BLOCK][SBLIMIT],
+                      double j_samps[SBLIMIT][SB_FRAME_SAMPLES],
                       unsigned int bit_alloc[2][SBLIMIT],
-                      unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT],
-                      frame_info * frame)
+                      unsigned int sbband[2][SBLIMIT][SB_FRAME_SAMPLES],
+                      frame_info * frame, int simd)
 {
-  int sb, j, ch, gr, qnt_coeff_index, sig;
+  int sb, ch, gr, qnt_coeff_index;
   int nch = frame->nch;
   int sblimit = frame->sblimit;
   int jsbound = frame->jsbound;
-  double d;
 
-    for (gr = 0; gr < 3; gr++)
-      for (j = 0; j < SCALE_BLOCK; j++)
-        for (sb = 0; sb < sblimit; sb++)
-          for (ch = 0; ch < ((sb < jsbound) ? nch : 1); ch++)
-
-          if (bit_alloc[ch][sb]) {
-            /* scale and quantize FLOATing point sample */
-            if (nch == 2 && sb >= jsbound)      /* use j-stereo samples */
-              d = j_samps[gr][j][sb] / scalefactor[j_scale[gr][sb]];
-            else
-              d = sb_samples[ch][gr][j][sb] / scalefactor[sf_index[ch][gr][sb]];
-
-            /* Check that the wrong scale factor hasn't been chosen -
-               which would result in a scaled sample being > 1.0 
-               This error shouldn't ever happen *unless* something went wrong in 
-               scalefactor calc
-
-             if (mod (d) > 1.0)
-               fprintf (stderr, "Not scaled properly %d %d %d %d\n", ch, gr, j,
-              sb); 
-            */
-            
-            {
-              /* 'index' indicates which "step line" we are using */
-              int index = line[tablenum][sb];
-              
-              /* Find the "step index" within that line */
-              qnt_coeff_index = step_index[index][bit_alloc[ch][sb]];
-            }
-            d = d * a[qnt_coeff_index] + b[qnt_coeff_index];
-
-            /* extract MSB N-1 bits from the FLOATing point sample */
-            if (d >= 0)
-              sig = 1;
-            else {
-              sig = 0;
-              d += 1.0;
-            }
+  for (sb = 0; sb < sblimit; sb++)
+    for (ch = 0; ch < ((sb < jsbound) ? nch : 1); ch++)
+      if (bit_alloc[ch][sb]) {
+        {
+          /* 'index' indicates which "step line" we are using */
+          int index = line[frame->tab_num][sb];
+
+          /* Find the "step index" within that line */
+          qnt_coeff_index = step_index[index][bit_alloc[ch][sb]];
+        }
 
-            sbband[ch][gr][j][sb] = (unsigned int) (d * (double)steps2n[qnt_coeff_index]);
-            /* tag the inverted sign bit to sbband at position N */
-            /* The bit inversion is a must for grouping with 3,5,9 steps
-               so it is done for all subbands */
-            if (sig)
-              sbband[ch][gr][j][sb] |= steps2n[qnt_coeff_index];
-          }
+        for (gr = 0; gr < 3; gr++) {
+          if (nch == 2 && sb >= jsbound)      /* use j-stereo samples */
+            quantize (simd, &j_samps[sb][gr * SCALE_BLOCK],
+                      scalefactor[j_scale[gr][sb]], qnt_coeff_index,
+                      &sbband[ch][sb][gr * SCALE_BLOCK]);
+          else
+            quantize (simd, &sb_samples[ch][sb][gr * SCALE_BLOCK],
+                      scalefactor[sf_index[ch][gr][sb]], qnt_coeff_index,
+                      &sbband[ch][sb][gr * SCALE_BLOCK]);
+        }
+      }
 
   /* Set everything above the sblimit to 0 */
   for (ch = 0; ch < nch; ch++)
-    for (gr = 0; gr < 3; gr++)
-      for (sb = 0; sb < SCALE_BLOCK; sb++)
-        for (j = sblimit; j < SBLIMIT; j++)
-          sbband[ch][gr][sb][j] = 0;
+    for (sb = sblimit; sb < SBLIMIT; sb++)
+      memset (sbband[ch][sb], 0, sizeof (sbband[ch][sb]));
 }
 
 /************************************************************************
@@ -557,7 +743,7 @@ subband_quantization_new (unsigned int sf_index[2][3][SBLIMIT],
  that are not a power of 2.
 
 ***********************************************************************/
-void write_samples_new (unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT],
+void write_samples_new (unsigned int sbband[2][SBLIMIT][SB_FRAME_SAMPLES],
                       unsigned int bit_alloc[2][SBLIMIT],
                       frame_info * frame, Bit_stream_struc * bs)
 {
@@ -573,13 +759,13 @@ void write_samples_new (unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT],
         for (ch = 0; ch < ((sb < jsbound) ? nch : 1); ch++)
 
           if (bit_alloc[ch][sb]) {
-            int thisline = line[tablenum][sb];
+            int thisline = line[frame->tab_num][sb];
             int thisstep_index = step_index[thisline][bit_alloc[ch][sb]];
             /* Check how many samples per codeword */
             if (group[thisstep_index] == 3) {
               /* Going to send 1 sample per codeword -> 3 samples */
               for (x = 0; x < 3; x++) {
-                putbits (bs, sbband[ch][gr][j + x][sb], bits[thisstep_index]); 
+                putbits (bs, sbband[ch][sb][gr * SCALE_BLOCK + j + x], bits[thisstep_index]);
               }
             } else {
               /* ISO11172 Sec C.1.5.2.8 
@@ -589,9 +775,8 @@ void write_samples_new (unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT],
                  V = (steps*steps)*z + steps*y +x
               */
               y = steps[thisstep_index];
-              temp =
-                sbband[ch][gr][j][sb] + sbband[ch][gr][j + 1][sb] * y +
-                sbband[ch][gr][j + 2][sb] * y * y;
+              const unsigned int *s = &sbband[ch][sb][gr * SCALE_BLOCK + j];
+              temp = s[0] + s[1] * y + s[2] * y * y;
               putbits (bs, temp, bits[thisstep_index]); 
             }
           }
@@ -660,17 +845,17 @@ int bits_for_nonoise_new (double SMR[2][SBLIMIT],
      channels in each subband. If we're above the jsbound, then pretend we only
      have one channel */
   for (sb = 0; sb < jsbound; ++sb)
-    bbal += nch * nbal[ line[tablenum][sb] ]; //(*alloc)[sb][0].bits;
+    bbal += nch * nbal[ line[frame->tab_num][sb] ]; //(*alloc)[sb][0].bits;
   for (sb = jsbound; sb < sblimit; ++sb)
-    bbal += nbal[ line[tablenum][sb] ]; //(*alloc)[sb][0].bits;
+    bbal += nbal[ line[frame->tab_num][sb] ]; //(*alloc)[sb][0].bits;
   req_bits = banc + bbal + berr;
 
   for (sb = 0; sb < sblimit; ++sb)
     for (ch = 0; ch < ((sb < jsbound) ? nch : 1); ++ch) {
-      int thisline = line[tablenum][sb];
+      int thisline = line[frame->tab_num][sb];
       
       /* How many possible steps are there to choose from ? */
-      maxAlloc = (1 << nbal[ line[tablenum][sb] ]) -1; //(*alloc)[sb][0].bits) - 1;
+      maxAlloc = (1 << nbal[ line[frame->tab_num][sb] ]) -1; //(*alloc)[sb][0].bits) - 1;
       sel_bits = sc_bits = smp_bits = 0;
       /* Keep choosing the next number of steps (and hence our SNR value)
          until we have the required MNR value */
@@ -760,17 +945,15 @@ void main_bit_allocation_new (double SMR[2][SBLIMIT],
      /* 32 */ {10, 14}}
   };
 
-  static int init = 0;
-  static int lower = 10, upper = 10;
-  static int bitrateindextobits[15] =
+  int lower = 10, upper = 10;
+  int bitrateindextobits[15] =
     { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
   int guessindex = 0;
 
-  if (init == 0) {
+  if (glopts->vbr == TRUE) {
     int nch = 2;
     int sfreq;
     frame_header *header = frame->header;
-    init++;
     if (header->version == 0) {
       /* LSF: so can use any bitrate index from 1->15 */
       lower = 1;
@@ -782,7 +965,7 @@ void main_bit_allocation_new (double SMR[2][SBLIMIT],
       lower = vbrlimits[nch-1][sfreq][0];
       upper = vbrlimits[nch-1][sfreq][1];
     }
-    if (glopts->verbosity > 2)
+    if (glopts->verbosity > 2 && frame->vbrframes == 0)
       fprintf (stderr, "VBR bitrate index limits [%i -> %i]\n", lower, upper);
 
     {                           
@@ -821,11 +1004,12 @@ void main_bit_allocation_new (double SMR[2][SBLIMIT],
   /* decide on which bit allocation method to use */
   if (glopts->vbr == FALSE) {
     /* Just do the old bit allocation method */
-    noisy_sbs = a_bit_allocation_new (SMR, scfsi, bit_alloc, adb, frame);
+    noisy_sbs = a_bit_allocation_new (SMR, scfsi, bit_alloc, adb, frame,
+                                      glopts->fast_bit_alloc);
   } else {                      
     /* do the VBR bit allocation method */
     frame->header->bitrate_index = lower;
-    *adb = available_bits (frame->header, glopts);
+    *adb = available_bits (frame, glopts);
     {
       int brindex;
       int found = FALSE;
@@ -855,18 +1039,17 @@ void main_bit_allocation_new (double SMR[2][SBLIMIT],
     }
 
     frame->header->bitrate_index = guessindex;
-    *adb = available_bits (frame->header, glopts);
+    *adb = available_bits (frame, glopts);
 
     /* update the statistics */
-    vbrstats_new[frame->header->bitrate_index]++;
+    frame->vbrstats[frame->header->bitrate_index]++;
 
     if (glopts->verbosity > 2) {
       /* print out the VBR stats every 1000th frame */
-      static int count = 0;
       int i;
-      if ((count++ % 1000) == 0) {
+      if ((frame->vbrframes++ % 1000) == 0) {
         for (i = 1; i < 15; i++)
-          fprintf (stderr, "%4i ", vbrstats_new[i]);
+          fprintf (stderr, "%4i ", frame->vbrstats[i]);
         fprintf (stderr, "\n");
       }
 
@@ -944,21 +1127,15 @@ int VBR_bit_allocation_new (double SMR[2][SBLIMIT],
   int sblimit = frame->sblimit;
   int jsbound = frame->jsbound;
   //al_table *alloc = frame->alloc;
-  static char init = 0;
-  static int banc = 32, berr = 0;
-  static int sfsPerScfsi[] = { 3, 2, 1, 2 };    /* lookup # sfs per scfsi */
+  const int banc = 32;
+  const int berr = frame->header->error_protection ? 16 : 0; /* added 92-08-11 shn */
+  static const int sfsPerScfsi[] = { 3, 2, 1, 2 };    /* lookup # sfs per scfsi */
 
   int thisstep_index;
 
-  if (!init) {
-    init = 1;
-    if (frame->header->error_protection)
-      berr = 16;                /* added 92-08-11 shn */
-  }
-
   /* No need to worry about jsbound here as JS is disabled for VBR mode */
   for (sb = 0; sb < sblimit; sb++)
-    bbal += nch * nbal[ line[tablenum][sb] ]; 
+    bbal += nch * nbal[ line[frame->tab_num][sb] ]; 
   *adb -= bbal + berr + banc;
   ad = *adb;
 
@@ -975,7 +1152,7 @@ int VBR_bit_allocation_new (double SMR[2][SBLIMIT],
     VBR_maxmnr_new (mnr, used, sblimit, nch, &min_sb, &min_ch, glopts);
 
     if (min_sb > -1) {          /* there was something to find */
-      int thisline = line[tablenum][min_sb]; {
+      int thisline = line[frame->tab_num][min_sb]; {
         /* find increase in bit allocation in subband [min] */
         int nextstep_index = step_index[thisline][bit_alloc[min_ch][min_sb]+1];                                   
         increment = SCALE_BLOCK * group[nextstep_index] * bits[nextstep_index];
@@ -1013,7 +1190,7 @@ int VBR_bit_allocation_new (double SMR[2][SBLIMIT],
         thisstep_index = step_index[thisline][ba];
         mnr[min_ch][min_sb] = SNR[thisstep_index] - SMR[min_ch][min_sb];
         /* Check if this min_sb subband has been fully allocated max bits */
-        if (ba >= (1 << nbal[ line[tablenum][min_sb] ]) -1 ) //(*alloc)[min_sb][0].bits) - 1)
+        if (ba >= (1 << nbal[ line[frame->tab_num][min_sb] ]) -1 ) //(*alloc)[min_sb][0].bits) - 1)
           used[min_ch][min_sb] = 2;     /* don't let this sb get any more bits */
       } else
         used[min_ch][min_sb] = 2;       /* can't increase this alloc */
@@ -1075,35 +1252,110 @@ void maxmnr_new (double mnr[2][SBLIMIT], char used[2][SBLIMIT], int sblimit,
         *min_ch = ch;
       }
 }
+
+/************************************************************************
+*
+* mnr_queue
+*
+* PURPOSE: Finds the same subband as maxmnr_new() without scanning all of
+* them in every iteration of the bit allocation.
+*
+* SEMANTICS: The subbands are the leaves of a tournament tree, a binary
+* heap in which every node holds the smaller of its two children. They are
+* ordered by MNR, and then by channel and subband, which is the order in
+* which maxmnr_new() scans them. The root is therefore the subband
+* maxmnr_new() would return, and the allocation is identical. Unavailable
+* subbands get an infinite MNR. After each allocation step, only the path
+* from the one or two subbands whose MNR changed to the root is updated,
+* which takes 6 comparisons without branches instead of a scan of up to
+* 64 subbands.
+*
+************************************************************************/
+
+/* Entries are ch * SBLIMIT + sb, leaf e is node 2 * SBLIMIT + e */
+#define MNR_QUEUE_LEAVES (2 * SBLIMIT)
+
+static void mnr_queue_set (mnr_queue * queue, double mnr[2][SBLIMIT],
+                           char used[2][SBLIMIT], int sb, int ch)
+{
+  queue->key[ch * SBLIMIT + sb] = used[ch][sb] == 2 ? HUGE_VAL : mnr[ch][sb];
+}
+
+/* The left child holds the lower entries, and wins ties */
+static int mnr_queue_winner (const mnr_queue * queue, int node)
+{
+  int l = queue->node[2 * node], r = queue->node[2 * node + 1];
+  return queue->key[r] < queue->key[l] ? r : l;
+}
+
+void mnr_queue_init (mnr_queue * queue, double mnr[2][SBLIMIT],
+                     char used[2][SBLIMIT], int sblimit, int nch)
+{
+  int sb, ch, e, n;
+
+  for (e = 0; e < MNR_QUEUE_LEAVES; e++) {
+    queue->key[e] = HUGE_VAL;
+    queue->node[MNR_QUEUE_LEAVES + e] = e;
+  }
+  for (ch = 0; ch < nch; ++ch)
+    for (sb = 0; sb < sblimit; sb++)
+      mnr_queue_set (queue, mnr, used, sb, ch);
+  for (n = MNR_QUEUE_LEAVES - 1; n > 0; n--)
+    queue->node[n] = mnr_queue_winner (queue, n);
+}
+
+/* Update the subband after a change of its MNR or of its availability */
+void mnr_queue_update (mnr_queue * queue, double mnr[2][SBLIMIT],
+                       char used[2][SBLIMIT], int sb, int ch)
+{
+  int n;
+
+  mnr_queue_set (queue, mnr, used, sb, ch);
+  for (n = (MNR_QUEUE_LEAVES + ch * SBLIMIT + sb) / 2; n > 0; n /= 2)
+    queue->node[n] = mnr_queue_winner (queue, n);
+}
+
+/* Same result as maxmnr_new() */
+void mnr_queue_min (const mnr_queue * queue, int *min_sb, int *min_ch)
+{
+  int e = queue->node[1];
+
+  /* maxmnr_new() ignores the MNRs above its start value, and the
+     unavailable subbands have an infinite one */
+  if (queue->key[e] < 999999.0) {
+    *min_sb = e % SBLIMIT;
+    *min_ch = e / SBLIMIT;
+  }
+  else {
+    *min_sb = -1;
+    *min_ch = -1;
+  }
+}
+
 int a_bit_allocation_new (double SMR[2][SBLIMIT],
                             unsigned int scfsi[2][SBLIMIT],
                             unsigned int bit_alloc[2][SBLIMIT], int *adb,
-                            frame_info * frame)
+                            frame_info * frame, int fast)
 {
   int sb, min_ch, min_sb, oth_ch, ch, increment, scale, seli, ba;
   int bspl, bscf, bsel, ad, bbal = 0;
   double mnr[2][SBLIMIT];
   char used[2][SBLIMIT];
+  mnr_queue queue;
   int nch = frame->nch;
   int sblimit = frame->sblimit;
   int jsbound = frame->jsbound;
   //al_table *alloc = frame->alloc;
-  static char init = 0;
-  static int banc = 32, berr = 0;
-  static int sfsPerScfsi[] = { 3, 2, 1, 2 };    /* lookup # sfs per scfsi */
+  const int banc = 32;
+  const int berr = frame->header->error_protection ? 16 : 0; /* added 92-08-11 shn */
+  static const int sfsPerScfsi[] = { 3, 2, 1, 2 };    /* lookup # sfs per scfsi */
 
   int thisstep_index;
 
-  if (!init) {
-    init = 1;
-    if (frame->header->error_protection)
-      berr = 16;                /* added 92-08-11 shn */
-  }
-
   for (sb = 0; sb < jsbound; sb++)
-    bbal += nch * nbal[ line[tablenum][sb] ]; //(*alloc)[sb][0].bits;
+    bbal += nch * nbal[ line[frame->tab_num][sb] ]; //(*alloc)[sb][0].bits;
   for (sb = jsbound; sb < sblimit; sb++)
-    bbal += nbal[ line[tablenum][sb] ]; //(*alloc)[sb][0].bits;
+    bbal += nbal[ line[frame->tab_num][sb] ]; //(*alloc)[sb][0].bits;
   *adb -= bbal + berr + banc;
   ad = *adb;
 
@@ -1115,12 +1367,18 @@ int a_bit_allocation_new (double SMR[2][SBLIMIT],
     }
   bspl = bscf = bsel = 0;
 
+  if (fast)
+    mnr_queue_init (&queue, mnr, used, sblimit, nch);
+
   do {
     /* locate the subband with minimum SMR */
-    maxmnr_new (mnr, used, sblimit, nch, &min_sb, &min_ch);
+    if (fast)
+      mnr_queue_min (&queue, &min_sb, &min_ch);
+    else
+      maxmnr_new (mnr, used, sblimit, nch, &min_sb, &min_ch);
 
     if (min_sb > -1) {          /* there was something to find */
-      int thisline = line[tablenum][min_sb]; {
+      int thisline = line[frame->tab_num][min_sb]; {
         /* find increase in bit allocation in subband [min] */
         int nextstep_index = step_index[thisline][bit_alloc[min_ch][min_sb]+1];                                   
         increment = SCALE_BLOCK * group[nextstep_index] * bits[nextstep_index];
@@ -1158,11 +1416,14 @@ int a_bit_allocation_new (double SMR[2][SBLIMIT],
         thisstep_index = step_index[thisline][ba];
         mnr[min_ch][min_sb] = SNR[thisstep_index] - SMR[min_ch][min_sb];
         /* Check if this min_sb subband has been fully allocated max bits */
-        if (ba >= (1 << nbal[ line[tablenum][min_sb] ]) -1 ) //(*alloc)[min_sb][0].bits) - 1)
+        if (ba >= (1 << nbal[ line[frame->tab_num][min_sb] ]) -1 ) //(*alloc)[min_sb][0].bits) - 1)
           used[min_ch][min_sb] = 2;     /* don't let this sb get any more bits */
       } else
         used[min_ch][min_sb] = 2;       /* can't increase this alloc */
 
+      if (fast)
+        mnr_queue_update (&queue, mnr, used, min_sb, min_ch);
+
       if (min_sb >= jsbound && nch == 2) {
         /* above jsbound, alloc applies L+R */
         ba = bit_alloc[oth_ch][min_sb] = bit_alloc[min_ch][min_sb];
@@ -1170,8 +1431,9 @@ int a_bit_allocation_new (double SMR[2][SBLIMIT],
         thisstep_index = step_index[thisline][ba];
         mnr[oth_ch][min_sb] = SNR[thisstep_index] - SMR[oth_ch][min_sb];
         //mnr[oth_ch][min_sb] = SNR[(*alloc)[min_sb][ba].quant + 1] - SMR[oth_ch][min_sb];
+        if (fast)
+          mnr_queue_update (&queue, mnr, used, min_sb, oth_ch);
       }
-
     }
   }
   while (min_sb > -1);          /* until could find no channel */
@@ -1,12 +1,15 @@
 int encode_init(frame_info *frame);
-void scalefactor_calc_new (double sb_sample[][3][SCALE_BLOCK][SBLIMIT],
+/* The subband samples are stored as [ch][sb][gr * SCALE_BLOCK + j], so that
+   the 36 samples of a subband are contiguous. simd is one of the SIMD_*
+   variants. */
+void scalefactor_calc_new (double sb_sample[][SBLIMIT][SB_FRAME_SAMPLES],
 			   unsigned int scalar[][3][SBLIMIT], int nch,
-			   int sblimit);
+			   int sblimit, int simd);
 
 double mod (double a);
 
-void combine_LR_new (double sb_sample[2][3][SCALE_BLOCK][SBLIMIT],
-		     double joint_sample[3][SCALE_BLOCK][SBLIMIT], int sblimit);
+void combine_LR_new (double sb_sample[2][SBLIMIT][SB_FRAME_SAMPLES],
+		     double joint_sample[SBLIMIT][SB_FRAME_SAMPLES], int sblimit);
 
 void find_sf_max (unsigned int sf_index[2][3][SBLIMIT], frame_info * frame,
 		  double sf_max[2][SBLIMIT]);
@@ -26,14 +29,14 @@ void write_scalefactors (unsigned int bit_alloc[2][SBLIMIT],
 			 Bit_stream_struc * bs);
 
 void subband_quantization_new (unsigned int sf_index[2][3][SBLIMIT],
-		      double sb_samples[2][3][SCALE_BLOCK][SBLIMIT],
+		      double sb_samples[2][SBLIMIT][SB_FRAME_SAMPLES],
 		      unsigned int j_scale[3][SBLIMIT],
-		      double j_samps[3][SCALE_BLOCK][SBLIMIT],
+		      double j_samps[SBLIMIT][SB_FRAME_SAMPLES],
 		      unsigned int bit_alloc[2][SBLIMIT],
-		      unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT],
-			  frame_info * frame);
+		      unsigned int sbband[2][SBLIMIT][SB_FRAME_SAMPLES],
+			  frame_info * frame, int simd);
 
-void write_samples_new (unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT],
+void write_samples_new (unsigned int sbband[2][SBLIMIT][SB_FRAME_SAMPLES],
 		      unsigned int bit_alloc[2][SBLIMIT],
 			frame_info * frame, Bit_stream_struc * bs);
 
@@ -57,7 +60,25 @@ VBR_bit_allocation_new (double SMR[2][SBLIMIT],
 		    frame_info * frame, options * glopts);
 void maxmnr_new (double mnr[2][SBLIMIT], char used[2][SBLIMIT], int sblimit,
 	     int nch, int *min_sb, int *min_ch);
+
+/* The MNRs of the subbands in a tournament tree, to find the one
+   maxmnr_new() would choose without scanning all of them */
+typedef struct
+{
+  double key[2 * SBLIMIT];	/* MNR of ch * SBLIMIT + sb, or HUGE_VAL */
+  int node[4 * SBLIMIT];	/* node n holds the winner of 2n and 2n + 1 */
+}
+mnr_queue;
+
+void mnr_queue_init (mnr_queue * queue, double mnr[2][SBLIMIT],
+		     char used[2][SBLIMIT], int sblimit, int nch);
+void mnr_queue_update (mnr_queue * queue, double mnr[2][SBLIMIT],
+		       char used[2][SBLIMIT], int sb, int ch);
+void mnr_queue_min (const mnr_queue * queue, int *min_sb, int *min_ch);
+
+/* With fast set, the subband with the smallest MNR is taken from a
+   mnr_queue instead of maxmnr_new(), with the same result */
 int a_bit_allocation_new (double SMR[2][SBLIMIT],
 		      unsigned int scfsi[2][SBLIMIT],
 		      unsigned int bit_alloc[2][SBLIMIT], int *adb,
-		      frame_info * frame);
+		      frame_info * frame, int fast);
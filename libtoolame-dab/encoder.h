@@ -33,6 +33,7 @@
 #define STOP            -100
 #define POWERNORM       90.3090	/* = 20 * log10(32768) to normalize */
 /* max output power to 96 dB per spec */
+#define DBTAB           1000	/* size of the table to fudge the adding of dB */
 
 /* Psychoacoustic Model 2 Definitions */
 
@@ -1,8 +1,25 @@
 
-//void fft (FLOAT[BLKSIZE], FLOAT[BLKSIZE], FLOAT[BLKSIZE], FLOAT[BLKSIZE], int);
+#define FFT_N 1024
 
-void psycho_2_fft (FLOAT * x_real, FLOAT * energy, FLOAT * phi);
-void psycho_1_fft (FLOAT * x_real, FLOAT * energy, int N);
+/* Precomputed tables of the FFT of FFT_N real samples */
+typedef struct fft_plan_struct {
+  /* Twiddles of the complex FFT, the stage with butterflies h apart
+     uses tw[h] to tw[2h - 1] */
+  double tw_re[FFT_N / 2], tw_im[FFT_N / 2];
+  /* Twiddles to combine the complex FFT into the real one */
+  double split_re[FFT_N / 2 + 1], split_im[FFT_N / 2 + 1];
+  short bitrev[FFT_N / 2];
+  int simd;			/* SIMD_* variant, they all give identical results */
+} fft_plan;
+
+void fft_init (fft_plan * plan);
+
+/* Spectrum of x, bins 0 to FFT_N / 2. x is not modified. */
+void fft_real (const fft_plan * plan, const FLOAT x[FFT_N],
+	       FLOAT re[FFT_N / 2 + 1], FLOAT im[FFT_N / 2 + 1]);
+
+void psycho_2_fft (const fft_plan * plan, FLOAT * x_real, FLOAT * energy, FLOAT * phi);
+void psycho_1_fft (const fft_plan * plan, FLOAT * x_real, FLOAT * energy);
 
 
 void atan_table_init(void);
@@ -19,9 +19,9 @@ typedef struct
 				          used for VBR in LAME */
   int verbosity;                /* 2 by default. 0 is no output at all */
   int show_level; /* 1=show the sox-like audio level measurement */
+  int fast_bit_alloc;		/* FALSE  find the subband with the lowest MNR with a tree */
 }
 options;
 
-extern options glopts;
 #endif
 
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <math.h>
 #include "common.h"
+#include "mem.h"
 #include "ath.h"
 #include "encoder.h"
 #include "psycho_0.h"
@@ -24,29 +25,36 @@
    Feel free to make any sort of generic change you want. Add or subtract numbers, take
    logs, whatever. Fiddle with the numbers until we get a good SMR output */
 
-void psycho_0(double SMR[2][SBLIMIT], int nch, unsigned int scalar[2][3][SBLIMIT], FLOAT sfreq) {
-  int ch, sb, gr;
-  int minscaleindex[2][SBLIMIT]; /* Smaller scale indexes mean bigger scalefactors */
-  static FLOAT ath_min[SBLIMIT];
-  int i;
-  static int init=0;
+psycho_0_mem *psycho_0_init(FLOAT sfreq) {
+  psycho_0_mem *mem;
+  FLOAT freqperline = sfreq/1024.0;
+  int sb, i;
+
+  mem = (psycho_0_mem *) mem_alloc (sizeof (psycho_0_mem), "psycho_0_mem");
 
-  if (!init) {
-    FLOAT freqperline = sfreq/1024.0;
-    for (sb=0;sb<SBLIMIT;sb++) {
-      ath_min[sb] = 1000; /* set it huge */
-    }
-    
-    /* Find the minimum ATH in each subband */
-    for (i=0;i<512;i++) {
-      FLOAT thisfreq = i * freqperline;
-      FLOAT ath_val = ATH_dB(thisfreq, 0);
-      if (ath_val < ath_min[i>>4])
-	ath_min[i>>4] = ath_val;
-    }
-    init++;
+  for (sb=0;sb<SBLIMIT;sb++) {
+    mem->ath_min[sb] = 1000; /* set it huge */
   }
 
+  /* Find the minimum ATH in each subband */
+  for (i=0;i<512;i++) {
+    FLOAT thisfreq = i * freqperline;
+    FLOAT ath_val = ATH_dB(thisfreq, 0);
+    if (ath_val < mem->ath_min[i>>4])
+      mem->ath_min[i>>4] = ath_val;
+  }
+
+  return mem;
+}
+
+void psycho_0_deinit(psycho_0_mem **mem) {
+  mem_free ((void **) mem);
+}
+
+void psycho_0(psycho_0_mem *mem, double SMR[2][SBLIMIT], int nch, unsigned int scalar[2][3][SBLIMIT]) {
+  int ch, sb, gr;
+  int minscaleindex[2][SBLIMIT]; /* Smaller scale indexes mean bigger scalefactors */
+
   /* Find the minimum scalefactor index for each ch/sb */
   for (ch=0;ch<nch;ch++) 
       for (sb=0;sb<SBLIMIT;sb++) 
@@ -65,5 +73,5 @@ void psycho_0(double SMR[2][SBLIMIT], int nch, unsigned int scalar[2][3][SBLIMIT
      MFC Mar 03 */
   for (ch=0;ch<nch;ch++)
     for (sb=0;sb<SBLIMIT;sb++)
-      SMR[ch][sb] = 2.0 * (30.0 - minscaleindex[ch][sb]) - ath_min[sb];
+      SMR[ch][sb] = 2.0 * (30.0 - minscaleindex[ch][sb]) - mem->ath_min[sb];
 }
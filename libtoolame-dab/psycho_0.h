@@ -1 +1,7 @@
-void psycho_0(double SMR[2][SBLIMIT], int nch, unsigned int scalar[2][3][SBLIMIT], FLOAT sfreq);
+typedef struct psycho_0_mem_struct {
+  FLOAT ath_min[SBLIMIT];
+} psycho_0_mem;
+
+psycho_0_mem *psycho_0_init(FLOAT sfreq);
+void psycho_0_deinit(psycho_0_mem **mem);
+void psycho_0(psycho_0_mem *mem, double SMR[2][SBLIMIT], int nch, unsigned int scalar[2][3][SBLIMIT]);
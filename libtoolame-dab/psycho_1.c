@@ -7,9 +7,6 @@
 #include "psycho_1.h"
 #include "psycho_1_priv.h"
 
-#define DBTAB 1000
-double dbtable[DBTAB];
-
 /**********************************************************************
 
         This module implements the psychoacoustic model I for the
@@ -19,41 +16,70 @@ double dbtable[DBTAB];
 
 **********************************************************************/
 
-void psycho_1 (short buffer[2][1152], double scale[2][SBLIMIT],
+psycho_1_mem *psycho_1_init (frame_info * frame)
+{
+  frame_header *header = frame->header;
+  psycho_1_mem *mem;
+  double sqrt_8_over_3;
+  int i;
+
+  mem = (psycho_1_mem *) mem_alloc (sizeof (psycho_1_mem), "psycho_1_mem");
+  fft_init (&mem->fft);
+  mem->off[0] = mem->off[1] = 256;
+
+  /* call functions for critical boundaries, freq. */
+  /* bands, bark values, and mapping */
+  mem->fft_buf = (D1408 *) mem_alloc ((long) sizeof (D1408) * 2, "fft_buf");
+  mem->power = (mask_ptr) mem_alloc (sizeof (mask) * HAN_SIZE, "power");
+  if (header->version == MPEG_AUDIO_ID) {
+    psycho_1_read_cbound (mem, header->lay, header->sampling_frequency);
+    psycho_1_read_freq_band (mem, &mem->ltg, header->lay, header->sampling_frequency);
+  } else {
+    psycho_1_read_cbound (mem, header->lay, header->sampling_frequency + 4);
+    psycho_1_read_freq_band (mem, &mem->ltg, header->lay, header->sampling_frequency + 4);
+  }
+  psycho_1_make_map (mem, mem->power, mem->ltg);
+
+  psycho_1_init_add_db (mem);		/* create the add_db table */
+
+  /* calculate window function for the Fourier transform */
+  sqrt_8_over_3 = pow (8.0 / 3.0, 0.5);
+  for (i = 0; i < FFT_SIZE; i++) {
+    /* Hann window formula */
+    mem->window[i] =
+      sqrt_8_over_3 * 0.5 * (1 - cos (2.0 * PI * i / (FFT_SIZE))) / FFT_SIZE;
+  }
+
+  return mem;
+}
+
+void psycho_1_deinit (psycho_1_mem ** mem)
+{
+  if (*mem == NULL)
+    return;
+
+  mem_free ((void **) &(*mem)->fft_buf);
+  mem_free ((void **) &(*mem)->power);
+  mem_free ((void **) &(*mem)->ltg);
+  mem_free ((void **) &(*mem)->cbound);
+  mem_free ((void **) mem);
+}
+
+void psycho_1 (psycho_1_mem * mem, short buffer[2][1152], double scale[2][SBLIMIT],
 	       double ltmin[2][SBLIMIT], frame_info * frame)
 {
   frame_header *header = frame->header;
   int nch = frame->nch;
   int sblimit = frame->sblimit;
   int k, i, tone = 0, noise = 0;
-  static char init = 0;
-  static int off[2] = { 256, 256 };
+  int *off = mem->off;
   double sample[FFT_SIZE];
   double spike[2][SBLIMIT];
-  static D1408 *fft_buf;
-  static mask_ptr power;
-  static g_ptr ltg;
+  D1408 *fft_buf = mem->fft_buf;
+  mask_ptr power = mem->power;
+  g_ptr ltg = mem->ltg;
   FLOAT energy[FFT_SIZE];
 
-  /* call functions for critical boundaries, freq. */
-  if (!init) {			/* bands, bark values, and mapping */
-    fft_buf = (D1408 *) mem_alloc ((long) sizeof (D1408) * 2, "fft_buf");
-    power = (mask_ptr) mem_alloc (sizeof (mask) * HAN_SIZE, "power");
-    if (header->version == MPEG_AUDIO_ID) {
-      psycho_1_read_cbound (header->lay, header->sampling_frequency);
-      psycho_1_read_freq_band (&ltg, header->lay, header->sampling_frequency);
-    } else {
-      psycho_1_read_cbound (header->lay, header->sampling_frequency + 4);
-      psycho_1_read_freq_band (&ltg, header->lay, header->sampling_frequency + 4);
-    }
-    psycho_1_make_map (power, ltg);
-    for (i = 0; i < 1408; i++)
-      fft_buf[0][i] = fft_buf[1][i] = 0;
-
-    psycho_1_init_add_db ();		/* create the add_db table */
-
-    init = 1;
-  }
   for (k = 0; k < nch; k++) {
     /* check pcm input for 3 blocks of 384 samples */
     /* sami's speedup, added in 02j
@@ -73,25 +99,20 @@ void psycho_1 (short buffer[2][1152], double scale[2][SBLIMIT],
     off[k] += 1152;
     off[k] %= 1408;
 
-    psycho_1_hann_fft_pickmax (sample, power, &spike[k][0], energy);
-    psycho_1_tonal_label (power, &tone);
-    psycho_1_noise_label (power, &noise, ltg, energy);
+    psycho_1_hann_fft_pickmax (mem, sample, power, &spike[k][0], energy);
+    psycho_1_tonal_label (mem, power, &tone);
+    psycho_1_noise_label (mem, power, &noise, ltg, energy);
     //psycho_1_dump(power, &tone, &noise) ;
     psycho_1_subsampling (power, ltg, &tone, &noise);
-    psycho_1_threshold (power, ltg, &tone, &noise,
+    psycho_1_threshold (mem, power, ltg, &tone, &noise,
 	       bitrate[header->version][header->bitrate_index] / nch);
-    psycho_1_minimum_mask (ltg, &ltmin[k][0], sblimit);
+    psycho_1_minimum_mask (mem, ltg, &ltmin[k][0], sblimit);
     psycho_1_smr (&ltmin[k][0], &spike[k][0], &scale[k][0], sblimit);
   }
 
 }
 
-
-int crit_band;
-int *cbound;
-int sub_size;
-
-void psycho_1_read_cbound (int lay, int freq)	
+void psycho_1_read_cbound (psycho_1_mem * mem, int lay, int freq)	
 /* this function reads in critical  band boundaries */
 {
 
@@ -109,12 +130,12 @@ void psycho_1_read_cbound (int lay, int freq)
     return;
   }
 
-  crit_band = SecondCriticalBand[freq][0];
-  cbound = (int *) mem_alloc (sizeof (int) * crit_band, "cbound");
-  for (i = 0; i < crit_band; i++) {
+  mem->crit_band = SecondCriticalBand[freq][0];
+  mem->cbound = (int *) mem_alloc (sizeof (int) * mem->crit_band, "cbound");
+  for (i = 0; i < mem->crit_band; i++) {
     k = SecondCriticalBand[freq][i + 1];
     if (k != 0) {
-      cbound[i] = k;
+      mem->cbound[i] = k;
     } else {
       printf ("Internal error (read_cbound())\n");
       return;
@@ -122,7 +143,8 @@ void psycho_1_read_cbound (int lay, int freq)
   }
 }
 
-void psycho_1_read_freq_band (ltg, lay, freq)	/* this function reads in   */
+void psycho_1_read_freq_band (mem, ltg, lay, freq)	/* this function reads in   */
+     psycho_1_mem *mem;
      int lay, freq;		/* frequency bands and bark */
      g_ptr *ltg;		/* values                   */
 {
@@ -138,12 +160,12 @@ void psycho_1_read_freq_band (ltg, lay, freq)	/* this function reads in   */
 
   /* read input for freq. subbands */
 
-  sub_size = SecondFreqEntries[freq] + 1;
-  *ltg = (g_ptr) mem_alloc (sizeof (g_thres) * sub_size, "ltg");
+  mem->sub_size = SecondFreqEntries[freq] + 1;
+  *ltg = (g_ptr) mem_alloc (sizeof (g_thres) * mem->sub_size, "ltg");
   (*ltg)[0].line = 0;		/* initialize global masking threshold */
   (*ltg)[0].bark = 0.0;
   (*ltg)[0].hear = 0.0;
-  for (i = 1; i < sub_size; i++) {
+  for (i = 1; i < mem->sub_size; i++) {
     k = SecondFreqSubband[freq][i - 1].line;
     if (k != 0) {
       (*ltg)[i].line = k;
@@ -157,27 +179,27 @@ void psycho_1_read_freq_band (ltg, lay, freq)	/* this function reads in   */
 }
 
 
-void psycho_1_make_map (mask power[HAN_SIZE], g_thres * ltg)
+void psycho_1_make_map (psycho_1_mem * mem, mask power[HAN_SIZE], g_thres * ltg)
 /* this function calculates the global masking threshold */
 {
   int i, j;
 
-  for (i = 1; i < sub_size; i++)
+  for (i = 1; i < mem->sub_size; i++)
     for (j = ltg[i - 1].line; j <= ltg[i].line; j++)
       power[j].map = i;
 }
 
-void psycho_1_init_add_db (void)
+void psycho_1_init_add_db (psycho_1_mem * mem)
 {
   int i;
   double x;
   for (i = 0; i < DBTAB; i++) {
     x = (double) i / 10.0;
-    dbtable[i] = 10 * log10 (1 + pow (10.0, x / 10.0)) - x;
+    mem->dbtable[i] = 10 * log10 (1 + pow (10.0, x / 10.0)) - x;
   }
 }
 
-double add_db (double a, double b)
+double add_db (psycho_1_mem * mem, double a, double b)
 {
   /* MFC - if the difference between a and b is large (>99), then just return the
      largest one. (about 10% of the time)
@@ -198,10 +220,10 @@ double add_db (double a, double b)
 
   idiff = (int) fdiff;
   if (idiff >= 0) {
-    return (a + dbtable[idiff]);
+    return (a + mem->dbtable[idiff]);
   }
 
-  return (b + dbtable[-idiff]);
+  return (b + mem->dbtable[-idiff]);
 }
 
 /****************************************************************
@@ -212,31 +234,17 @@ double add_db (double a, double b)
 *    
 *
 ****************************************************************/
-void psycho_1_hann_fft_pickmax (double sample[FFT_SIZE], mask power[HAN_SIZE],
+void psycho_1_hann_fft_pickmax (psycho_1_mem * mem, double sample[FFT_SIZE], mask power[HAN_SIZE],
 		       double spike[SBLIMIT], FLOAT energy[FFT_SIZE])
 {
   FLOAT x_real[FFT_SIZE];
   register int i, j;
-  register double sqrt_8_over_3;
-  static int init = 0;
-  static double *window;
   double sum;
 
-  if (!init) {			/* calculate window function for the Fourier transform */
-    window = (double *) mem_alloc (sizeof (DFFT), "window");
-    sqrt_8_over_3 = pow (8.0 / 3.0, 0.5);
-    for (i = 0; i < FFT_SIZE; i++) {
-      /* Hann window formula */
-      window[i] =
-	sqrt_8_over_3 * 0.5 * (1 -
-			       cos (2.0 * PI * i / (FFT_SIZE))) / FFT_SIZE;
-    }
-    init = 1;
-  }
   for (i = 0; i < FFT_SIZE; i++)
-    x_real[i] = (FLOAT) (sample[i] * window[i]);
+    x_real[i] = (FLOAT) (sample[i] * mem->window[i]);
 
-  psycho_1_fft (x_real, energy, FFT_SIZE);
+  psycho_1_fft (&mem->fft, x_real, energy);
 
   for (i = 0; i < HAN_SIZE; i++) {	/* calculate power density spectrum */
     if (energy[i] < 1E-20)
@@ -264,7 +272,7 @@ void psycho_1_hann_fft_pickmax (double sample[FFT_SIZE], mask power[HAN_SIZE],
 *
 ****************************************************************/
 
-void psycho_1_tonal_label (mask power[HAN_SIZE], int *tone)
+void psycho_1_tonal_label (psycho_1_mem * mem, mask power[HAN_SIZE], int *tone)
 /* this function extracts (tonal)  sinusoidals from the spectrum  */
 {
   int i, j, last = LAST, first, run, last_but_one = LAST;	/* dpwe */
@@ -316,8 +324,8 @@ void psycho_1_tonal_label (mask power[HAN_SIZE], int *tone)
       }
       if (first > 1 && first < 500) {	/* calculate the sum of the */
 	double tmp;		/* powers of the components */
-	tmp = add_db (power[first - 1].x, power[first + 1].x);
-	power[first].x = add_db (power[first].x, tmp);
+	tmp = add_db (mem, power[first - 1].x, power[first + 1].x);
+	power[first].x = add_db (mem, power[first].x, tmp);
       }
       for (j = 1; j <= run; j++) {
 	power[first - j].x = power[first + j].x = DBMIN;
@@ -347,9 +355,11 @@ void psycho_1_tonal_label (mask power[HAN_SIZE], int *tone)
 *
 ****************************************************************/
 
-void psycho_1_noise_label (mask * power, int *noise, g_thres * ltg,
+void psycho_1_noise_label (psycho_1_mem * mem, mask * power, int *noise, g_thres * ltg,
 		  FLOAT energy[FFT_SIZE])
 {
+  int crit_band = mem->crit_band;
+  int *cbound = mem->cbound;
   int i, j, centre, last = LAST;
   double index, weight, sum;
   /* calculate the remaining spectral */
@@ -357,7 +367,7 @@ void psycho_1_noise_label (mask * power, int *noise, g_thres * ltg,
     for (j = cbound[i], weight = 0.0, sum = DBMIN; j < cbound[i + 1]; j++) {
       if (power[j].type != TONE) {
 	if (power[j].x != DBMIN) {
-	  sum = add_db (power[j].x, sum);
+	  sum = add_db (mem, power[j].x, sum);
 	  /* Weight is used in finding the geometric mean of the noise energy within a subband */
 	  weight += CF * energy[j] * (double) (j - cbound[i]) / (double) (cbound[i + 1] - cbound[i]);	/* correction */
 	  power[j].x = DBMIN;
@@ -477,13 +487,13 @@ void psycho_1_subsampling (mask power[HAN_SIZE], g_thres * ltg, int *tone, int *
 ****************************************************************/
 
 /* mainly just changed the way range checking was done MFC Nov 1999 */
-void psycho_1_threshold (mask power[HAN_SIZE], g_thres * ltg, int *tone, int *noise,
+void psycho_1_threshold (psycho_1_mem * mem, mask power[HAN_SIZE], g_thres * ltg, int *tone, int *noise,
 		int bit_rate)
 {
   int k, t;
   double dz, tmps, vf;
 
-  for (k = 1; k < sub_size; k++) {
+  for (k = 1; k < mem->sub_size; k++) {
     ltg[k].x = DBMIN;
     t = *tone;			/* calculate individual masking threshold for */
     while ((t != LAST) && (t != STOP))
@@ -500,7 +510,7 @@ void psycho_1_threshold (mask power[HAN_SIZE], g_thres * ltg, int *tone, int *no
 	  vf = (-17 * dz);
 	else
 	  vf = -(dz - 1) * (17 - 0.15 * power[t].x) - 17;
-	ltg[k].x = add_db (ltg[k].x, tmps + vf);
+	ltg[k].x = add_db (mem, ltg[k].x, tmps + vf);
       }
       t = power[t].next;
     }
@@ -519,14 +529,14 @@ void psycho_1_threshold (mask power[HAN_SIZE], g_thres * ltg, int *tone, int *no
 	  vf = (-17 * dz);
 	else
 	  vf = -(dz - 1) * (17 - 0.15 * power[t].x) - 17;
-	ltg[k].x = add_db (ltg[k].x, tmps + vf);
+	ltg[k].x = add_db (mem, ltg[k].x, tmps + vf);
       }
       t = power[t].next;
     }
     if (bit_rate < 96)
-      ltg[k].x = add_db (ltg[k].hear, ltg[k].x);
+      ltg[k].x = add_db (mem, ltg[k].hear, ltg[k].x);
     else
-      ltg[k].x = add_db (ltg[k].hear - 12.0, ltg[k].x);
+      ltg[k].x = add_db (mem, ltg[k].hear - 12.0, ltg[k].x);
   }
 
 }
@@ -538,8 +548,9 @@ void psycho_1_threshold (mask power[HAN_SIZE], g_thres * ltg, int *tone, int *no
 *
 ****************************************************************/
 
-void psycho_1_minimum_mask (g_thres * ltg, double ltmin[SBLIMIT], int sblimit)
+void psycho_1_minimum_mask (psycho_1_mem * mem, g_thres * ltg, double ltmin[SBLIMIT], int sblimit)
 {
+  int sub_size = mem->sub_size;
   double min;
   int i, j;
 
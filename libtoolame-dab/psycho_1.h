@@ -1,2 +1,17 @@
+/* State of psychoacoustic model 1 for one encoder */
+typedef struct psycho_1_mem_struct {
+  int off[2];
+  D1408 *fft_buf;
+  mask_ptr power;
+  g_ptr ltg;
+  int crit_band;
+  int *cbound;
+  int sub_size;
+  double dbtable[DBTAB];
+  double window[FFT_SIZE];
+  fft_plan fft;
+} psycho_1_mem;
 
-void psycho_1 (short[2][1152], double[2][SBLIMIT], double[2][SBLIMIT], frame_info *);
+psycho_1_mem *psycho_1_init (frame_info *);
+void psycho_1_deinit (psycho_1_mem **);
+void psycho_1 (psycho_1_mem *, short[2][1152], double[2][SBLIMIT], double[2][SBLIMIT], frame_info *);
@@ -8,14 +8,6 @@
 #include "fft.h"
 #include "psycho_2.h"
 
-/* The static variables "r", "phi_sav", "new", "old" and "oldest" have    */
-/* to be remembered for the unpredictability measure.  For "r" and        */
-/* "phi_sav", the first index from the left is the channel select and     */
-/* the second index is the "age" of the data.                             */
-
-static int new = 0, old = 1, oldest = 0;
-static int init = 0, flush, sync_flush, syncsize, sfreq_idx;
-
 /* The following static variables are constants.                           */
 
 static double nmt = 5.5;
@@ -32,36 +24,29 @@ static FLOAT bmax[27] = { 20.0, 20.0, 20.0, 20.0, 20.0, 17.0, 15.0,
   4.5, 4.5, 4.5, 3.5, 3.5, 3.5
 };
 
-static FLOAT *grouped_c, *grouped_e, *nb, *cb, *ecb, *bc;
-static FLOAT *wsamp_r, *phi, *energy;
-static FLOAT *c, *fthr;
-static F32 *snrtmp;
-
-static int *numlines;
-static int *partition;
-static FLOAT *cbval, *rnorm;
-static FLOAT *window;
-static FLOAT *absthr;
-static double *tmn;
-static FCB *s;
-static FHBLK *lthr;
-static F2HBLK *r, *phi_sav;
-
-void psycho_2_init (double sfreq);
-
-void psycho_2 (short int *buffer, short int savebuf[1056], int chn,
-		double *smr, double sfreq, options *glopts)
-/* to match prototype : FLOAT args are always double */
+void psycho_2 (psycho_2_mem *mem, short int *buffer, short int savebuf[1056], int chn,
+		double *smr)
 {
   unsigned int i, j, k;
   FLOAT r_prime, phi_prime;
   FLOAT minthres, sum_energy;
   double tb, temp1, temp2, temp3;
 
-  if (init == 0) {
-    psycho_2_init (sfreq);
-    init++;
-  }
+  FLOAT *grouped_c = mem->grouped_c, *grouped_e = mem->grouped_e;
+  FLOAT *nb = mem->nb, *cb = mem->cb, *ecb = mem->ecb, *bc = mem->bc;
+  FLOAT *wsamp_r = mem->wsamp_r, *phi = mem->phi, *energy = mem->energy;
+  FLOAT *c = mem->c, *fthr = mem->fthr;
+  F32 *snrtmp = mem->snrtmp;
+  int *numlines = mem->numlines;
+  int *partition = mem->partition;
+  FLOAT *cbval = mem->cbval, *rnorm = mem->rnorm;
+  FLOAT *window = mem->window;
+  FLOAT *absthr = mem->absthr;
+  double *tmn = mem->tmn;
+  FCB *s = mem->s;
+  FHBLK *lthr = mem->lthr;
+  F2HBLK *r = mem->r, *phi_sav = mem->phi_sav;
+  const int flush = mem->flush;
 
   for (i = 0; i < 2; i++) {
       /*****************************************************************************
@@ -88,7 +73,7 @@ void psycho_2 (short int *buffer, short int savebuf[1056], int chn,
       savebuf[j] = *buffer++;
 
       /**Compute FFT****************************************************************/
-    psycho_2_fft (wsamp_r, energy, phi);
+    psycho_2_fft (&mem->fft, wsamp_r, energy, phi);
       /*****************************************************************************
        * calculate the unpredictability measure, given energy[f] and phi[f]        *
        *****************************************************************************/
@@ -96,18 +81,19 @@ void psycho_2 (short int *buffer, short int savebuf[1056], int chn,
     /*for layer 1 computations, for the layer 2 double computations, the pointers */
     /*are reset automatically on the second pass                                 */
     {
-      if (new == 0) {
-	new = 1;
-	oldest = 1;
+      if (mem->new == 0) {
+	mem->new = 1;
+	mem->oldest = 1;
       } else {
-	new = 0;
-	oldest = 0;
+	mem->new = 0;
+	mem->oldest = 0;
       }
-      if (old == 0)
-	old = 1;
+      if (mem->old == 0)
+	mem->old = 1;
       else
-	old = 0;
+	mem->old = 0;
     }
+    const int new = mem->new, old = mem->old, oldest = mem->oldest;
     for (j = 0; j < HBLKSIZE; j++) {
       r_prime = 2.0 * r[chn][old][j] - r[chn][oldest][j];
       phi_prime = 2.0 * phi_sav[chn][old][j] - phi_sav[chn][oldest][j];
@@ -256,37 +242,51 @@ void psycho_2 (short int *buffer, short int savebuf[1056], int chn,
 /********************************
  * init psycho model 2
  ********************************/
-void psycho_2_init (double sfreq)
+psycho_2_mem *psycho_2_init (double sfreq, options *glopts)
 {
   int i, j;
   FLOAT freq_mult;
   double temp1, temp2, temp3;
   FLOAT bval_lo;
-
-  grouped_c = (FLOAT *) mem_alloc (sizeof (FCB), "grouped_c");
-  grouped_e = (FLOAT *) mem_alloc (sizeof (FCB), "grouped_e");
-  nb = (FLOAT *) mem_alloc (sizeof (FCB), "nb");
-  cb = (FLOAT *) mem_alloc (sizeof (FCB), "cb");
-  ecb = (FLOAT *) mem_alloc (sizeof (FCB), "ecb");
-  bc = (FLOAT *) mem_alloc (sizeof (FCB), "bc");
-  wsamp_r = (FLOAT *) mem_alloc (sizeof (FBLK), "wsamp_r");
-  phi = (FLOAT *) mem_alloc (sizeof (FBLK), "phi");
-  energy = (FLOAT *) mem_alloc (sizeof (FBLK), "energy");
-  c = (FLOAT *) mem_alloc (sizeof (FHBLK), "c");
-  fthr = (FLOAT *) mem_alloc (sizeof (FHBLK), "fthr");
-  snrtmp = (F32 *) mem_alloc (sizeof (F2_32), "snrtmp");
-
-  numlines = (int *) mem_alloc (sizeof (ICB), "numlines");
-  partition = (int *) mem_alloc (sizeof (IHBLK), "partition");
-  cbval = (FLOAT *) mem_alloc (sizeof (FCB), "cbval");
-  rnorm = (FLOAT *) mem_alloc (sizeof (FCB), "rnorm");
-  window = (FLOAT *) mem_alloc (sizeof (FBLK), "window");
-  absthr = (FLOAT *) mem_alloc (sizeof (FHBLK), "absthr");
-  tmn = (double *) mem_alloc (sizeof (DCB), "tmn");
-  s = (FCB *) mem_alloc (sizeof (FCBCB), "s");
-  lthr = (FHBLK *) mem_alloc (sizeof (F2HBLK), "lthr");
-  r = (F2HBLK *) mem_alloc (sizeof (F22HBLK), "r");
-  phi_sav = (F2HBLK *) mem_alloc (sizeof (F22HBLK), "phi_sav");
+  int sfreq_idx;
+  psycho_2_mem *mem;
+  FLOAT *cbval, *rnorm, *window, *absthr, *fthr;
+  int *numlines, *partition;
+  double *tmn;
+  FCB *s;
+  FHBLK *lthr;
+  F2HBLK *r, *phi_sav;
+
+  mem = (psycho_2_mem *) mem_alloc (sizeof (psycho_2_mem), "psycho_2_mem");
+  fft_init (&mem->fft);
+  mem->new = 0;
+  mem->old = 1;
+  mem->oldest = 0;
+
+  mem->grouped_c = (FLOAT *) mem_alloc (sizeof (FCB), "grouped_c");
+  mem->grouped_e = (FLOAT *) mem_alloc (sizeof (FCB), "grouped_e");
+  mem->nb = (FLOAT *) mem_alloc (sizeof (FCB), "nb");
+  mem->cb = (FLOAT *) mem_alloc (sizeof (FCB), "cb");
+  mem->ecb = (FLOAT *) mem_alloc (sizeof (FCB), "ecb");
+  mem->bc = (FLOAT *) mem_alloc (sizeof (FCB), "bc");
+  mem->wsamp_r = (FLOAT *) mem_alloc (sizeof (FBLK), "wsamp_r");
+  mem->phi = (FLOAT *) mem_alloc (sizeof (FBLK), "phi");
+  mem->energy = (FLOAT *) mem_alloc (sizeof (FBLK), "energy");
+  mem->c = (FLOAT *) mem_alloc (sizeof (FHBLK), "c");
+  mem->fthr = fthr = (FLOAT *) mem_alloc (sizeof (FHBLK), "fthr");
+  mem->snrtmp = (F32 *) mem_alloc (sizeof (F2_32), "snrtmp");
+
+  mem->numlines = numlines = (int *) mem_alloc (sizeof (ICB), "numlines");
+  mem->partition = partition = (int *) mem_alloc (sizeof (IHBLK), "partition");
+  mem->cbval = cbval = (FLOAT *) mem_alloc (sizeof (FCB), "cbval");
+  mem->rnorm = rnorm = (FLOAT *) mem_alloc (sizeof (FCB), "rnorm");
+  mem->window = window = (FLOAT *) mem_alloc (sizeof (FBLK), "window");
+  mem->absthr = absthr = (FLOAT *) mem_alloc (sizeof (FHBLK), "absthr");
+  mem->tmn = tmn = (double *) mem_alloc (sizeof (DCB), "tmn");
+  mem->s = s = (FCB *) mem_alloc (sizeof (FCBCB), "s");
+  mem->lthr = lthr = (FHBLK *) mem_alloc (sizeof (F2HBLK), "lthr");
+  mem->r = r = (F2HBLK *) mem_alloc (sizeof (F22HBLK), "r");
+  mem->phi_sav = phi_sav = (F2HBLK *) mem_alloc (sizeof (F22HBLK), "phi_sav");
 
   i = sfreq + 0.5;
   switch (i) {
@@ -309,9 +309,9 @@ void psycho_2_init (double sfreq)
   fprintf (stderr, "absthr[][] sampling frequency index: %d\n", sfreq_idx);
   psycho_2_read_absthr (absthr, sfreq_idx);
 
-  flush = 384 * 3.0 / 2.0;
-  syncsize = 1056;
-  sync_flush = syncsize - flush;
+  mem->flush = 384 * 3.0 / 2.0;
+  mem->syncsize = 1056;
+  mem->sync_flush = mem->syncsize - mem->flush;
 
   /* calculate HANN window coefficients */
   /*   for(i=0;i<BLKSIZE;i++)window[i]=0.5*(1-cos(2.0*PI*i/(BLKSIZE-1.0))); */
@@ -404,7 +404,7 @@ void psycho_2_init (double sfreq)
     }
   }
 
-  if (glopts.verbosity > 10){
+  if (glopts->verbosity > 10){
     /* Dump All the Values to STDOUT and exit */
     int wlow, whigh=0;
     fprintf(stdout,"psy model 2 init\n");
@@ -417,6 +417,38 @@ void psycho_2_init (double sfreq)
     exit(0);
   }
 
+  return mem;
+}
+
+void psycho_2_deinit (psycho_2_mem ** mem)
+{
+  if (*mem == NULL)
+    return;
+
+  mem_free ((void **) &(*mem)->grouped_c);
+  mem_free ((void **) &(*mem)->grouped_e);
+  mem_free ((void **) &(*mem)->nb);
+  mem_free ((void **) &(*mem)->cb);
+  mem_free ((void **) &(*mem)->ecb);
+  mem_free ((void **) &(*mem)->bc);
+  mem_free ((void **) &(*mem)->wsamp_r);
+  mem_free ((void **) &(*mem)->phi);
+  mem_free ((void **) &(*mem)->energy);
+  mem_free ((void **) &(*mem)->c);
+  mem_free ((void **) &(*mem)->fthr);
+  mem_free ((void **) &(*mem)->snrtmp);
+  mem_free ((void **) &(*mem)->numlines);
+  mem_free ((void **) &(*mem)->partition);
+  mem_free ((void **) &(*mem)->cbval);
+  mem_free ((void **) &(*mem)->rnorm);
+  mem_free ((void **) &(*mem)->window);
+  mem_free ((void **) &(*mem)->absthr);
+  mem_free ((void **) &(*mem)->tmn);
+  mem_free ((void **) &(*mem)->s);
+  mem_free ((void **) &(*mem)->lthr);
+  mem_free ((void **) &(*mem)->r);
+  mem_free ((void **) &(*mem)->phi_sav);
+  mem_free ((void **) mem);
 }
 
 void psycho_2_read_absthr (absthr, table)
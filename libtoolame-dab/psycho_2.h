@@ -1,2 +1,29 @@
+/* State of psychoacoustic model 2 for one encoder.
+ * "r", "phi_sav", "new", "old" and "oldest" have to be remembered for the
+ * unpredictability measure. For "r" and "phi_sav", the first index from the
+ * left is the channel select and the second index is the "age" of the data. */
+typedef struct psycho_2_mem_struct {
+  int new, old, oldest;
+  int flush, sync_flush, syncsize;
+
+  FLOAT *grouped_c, *grouped_e, *nb, *cb, *ecb, *bc;
+  FLOAT *wsamp_r, *phi, *energy;
+  FLOAT *c, *fthr;
+  F32 *snrtmp;
+
+  int *numlines;
+  int *partition;
+  FLOAT *cbval, *rnorm;
+  FLOAT *window;
+  FLOAT *absthr;
+  double *tmn;
+  FCB *s;
+  FHBLK *lthr;
+  F2HBLK *r, *phi_sav;
+  fft_plan fft;
+} psycho_2_mem;
+
 void psycho_2_read_absthr (FLOAT *, int);
-void psycho_2 (short int *, short int[1056], int, double *snr32, double sfreq, options *glopts);
+psycho_2_mem *psycho_2_init (double sfreq, options *glopts);
+void psycho_2_deinit (psycho_2_mem **mem);
+void psycho_2 (psycho_2_mem *mem, short int *, short int[1056], int, double *snr32);
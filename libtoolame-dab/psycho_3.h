@@ -1,4 +1,26 @@
-void psycho_3 (short[2][1152], double[2][SBLIMIT],
+#define CRITBANDMAX 32 /* this is much higher than it needs to be. really only about 24 */
+#define SUBSIZE 136
+
+typedef struct psycho_3_mem_struct {
+  /* Keep a table to fudge the adding of dB */
+  double dbtable[DBTAB];
+
+  int cbands; /* How many critical bands there really are */
+  int cbandindex[CRITBANDMAX]; /* The spectral line index of the start of
+				  each critical band */
+
+  int freq_subset[SUBSIZE];
+  FLOAT bark[HBLKSIZE], ath[HBLKSIZE];
+  int partition[HBLKSIZE];
+
+  int off[2];
+  D1408 *fft_buf;
+  FLOAT window[BLKSIZE];
+  fft_plan fft;
+} psycho_3_mem;
+
+void psycho_3 (psycho_3_mem *mem, short[2][1152], double[2][SBLIMIT],
 		      double[2][SBLIMIT], frame_info *, options *glopts);
 
-void psycho_3_init(options *glopts);
+psycho_3_mem *psycho_3_init(frame_info *frame, options *glopts);
+void psycho_3_deinit(psycho_3_mem **mem);
@@ -1,2 +0,0 @@
-
-void psycho_n1(double ltmin[2][SBLIMIT], int stereo);
@@ -8,6 +8,13 @@
 #include "encode.h"
 #include "enwindow.h"
 #include "subband.h"
+#include "utils.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 
 #ifdef REFERENCECODE
@@ -195,116 +202,416 @@ void window_subband12 (short **buffer, int ch)
 #endif /* NEWWS */
 
 
-//____________________________________________________________________________
-//____ WindowFilterSubband() _________________________________________
-//____ RS&A - Feb 2003 _______________________________________________________
-void WindowFilterSubband (short *pBuffer, int ch, double s[SBLIMIT])
+/* The windowing and the matrixing are computed for several subbands at
+   once with SIMD instructions when available. Each output is still the sum
+   of the same products in the same order as in the scalar code, and no
+   fused multiply-add is used, so that all variants give bit-identical
+   results. */
+
+/* Convert the 32 samples of channel ch in pcm, in which the samples of the
+   channels are interleaved, and store them in reverse order to dp[0..31]. */
+static void load_scalar (const short *pcm, int channels, int ch, double *dp)
 {
-  register int i, j;
-  int pa, pb, pc, pd, pe, pf, pg, ph;
-  double t;
-  double *dp, *dp2;
-  double *pEnw;
-  double y[64];
-  double yprime[32];
+  int i;
+  for (i = 0; i < 32; i++)
+    dp[31 - i] = (double) pcm[i * channels + ch] / SCALE;
+}
 
-  static double x[2][512];
-  static double m[16][32];
-  static int init = 0;
-  static int off[2];
-  static int half[2];
+/* Window one half of the history of a channel. xh points to the 8 phases
+   of 32 samples, pa is the phase of the oldest samples and win points to
+   the first of the 8 rows of window coefficients, which are 64 apart. */
+#define WINDOW_ROWS(xh, pa) \
+  const double *r0 = xh + (pa) * 32, *r1 = xh + (((pa) + 1) & 7) * 32, \
+    *r2 = xh + (((pa) + 2) & 7) * 32, *r3 = xh + (((pa) + 3) & 7) * 32, \
+    *r4 = xh + (((pa) + 4) & 7) * 32, *r5 = xh + (((pa) + 5) & 7) * 32, \
+    *r6 = xh + (((pa) + 6) & 7) * 32, *r7 = xh + (((pa) + 7) & 7) * 32
 
-  if (init == 0) {
-    init++;
-    off[0] = 0;
-    off[1] = 0;
-    half[0] = 0;
-    half[1] = 0;
-    for (i = 0; i < 2; i++)
-      for (j = 0; j < 512; j++)
-	x[i][j] = 0;
-    create_dct_matrix (m);
+static void window_scalar (const double *xh, int pa, const double *win, double y[32])
+{
+  WINDOW_ROWS (xh, pa);
+  int i;
+  for (i = 0; i < 32; i++) {
+    double t = r0[i] * win[i];
+    t += r1[i] * win[i + 64];
+    t += r2[i] * win[i + 128];
+    t += r3[i] * win[i + 192];
+    t += r4[i] * win[i + 256];
+    t += r5[i] * win[i + 320];
+    t += r6[i] * win[i + 384];
+    t += r7[i] * win[i + 448];
+    y[i] = t;
   }
+}
 
-  dp = x[ch] + off[ch] + half[ch] * 256;
+/* Multiply the 32 values of yprime with the DCT matrix m, stored with one
+   row of 16 subbands per input value. The even inputs are accumulated in s0,
+   the odd ones in s1. */
+static void matrix_scalar (const double m[32][16], const double yprime[32], double s[SBLIMIT])
+{
+  int i, j;
+  for (i = 15; i >= 0; i--) {
+    double s0 = 0.0, s1 = 0.0;
+    for (j = 0; j < 32; j += 2) {
+      s0 += m[j][i] * yprime[j];
+      s1 += m[j + 1][i] * yprime[j + 1];
+    }
+    s[i] = s0 + s1;
+    s[31 - i] = s0 - s1;
+  }
+}
 
-  /* replace 32 oldest samples with 32 new samples */
-  for (i = 0; i < 32; i++)
-    dp[(31 - i) * 8] = (double) pBuffer[i] / SCALE;
-
-  // looks like "school example" but does faster ...
-  dp = (x[ch] + half[ch] * 256);
-  pa = off[ch];
-  pb = (pa + 1) % 8;
-  pc = (pa + 2) % 8;
-  pd = (pa + 3) % 8;
-  pe = (pa + 4) % 8;
-  pf = (pa + 5) % 8;
-  pg = (pa + 6) % 8;
-  ph = (pa + 7) % 8;
+#if defined(__SSE2__)
+/* Convert the 4 samples in v and store them in reverse order to dp[0..3].
+   Dividing by SCALE is exact, and so is multiplying by its inverse. */
+static void store_reversed_sse2 (__m128i v, double *dp)
+{
+  const __m128d scale = _mm_set1_pd (1.0 / SCALE);
+  const __m128d lo = _mm_mul_pd (_mm_cvtepi32_pd (v), scale);
+  const __m128d hi = _mm_mul_pd (_mm_cvtepi32_pd (_mm_srli_si128 (v, 8)), scale);
+  _mm_storeu_pd (dp + 2, _mm_shuffle_pd (lo, lo, 1));
+  _mm_storeu_pd (dp, _mm_shuffle_pd (hi, hi, 1));
+}
 
-  for (i = 0; i < 32; i++) {
-    dp2 = dp + i * 8;
-    pEnw = enwindow + i;
-    t = dp2[pa] * pEnw[0];
-    t += dp2[pb] * pEnw[64];
-    t += dp2[pc] * pEnw[128];
-    t += dp2[pd] * pEnw[192];
-    t += dp2[pe] * pEnw[256];
-    t += dp2[pf] * pEnw[320];
-    t += dp2[pg] * pEnw[384];
-    t += dp2[ph] * pEnw[448];
-    y[i] = t;
+/* The samples are sign extended to 32 bits with shifts. With two channels,
+   the left sample is in the low half of each 32-bit word and the right one
+   in the high half, which also deinterleaves them. */
+static void load_sse2 (const short *pcm, int channels, int ch, double *dp)
+{
+  int i;
+  if (channels == 1) {
+    for (i = 0; i < 32; i += 8) {
+      const __m128i v = _mm_loadu_si128 ((const __m128i *) (pcm + i));
+      store_reversed_sse2 (_mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16), dp + 28 - i);
+      store_reversed_sse2 (_mm_srai_epi32 (_mm_unpackhi_epi16 (v, v), 16), dp + 24 - i);
+    }
   }
+  else if (channels == 2) {
+    for (i = 0; i < 32; i += 4) {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (pcm + 2 * i));
+      if (ch == 0)
+        v = _mm_slli_epi32 (v, 16);
+      store_reversed_sse2 (_mm_srai_epi32 (v, 16), dp + 28 - i);
+    }
+  }
+  else {
+    load_scalar (pcm, channels, ch, dp);
+  }
+}
 
-  yprime[0] = y[16];		// Michael Chens dct filter
+static void window_sse2 (const double *xh, int pa, const double *win, double y[32])
+{
+  WINDOW_ROWS (xh, pa);
+  int i;
+  for (i = 0; i < 32; i += 2) {
+    __m128d t = _mm_mul_pd (_mm_loadu_pd (r0 + i), _mm_loadu_pd (win + i));
+    t = _mm_add_pd (t, _mm_mul_pd (_mm_loadu_pd (r1 + i), _mm_loadu_pd (win + i + 64)));
+    t = _mm_add_pd (t, _mm_mul_pd (_mm_loadu_pd (r2 + i), _mm_loadu_pd (win + i + 128)));
+    t = _mm_add_pd (t, _mm_mul_pd (_mm_loadu_pd (r3 + i), _mm_loadu_pd (win + i + 192)));
+    t = _mm_add_pd (t, _mm_mul_pd (_mm_loadu_pd (r4 + i), _mm_loadu_pd (win + i + 256)));
+    t = _mm_add_pd (t, _mm_mul_pd (_mm_loadu_pd (r5 + i), _mm_loadu_pd (win + i + 320)));
+    t = _mm_add_pd (t, _mm_mul_pd (_mm_loadu_pd (r6 + i), _mm_loadu_pd (win + i + 384)));
+    t = _mm_add_pd (t, _mm_mul_pd (_mm_loadu_pd (r7 + i), _mm_loadu_pd (win + i + 448)));
+    _mm_storeu_pd (y + i, t);
+  }
+}
+
+static void matrix_sse2 (const double m[32][16], const double yprime[32], double s[SBLIMIT])
+{
+  double d[16];
+  int i, j;
+  for (i = 0; i < 16; i += 2) {
+    __m128d s0 = _mm_setzero_pd (), s1 = _mm_setzero_pd ();
+    for (j = 0; j < 32; j += 2) {
+      s0 = _mm_add_pd (s0, _mm_mul_pd (_mm_loadu_pd (&m[j][i]), _mm_set1_pd (yprime[j])));
+      s1 = _mm_add_pd (s1, _mm_mul_pd (_mm_loadu_pd (&m[j + 1][i]), _mm_set1_pd (yprime[j + 1])));
+    }
+    _mm_storeu_pd (s + i, _mm_add_pd (s0, s1));
+    _mm_storeu_pd (d + i, _mm_sub_pd (s0, s1));
+  }
+  for (i = 0; i < 16; i++)
+    s[31 - i] = d[i];
+}
 
-  dp = half[ch] ? x[ch] : (x[ch] + 256);
-  pa = half[ch] ? (off[ch] + 1) & 7 : off[ch];
-  pb = (pa + 1) % 8;
-  pc = (pa + 2) % 8;
-  pd = (pa + 3) % 8;
-  pe = (pa + 4) % 8;
-  pf = (pa + 5) % 8;
-  pg = (pa + 6) % 8;
-  ph = (pa + 7) % 8;
+#if defined(__GNUC__)
+__attribute__((target("avx")))
+static void window_avx (const double *xh, int pa, const double *win, double y[32])
+{
+  WINDOW_ROWS (xh, pa);
+  int i;
+  for (i = 0; i < 32; i += 4) {
+    __m256d t = _mm256_mul_pd (_mm256_loadu_pd (r0 + i), _mm256_loadu_pd (win + i));
+    t = _mm256_add_pd (t, _mm256_mul_pd (_mm256_loadu_pd (r1 + i), _mm256_loadu_pd (win + i + 64)));
+    t = _mm256_add_pd (t, _mm256_mul_pd (_mm256_loadu_pd (r2 + i), _mm256_loadu_pd (win + i + 128)));
+    t = _mm256_add_pd (t, _mm256_mul_pd (_mm256_loadu_pd (r3 + i), _mm256_loadu_pd (win + i + 192)));
+    t = _mm256_add_pd (t, _mm256_mul_pd (_mm256_loadu_pd (r4 + i), _mm256_loadu_pd (win + i + 256)));
+    t = _mm256_add_pd (t, _mm256_mul_pd (_mm256_loadu_pd (r5 + i), _mm256_loadu_pd (win + i + 320)));
+    t = _mm256_add_pd (t, _mm256_mul_pd (_mm256_loadu_pd (r6 + i), _mm256_loadu_pd (win + i + 384)));
+    t = _mm256_add_pd (t, _mm256_mul_pd (_mm256_loadu_pd (r7 + i), _mm256_loadu_pd (win + i + 448)));
+    _mm256_storeu_pd (y + i, t);
+  }
+}
 
-  for (i = 0; i < 32; i++) {
-    dp2 = dp + i * 8;
-    pEnw = enwindow + i + 32;
-    t = dp2[pa] * pEnw[0];
-    t += dp2[pb] * pEnw[64];
-    t += dp2[pc] * pEnw[128];
-    t += dp2[pd] * pEnw[192];
-    t += dp2[pe] * pEnw[256];
-    t += dp2[pf] * pEnw[320];
-    t += dp2[pg] * pEnw[384];
-    t += dp2[ph] * pEnw[448];
-    y[i + 32] = t;
-    // 1st pass on Michael Chens dct filter
-    if (i > 0 && i < 17)
-      yprime[i] = y[i + 16] + y[16 - i];
+__attribute__((target("avx")))
+static void matrix_avx (const double m[32][16], const double yprime[32], double s[SBLIMIT])
+{
+  double d[16];
+  int i, j;
+  for (i = 0; i < 16; i += 4) {
+    __m256d s0 = _mm256_setzero_pd (), s1 = _mm256_setzero_pd ();
+    for (j = 0; j < 32; j += 2) {
+      s0 = _mm256_add_pd (s0, _mm256_mul_pd (_mm256_loadu_pd (&m[j][i]), _mm256_set1_pd (yprime[j])));
+      s1 = _mm256_add_pd (s1, _mm256_mul_pd (_mm256_loadu_pd (&m[j + 1][i]), _mm256_set1_pd (yprime[j + 1])));
+    }
+    _mm256_storeu_pd (s + i, _mm256_add_pd (s0, s1));
+    _mm256_storeu_pd (d + i, _mm256_sub_pd (s0, s1));
   }
+  for (i = 0; i < 16; i++)
+    s[31 - i] = d[i];
+}
+#endif
+#endif
 
-  // 2nd pass on Michael Chens dct filter
+#if defined(__aarch64__)
+static void load_neon (const short *pcm, int channels, int ch, double *dp)
+{
+  const float64x2_t scale = vdupq_n_f64 (1.0 / SCALE);
+  int i;
+  if (channels > 2) {
+    load_scalar (pcm, channels, ch, dp);
+    return;
+  }
+  for (i = 0; i < 32; i += 4) {
+    int16x4_t v;
+    if (channels == 1) {
+      v = vld1_s16 (pcm + i);
+    }
+    else {
+      const int16x4x2_t lr = vld2_s16 (pcm + 2 * i);
+      v = ch == 0 ? lr.val[0] : lr.val[1];
+    }
+    const int32x4_t w = vmovl_s16 (v);
+    const float64x2_t lo = vmulq_f64 (vcvtq_f64_s64 (vmovl_s32 (vget_low_s32 (w))), scale);
+    const float64x2_t hi = vmulq_f64 (vcvtq_f64_s64 (vmovl_s32 (vget_high_s32 (w))), scale);
+    vst1q_f64 (dp + 30 - i, vextq_f64 (lo, lo, 1));
+    vst1q_f64 (dp + 28 - i, vextq_f64 (hi, hi, 1));
+  }
+}
+
+static void window_neon (const double *xh, int pa, const double *win, double y[32])
+{
+  WINDOW_ROWS (xh, pa);
+  int i;
+  for (i = 0; i < 32; i += 2) {
+    float64x2_t t = vmulq_f64 (vld1q_f64 (r0 + i), vld1q_f64 (win + i));
+    t = vaddq_f64 (t, vmulq_f64 (vld1q_f64 (r1 + i), vld1q_f64 (win + i + 64)));
+    t = vaddq_f64 (t, vmulq_f64 (vld1q_f64 (r2 + i), vld1q_f64 (win + i + 128)));
+    t = vaddq_f64 (t, vmulq_f64 (vld1q_f64 (r3 + i), vld1q_f64 (win + i + 192)));
+    t = vaddq_f64 (t, vmulq_f64 (vld1q_f64 (r4 + i), vld1q_f64 (win + i + 256)));
+    t = vaddq_f64 (t, vmulq_f64 (vld1q_f64 (r5 + i), vld1q_f64 (win + i + 320)));
+    t = vaddq_f64 (t, vmulq_f64 (vld1q_f64 (r6 + i), vld1q_f64 (win + i + 384)));
+    t = vaddq_f64 (t, vmulq_f64 (vld1q_f64 (r7 + i), vld1q_f64 (win + i + 448)));
+    vst1q_f64 (y + i, t);
+  }
+}
+
+static void matrix_neon (const double m[32][16], const double yprime[32], double s[SBLIMIT])
+{
+  double d[16];
+  int i, j;
+  for (i = 0; i < 16; i += 2) {
+    float64x2_t s0 = vdupq_n_f64 (0.0), s1 = vdupq_n_f64 (0.0);
+    for (j = 0; j < 32; j += 2) {
+      s0 = vaddq_f64 (s0, vmulq_f64 (vld1q_f64 (&m[j][i]), vdupq_n_f64 (yprime[j])));
+      s1 = vaddq_f64 (s1, vmulq_f64 (vld1q_f64 (&m[j + 1][i]), vdupq_n_f64 (yprime[j + 1])));
+    }
+    vst1q_f64 (s + i, vaddq_f64 (s0, s1));
+    vst1q_f64 (d + i, vsubq_f64 (s0, s1));
+  }
+  for (i = 0; i < 16; i++)
+    s[31 - i] = d[i];
+}
+#endif
+
+/* Reset the filterbank history and create the DCT matrix */
+void subband_init (subband_mem * smem)
+{
+  double m[16][32];
+  int i, k;
+
+  memset (smem->x, 0, sizeof (smem->x));
+  smem->off[0] = 0;
+  smem->off[1] = 0;
+  smem->half[0] = 0;
+  smem->half[1] = 0;
+
+  create_dct_matrix (m);
+  for (i = 0; i < 16; i++)
+    for (k = 0; k < 32; k++)
+      smem->m[k][i] = m[i][k];
+
+  smem->simd = simd_best ();
+}
+
+static void load (int simd, const short *pcm, int channels, int ch, double *dp)
+{
+  switch (simd) {
+#if defined(__SSE2__)
+    case SIMD_AVX:
+    case SIMD_SSE2:
+      load_sse2 (pcm, channels, ch, dp);
+      break;
+#endif
+#if defined(__aarch64__)
+    case SIMD_NEON:
+      load_neon (pcm, channels, ch, dp);
+      break;
+#endif
+    default:
+      load_scalar (pcm, channels, ch, dp);
+  }
+}
+
+static void window (int simd, const double *xh, int pa, const double *win, double y[32])
+{
+  switch (simd) {
+#if defined(__SSE2__)
+#if defined(__GNUC__)
+    case SIMD_AVX:
+      window_avx (xh, pa, win, y);
+      break;
+#endif
+    case SIMD_SSE2:
+      window_sse2 (xh, pa, win, y);
+      break;
+#endif
+#if defined(__aarch64__)
+    case SIMD_NEON:
+      window_neon (xh, pa, win, y);
+      break;
+#endif
+    default:
+      window_scalar (xh, pa, win, y);
+  }
+}
+
+static void matrix (int simd, const double m[32][16], const double yprime[32], double s[SBLIMIT])
+{
+  switch (simd) {
+#if defined(__SSE2__)
+#if defined(__GNUC__)
+    case SIMD_AVX:
+      matrix_avx (m, yprime, s);
+      break;
+#endif
+    case SIMD_SSE2:
+      matrix_sse2 (m, yprime, s);
+      break;
+#endif
+#if defined(__aarch64__)
+    case SIMD_NEON:
+      matrix_neon (m, yprime, s);
+      break;
+#endif
+    default:
+      matrix_scalar (m, yprime, s);
+  }
+}
+
+//____________________________________________________________________________
+//____ WindowFilterSubband() _________________________________________
+//____ RS&A - Feb 2003 _______________________________________________________
+/* The 32 oldest samples of a channel, to be replaced by the 32 new ones */
+static double *oldest_samples (subband_mem * smem, int ch)
+{
+  return smem->x[ch] + smem->half[ch] * 256 + smem->off[ch] * 32;
+}
+
+/* Window and filter the history of a channel, once the new samples are in */
+static void filter_history (subband_mem * smem, int ch, double s[SBLIMIT])
+{
+  register int i;
+  double *xc = smem->x[ch];
+  double y[64];
+  double yprime[32];
+  int off = smem->off[ch];
+  int half = smem->half[ch];
+
+  window (smem->simd, xc + half * 256, off, enwindow, y);
+  window (smem->simd, half ? xc : xc + 256, half ? (off + 1) & 7 : off,
+          enwindow + 32, y + 32);
+
+  // Michael Chens dct filter
+  yprime[0] = y[16];
+  for (i = 1; i < 17; i++)
+    yprime[i] = y[i + 16] + y[16 - i];
   for (i = 17; i < 32; i++)
     yprime[i] = y[i + 16] - y[80 - i];
 
-  for (i = 15; i >= 0; i--) {
-    register double s0 = 0.0, s1 = 0.0;
-    register double *mp = m[i];
-    register double *xinp = yprime;
-    for (j = 0; j < 8; j++) {
-      s0 += *mp++ * *xinp++;
-      s1 += *mp++ * *xinp++;
-      s0 += *mp++ * *xinp++;
-      s1 += *mp++ * *xinp++;
+  matrix (smem->simd, smem->m, yprime, s);
+
+  smem->half[ch] = (half + 1) & 1;
+  if (smem->half[ch] == 1)
+    smem->off[ch] = (off + 7) & 7;
+}
+
+void WindowFilterSubband (subband_mem * smem, short *pBuffer, int ch, double s[SBLIMIT])
+{
+  load (smem->simd, pBuffer, 1, 0, oldest_samples (smem, ch));
+  filter_history (smem, ch, s);
+}
+
+/* Same as WindowFilterSubband() for the nch channels of 32 samples in which
+   the channels are interleaved, which are deinterleaved while they are
+   converted. If there are less input channels than nch, the last one is
+   used for the others. */
+void WindowFilterSubbandInterleaved (subband_mem * smem, const short *pBuffer,
+                                     int channels, int nch, double s[2][SBLIMIT])
+{
+  int ch;
+  for (ch = 0; ch < nch; ch++) {
+    load (smem->simd, pBuffer, channels, ch < channels ? ch : channels - 1,
+          oldest_samples (smem, ch));
+    filter_history (smem, ch, s[ch]);
+  }
+}
+
+/* Copy the nch channels of 1152 interleaved samples to buffer, for the psy
+   models */
+void deinterleave_pcm (int simd, const short *pcm, int channels, int nch,
+                       short buffer[2][1152])
+{
+  int ch, i = 0;
+
+  if (channels == 1) {
+    memcpy (buffer[0], pcm, 1152 * sizeof (short));
+  }
+  else {
+#if defined(__SSE2__)
+    if (channels == 2 && simd != SIMD_NONE) {
+      for (; i < 1152; i += 8) {
+        const __m128i v0 = _mm_loadu_si128 ((const __m128i *) (pcm + 2 * i));
+        const __m128i v1 = _mm_loadu_si128 ((const __m128i *) (pcm + 2 * i + 8));
+        const __m128i l = _mm_packs_epi32 (_mm_srai_epi32 (_mm_slli_epi32 (v0, 16), 16),
+                                           _mm_srai_epi32 (_mm_slli_epi32 (v1, 16), 16));
+        const __m128i r = _mm_packs_epi32 (_mm_srai_epi32 (v0, 16), _mm_srai_epi32 (v1, 16));
+        _mm_storeu_si128 ((__m128i *) (buffer[0] + i), l);
+        _mm_storeu_si128 ((__m128i *) (buffer[1] + i), r);
+      }
     }
-    s[i] = s0 + s1;
-    s[31 - i] = s0 - s1;
+#elif defined(__aarch64__)
+    if (channels == 2 && simd != SIMD_NONE) {
+      for (; i < 1152; i += 8) {
+        const int16x8x2_t lr = vld2q_s16 (pcm + 2 * i);
+        vst1q_s16 (buffer[0] + i, lr.val[0]);
+        vst1q_s16 (buffer[1] + i, lr.val[1]);
+      }
+    }
+#endif
+    for (; i < 1152; i++)
+      for (ch = 0; ch < nch && ch < channels; ch++)
+        buffer[ch][i] = pcm[i * channels + ch];
   }
 
-  half[ch] = (half[ch] + 1) & 1;
-  if (half[ch] == 1)
-    off[ch] = (off[ch] + 7) & 7;
+  for (ch = channels; ch < nch; ch++)
+    memcpy (buffer[ch], buffer[channels - 1], 1152 * sizeof (short));
 }
@@ -1,6 +1,23 @@
 
 
-void  WindowFilterSubband( short *pBuffer, int ch, double s[SBLIMIT] );
+/* State of the polyphase filterbank of one encoder */
+typedef struct subband_mem_struct {
+  /* Two halves of 8 phases of 32 samples for each channel, so that the
+     samples windowed together are contiguous */
+  double x[2][512];
+  /* DCT matrix, transposed: 16 subbands for each of the 32 inputs */
+  double m[32][16];
+  int off[2];
+  int half[2];
+  int simd;			/* SIMD_* variant, they all give identical results */
+} subband_mem;
+
+void subband_init (subband_mem * smem);
+void WindowFilterSubband (subband_mem * smem, short *pBuffer, int ch, double s[SBLIMIT]);
+void WindowFilterSubbandInterleaved (subband_mem * smem, const short *pBuffer,
+                                     int channels, int nch, double s[2][SBLIMIT]);
+void deinterleave_pcm (int simd, const short *pcm, int channels, int nch,
+                       short buffer[2][1152]);
 void create_dct_matrix (double filter[16][32]);
 
 #ifdef REFERENCECODE
@@ -9,7 +9,91 @@
 /*! All exported functions shown here return zero
  * on success */
 
-/*! Initialise toolame encoding library. */
+/*! The state of one encoder. Each context is independent of the others,
+ * and different contexts may be used concurrently from different threads.
+ * A single context must not be used from several threads at the same time.
+ */
+typedef struct toolame_ctx toolame_ctx;
+
+/*! Create an encoder with default settings. Returns NULL on failure. */
+toolame_ctx *toolame_ctx_create(void);
+
+/*! Release all memory used by the encoder. */
+void toolame_ctx_destroy(toolame_ctx *ctx);
+
+/*! Finish encoding the pending samples.
+ *
+ * \return number of bytes written to output_buffer
+ */
+int toolame_ctx_finish(
+        toolame_ctx *ctx,
+        unsigned char *output_buffer,
+        size_t output_buffer_size);
+
+int toolame_ctx_enable_byteswap(toolame_ctx *ctx);
+
+/*! Set channel mode. Allowed values:
+ * s, d, j, and m
+ */
+int toolame_ctx_set_channel_mode(toolame_ctx *ctx, const char mode);
+
+/*! Valid PSY models: 0 to 3 */
+int toolame_ctx_set_psy_model(toolame_ctx *ctx, int new_model);
+
+/*! Find the subband that gets the next bits with a tournament tree instead of
+ * scanning all subbands, which is faster and gives the same bitstream.
+ * Disabled by default. */
+int toolame_ctx_set_fast_bit_allocation(toolame_ctx *ctx, int enable);
+
+/*! Run the psy model only every interval frames, and reuse its SMRs for
+ * the frames in between. The model still runs immediately on frames with
+ * an attack. Valid intervals: 1 (every frame, the default) to 100 */
+int toolame_ctx_set_psy_interval(toolame_ctx *ctx, int interval);
+
+/*! Get how many times the psy model ran, and how many of these runs were
+ * caused by an attack, since the encoder was created. */
+int toolame_ctx_get_psy_stats(
+        toolame_ctx *ctx,
+        unsigned long *num_runs,
+        unsigned long *num_transients);
+
+int toolame_ctx_set_bitrate(toolame_ctx *ctx, int brate);
+
+/*! Set sample rate in Hz */
+int toolame_ctx_set_samplerate(toolame_ctx *ctx, long sample_rate);
+
+/*! Enable PAD insertion from the specified file with length */
+int toolame_ctx_set_pad(toolame_ctx *ctx, int pad_len);
+
+/*! Encodes one frame. Returns number of bytes written to output_buffer
+ */
+int toolame_ctx_encode_frame(
+        toolame_ctx *ctx,
+        short buffer[2][1152],
+        unsigned char *xpad_data,
+        size_t xpad_len,
+        unsigned char *output_buffer,
+        size_t output_buffer_size);
+
+/*! Same as toolame_ctx_encode_frame(), with the 1152 samples of each
+ * channel interleaved in pcm, in host byte order, as they come from an
+ * audio input. channels is 1 or 2. The samples are deinterleaved by the
+ * polyphase filterbank while it reads them. Returns -1 if channels is
+ * invalid.
+ */
+int toolame_ctx_encode_frame_interleaved(
+        toolame_ctx *ctx,
+        const short *pcm,
+        int channels,
+        unsigned char *xpad_data,
+        size_t xpad_len,
+        unsigned char *output_buffer,
+        size_t output_buffer_size);
+
+/*! The functions below use a single context shared by the whole process,
+ * and are kept for compatibility. */
+
+/*! Initialise toolame encoding library. Resets the shared context. */
 int toolame_init(void);
 
 /*! Finish encoding the pending samples.
@@ -3,6 +3,22 @@
 #include <stdint.h>
 #include <math.h>
 
+int simd_best(void)
+{
+#if defined(__SSE2__)
+#if defined(__GNUC__)
+    if (__builtin_cpu_supports("avx")) {
+        return SIMD_AVX;
+    }
+#endif
+    return SIMD_SSE2;
+#elif defined(__aarch64__)
+    return SIMD_NEON;
+#else
+    return SIMD_NONE;
+#endif
+}
+
 /* Taken from sox */
 const char* level(int channel, int* peak)
 {
@@ -11,6 +11,15 @@
 
 #define linear_to_dB(x) (log10(x) * 20)
 
+/* Instruction sets the DSP kernels can be built with */
+#define SIMD_NONE 0
+#define SIMD_SSE2 1
+#define SIMD_AVX  2
+#define SIMD_NEON 3
+
+/* Return the fastest SIMD_* variant this CPU supports */
+int simd_best(void);
+
 /* Calculate the little string containing a bargraph
  * 'VU-meter' from the peak value measured
  */
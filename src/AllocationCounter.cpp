@@ -0,0 +1,118 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+
+#include "AllocationCounter.h"
+
+#if HAVE_ALLOCATION_CHECK
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <cstdio>
+#include <execinfo.h>
+#include <unistd.h>
+
+using namespace std;
+
+static atomic<size_t> num_allocations(0);
+static atomic<bool> trace_allocations(false);
+
+// Avoids recursion if printing the backtrace allocates
+static thread_local bool in_trace = false;
+
+size_t allocation_count(void)
+{
+    return num_allocations.load(memory_order_relaxed);
+}
+
+void allocation_trace_enable(bool enable)
+{
+    if (enable) {
+        // The first call to backtrace() loads libgcc, which allocates
+        void *frames[1];
+        backtrace(frames, 1);
+    }
+    trace_allocations.store(enable);
+}
+
+static void count_allocation(size_t size)
+{
+    num_allocations.fetch_add(1, memory_order_relaxed);
+
+    if (trace_allocations.load(memory_order_relaxed) and not in_trace) {
+        in_trace = true;
+        void *frames[32];
+        const int num_frames = backtrace(frames, 32);
+        fprintf(stderr, "Allocation of %zu bytes from:\n", size);
+        backtrace_symbols_fd(frames, num_frames, STDERR_FILENO);
+        in_trace = false;
+    }
+}
+
+void* operator new(size_t size)
+{
+    count_allocation(size);
+    void *p = malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+    count_allocation(size);
+    return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept
+{
+    return operator new(size, nothrow);
+}
+
+void* operator new(size_t size, align_val_t alignment)
+{
+    count_allocation(size);
+    void *p = nullptr;
+    if (posix_memalign(&p, max(sizeof(void*), (size_t)alignment), size ? size : 1) != 0) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size, align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, align_val_t) noexcept { free(p); }
+void operator delete[](void *p, align_val_t) noexcept { free(p); }
+void operator delete(void *p, size_t, align_val_t) noexcept { free(p); }
+void operator delete[](void *p, size_t, align_val_t) noexcept { free(p); }
+
+#endif // HAVE_ALLOCATION_CHECK
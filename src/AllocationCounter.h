@@ -0,0 +1,43 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+/*! \file AllocationCounter.h
+ *
+ * When configured with --enable-allocation-check, the global operator new
+ * gets replaced by one that counts the allocations of all threads. The
+ * --check-allocations option uses it to verify that the encoder does not
+ * allocate once it has warmed up.
+ *
+ * Allocations done with malloc() directly, e.g. inside the C libraries,
+ * are not counted.
+ */
+
+#pragma once
+
+#include "config.h"
+#include <cstddef>
+
+#if HAVE_ALLOCATION_CHECK
+
+/*! Number of allocations done with operator new since startup */
+size_t allocation_count(void);
+
+/*! When enabled, every allocation prints a backtrace to stderr, to find out
+ * where it comes from. */
+void allocation_trace_enable(bool enable);
+
+#endif // HAVE_ALLOCATION_CHECK
@@ -82,11 +82,17 @@ void AlsaInput::m_init_alsa()
                 alsa_strerror(err) + ")");
     }
 
+    unsigned int device_rate = m_rate;
     if ((err = snd_pcm_hw_params_set_rate_near(m_alsa_handle,
-                hw_params, &m_rate, 0)) < 0) {
+                hw_params, &device_rate, 0)) < 0) {
         throw runtime_error("cannot set sample rate (" + alsa_strerror(err) + ")");
     }
 
+    if (device_rate != m_rate) {
+        fprintf(stderr, "Converting ALSA sample rate %u to %u\n", device_rate, m_rate);
+        m_converter = make_unique<SampleRateConverter>(m_channels, device_rate, m_rate);
+    }
+
     if ((err = snd_pcm_hw_params_set_channels(m_alsa_handle,
                     hw_params, m_channels)) < 0) {
         throw runtime_error("cannot set channel count (" +
@@ -126,6 +132,18 @@ ssize_t AlsaInput::m_read(uint8_t* buf, snd_pcm_uframes_t length)
     return err;
 }
 
+void AlsaInput::m_push(const uint8_t* buf, size_t num_frames)
+{
+    if (m_converter) {
+        m_converter->process(reinterpret_cast<const int16_t*>(buf), num_frames, m_converted);
+        m_queue.push(reinterpret_cast<const uint8_t*>(m_converted.data()),
+                m_converted.size() * BYTES_PER_SAMPLE);
+    }
+    else {
+        m_queue.push(buf, BYTES_PER_SAMPLE * m_channels * num_frames);
+    }
+}
+
 AlsaInputThreaded::~AlsaInputThreaded()
 {
     m_running = false;
@@ -169,26 +187,40 @@ void AlsaInputThreaded::process()
             break;
         }
 
-        m_queue.push(samplebuf, BYTES_PER_SAMPLE*m_channels*n);
+        m_push(samplebuf, n);
     }
 }
 
 void AlsaInputDirect::prepare()
 {
     m_init_alsa();
+
+    // The converter needs the most input frames on the first read, while
+    // its history is empty. Later reads stay within this capacity.
+    m_samplebuf.resize(m_frames_to_read(m_read_bytes) * m_channels * BYTES_PER_SAMPLE);
+}
+
+size_t AlsaInputDirect::m_frames_to_read(size_t num_bytes) const
+{
+    const size_t bytes_per_frame = m_channels * BYTES_PER_SAMPLE;
+
+    // With sample rate conversion, read enough frames at the device rate
+    return m_converter ?
+        m_converter->input_frames_needed(num_bytes / bytes_per_frame) :
+        num_bytes / bytes_per_frame;
 }
 
 bool AlsaInputDirect::read_source(size_t num_bytes)
 {
-    const int bytes_per_frame = m_channels * BYTES_PER_SAMPLE;
+    const size_t bytes_per_frame = m_channels * BYTES_PER_SAMPLE;
     assert(num_bytes % bytes_per_frame == 0);
 
-    const size_t num_frames = num_bytes / bytes_per_frame;
-    vector<uint8_t> buf(num_bytes);
-    ssize_t ret = m_read(buf.data(), num_frames);
+    const size_t num_frames = m_frames_to_read(num_bytes);
+    m_samplebuf.resize(num_frames * bytes_per_frame);
+    ssize_t ret = m_read(m_samplebuf.data(), num_frames);
 
     if (ret > 0) {
-        m_queue.push(buf.data(), ret * bytes_per_frame);
+        m_push(m_samplebuf.data(), ret);
     }
     return ret == (ssize_t)num_frames;
 }
@@ -34,7 +34,10 @@
 
 #include <alsa/asoundlib.h>
 
+#include <memory>
+#include <vector>
 #include "SampleQueue.h"
+#include "SampleRateConverter.h"
 #include "common.h"
 #include "InputInterface.h"
 
@@ -68,6 +71,10 @@ class AlsaInput : public InputInterface
         /* Open the ALSA device and set it up */
         void m_init_alsa(void);
 
+        /* Push samples read from the device to the queue, converting them
+         * if the device does not support the requested rate */
+        void m_push(const uint8_t* buf, size_t num_frames);
+
         std::string m_alsa_dev;
         unsigned int m_channels;
         unsigned int m_rate;
@@ -75,29 +82,46 @@ class AlsaInput : public InputInterface
         SampleQueue<uint8_t>& m_queue;
 
         snd_pcm_t *m_alsa_handle = nullptr;
+
+        std::unique_ptr<SampleRateConverter> m_converter;
+        std::vector<int16_t> m_converted;
 };
 
 class AlsaInputDirect : public AlsaInput
 {
     public:
+        /*! read_bytes is the number of bytes the encoder asks for in each
+         * read_source() call */
         AlsaInputDirect(const std::string& alsa_dev,
                 unsigned int channels,
                 unsigned int rate,
-                SampleQueue<uint8_t>& queue) :
-            AlsaInput(alsa_dev, channels, rate, queue) { }
+                SampleQueue<uint8_t>& queue,
+                size_t read_bytes) :
+            AlsaInput(alsa_dev, channels, rate, queue),
+            m_read_bytes(read_bytes) { }
 
+        /*! Open the device and allocate the sample buffer */
         virtual void prepare(void) override;
 
         virtual bool fault_detected(void) const override { return false; };
 
         virtual bool read_source(size_t num_bytes) override;
 
+        virtual bool fills_queue_on_read(void) const override { return true; }
+
         /*! Read length Bytes from from the alsa device.
          * length must be a multiple of channels * bytes_per_sample.
          *
          * \return the number of bytes read.
          */
         ssize_t read(uint8_t* buf, size_t length);
+
+    private:
+        /* Number of frames to read from the device for num_bytes of output */
+        size_t m_frames_to_read(size_t num_bytes) const;
+
+        size_t m_read_bytes;
+        std::vector<uint8_t> m_samplebuf;
 };
 
 class AlsaInputThreaded : public AlsaInput
@@ -0,0 +1,111 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+/*! \file ByteRing.h
+ *
+ * A ring of bytes that are written in blocks of any size, and read in chunks
+ * of at most max_read bytes. It is used to cut the output of the MPEG
+ * encoder into the frames ODR-DabMux expects.
+ *
+ * Every chunk can be read in place from one contiguous pointer, even when it
+ * wraps around the end of the ring: the first max_read bytes of the ring are
+ * mirrored after its end. The memory is allocated in the constructor, writing
+ * and reading never allocate nor move the buffered data.
+ *
+ * Not thread-safe, both sides must be used from the same thread.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+class ByteRing
+{
+public:
+    ByteRing(size_t capacity, size_t max_read) :
+        m_buf(capacity + max_read),
+        m_capacity(capacity),
+        m_max_read(max_read)
+    {
+        if (capacity == 0 or max_read > capacity) {
+            throw std::invalid_argument("ByteRing max_read larger than capacity");
+        }
+    }
+
+    ByteRing(const ByteRing&) = delete;
+    ByteRing& operator=(const ByteRing&) = delete;
+
+    /*! Number of bytes that can be read */
+    size_t size() const { return m_size; }
+
+    size_t capacity() const { return m_capacity; }
+
+    /*! Append len bytes. Returns false and writes nothing if there is not
+     * enough space left. */
+    bool write(const uint8_t *data, size_t len)
+    {
+        if (len > m_capacity - m_size) {
+            return false;
+        }
+
+        size_t pos = (m_read + m_size) % m_capacity;
+        m_size += len;
+        while (len > 0) {
+            const size_t n = std::min(len, m_capacity - pos);
+            memcpy(&m_buf[pos], data, n);
+
+            // Keep the mirror of the start of the ring up to date
+            if (pos < m_max_read) {
+                const size_t n_mirror = std::min(n, m_max_read - pos);
+                memcpy(&m_buf[m_capacity + pos], data, n_mirror);
+            }
+
+            data += n;
+            len -= n;
+            pos = 0;
+        }
+        return true;
+    }
+
+    /*! Return the oldest buffered bytes. The next min(size(), max_read)
+     * bytes are contiguous from the returned pointer. */
+    const uint8_t* read_ptr() const { return &m_buf[m_read]; }
+
+    /*! Release len bytes returned by read_ptr(), len must not be larger
+     * than max_read and size(). */
+    void consume(size_t len)
+    {
+        if (len > m_size or len > m_max_read) {
+            throw std::logic_error("ByteRing consume larger than available");
+        }
+        m_read = (m_read + len) % m_capacity;
+        m_size -= len;
+    }
+
+private:
+    std::vector<uint8_t> m_buf;
+    const size_t m_capacity;
+    const size_t m_max_read;
+
+    size_t m_read = 0;
+    size_t m_size = 0;
+};
@@ -0,0 +1,99 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+/*! \file DriftController.h
+ *
+ * A PI controller that keeps the fill level of the input queue at a target
+ * latency, by choosing the resampling ratio used to read from it. A ratio
+ * above one consumes the input faster than nominal rate.
+ */
+
+#pragma once
+
+#include <algorithm>
+
+class DriftController {
+    public:
+        /*! \param target_latency the queue fill level to aim for, in seconds
+         *  \param max_deviation the largest allowed deviation of the ratio
+         *  from one
+         */
+        DriftController(double target_latency, double max_deviation = 0.01) :
+            m_target_latency(target_latency),
+            m_max_deviation(max_deviation) {}
+
+        /*! Update the controller with the current fill level, in seconds,
+         * measured dt seconds after the previous update.
+         *
+         * \return the resampling ratio to use until the next update
+         */
+        double update(double latency, double dt)
+        {
+            /* The fill level is only a noisy measure of the latency because
+             * the input delivers samples in blocks. Smooth it with a time
+             * constant that is well below the one of the control loop. */
+            if (m_first_update) {
+                m_filtered_latency = latency;
+                m_first_update = false;
+            }
+            else {
+                const double alpha = dt / (dt + FILTER_TIME_CONSTANT);
+                m_filtered_latency += alpha * (latency - m_filtered_latency);
+            }
+
+            const double error = m_filtered_latency - m_target_latency;
+
+            double deviation = KP * error + m_integral + KI * error * dt;
+
+            // Do not wind up the integrator while the output is saturated
+            if (deviation > m_max_deviation) {
+                deviation = m_max_deviation;
+            }
+            else if (deviation < -m_max_deviation) {
+                deviation = -m_max_deviation;
+            }
+            else {
+                m_integral += KI * error * dt;
+            }
+
+            m_ratio = 1.0 + deviation;
+            return m_ratio;
+        }
+
+        /*! The ratio returned by the last update() */
+        double ratio() const { return m_ratio; }
+
+        double target_latency() const { return m_target_latency; }
+
+    private:
+        /* The gains give a critically damped loop with a natural frequency
+         * of 0.1 rad/s. Pitch changes are therefore slow enough to be
+         * inaudible, while a clock offset of a few hundred ppm is absorbed
+         * within about a minute. */
+        static constexpr double KP = 0.2;
+        static constexpr double KI = 0.01;
+        static constexpr double FILTER_TIME_CONSTANT = 1.0;
+
+        double m_target_latency;
+        double m_max_deviation;
+
+        bool m_first_update = true;
+        double m_filtered_latency = 0.0;
+        double m_integral = 0.0;
+        double m_ratio = 1.0;
+};
+
@@ -0,0 +1,146 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+
+#include "DynamicsProcessor.h"
+#include "limiter.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+using namespace std;
+
+static_assert(sizeof(FIXP_DBL) == sizeof(int32_t), "Unexpected FIXP_DBL size");
+static_assert(sizeof(INT_PCM) == sizeof(int16_t), "Unexpected INT_PCM size");
+
+/* The AGC follows the RMS level with this time constant */
+static constexpr float AGC_TIME_CONSTANT_S = 3.0f;
+
+/* The AGC does not change the gain on blocks below this level, so that it
+ * does not pull up noise in pauses */
+static constexpr float AGC_GATE_DBFS = -50.0f;
+
+/* Range of the AGC gain */
+static constexpr float AGC_MAX_GAIN_DB = 12.0f;
+
+DynamicsProcessor::DynamicsProcessor(unsigned int sample_rate, unsigned int channels,
+        float static_gain, bool agc_enabled, float agc_target_dBFS,
+        float limiter_threshold_dBFS) :
+    m_sample_rate(sample_rate),
+    m_channels(channels),
+    m_static_gain(static_gain),
+    m_agc_enabled(agc_enabled),
+    m_agc_target_dBFS(agc_target_dBFS),
+    m_agc_level_dBFS(agc_target_dBFS)
+{
+    if (limiter_threshold_dBFS > 0.0f) {
+        throw invalid_argument("Limiter threshold must not be above 0 dBFS");
+    }
+
+    const float max_agc_gain = agc_enabled ? powf(10.0f, AGC_MAX_GAIN_DB / 20.0f) : 1.0f;
+    if (static_gain * max_agc_gain > (1 << HEADROOM_BITS)) {
+        throw invalid_argument("Audio gain too large for the dynamics processing");
+    }
+
+    const double threshold = pow(10.0, limiter_threshold_dBFS / 20.0);
+    m_limiter = pcmLimiter_Create(LIMITER_ATTACK_MS, LIMITER_RELEASE_MS,
+            FL2FXCONST_DBL(std::min(threshold, 0.999999)), channels, sample_rate);
+    if (m_limiter == nullptr) {
+        throw runtime_error("Could not create the limiter");
+    }
+}
+
+DynamicsProcessor::~DynamicsProcessor()
+{
+    pcmLimiter_Destroy(m_limiter);
+}
+
+size_t DynamicsProcessor::delay_frames() const
+{
+    return pcmLimiter_GetDelay(m_limiter);
+}
+
+float DynamicsProcessor::update_agc(const int16_t *samples, size_t num_frames)
+{
+    const size_t num_samples = num_frames * m_channels;
+    int64_t sum_squares = 0;
+    for (size_t i = 0; i < num_samples; i++) {
+        sum_squares += (int32_t)samples[i] * samples[i];
+    }
+
+    if (sum_squares == 0) {
+        return m_agc_gain;
+    }
+
+    const float mean_square = (float)sum_squares / num_samples / (32768.0f * 32768.0f);
+    const float block_level_dBFS = 10.0f * log10f(mean_square * m_static_gain * m_static_gain);
+
+    if (block_level_dBFS > AGC_GATE_DBFS) {
+        const float block_duration = (float)num_frames / m_sample_rate;
+        const float alpha = 1.0f - expf(-block_duration / AGC_TIME_CONSTANT_S);
+        m_agc_level_dBFS += alpha * (block_level_dBFS - m_agc_level_dBFS);
+    }
+
+    const float gain_dB = std::max(-AGC_MAX_GAIN_DB,
+            std::min(AGC_MAX_GAIN_DB, m_agc_target_dBFS - m_agc_level_dBFS));
+    return powf(10.0f, gain_dB / 20.0f);
+}
+
+void DynamicsProcessor::process(int16_t *samples, size_t num_frames)
+{
+    if (num_frames == 0) {
+        return;
+    }
+
+    const size_t num_samples = num_frames * m_channels;
+    if (m_limiter_input.size() < num_samples) {
+        m_limiter_input.resize(num_samples);
+        m_gain_per_sample.resize(num_frames);
+    }
+
+    const float previous_gain = m_agc_gain;
+    if (m_agc_enabled) {
+        m_agc_gain = update_agc(samples, num_frames);
+    }
+
+    // Ramp the gain linearly over the block to avoid discontinuities. The
+    // gains are scaled down by the headroom, which the limiter restores on
+    // its output.
+    const float scale = (float)(1u << 31) / (1 << HEADROOM_BITS) * m_static_gain;
+    const int64_t g0 = llrintf(previous_gain * scale);
+    const int64_t g1 = llrintf(m_agc_gain * scale);
+    for (size_t i = 0; i < num_frames; i++) {
+        const int64_t g = g0 + (g1 - g0) * (int64_t)(i + 1) / (int64_t)num_frames;
+        m_gain_per_sample[i] = std::min<int64_t>(g, MAXVAL_DBL);
+    }
+
+    for (size_t i = 0; i < num_samples; i++) {
+        m_limiter_input[i] = (int32_t)samples[i] << 16;
+    }
+
+    pcmLimiter_Apply(m_limiter,
+            reinterpret_cast<PCM_LIM*>(m_limiter_input.data()),
+            reinterpret_cast<INT_PCM*>(samples),
+            reinterpret_cast<FIXP_DBL*>(m_gain_per_sample.data()),
+            HEADROOM_BITS, num_frames);
+
+    // minGain is the smallest limiter gain of the block, scaled by 1/2
+    const float min_gain = (float)m_limiter->minGain / (1u << 30);
+    m_levels.agc_gain = 20.0f * log10f(m_agc_gain);
+    m_levels.limiter_reduction = min_gain < 1.0f ? -20.0f * log10f(min_gain) : 0.0f;
+}
+
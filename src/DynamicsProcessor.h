@@ -0,0 +1,100 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+/*! \file DynamicsProcessor.h
+ *
+ * Pre-encoder dynamics processing: a slow automatic gain control that rides
+ * the level towards a target RMS level, followed by the brickwall look-ahead
+ * limiter from FDK libPCMutils.
+ *
+ * The AGC computes one gain per block of samples and ramps towards it over
+ * the block. The per-sample gains and the samples are handed to the limiter
+ * in fixed point, the limiter then applies the gain and the limiting in a
+ * single pass. The look-ahead of the limiter delays the audio, see
+ * delay_frames().
+ */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct TDLimiter;
+
+/*! The state of the dynamics processing after one block, for the stats */
+struct dynamics_levels_t {
+    float agc_gain = 0.0f;          // dB
+    float limiter_reduction = 0.0f; // dB, largest in the block
+};
+
+class DynamicsProcessor {
+    public:
+        /*! Look-ahead and attack time of the limiter */
+        static constexpr unsigned int LIMITER_ATTACK_MS = 5;
+
+        /*! Release time of the limiter */
+        static constexpr unsigned int LIMITER_RELEASE_MS = 50;
+
+        /*! Largest gain AGC and static gain can apply together. The limiter
+         * input is scaled down by this headroom. */
+        static constexpr int HEADROOM_BITS = 3;
+
+        /*! \param sample_rate, channels the input format
+         *  \param static_gain linear gain always applied before the limiter
+         *  \param agc_enabled whether to apply the AGC
+         *  \param agc_target_dBFS the RMS level the AGC aims for
+         *  \param limiter_threshold_dBFS the level the peaks are limited to
+         */
+        DynamicsProcessor(unsigned int sample_rate, unsigned int channels,
+                float static_gain, bool agc_enabled, float agc_target_dBFS,
+                float limiter_threshold_dBFS);
+        DynamicsProcessor(const DynamicsProcessor&) = delete;
+        DynamicsProcessor& operator=(const DynamicsProcessor&) = delete;
+        ~DynamicsProcessor();
+
+        /*! Process num_frames interleaved frames in place */
+        void process(int16_t *samples, size_t num_frames);
+
+        /*! The delay the limiter look-ahead adds, in frames */
+        size_t delay_frames() const;
+
+        /*! The state after the last call to process() */
+        dynamics_levels_t levels() const { return m_levels; }
+
+    private:
+        /*! Update the AGC with one block, return the new linear gain */
+        float update_agc(const int16_t *samples, size_t num_frames);
+
+        unsigned int m_sample_rate;
+        unsigned int m_channels;
+        float m_static_gain;
+
+        bool m_agc_enabled;
+        float m_agc_target_dBFS;
+        float m_agc_level_dBFS;
+        float m_agc_gain = 1.0f;
+
+        TDLimiter *m_limiter = nullptr;
+
+        // Preallocated buffers for the limiter input
+        std::vector<int32_t> m_limiter_input;
+        std::vector<int32_t> m_gain_per_sample;
+
+        dynamics_levels_t m_levels;
+};
+
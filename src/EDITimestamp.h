@@ -0,0 +1,68 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+/*! \file EDITimestamp.h
+ *
+ * The EDI time and TIST of the first frame sent by the EDI output. The
+ * timestamp is at level 2, in units of 1/16384 ms, and stays below one
+ * second.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+
+struct edi_timestamp_t {
+    std::time_t seconds = 0;
+    uint32_t timestamp = 0;
+};
+
+constexpr int64_t EDI_TIMESTAMP_UNITS_PER_MS = 1 << 14;
+constexpr int64_t EDI_TIMESTAMP_UNITS_PER_S = 1000 * EDI_TIMESTAMP_UNITS_PER_MS;
+
+/*! Return the time of the first frame, delay_ms after now.
+ *
+ * The part of the delay below one second is rounded up to a multiple of
+ * 24ms, the duration of a frame. The audio left the input
+ * processing_delay_ms earlier than the encoder output, this is subtracted
+ * exactly.
+ */
+inline edi_timestamp_t initial_edi_timestamp(std::time_t now,
+        uint32_t delay_ms, uint32_t processing_delay_ms)
+{
+    /* TODO we still have to see if 24ms granularity is achievable, given that
+     * one DAB+ super frame is carried over more than 1 ETI frame.
+     */
+    int64_t units = (int64_t)(delay_ms / 1000) * EDI_TIMESTAMP_UNITS_PER_S;
+    for (int32_t sub_ms = delay_ms % 1000; sub_ms > 0; sub_ms -= 24) {
+        units += 24 * EDI_TIMESTAMP_UNITS_PER_MS;
+    }
+
+    units -= (int64_t)processing_delay_ms * EDI_TIMESTAMP_UNITS_PER_MS;
+
+    // Round towards minus infinity, the timestamp is never negative
+    int64_t seconds = units / EDI_TIMESTAMP_UNITS_PER_S;
+    if (units % EDI_TIMESTAMP_UNITS_PER_S < 0) {
+        seconds -= 1;
+    }
+
+    edi_timestamp_t t;
+    t.seconds = now + seconds;
+    t.timestamp = units - seconds * EDI_TIMESTAMP_UNITS_PER_S;
+    return t;
+}
@@ -17,6 +17,7 @@
  */
 
 #include "FileInput.h"
+#include "common.h"
 #include "wavfile.h"
 #include <cstring>
 #include <cstdio>
@@ -78,30 +79,46 @@ void FileInput::prepare(void)
             throw runtime_error("Unsupported WAV channels " + to_string(channels));
         }
         if (m_sample_rate != sample_rate) {
-            throw runtime_error(
-                    "WAV sample rate " +
-                    to_string(sample_rate) +
-                    " doesn't correspond to desired sample rate " +
-                    to_string(m_sample_rate));
+            fprintf(stderr, "Converting WAV sample rate %d to %d\n",
+                    sample_rate, m_sample_rate);
+            m_converter = make_unique<SampleRateConverter>(
+                    channels, sample_rate, m_sample_rate);
+            m_wav_channels = channels;
         }
     }
 }
 
 bool FileInput::read_source(size_t num_bytes)
 {
-    vector<uint8_t> samplebuf(num_bytes);
+    if (m_converter) {
+        // Read as many frames at the file sample rate as needed to produce
+        // num_bytes at the encoder sample rate
+        const size_t bytes_per_frame = BYTES_PER_SAMPLE * m_wav_channels;
+        const size_t num_frames = m_converter->input_frames_needed(num_bytes / bytes_per_frame);
+        num_bytes = num_frames * bytes_per_frame;
+    }
+
+    // Keep the capacity of the buffer from one call to the next
+    m_samplebuf.resize(num_bytes);
+    uint8_t *samplebuf = m_samplebuf.data();
 
     ssize_t ret = 0;
 
     if (m_raw_input) {
-        ret = fread(samplebuf.data(), 1, num_bytes, m_in_fh);
+        ret = fread(samplebuf, 1, num_bytes, m_in_fh);
     }
     else {
-        ret = wav_read_data(m_wav, samplebuf.data(), num_bytes);
+        ret = wav_read_data(m_wav, samplebuf, num_bytes);
     }
 
-    if (ret > 0) {
-        m_queue.push(samplebuf.data(), ret);
+    if (ret > 0 and m_converter) {
+        m_converter->process(reinterpret_cast<const int16_t*>(samplebuf),
+                ret / (BYTES_PER_SAMPLE * m_wav_channels), m_converted);
+        m_queue.push(reinterpret_cast<const uint8_t*>(m_converted.data()),
+                m_converted.size() * BYTES_PER_SAMPLE);
+    }
+    else if (ret > 0) {
+        m_queue.push(samplebuf, ret);
     }
 
     if (ret < (ssize_t)num_bytes) {
@@ -22,8 +22,9 @@
  * The raw input needs to be signed 16-bit per sample data, with
  * the number of channels corresponding to the command line.
  *
- * The wav input must also correspond to the parameters on the command
- * line (number of channels, rate)
+ * The wav input must also correspond to the number of channels given on the
+ * command line. If its sample rate differs from the encoder sample rate,
+ * it gets converted.
  */
 
 #pragma once
@@ -31,7 +32,10 @@
 #include <stdint.h>
 #include <cstdio>
 #include <string>
+#include <memory>
+#include <vector>
 #include "SampleQueue.h"
+#include "SampleRateConverter.h"
 #include "InputInterface.h"
 
 class FileInput : public InputInterface
@@ -59,6 +63,8 @@ class FileInput : public InputInterface
 
         virtual bool read_source(size_t num_bytes) override;
 
+        virtual bool fills_queue_on_read(void) const override { return true; }
+
     protected:
         std::string m_filename;
         bool m_raw_input;
@@ -69,5 +75,11 @@ class FileInput : public InputInterface
         /* handle to the wav reader */
         void *m_wav = nullptr;
         FILE* m_in_fh = nullptr;
+        std::vector<uint8_t> m_samplebuf;
+
+        /* Set if the wav file has a different sample rate */
+        std::unique_ptr<SampleRateConverter> m_converter;
+        int m_wav_channels = 0;
+        std::vector<int16_t> m_converted;
 };
 
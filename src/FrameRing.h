@@ -0,0 +1,212 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+/*! \file FrameRing.h
+ *
+ * A bounded single-producer single-consumer ring of frames, used to connect
+ * the stages of the encoding pipeline.
+ *
+ * All slots are allocated up front. The producer fills the slot returned by
+ * write_slot() in place and publishes it with commit_write(), the consumer
+ * reads the slot returned by read_slot() and releases it with
+ * commit_read(). Neither side takes a lock; a mutex and condition variable
+ * are only used to put a side to sleep when the ring is empty or full.
+ *
+ * The stages share a PipelineControl to stop the pipeline and report its
+ * result.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <vector>
+#include <stdexcept>
+#include <cstddef>
+
+template<typename T>
+class FrameRing
+{
+public:
+    /*! capacity must be a power of two */
+    explicit FrameRing(size_t capacity) :
+        m_slots(capacity),
+        m_mask(capacity - 1)
+    {
+        if (capacity == 0 or (capacity & m_mask) != 0) {
+            throw std::invalid_argument("FrameRing capacity must be a power of two");
+        }
+    }
+
+    FrameRing(const FrameRing&) = delete;
+    FrameRing& operator=(const FrameRing&) = delete;
+
+    /*! Access all slots, e.g. to preallocate buffers inside them before
+     * the ring is used. */
+    std::vector<T>& slots() { return m_slots; }
+
+    /*! Number of frames ready to be read */
+    size_t size() const
+    {
+        return m_write_ix.load(std::memory_order_acquire) -
+            m_read_ix.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return m_slots.size(); }
+
+    /*! Producer side: return the slot to fill, or nullptr if the ring is full */
+    T* write_slot()
+    {
+        const size_t w = m_write_ix.load(std::memory_order_relaxed);
+        if (w - m_read_ix.load(std::memory_order_acquire) == m_slots.size()) {
+            return nullptr;
+        }
+        return &m_slots[w & m_mask];
+    }
+
+    /*! Producer side: publish the slot returned by write_slot() */
+    void commit_write()
+    {
+        m_write_ix.fetch_add(1, std::memory_order_seq_cst);
+        if (m_consumer_waiting.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cond.notify_all();
+        }
+    }
+
+    /*! Consumer side: return the oldest frame, or nullptr if the ring is empty */
+    T* read_slot()
+    {
+        const size_t r = m_read_ix.load(std::memory_order_relaxed);
+        if (m_write_ix.load(std::memory_order_acquire) == r) {
+            return nullptr;
+        }
+        return &m_slots[r & m_mask];
+    }
+
+    /*! Consumer side: release the slot returned by read_slot() */
+    void commit_read()
+    {
+        m_read_ix.fetch_add(1, std::memory_order_seq_cst);
+        if (m_producer_waiting.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cond.notify_all();
+        }
+    }
+
+    /*! Consumer side: wait until a frame is available, or the timeout
+     * expires. \return the frame or nullptr on timeout */
+    T* wait_read_slot(std::chrono::milliseconds timeout)
+    {
+        T* slot = read_slot();
+        if (slot == nullptr) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_consumer_waiting.store(true, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_cond.wait_for(lock, timeout, [&]{ return (slot = read_slot()) != nullptr; });
+            m_consumer_waiting.store(false, std::memory_order_relaxed);
+        }
+        return slot;
+    }
+
+    /*! Producer side: wait until a slot is free, or the timeout expires.
+     * \return the slot or nullptr on timeout */
+    T* wait_write_slot(std::chrono::milliseconds timeout)
+    {
+        T* slot = write_slot();
+        if (slot == nullptr) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_producer_waiting.store(true, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_cond.wait_for(lock, timeout, [&]{ return (slot = write_slot()) != nullptr; });
+            m_producer_waiting.store(false, std::memory_order_relaxed);
+        }
+        return slot;
+    }
+
+private:
+    std::vector<T> m_slots;
+    const size_t m_mask;
+
+    /* Indices grow monotonically and are masked on access. They are kept on
+     * separate cache lines so that producer and consumer do not
+     * invalidate each other's cache line on every frame. */
+    alignas(64) std::atomic<size_t> m_write_ix = {0};
+    alignas(64) std::atomic<size_t> m_read_ix = {0};
+
+    alignas(64) std::atomic<bool> m_consumer_waiting = {false};
+    std::atomic<bool> m_producer_waiting = {false};
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+/*! Stops the stages of a pipeline. The first stage to call stop() decides
+ * the result of the pipeline: an exit code, or an exception to rethrow
+ * once all stages have terminated. The stages check running() between
+ * their waits on the rings.
+ */
+class PipelineControl
+{
+public:
+    void start()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_retval = 0;
+        m_exception = nullptr;
+        m_running = true;
+    }
+
+    bool running() const { return m_running.load(); }
+
+    void stop(int retval)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_running) {
+            m_retval = retval;
+            m_running = false;
+        }
+    }
+
+    void stop(std::exception_ptr e)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_running) {
+            m_exception = e;
+            m_running = false;
+        }
+    }
+
+    /*! Call once all stages have terminated: rethrow the exception that
+     * stopped the pipeline, or return its exit code */
+    int result()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_exception) {
+            std::rethrow_exception(m_exception);
+        }
+        return m_retval;
+    }
+
+private:
+    std::atomic<bool> m_running = {false};
+    std::mutex m_mutex;
+    int m_retval = 0;
+    std::exception_ptr m_exception;
+};
@@ -50,4 +50,11 @@ class InputInterface {
          *  false means a normal termination of the input (e.g. end of file)
          */
         virtual bool read_source(size_t num_bytes) = 0;
+
+        /*! Return true if the queue only gets filled by read_source(), i.e.
+         *  if the input has no thread or callback of its own that delivers
+         *  samples. The multi-service scheduler uses this to know if it must
+         *  wait for the queue to fill up before encoding a frame.
+         */
+        virtual bool fills_queue_on_read(void) const { return false; }
 };
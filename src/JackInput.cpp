@@ -75,11 +75,10 @@ void JackInput::prepare()
        just decides to stop calling us. */
     jack_on_shutdown(m_client, shutdown_cb, this);
 
-    if (m_rate != jack_get_sample_rate(m_client)) {
-        throw runtime_error(
-                "JACK uses different sample_rate " +
-                to_string(jack_get_sample_rate(m_client)) +
-                " than requested (" + to_string(m_rate) + ")!");
+    const unsigned int jack_rate = jack_get_sample_rate(m_client);
+    if (m_rate != jack_rate) {
+        fprintf(stderr, "Converting JACK sample rate %u to %u\n", jack_rate, m_rate);
+        m_converter = make_unique<SampleRateConverter>(m_channels, jack_rate, m_rate);
     }
 
     /* create ports */
@@ -148,7 +147,13 @@ void JackInput::jack_process(jack_nframes_t nframes)
         }
     }
 
-    m_queue.push((uint8_t*)&buffer.front(), buffer.size() * sizeof(uint16_t));
+    if (m_converter) {
+        m_converter->process(buffer.data(), nframes, m_converted);
+        m_queue.push((uint8_t*)m_converted.data(), m_converted.size() * sizeof(uint16_t));
+    }
+    else {
+        m_queue.push((uint8_t*)&buffer.front(), buffer.size() * sizeof(uint16_t));
+    }
 }
 
 #endif // HAVE_JACK
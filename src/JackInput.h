@@ -34,7 +34,10 @@ extern "C" {
 #include <jack/jack.h>
 }
 
+#include <memory>
+#include <vector>
 #include "SampleQueue.h"
+#include "SampleRateConverter.h"
 #include "InputInterface.h"
 
 // 16 bits per sample is fine for now
@@ -86,6 +89,10 @@ class JackInput : public InputInterface
 
         SampleQueue<uint8_t>& m_queue;
 
+        /* Set if the JACK server runs at a different sample rate */
+        std::unique_ptr<SampleRateConverter> m_converter;
+        std::vector<int16_t> m_converted;
+
         // Static functions for JACK callbacks
         static int process_cb(jack_nframes_t nframes, void *arg)
         {
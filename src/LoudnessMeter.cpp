@@ -0,0 +1,368 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+
+#include "LoudnessMeter.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+#if defined(__SSE__)
+#  include <xmmintrin.h>
+#endif
+
+using namespace std;
+
+/* The input is processed in chunks of this many frames, so that the
+ * true-peak history buffers have a fixed size */
+static constexpr size_t CHUNK_FRAMES = 1024;
+
+/* The true-peak interpolation filter has 48 taps at the 4x oversampled
+ * rate, i.e. 12 taps for each of the 4 phases */
+static constexpr size_t TP_PHASES = 4;
+static constexpr size_t TP_TAPS = 12;
+
+/* Histogram from -70 LUFS (the absolute gate) to +5 LUFS, in 0.1 LU steps */
+static constexpr double HIST_MIN = -70.0;
+static constexpr size_t HIST_BINS = 750;
+
+static float tp_coeffs[TP_TAPS * TP_PHASES] __attribute__((aligned(16)));
+
+static void init_tp_coeffs()
+{
+    const size_t length = TP_TAPS * TP_PHASES;
+    const double center = (length - 1) / 2.0;
+    const double beta = 6.0;
+
+    auto bessel_i0 = [](double x) {
+        double sum = 1.0, term = 1.0;
+        for (int k = 1; k < 32; k++) {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+        return sum;
+    };
+
+    vector<double> prototype(length);
+    for (size_t m = 0; m < length; m++) {
+        const double d = (m - center) / TP_PHASES;
+        const double sinc = (d == 0.0) ? 1.0 : sin(M_PI * d) / (M_PI * d);
+        const double r = (m - center) / (center + 1);
+        prototype[m] = sinc * bessel_i0(beta * sqrt(1.0 - r * r)) / bessel_i0(beta);
+    }
+
+    // Tap t of phase k is at prototype index TP_PHASES * t + k. Store the
+    // four phases of each tap next to each other, and normalise each phase
+    // to unity gain.
+    for (size_t k = 0; k < TP_PHASES; k++) {
+        double sum = 0.0;
+        for (size_t t = 0; t < TP_TAPS; t++) {
+            sum += prototype[TP_PHASES * t + k];
+        }
+        for (size_t t = 0; t < TP_TAPS; t++) {
+            tp_coeffs[t * TP_PHASES + k] = prototype[TP_PHASES * t + k] / sum;
+        }
+    }
+}
+
+/* Return the largest absolute value of the 4x oversampled signal. x points
+ * to the first of num_samples new samples, and is preceded by TP_TAPS-1
+ * older samples. */
+static float true_peak(const float *x, size_t num_samples)
+{
+#if defined(__SSE__)
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    __m128 peak = _mm_setzero_ps();
+    for (size_t i = 0; i < num_samples; i++) {
+        __m128 acc = _mm_setzero_ps();
+        for (size_t t = 0; t < TP_TAPS; t++) {
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(x[i - t]),
+                        _mm_load_ps(&tp_coeffs[t * TP_PHASES])));
+        }
+        peak = _mm_max_ps(peak, _mm_andnot_ps(sign_mask, acc));
+    }
+    peak = _mm_max_ps(peak, _mm_movehl_ps(peak, peak));
+    peak = _mm_max_ss(peak, _mm_shuffle_ps(peak, peak, 1));
+    return _mm_cvtss_f32(peak);
+#else
+    float peak = 0.0f;
+    for (size_t i = 0; i < num_samples; i++) {
+        for (size_t k = 0; k < TP_PHASES; k++) {
+            float acc = 0.0f;
+            for (size_t t = 0; t < TP_TAPS; t++) {
+                acc += x[i - t] * tp_coeffs[t * TP_PHASES + k];
+            }
+            peak = std::max(peak, fabsf(acc));
+        }
+    }
+    return peak;
+#endif
+}
+
+static double power_to_loudness(double power)
+{
+    return power > 0 ? -0.691 + 10.0 * log10(power) : -INFINITY;
+}
+
+static double loudness_to_power(double loudness)
+{
+    return pow(10.0, (loudness + 0.691) / 10.0);
+}
+
+static size_t hist_index(double loudness)
+{
+    const long ix = lrint(floor((loudness - HIST_MIN) * 10.0));
+    return std::min<long>(std::max<long>(ix, 0), HIST_BINS - 1);
+}
+
+static double hist_center(size_t ix)
+{
+    return HIST_MIN + (ix + 0.5) / 10.0;
+}
+
+LoudnessMeter::LoudnessMeter(unsigned int sample_rate, unsigned int channels) :
+    m_channels(channels),
+    m_block_length(sample_rate / 10),
+    m_filter_state(4 * channels),
+    m_momentary_hist(HIST_BINS),
+    m_momentary_hist_energy(HIST_BINS),
+    m_short_term_hist(HIST_BINS),
+    m_tp_history(channels)
+{
+    if (channels == 0 or sample_rate == 0) {
+        throw invalid_argument("Invalid LoudnessMeter configuration");
+    }
+
+    static bool tp_coeffs_initialised = false;
+    if (not tp_coeffs_initialised) {
+        init_tp_coeffs();
+        tp_coeffs_initialised = true;
+    }
+
+    // K-weighting filter coefficients for the given sample rate, see
+    // ITU-R BS.1770-4 and libebur128
+    const double fs = sample_rate;
+    {
+        const double f0 = 1681.974450955533;
+        const double G = 3.999843853973347;
+        const double Q = 0.7071752369554196;
+        const double K = tan(M_PI * f0 / fs);
+        const double Vh = pow(10.0, G / 20.0);
+        const double Vb = pow(Vh, 0.4996667741545416);
+        const double a0 = 1.0 + K / Q + K * K;
+        m_shelving.b0 = (Vh + Vb * K / Q + K * K) / a0;
+        m_shelving.b1 = 2.0 * (K * K - Vh) / a0;
+        m_shelving.b2 = (Vh - Vb * K / Q + K * K) / a0;
+        m_shelving.a1 = 2.0 * (K * K - 1.0) / a0;
+        m_shelving.a2 = (1.0 - K / Q + K * K) / a0;
+    }
+    {
+        const double f0 = 38.13547087602444;
+        const double Q = 0.5003270373238773;
+        const double K = tan(M_PI * f0 / fs);
+        const double a0 = 1.0 + K / Q + K * K;
+        m_highpass.b0 = 1.0;
+        m_highpass.b1 = -2.0;
+        m_highpass.b2 = 1.0;
+        m_highpass.a1 = 2.0 * (K * K - 1.0) / a0;
+        m_highpass.a2 = (1.0 - K / Q + K * K) / a0;
+    }
+
+    for (auto& h : m_tp_history) {
+        h.resize(TP_TAPS - 1 + CHUNK_FRAMES);
+    }
+}
+
+void LoudnessMeter::process(const int16_t *samples, size_t num_frames)
+{
+    while (num_frames > 0) {
+        const size_t n = std::min(num_frames, CHUNK_FRAMES);
+        process_chunk(samples, n);
+        samples += n * m_channels;
+        num_frames -= n;
+    }
+}
+
+void LoudnessMeter::process_chunk(const int16_t *samples, size_t num_frames)
+{
+    const float scale = 1.0f / 32768.0f;
+
+    for (size_t ch = 0; ch < m_channels; ch++) {
+        float *x = m_tp_history[ch].data() + TP_TAPS - 1;
+        for (size_t i = 0; i < num_frames; i++) {
+            x[i] = samples[i * m_channels + ch] * scale;
+        }
+
+        m_true_peak = std::max(m_true_peak, true_peak(x, num_frames));
+
+        memmove(m_tp_history[ch].data(), x + num_frames - (TP_TAPS - 1),
+                (TP_TAPS - 1) * sizeof(float));
+    }
+
+    size_t done = 0;
+    while (done < num_frames) {
+        const size_t n = std::min(num_frames - done, m_block_length - m_block_fill);
+
+        for (size_t ch = 0; ch < m_channels; ch++) {
+            double *state = &m_filter_state[4 * ch];
+            double s1 = state[0], s2 = state[1], h1 = state[2], h2 = state[3];
+            double energy = 0.0;
+
+            for (size_t i = done; i < done + n; i++) {
+                const double in = samples[i * m_channels + ch] * (1.0 / 32768.0);
+
+                // Transposed direct form II
+                const double y1 = m_shelving.b0 * in + s1;
+                s1 = m_shelving.b1 * in - m_shelving.a1 * y1 + s2;
+                s2 = m_shelving.b2 * in - m_shelving.a2 * y1;
+
+                const double y2 = m_highpass.b0 * y1 + h1;
+                h1 = m_highpass.b1 * y1 - m_highpass.a1 * y2 + h2;
+                h2 = m_highpass.b2 * y1 - m_highpass.a2 * y2;
+
+                energy += y2 * y2;
+            }
+
+            state[0] = s1; state[1] = s2; state[2] = h1; state[3] = h2;
+            m_block_energy += energy;
+        }
+
+        m_block_fill += n;
+        done += n;
+
+        if (m_block_fill == m_block_length) {
+            finish_block();
+        }
+    }
+}
+
+void LoudnessMeter::finish_block()
+{
+    m_block_history[m_num_blocks % SHORT_TERM_BLOCKS] = m_block_energy;
+    m_num_blocks++;
+    m_block_energy = 0.0;
+    m_block_fill = 0;
+
+    auto window_power = [&](size_t num_blocks) {
+        double sum = 0.0;
+        for (size_t i = 0; i < num_blocks; i++) {
+            sum += m_block_history[(m_num_blocks - 1 - i) % SHORT_TERM_BLOCKS];
+        }
+        return sum / (num_blocks * m_block_length);
+    };
+
+    // Gating blocks of 400ms overlap by 75%, i.e. there is one every 100ms
+    if (m_num_blocks >= MOMENTARY_BLOCKS) {
+        const double power = window_power(MOMENTARY_BLOCKS);
+        m_momentary = power_to_loudness(power);
+        if (m_momentary >= HIST_MIN) {
+            const size_t ix = hist_index(m_momentary);
+            m_momentary_hist[ix]++;
+            m_momentary_hist_energy[ix] += power;
+        }
+    }
+
+    if (m_num_blocks >= SHORT_TERM_BLOCKS) {
+        m_short_term = power_to_loudness(window_power(SHORT_TERM_BLOCKS));
+        if (m_short_term >= HIST_MIN) {
+            m_short_term_hist[hist_index(m_short_term)]++;
+        }
+    }
+}
+
+float LoudnessMeter::integrated_loudness() const
+{
+    uint64_t count = 0;
+    double energy = 0.0;
+    for (size_t i = 0; i < HIST_BINS; i++) {
+        count += m_momentary_hist[i];
+        energy += m_momentary_hist_energy[i];
+    }
+
+    if (count == 0) {
+        return -INFINITY;
+    }
+
+    const double relative_gate = power_to_loudness(energy / count) - 10.0;
+
+    count = 0;
+    energy = 0.0;
+    for (size_t i = hist_index(relative_gate); i < HIST_BINS; i++) {
+        count += m_momentary_hist[i];
+        energy += m_momentary_hist_energy[i];
+    }
+
+    return count ? power_to_loudness(energy / count) : -INFINITY;
+}
+
+float LoudnessMeter::loudness_range() const
+{
+    uint64_t count = 0;
+    double energy = 0.0;
+    for (size_t i = 0; i < HIST_BINS; i++) {
+        count += m_short_term_hist[i];
+        energy += m_short_term_hist[i] * loudness_to_power(hist_center(i));
+    }
+
+    if (count == 0) {
+        return 0.0f;
+    }
+
+    const size_t first_bin = hist_index(power_to_loudness(energy / count) - 20.0);
+
+    uint64_t gated_count = 0;
+    for (size_t i = first_bin; i < HIST_BINS; i++) {
+        gated_count += m_short_term_hist[i];
+    }
+
+    if (gated_count == 0) {
+        return 0.0f;
+    }
+
+    // Loudness range is the difference between the 10th and the 95th
+    // percentile of the gated short-term loudness distribution
+    const uint64_t low_count = gated_count / 10;
+    const uint64_t high_count = gated_count * 95 / 100;
+    double low = -INFINITY;
+    double high = hist_center(HIST_BINS - 1);
+    uint64_t cumulated = 0;
+    for (size_t i = first_bin; i < HIST_BINS; i++) {
+        cumulated += m_short_term_hist[i];
+        if (low == -INFINITY and cumulated > low_count) {
+            low = hist_center(i);
+        }
+        if (cumulated > high_count) {
+            high = hist_center(i);
+            break;
+        }
+    }
+
+    return high - low;
+}
+
+loudness_levels_t LoudnessMeter::take_levels()
+{
+    loudness_levels_t levels;
+    levels.momentary = m_momentary;
+    levels.short_term = m_short_term;
+    levels.integrated = integrated_loudness();
+    levels.range = loudness_range();
+    levels.true_peak = m_true_peak > 0.0f ? 20.0f * log10f(m_true_peak) : -INFINITY;
+    m_true_peak = 0.0f;
+    return levels;
+}
+
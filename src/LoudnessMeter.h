@@ -0,0 +1,100 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+/*! \file LoudnessMeter.h
+ *
+ * Loudness measurement according to ITU-R BS.1770-4 and EBU R 128:
+ * momentary (400ms), short-term (3s) and integrated loudness, loudness
+ * range (EBU Tech 3342) and true-peak level using 4x oversampling.
+ *
+ * The integrated loudness and the loudness range are computed from
+ * histograms with a resolution of 0.1 LU, so that the memory used does not
+ * grow with the measurement duration.
+ */
+
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+/*! The values measured by the LoudnessMeter. Loudness values that are not
+ * available yet, e.g. during the first 400ms or during silence, are
+ * -infinity. */
+struct loudness_levels_t {
+    float momentary = -INFINITY;    // LUFS
+    float short_term = -INFINITY;   // LUFS
+    float integrated = -INFINITY;   // LUFS
+    float range = 0.0f;             // LU
+    float true_peak = -INFINITY;    // dBTP, since the last take_levels()
+};
+
+class LoudnessMeter {
+    public:
+        LoudnessMeter(unsigned int sample_rate, unsigned int channels);
+
+        /*! Measure num_frames interleaved frames */
+        void process(const int16_t *samples, size_t num_frames);
+
+        /*! Return the current levels. The true peak is the largest since the
+         * previous call, and is reset. */
+        loudness_levels_t take_levels();
+
+    private:
+        struct biquad_t {
+            double b0, b1, b2, a1, a2;
+        };
+
+        void process_chunk(const int16_t *samples, size_t num_frames);
+        void finish_block();
+        float integrated_loudness() const;
+        float loudness_range() const;
+
+        unsigned int m_channels;
+        size_t m_block_length;
+
+        // K-weighting filter, two biquads per channel
+        biquad_t m_shelving;
+        biquad_t m_highpass;
+        std::vector<double> m_filter_state; // 4 values per channel
+
+        // Energy of the 100ms block being accumulated
+        double m_block_energy = 0.0;
+        size_t m_block_fill = 0;
+
+        // Energies of the last 30 blocks, for the momentary and short-term
+        // windows
+        static constexpr size_t SHORT_TERM_BLOCKS = 30;
+        static constexpr size_t MOMENTARY_BLOCKS = 4;
+        double m_block_history[SHORT_TERM_BLOCKS] = {};
+        size_t m_num_blocks = 0;
+
+        float m_momentary = -INFINITY;
+        float m_short_term = -INFINITY;
+
+        // Histograms of the gated momentary and short-term loudness
+        std::vector<uint64_t> m_momentary_hist;
+        std::vector<double> m_momentary_hist_energy;
+        std::vector<uint64_t> m_short_term_hist;
+
+        // True-peak: the last input samples needed by the interpolation
+        // filter for each channel, followed by the current chunk
+        std::vector<std::vector<float> > m_tp_history;
+        float m_true_peak = 0.0f;
+};
+
@@ -18,12 +18,15 @@
  */
 
 #include "Outputs.h"
+#include "EDITimestamp.h"
 #include <chrono>
 #include <string>
 #include <stdexcept>
 #include <cstring>
 #include <cerrno>
 #include <cassert>
+#include <cmath>
+#include <algorithm>
 
 namespace Output {
 
@@ -61,9 +64,17 @@ bool File::write_frame(const uint8_t *buf, size_t len)
     return fwrite(buf, len, 1, m_fd) == 1;
 }
 
+/* All ZMQ outputs of the process share one context, so that running several
+ * services in one process does not create one set of ZMQ I/O threads per
+ * service. */
+static zmq::context_t& zmq_context()
+{
+    static zmq::context_t ctx;
+    return ctx;
+}
+
 ZMQ::ZMQ() :
-    m_ctx(),
-    m_sock(m_ctx, ZMQ_PUB)
+    m_sock(zmq_context(), ZMQ_PUB)
 {
     // Do not wait at teardown to send all data out
     int linger = 0;
@@ -138,6 +149,11 @@ bool ZMQ::write_frame(const uint8_t *buf, size_t len)
 }
 
 EDI::EDI() :
+    m_edi_tagStarPtr("DSTI"),
+    m_edi_tagAudioLevels(0, 0),
+    m_edi_tagLoudness(0, 0, 0, 0, 0),
+    m_edi_tagVersion("", 0),
+    m_edi_tagpacket(0),
     m_clock_tai({})
 { }
 
@@ -150,7 +166,7 @@ void EDI::set_verbose(bool verbose)
 
 void EDI::set_odr_version_tag(const std::string& odr_version_tag)
 {
-    m_odr_version_tag = odr_version_tag;
+    m_edi_tagVersion = edi::TagODRVersion(odr_version_tag, 0);
 }
 
 void EDI::add_udp_destination(const std::string& host, unsigned int port)
@@ -185,34 +201,87 @@ bool EDI::enabled() const
     return not m_edi_conf.destinations.empty();
 }
 
+bool EDI::collect_scheduler_stats(edi::FragmentScheduler::stats_t& stats)
+{
+    if (not m_edi_sender or not m_edi_conf.enable_pft) {
+        return false;
+    }
+    stats = m_edi_sender->collect_scheduler_stats();
+    return true;
+}
+
+bool EDI::collect_udp_stats(edi::UDPBatchSender::stats_t& stats)
+{
+    const bool has_udp_destination = any_of(
+            m_edi_conf.destinations.begin(), m_edi_conf.destinations.end(),
+            [](const shared_ptr<edi::destination_t>& dest) {
+                return dynamic_pointer_cast<edi::udp_destination_t>(dest) != nullptr;
+            });
+
+    if (not m_edi_sender or not has_udp_destination) {
+        return false;
+    }
+    stats = m_edi_sender->collect_udp_stats();
+    return true;
+}
+
+bool EDI::collect_destination_stats(std::vector<edi::destination_stats_t>& stats)
+{
+    if (not m_edi_sender) {
+        return false;
+    }
+    m_edi_sender->collect_destination_stats(stats);
+    return true;
+}
+
 void EDI::set_tist(bool enable, uint32_t delay_ms)
 {
     m_tist = enable;
     m_delay_ms = delay_ms;
 }
 
+void EDI::set_processing_delay(uint32_t delay_ms)
+{
+    m_processing_delay_ms = delay_ms;
+}
+
+void EDI::update_loudness(const loudness_levels_t& levels)
+{
+    m_loudness = levels;
+    m_loudness_available = true;
+}
+
+/* Convert to the fixed-point representation of the ODRl tag */
+static int16_t loudness_to_tag(float value)
+{
+    if (not std::isfinite(value)) {
+        return INT16_MIN;
+    }
+    const long v = lrintf(value * 100.0f);
+    return std::max<long>(INT16_MIN + 1, std::min<long>(INT16_MAX, v));
+}
+
 bool EDI::write_frame(const uint8_t *buf, size_t len)
 {
     if (not m_edi_sender) {
         m_edi_sender = make_shared<edi::Sender>(m_edi_conf);
+
+        // The tag items will be assembled into this TAG Packet
+        m_edi_tagpacket = edi::TagPacket(m_edi_conf.tagpacket_alignment);
+        m_edi_tagpacket.tag_items.reserve(8);
     }
 
     if (m_edi_time == 0) {
         using Sec = chrono::seconds;
         const auto now = chrono::time_point_cast<Sec>(chrono::system_clock::now());
-        m_edi_time = chrono::system_clock::to_time_t(now) + (m_delay_ms / 1000);
-        m_send_version_at_time = m_edi_time;
 
-        /* TODO we still have to see if 24ms granularity is achievable, given that
-         * one DAB+ super frame is carried over more than 1 ETI frame.
-         */
-        for (int32_t sub_ms = (m_delay_ms % 1000); sub_ms > 0; sub_ms -= 24) {
-            m_timestamp += 24 << 14; // Shift 24ms by 14 to Timestamp level 2
-        }
+        const auto first = initial_edi_timestamp(chrono::system_clock::to_time_t(now),
+                m_delay_ms, m_processing_delay_ms);
+        m_edi_time = first.seconds;
+        m_timestamp = first.timestamp;
+        m_send_version_at_time = m_edi_time;
     }
 
-    edi::TagStarPTR edi_tagStarPtr("DSTI");
-
     m_edi_tagDSTI.stihf = false;
     m_edi_tagDSTI.atstf = m_tist;
 
@@ -230,31 +299,38 @@ bool EDI::write_frame(const uint8_t *buf, size_t len)
     m_edi_tagDSTI.rfadf = false;
     // DFCT is handled inside the TagDSTI
 
-    edi::TagSSm edi_tagPayload;
-    // TODO make edi_tagPayload.stid configurable
-    edi_tagPayload.istd_data = buf;
-    edi_tagPayload.istd_length = len;
+    // TODO make m_edi_tagPayload.stid configurable
+    m_edi_tagPayload.istd_data = buf;
+    m_edi_tagPayload.istd_length = len;
 
-    edi::TagODRAudioLevels edi_tagAudioLevels(m_audio_left, m_audio_right);
+    m_edi_tagAudioLevels = edi::TagODRAudioLevels(m_audio_left, m_audio_right);
 
-    edi::TagODRVersion edi_tagVersion(m_odr_version_tag, m_num_seconds_sent);
+    m_edi_tagLoudness = edi::TagODRAudioLoudness(
+            loudness_to_tag(m_loudness.momentary),
+            loudness_to_tag(m_loudness.short_term),
+            loudness_to_tag(m_loudness.integrated),
+            loudness_to_tag(m_loudness.range),
+            loudness_to_tag(m_loudness.true_peak));
 
-    // The above Tag Items will be assembled into a TAG Packet
-    edi::TagPacket edi_tagpacket(m_edi_conf.tagpacket_alignment);
+    m_edi_tagVersion.set_uptime(m_num_seconds_sent);
 
     // put tags *ptr, DETI and all subchannels into one TagPacket
-    edi_tagpacket.tag_items.push_back(&edi_tagStarPtr);
-    edi_tagpacket.tag_items.push_back(&m_edi_tagDSTI);
-    edi_tagpacket.tag_items.push_back(&edi_tagPayload);
-    edi_tagpacket.tag_items.push_back(&edi_tagAudioLevels);
+    m_edi_tagpacket.tag_items.clear();
+    m_edi_tagpacket.tag_items.push_back(&m_edi_tagStarPtr);
+    m_edi_tagpacket.tag_items.push_back(&m_edi_tagDSTI);
+    m_edi_tagpacket.tag_items.push_back(&m_edi_tagPayload);
+    m_edi_tagpacket.tag_items.push_back(&m_edi_tagAudioLevels);
+    if (m_loudness_available) {
+        m_edi_tagpacket.tag_items.push_back(&m_edi_tagLoudness);
+    }
 
     // Send version information only every 10 seconds to save bandwidth
     if (m_send_version_at_time < m_edi_time) {
         m_send_version_at_time += 10;
-        edi_tagpacket.tag_items.push_back(&edi_tagVersion);
+        m_edi_tagpacket.tag_items.push_back(&m_edi_tagVersion);
     }
 
-    m_edi_sender->write(edi_tagpacket);
+    m_edi_sender->write(m_edi_tagpacket);
 
     // TODO Handle TCP disconnect
     return true;
@@ -25,6 +25,7 @@
 #include "common.h"
 #include "zmq.hpp"
 #include "ClockTAI.h"
+#include "LoudnessMeter.h"
 #include "edioutput/TagItems.h"
 #include "edioutput/TagPacket.h"
 #include "edioutput/AFPacket.h"
@@ -112,7 +113,6 @@ class ZMQ: public Base {
         virtual bool write_frame(const uint8_t *buf, size_t len) override;
 
     private:
-        zmq::context_t m_ctx;
         zmq::socket_t m_sock;
 
         int m_bitrate = 0;
@@ -142,13 +142,33 @@ class EDI: public Base {
 
         void set_tist(bool enable, uint32_t delay_ms);
 
+        /*! Set the delay the audio processing adds between the input and
+         * the encoder, which is subtracted from the TIST delay. */
+        void set_processing_delay(uint32_t delay_ms);
+
+        /*! Update the loudness carried in the ODRl tag. The tag is only
+         * sent once this has been called. */
+        void update_loudness(const loudness_levels_t& levels);
+
         bool enabled() const;
 
+        /*! Return in stats the scheduling statistics of the PFT fragments
+         * since the previous call. Returns false if PFT is not used. */
+        bool collect_scheduler_stats(edi::FragmentScheduler::stats_t& stats);
+
+        /*! Return in stats the number of UDP packets and send system calls
+         * since the previous call. Returns false if there is no UDP
+         * destination. */
+        bool collect_udp_stats(edi::UDPBatchSender::stats_t& stats);
+
+        /*! Fill stats with the queue depth, the sent and dropped packets,
+         * the reconnects and the send latency of every destination since the
+         * previous call. Returns false if the output is not set up. */
+        bool collect_destination_stats(std::vector<edi::destination_stats_t>& stats);
+
         virtual bool write_frame(const uint8_t *buf, size_t len) override;
 
     private:
-        std::string m_odr_version_tag;
-
         edi::configuration_t m_edi_conf;
         std::shared_ptr<edi::Sender> m_edi_sender;
 
@@ -157,11 +177,23 @@ class EDI: public Base {
         std::time_t m_edi_time = 0;
         std::time_t m_send_version_at_time = 0;
 
+        /* The tags and the TAG packet are kept from one frame to the
+         * next, so that assembling the packet does not allocate */
+        edi::TagStarPTR m_edi_tagStarPtr;
         edi::TagDSTI m_edi_tagDSTI;
+        edi::TagSSm m_edi_tagPayload;
+        edi::TagODRAudioLevels m_edi_tagAudioLevels;
+        edi::TagODRAudioLoudness m_edi_tagLoudness;
+        edi::TagODRVersion m_edi_tagVersion;
+        edi::TagPacket m_edi_tagpacket;
 
         ClockTAI m_clock_tai;
         bool m_tist = false;
         uint32_t m_delay_ms = 0;
+        uint32_t m_processing_delay_ms = 0;
+
+        bool m_loudness_available = false;
+        loudness_levels_t m_loudness;
 };
 
 }
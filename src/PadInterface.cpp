@@ -37,6 +37,10 @@ void PadInterface::open(const std::string& pad_ident)
 {
     m_pad_ident = pad_ident;
 
+    // Allocate the receive buffers once, request() only resizes them
+    m_buffer.resize(2048);
+    m_pad_data.reserve(m_buffer.size());
+
     m_sock = ::socket(AF_UNIX, SOCK_DGRAM, 0);
     if (m_sock == -1) {
         throw runtime_error("PAD socket creation failed: " + string(strerror(errno)));
@@ -67,7 +71,7 @@ void PadInterface::open(const std::string& pad_ident)
     }
 }
 
-vector<uint8_t> PadInterface::request(uint8_t padlen)
+const vector<uint8_t>& PadInterface::request(uint8_t padlen)
 {
     if (m_pad_ident.empty()) {
         throw logic_error("Uninitialised PadInterface::request() called");
@@ -113,10 +117,10 @@ vector<uint8_t> PadInterface::request(uint8_t padlen)
         m_padenc_reachable = true;
     }
 
-    vector<uint8_t> buffer(2048);
+    m_pad_data.clear();
 
     while (true) {
-        ret = ::recvfrom(m_sock, buffer.data(), buffer.size(), 0, nullptr, nullptr);
+        ret = ::recvfrom(m_sock, m_buffer.data(), m_buffer.size(), 0, nullptr, nullptr);
 
         if (ret == -1) {
             // This suppresses the -Wlogical-op warning
@@ -129,18 +133,15 @@ vector<uint8_t> PadInterface::request(uint8_t padlen)
                 throw runtime_error(string("Can't receive data: ") + strerror(errno));
             }
 
-            return {};
+            return m_pad_data;
         }
         else if (ret > 0) {
-            buffer.resize(ret);
-
             // We could check where the data comes from, but since we're using UNIX sockets
             // the source is anyway local to the machine.
 
-            if (buffer[0] == MESSAGE_PAD_DATA) {
-                vector<uint8_t> pad_data(buffer.size() - 1);
-                copy(buffer.begin() + 1, buffer.end(), pad_data.begin());
-                return pad_data;
+            if (m_buffer[0] == MESSAGE_PAD_DATA) {
+                m_pad_data.assign(m_buffer.begin() + 1, m_buffer.begin() + ret);
+                return m_pad_data;
             }
             else {
                 continue;
@@ -35,10 +35,15 @@ class PadInterface {
          */
         void open(const std::string &pad_ident);
 
-        std::vector<uint8_t> request(uint8_t padlen);
+        /*! Request padlen bytes of PAD and return the data received from
+         * ODR-PadEnc, or an empty vector if none is available. The returned
+         * buffer is reused by the next call. */
+        const std::vector<uint8_t>& request(uint8_t padlen);
 
     private:
         std::string m_pad_ident;
+        std::vector<uint8_t> m_buffer;
+        std::vector<uint8_t> m_pad_data;
         int m_sock = -1;
         bool m_padenc_reachable = true;
 };
@@ -0,0 +1,197 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+
+#include "Resampler.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE__)
+#  include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+#endif
+
+using namespace std;
+
+static_assert(Resampler::TAPS % 4 == 0, "TAPS must be a multiple of the vector width");
+
+static constexpr size_t HALF_TAPS = Resampler::TAPS / 2;
+
+/* Zeroth order modified Bessel function of the first kind, for the Kaiser
+ * window */
+static double bessel_i0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+Resampler::Resampler(unsigned int channels, size_t max_output_frames,
+        double max_ratio, double cutoff) :
+    m_channels(channels),
+    m_coeffs((PHASES + 1) * TAPS),
+    m_history(channels)
+{
+    if (channels == 0 or max_ratio <= 0 or max_ratio >= HALF_TAPS) {
+        throw invalid_argument("Invalid Resampler configuration");
+    }
+
+    const double beta = 8.0;
+    const double i0_beta = bessel_i0(beta);
+
+    for (size_t p = 0; p <= PHASES; p++) {
+        const double frac = (double)p / PHASES;
+        float *phase_coeffs = &m_coeffs[p * TAPS];
+
+        double sum = 0.0;
+        for (size_t t = 0; t < TAPS; t++) {
+            // Distance between the input sample of this tap and the
+            // output position
+            const double d = (double)t - (double)(HALF_TAPS - 1) - frac;
+            const double x = M_PI * cutoff * d;
+            const double sinc = (d == 0.0) ? 1.0 : sin(x) / x;
+            const double r = d / HALF_TAPS;
+            const double window = bessel_i0(beta * sqrt(std::max(0.0, 1.0 - r * r))) / i0_beta;
+            const double h = sinc * window;
+            phase_coeffs[t] = h;
+            sum += h;
+        }
+
+        // Unity gain at DC for every phase
+        for (size_t t = 0; t < TAPS; t++) {
+            phase_coeffs[t] /= sum;
+        }
+    }
+
+    const size_t capacity = max_input_frames_needed(max_output_frames, max_ratio) + 2 * TAPS;
+    for (auto& h : m_history) {
+        h.resize(capacity);
+    }
+
+    // Prime the history so that the first output sample is centered on
+    // the first input sample.
+    m_history_len = HALF_TAPS - 1;
+    m_position = HALF_TAPS - 1;
+}
+
+size_t Resampler::input_frames_needed(size_t num_out, double ratio) const
+{
+    if (num_out == 0) {
+        return 0;
+    }
+
+    const double last_position = m_position + (num_out - 1) * ratio;
+    const size_t needed = (size_t)floor(last_position) + HALF_TAPS + 1;
+    return needed > m_history_len ? needed - m_history_len : 0;
+}
+
+size_t Resampler::max_input_frames_needed(size_t num_out, double max_ratio)
+{
+    return (size_t)ceil(num_out * max_ratio) + TAPS;
+}
+
+void Resampler::push_input(const int16_t *samples, size_t num_frames)
+{
+    if (m_history_len + num_frames > m_history[0].size()) {
+        throw logic_error("Resampler history overflow");
+    }
+
+    for (size_t ch = 0; ch < m_channels; ch++) {
+        float *h = m_history[ch].data() + m_history_len;
+        for (size_t i = 0; i < num_frames; i++) {
+            h[i] = samples[i * m_channels + ch];
+        }
+    }
+    m_history_len += num_frames;
+}
+
+float Resampler::interpolate(const float *history, const float *coeffs) const
+{
+#if defined(__SSE__)
+    __m128 acc = _mm_setzero_ps();
+    for (size_t t = 0; t < TAPS; t += 4) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(history + t), _mm_load_ps(coeffs + t)));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc);
+#elif defined(__ARM_NEON)
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (size_t t = 0; t < TAPS; t += 4) {
+        acc = vmlaq_f32(acc, vld1q_f32(history + t), vld1q_f32(coeffs + t));
+    }
+    float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#else
+    float acc = 0.0f;
+    for (size_t t = 0; t < TAPS; t++) {
+        acc += history[t] * coeffs[t];
+    }
+    return acc;
+#endif
+}
+
+void Resampler::process(int16_t *out, size_t num_out, double ratio)
+{
+    assert(input_frames_needed(num_out, ratio) == 0);
+
+    alignas(16) float coeffs[TAPS];
+
+    for (size_t k = 0; k < num_out; k++) {
+        const double position = m_position + k * ratio;
+        const size_t ix = (size_t)floor(position);
+        const double phase = (position - ix) * PHASES;
+        const size_t p = std::min((size_t)phase, PHASES - 1);
+        const float a = phase - p;
+
+        // Interpolate the coefficients between the two nearest phases
+        const float *c0 = &m_coeffs[p * TAPS];
+        const float *c1 = c0 + TAPS;
+        for (size_t t = 0; t < TAPS; t++) {
+            coeffs[t] = c0[t] + a * (c1[t] - c0[t]);
+        }
+
+        const size_t first = ix + 1 - HALF_TAPS;
+        for (size_t ch = 0; ch < m_channels; ch++) {
+            const float y = interpolate(m_history[ch].data() + first, coeffs);
+            const long sample = lrintf(y);
+            out[k * m_channels + ch] = std::max(-32768L, std::min(32767L, sample));
+        }
+    }
+
+    // Discard the input samples that will not be used anymore
+    m_position += num_out * ratio;
+    const size_t discard = std::min(m_history_len,
+            (size_t)floor(m_position) + 1 - HALF_TAPS);
+    for (auto& h : m_history) {
+        memmove(h.data(), h.data() + discard, (m_history_len - discard) * sizeof(float));
+    }
+    m_history_len -= discard;
+    m_position -= discard;
+}
+
@@ -0,0 +1,85 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+/*! \file Resampler.h
+ *
+ * A polyphase windowed-sinc resampler for interleaved 16-bit samples, whose
+ * ratio can be changed on every call. It is used by the drift compensation
+ * to play the input back slightly faster or slower than nominal rate,
+ * instead of repeating or dropping samples.
+ *
+ * The filter coefficients are tabulated for PHASES fractional positions and
+ * linearly interpolated between neighbouring phases. The inner products are
+ * computed with SSE or NEON when available.
+ */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class Resampler {
+    public:
+        /*! Number of filter taps, i.e. input samples used per output sample */
+        static constexpr size_t TAPS = 16;
+
+        /*! Number of tabulated fractional positions */
+        static constexpr size_t PHASES = 256;
+
+        /*! \param channels number of interleaved channels
+         *  \param max_output_frames the largest num_out given to process()
+         *  \param max_ratio the largest ratio given to process()
+         *  \param cutoff filter cutoff relative to the input Nyquist frequency
+         */
+        Resampler(unsigned int channels, size_t max_output_frames,
+                double max_ratio, double cutoff = 0.95);
+
+        /*! Return how many input frames must be given to push_input() so
+         * that process() can produce num_out frames at the given ratio. */
+        size_t input_frames_needed(size_t num_out, double ratio) const;
+
+        /*! Upper bound of input_frames_needed() for any state of the
+         * resampler, to size the input buffers. */
+        static size_t max_input_frames_needed(size_t num_out, double max_ratio);
+
+        /*! Append num_frames interleaved input frames */
+        void push_input(const int16_t *samples, size_t num_frames);
+
+        /*! Produce num_out interleaved output frames, consuming ratio input
+         * frames per output frame. Enough input must have been given
+         * beforehand, see input_frames_needed(). */
+        void process(int16_t *out, size_t num_out, double ratio);
+
+    private:
+        float interpolate(const float *history, const float *coeffs) const;
+
+        unsigned int m_channels;
+
+        /* (PHASES + 1) * TAPS coefficients, the last phase is the first one
+         * shifted by one tap, so that interpolation never wraps. */
+        std::vector<float> m_coeffs;
+
+        /* One history buffer per channel, preallocated to the largest
+         * size needed. m_history_len valid samples each. */
+        std::vector<std::vector<float> > m_history;
+        size_t m_history_len = 0;
+
+        /* Fractional index into the history of the next output sample */
+        double m_position = 0.0;
+};
+
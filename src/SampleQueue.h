@@ -32,10 +32,19 @@
 #include <thread>
 #include <chrono>
 #include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <type_traits>
 #include <queue>
 #include <cassert>
 #include <sstream>
+#include <cstring>
 #include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
 #include <cmath>
 
 /*! This queue is meant to be used by two threads. One producer
@@ -53,6 +62,17 @@
  * If pop() is called but there is not enough data in the queue,
  * the missing samples are replaced by zeros. pop() will always
  * write the requested length.
+ *
+ * The samples are stored in a contiguous ring buffer whose size is a power
+ * of two. push() and pop() copy with memcpy and only use atomic read and
+ * write indices, so that they never wait for each other. The mutex and
+ * condition variables are only used to put one side to sleep, when
+ * pop_wait() waits for data, or a blocking push() waits for space.
+ *
+ * When pop_wait() has to sleep, it sets a watermark at the write index
+ * that makes the requested length available. push() only wakes the
+ * consumer once that watermark is crossed, so the consumer wakes up once
+ * per frame instead of once per push.
  */
 
 
@@ -62,15 +82,60 @@
 template<typename T>
 class SampleQueue
 {
+    static_assert(std::is_trivially_copyable<T>::value,
+            "SampleQueue copies elements with memcpy");
+
 public:
     SampleQueue(unsigned int bytes_per_sample) :
         m_bytes_per_sample(bytes_per_sample) {}
 
+    SampleQueue(const SampleQueue&) = delete;
+    SampleQueue& operator=(const SampleQueue&) = delete;
+
+    /*! Statistics about the pop_wait() sleeps, see collect_wait_stats() */
+    struct wait_stats_t {
+        /*! How many times the consumer woke up inside pop_wait() */
+        size_t num_wakeups = 0;
+
+        /*! How many times the consumer was woken by a push() that crossed
+         * the watermark, and the time between that push() and pop_wait()
+         * returning. */
+        size_t num_handovers = 0;
+        std::chrono::steady_clock::duration handover_latency_total = {};
+        std::chrono::steady_clock::duration handover_latency_max = {};
+    };
+
+    /*! Allocate the ring buffer. Must be called before the producer
+     * and consumer start. */
     void configure(size_t max_size, bool push_block, unsigned int channels)
     {
         m_max_size = max_size;
         m_push_block = push_block;
         m_channels = channels;
+
+        /* In non-blocking mode, a push is accepted as long as the queue
+         * contains less than max_size elements, which means the queue can
+         * grow above max_size by the length of one push. Leave enough
+         * room for that. */
+        size_t capacity = 1;
+        while (capacity < 2 * max_size) {
+            capacity <<= 1;
+        }
+
+        /* Start the samples on a cache line, like the indices. aligned_alloc
+         * wants a size that is a multiple of the alignment. */
+        const size_t num_bytes = (capacity * sizeof(T) + BUFFER_ALIGNMENT - 1) &
+            ~(BUFFER_ALIGNMENT - 1);
+        T *buffer = static_cast<T*>(std::aligned_alloc(BUFFER_ALIGNMENT, num_bytes));
+        if (buffer == nullptr) {
+            throw std::bad_alloc();
+        }
+        m_buffer.reset(buffer);
+        m_capacity = capacity;
+        m_mask = capacity - 1;
+        m_write_ix.store(0);
+        m_read_ix.store(0);
+        m_overruns.store(0);
     }
 
 
@@ -80,58 +145,51 @@ public:
      */
     size_t push(const T *val, size_t len)
     {
-        size_t new_size = 0;
-
-        {
-            std::unique_lock<std::mutex> lock(m_mutex);
+        assert(len % (m_channels * m_bytes_per_sample) == 0);
 
-            assert(len % (m_channels * m_bytes_per_sample) == 0);
+        const size_t queue_size = size();
 
 #if DEBUG_SAMPLE_QUEUE
-            fprintf(stdout, "######## push %s %zu, %zu >= %zu\n",
-                    (m_queue.size() >= m_max_size) ? "overrun" : "ok",
-                    len / 4,
-                    m_queue.size() / 4,
-                    m_max_size / 4);
+        fprintf(stdout, "######## push %s %zu, %zu >= %zu\n",
+                (queue_size >= m_max_size) ? "overrun" : "ok",
+                len / 4,
+                queue_size / 4,
+                m_max_size / 4);
 #endif
 
-            if (m_push_block) {
-                while (len) {
-                    const size_t available = m_max_size - m_queue.size();
-                    const size_t copy_len = std::min(available, len);
-
-                    if (copy_len > 0) {
-                        std::copy(val, val + copy_len, std::back_inserter(m_queue));
-                        len -= copy_len;
-                        val += copy_len;
-                    }
-                    else {
-                        const auto wait_timeout = std::chrono::milliseconds(100);
-                        m_pop_notification.wait_for(lock, wait_timeout);
-                    }
-                }
-            }
-            else {
-                if (m_queue.size() < m_max_size) {
-                    std::copy(val, val + len, std::back_inserter(m_queue));
+        if (m_push_block) {
+            size_t written = 0;
+            while (written < len) {
+                const size_t current_size = size();
+                const size_t available = m_max_size > current_size ?
+                    m_max_size - current_size : 0;
+                const size_t copy_len = std::min(available, len - written);
+
+                if (copy_len > 0) {
+                    write_elements(val + written, copy_len);
+                    written += copy_len;
                 }
                 else {
-                    m_overruns++;
+                    wait_for_pop();
                 }
             }
-
-            new_size = m_queue.size();
+        }
+        else {
+            if (queue_size < m_max_size and len <= m_capacity - queue_size) {
+                write_elements(val, len);
+            }
+            else {
+                m_overruns.fetch_add(1, std::memory_order_relaxed);
+            }
         }
 
-        m_push_notification.notify_all();
-
-        return new_size;
+        return size();
     }
 
     size_t size() const
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        return m_queue.size();
+        return m_write_ix.load(std::memory_order_acquire) -
+            m_read_ix.load(std::memory_order_acquire);
     }
 
     /*! Wait until len elements in the queue are available,
@@ -149,53 +207,92 @@ public:
 #if DEBUG_SAMPLE_QUEUE
         fprintf(stdout, "######## pop_wait %zu\n", len);
 #endif
-        std::unique_lock<std::mutex> lock(m_mutex);
 
         if (overruns) {
-            *overruns = m_overruns;
-            m_overruns = 0;
+            *overruns = m_overruns.exchange(0);
         }
 
-        auto time_start = std::chrono::steady_clock::now();
-        const auto timeout = std::chrono::milliseconds(timeout_ms);
+        if (size() < len) {
+            const auto deadline = std::chrono::steady_clock::now() +
+                std::chrono::milliseconds(timeout_ms);
 
-        do {
-            const auto wait_timeout = std::chrono::milliseconds(10);
-            m_push_notification.wait_for(lock, wait_timeout);
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_watermark_crossed = false;
+            m_wake_watermark.store(
+                    m_read_ix.load(std::memory_order_relaxed) + len,
+                    std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            while (size() < len) {
+                const auto status = m_push_notification.wait_until(lock, deadline);
+                m_wait_stats.num_wakeups++;
 
 #if DEBUG_SAMPLE_QUEUE
                 fprintf(stdout, "######## pop_wait %zu need %zu\n",
-                        m_queue.size(), len);
+                        size(), len);
 #endif
 
-            if (std::chrono::steady_clock::now() - time_start > timeout) {
+                if (status == std::cv_status::timeout) {
 #if DEBUG_SAMPLE_QUEUE
-                fprintf(stdout, "######## pop_wait timeout\n");
+                    fprintf(stdout, "######## pop_wait timeout\n");
 #endif
-                break;
+                    break;
+                }
             }
-        } while (m_queue.size() < len);
 
-        size_t num_to_copy = (m_queue.size() < len) ?
-            m_queue.size() : len;
+            m_wake_watermark.store(NO_WATERMARK, std::memory_order_relaxed);
 
-        std::copy(
-                m_queue.begin(),
-                m_queue.begin() + num_to_copy,
-                buf);
-
-        m_queue.erase(m_queue.begin(), m_queue.begin() + num_to_copy);
+            if (m_watermark_crossed) {
+                const auto latency = std::chrono::steady_clock::now() -
+                    m_watermark_crossed_time;
+                m_wait_stats.num_handovers++;
+                m_wait_stats.handover_latency_total += latency;
+                m_wait_stats.handover_latency_max =
+                    std::max(m_wait_stats.handover_latency_max, latency);
+            }
+        }
 
-        lock.unlock();
+        const size_t num_to_copy = std::min(size(), len);
+        read_elements(buf, num_to_copy);
 
 #if DEBUG_SAMPLE_QUEUE
         fprintf(stdout, "######## pop_wait returns %zu\n", num_to_copy);
 #endif
 
-        m_pop_notification.notify_all();
         return num_to_copy;
     }
 
+    /*! Set the function push() calls when the watermark set by
+     * notify_when_available() is reached. It is called from the producer
+     * thread, without any lock of the queue held.
+     */
+    void set_watermark_callback(std::function<void()> callback)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_watermark_callback = callback;
+    }
+
+    /*! For a consumer that does not sleep in pop_wait(): make push() call
+     * the watermark callback once len elements are available.
+     *
+     * \return true if they are already available, in which case the
+     * callback will not be called.
+     */
+    bool notify_when_available(size_t len)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_wake_watermark.store(
+                m_read_ix.load(std::memory_order_relaxed) + len,
+                std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (size() >= len) {
+            m_wake_watermark.store(NO_WATERMARK, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
     /*! Get up to len elements, place them into the buf array
      *
      * \return the number of elements it was able to take
@@ -204,7 +301,7 @@ public:
     size_t pop(T* buf, size_t len)
     {
         size_t ovr;
-        return pop(buf, len, ovr);
+        return pop(buf, len, &ovr);
     }
 
     /*! Get up to len elements, place them into the buf array.
@@ -216,83 +313,174 @@ public:
      */
     size_t pop(T* buf, size_t len, size_t* overruns)
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-
         assert(len % (m_channels * m_bytes_per_sample) == 0);
 
+        const size_t queue_size = size();
+
 #if DEBUG_SAMPLE_QUEUE
         fprintf(stdout, "######## pop %zu (%zu), %zu overruns: ",
                 len / 4,
-                m_queue.size() / 4,
-                m_overruns);
+                queue_size / 4,
+                m_overruns.load());
 #endif
-        *overruns = m_overruns;
-        m_overruns = 0;
+        *overruns = m_overruns.exchange(0);
 
         size_t ret = 0;
 
-        if (m_queue.size() < len) {
+        if (queue_size < len) {
             /* Not enough data in queue, fill with zeros */
-
-            size_t i;
-            for (i = 0; i < m_queue.size(); i++) {
-                buf[i] = m_queue[i];
-            }
-
-            ret = i;
-
-            for (; i < len; i++) {
-                buf[i] = 0;
-            }
-
-            m_queue.resize(0);
+            read_elements(buf, queue_size);
+            std::fill(buf + queue_size, buf + len, 0);
+            ret = queue_size;
 
 #if DEBUG_SAMPLE_QUEUE
             fprintf(stdout, "after short pop %zu (%zu)\n",
                 len / 4,
-                m_queue.size() / 4);
+                size() / 4);
 #endif
         }
         else {
             /* Queue contains enough data */
-
-            for (size_t i = 0; i < len; i++) {
-                buf[i] = m_queue[i];
-            }
-
+            read_elements(buf, len);
             ret = len;
 
-            m_queue.erase(m_queue.begin(), m_queue.begin() + len);
-
 #if DEBUG_SAMPLE_QUEUE
             fprintf(stdout, "after ok pop %zu (%zu)\n",
                 len / 4,
-                m_queue.size() / 4);
+                size() / 4);
 #endif
         }
 
-        m_pop_notification.notify_all();
         return ret;
     }
 
+    /*! Return the pop_wait() statistics gathered since the previous
+     * call, and reset them. Can be called from any thread.
+     */
+    wait_stats_t collect_wait_stats()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        wait_stats_t stats = m_wait_stats;
+        m_wait_stats = wait_stats_t();
+        return stats;
+    }
+
+    /*! Discard the queue contents. Must not be called while the
+     * consumer is popping.
+     */
     void clear()
     {
-        {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            m_queue.clear();
+        m_read_ix.store(m_write_ix.load(std::memory_order_acquire),
+                std::memory_order_release);
 #if DEBUG_SAMPLE_QUEUE
-            fprintf(stdout, "clear\n");
+        fprintf(stdout, "clear\n");
 #endif
-        }
-        m_pop_notification.notify_all();
+        notify_pop();
     }
 
 private:
-    std::deque<T> m_queue;
+    /*! Producer side: copy len elements into the ring, the caller
+     * has checked there is enough space. */
+    void write_elements(const T *val, size_t len)
+    {
+        const size_t write_ix = m_write_ix.load(std::memory_order_relaxed);
+        const size_t offset = write_ix & m_mask;
+        const size_t first_part = std::min(len, m_capacity - offset);
+
+        memcpy(m_buffer.get() + offset, val, first_part * sizeof(T));
+        memcpy(m_buffer.get(), val + first_part, (len - first_part) * sizeof(T));
+
+        m_write_ix.store(write_ix + len, std::memory_order_seq_cst);
+
+        if (write_ix + len >= m_wake_watermark.load(std::memory_order_seq_cst)) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_wake_watermark.store(NO_WATERMARK, std::memory_order_relaxed);
+                m_watermark_crossed = true;
+                m_watermark_crossed_time = std::chrono::steady_clock::now();
+                m_push_notification.notify_all();
+            }
+
+            // Outside of the lock, the callback usually takes the lock of
+            // the consumer, which might be calling notify_when_available()
+            if (m_watermark_callback) {
+                m_watermark_callback();
+            }
+        }
+    }
+
+    /*! Consumer side: copy len elements out of the ring, the caller
+     * has checked they are available. */
+    void read_elements(T *buf, size_t len)
+    {
+        const size_t read_ix = m_read_ix.load(std::memory_order_relaxed);
+        const size_t offset = read_ix & m_mask;
+        const size_t first_part = std::min(len, m_capacity - offset);
+
+        memcpy(buf, m_buffer.get() + offset, first_part * sizeof(T));
+        memcpy(buf + first_part, m_buffer.get(), (len - first_part) * sizeof(T));
+
+        m_read_ix.store(read_ix + len, std::memory_order_seq_cst);
+        notify_pop();
+    }
+
+    void notify_pop()
+    {
+        if (m_producer_waiting.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pop_notification.notify_all();
+        }
+    }
+
+    /*! Producer side of a blocking push: wait until the consumer popped
+     * some data, or the timeout expired. */
+    void wait_for_pop()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_producer_waiting.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        const size_t queue_size = size();
+        if (queue_size >= m_max_size) {
+            const auto wait_timeout = std::chrono::milliseconds(100);
+            m_pop_notification.wait_for(lock, wait_timeout);
+        }
+
+        m_producer_waiting.store(false);
+    }
+
+    static constexpr size_t BUFFER_ALIGNMENT = 64;
+
+    struct free_deleter {
+        void operator()(T *p) const { std::free(p); }
+    };
+    std::unique_ptr<T[], free_deleter> m_buffer;
+    size_t m_capacity = 0;
+    size_t m_mask = 0;
+
+    /* The indices grow monotonically and are masked on access. The
+     * producer writes m_write_ix, the consumer m_read_ix, and they are
+     * kept on separate cache lines. */
+    alignas(64) std::atomic<size_t> m_write_ix = {0};
+    alignas(64) std::atomic<size_t> m_read_ix = {0};
+
+    /* Write index at which push() has to wake up the consumer sleeping
+     * in pop_wait() or waiting for the watermark callback, NO_WATERMARK if
+     * the consumer is not waiting. */
+    static constexpr size_t NO_WATERMARK = SIZE_MAX;
+    alignas(64) std::atomic<size_t> m_wake_watermark = {NO_WATERMARK};
+    std::atomic<bool> m_producer_waiting = {false};
     mutable std::mutex m_mutex;
     std::condition_variable m_push_notification;
     std::condition_variable m_pop_notification;
 
+    /* Protected by m_mutex */
+    bool m_watermark_crossed = false;
+    std::chrono::steady_clock::time_point m_watermark_crossed_time;
+    wait_stats_t m_wait_stats;
+    /* Only changed before the watermark is set */
+    std::function<void()> m_watermark_callback;
+
     unsigned int m_bytes_per_sample;
     unsigned int m_channels = 2;
     size_t m_max_size = 1;
@@ -301,8 +489,7 @@ private:
     /*! Counter to keep track of number of overruns between calls
      * to pop()
      */
-    size_t m_overruns = 0;
+    std::atomic<size_t> m_overruns = {0};
 };
 
 #endif
-
@@ -0,0 +1,212 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+
+#include "SampleRateConverter.h"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE__)
+#  include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+#endif
+
+using namespace std;
+
+static_assert(SampleRateConverter::TAPS % 8 == 0, "TAPS must be a multiple of twice the vector width");
+
+static constexpr size_t HALF_TAPS = SampleRateConverter::TAPS / 2;
+
+/* Cutoff of the filter relative to the lower Nyquist frequency. With 64
+ * taps and the Kaiser window below, the transition band is about 8% of the
+ * lower sample rate wide, and the stopband attenuation is about 80dB */
+static constexpr double CUTOFF = 0.91;
+static constexpr double KAISER_BETA = 8.0;
+
+/* Zeroth order modified Bessel function of the first kind, for the Kaiser
+ * window */
+static double bessel_i0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+SampleRateConverter::SampleRateConverter(unsigned int channels,
+        unsigned int input_rate, unsigned int output_rate) :
+    m_channels(channels),
+    m_input_rate(input_rate),
+    m_output_rate(output_rate),
+    m_history(channels)
+{
+    if (channels == 0 or input_rate == 0 or output_rate == 0) {
+        throw invalid_argument("Invalid SampleRateConverter configuration");
+    }
+
+    const unsigned int divisor = gcd(input_rate, output_rate);
+    m_up = output_rate / divisor;
+    m_down = input_rate / divisor;
+
+    if (m_up > 1000) {
+        throw invalid_argument("Unsupported sample rate conversion from " +
+                to_string(input_rate) + " to " + to_string(output_rate));
+    }
+
+    // Cutoff relative to the input Nyquist frequency
+    const double cutoff = CUTOFF * std::min(1.0, (double)output_rate / input_rate);
+    const double i0_beta = bessel_i0(KAISER_BETA);
+
+    m_coeffs.resize(m_up * TAPS);
+    for (size_t p = 0; p < m_up; p++) {
+        const double frac = (double)p / m_up;
+        float *phase_coeffs = &m_coeffs[p * TAPS];
+
+        double sum = 0.0;
+        for (size_t t = 0; t < TAPS; t++) {
+            // Distance between the input sample of this tap and the
+            // output position
+            const double d = (double)t - (double)(HALF_TAPS - 1) - frac;
+            const double x = M_PI * cutoff * d;
+            const double sinc = (d == 0.0) ? 1.0 : sin(x) / x;
+            const double r = d / HALF_TAPS;
+            const double window = bessel_i0(KAISER_BETA * sqrt(std::max(0.0, 1.0 - r * r))) / i0_beta;
+            phase_coeffs[t] = sinc * window;
+            sum += sinc * window;
+        }
+
+        // Unity gain at DC for every phase
+        for (size_t t = 0; t < TAPS; t++) {
+            phase_coeffs[t] /= sum;
+        }
+    }
+
+    // Prime the history so that the first output sample is centered on
+    // the first input sample.
+    for (auto& h : m_history) {
+        h.resize(4 * TAPS);
+    }
+    m_history_len = HALF_TAPS - 1;
+    m_position = (HALF_TAPS - 1) * m_up;
+}
+
+size_t SampleRateConverter::input_frames_needed(size_t num_out) const
+{
+    if (num_out == 0) {
+        return 0;
+    }
+
+    const uint64_t last_position = m_position + (num_out - 1) * m_down;
+    const size_t needed = last_position / m_up + HALF_TAPS + 1;
+    return needed > m_history_len ? needed - m_history_len : 0;
+}
+
+float SampleRateConverter::dot_product(const float *history, const float *coeffs) const
+{
+#if defined(__SSE__)
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (size_t t = 0; t < TAPS; t += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(history + t), _mm_load_ps(coeffs + t)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(history + t + 4), _mm_load_ps(coeffs + t + 4)));
+    }
+    __m128 acc = _mm_add_ps(acc0, acc1);
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc);
+#elif defined(__ARM_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    for (size_t t = 0; t < TAPS; t += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(history + t), vld1q_f32(coeffs + t));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(history + t + 4), vld1q_f32(coeffs + t + 4));
+    }
+    const float32x4_t acc = vaddq_f32(acc0, acc1);
+    float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#else
+    float acc = 0.0f;
+    for (size_t t = 0; t < TAPS; t++) {
+        acc += history[t] * coeffs[t];
+    }
+    return acc;
+#endif
+}
+
+void SampleRateConverter::process(const int16_t *in, size_t num_in, vector<int16_t>& out)
+{
+    if (m_history_len + num_in > m_history[0].size()) {
+        for (auto& h : m_history) {
+            h.resize(m_history_len + num_in);
+        }
+    }
+
+    for (size_t ch = 0; ch < m_channels; ch++) {
+        float *h = m_history[ch].data() + m_history_len;
+        for (size_t i = 0; i < num_in; i++) {
+            h[i] = in[i * m_channels + ch];
+        }
+    }
+    m_history_len += num_in;
+
+    // Number of output frames for which the whole filter has input
+    size_t num_out = 0;
+    if (m_history_len >= HALF_TAPS + 1) {
+        const uint64_t last_ix = m_history_len - HALF_TAPS - 1;
+        if (m_position / m_up <= last_ix) {
+            num_out = (last_ix * m_up + m_up - 1 - m_position) / m_down + 1;
+        }
+    }
+
+    out.resize(num_out * m_channels);
+
+    // The coefficients are aligned for _mm_load_ps, as TAPS is a multiple of
+    // the vector size and vector storage is aligned to 16 bytes
+    for (size_t k = 0; k < num_out; k++) {
+        const size_t ix = m_position / m_up;
+        const float *coeffs = &m_coeffs[(m_position % m_up) * TAPS];
+        const size_t first = ix + 1 - HALF_TAPS;
+
+        for (size_t ch = 0; ch < m_channels; ch++) {
+            const float y = dot_product(m_history[ch].data() + first, coeffs);
+            const long sample = lrintf(y);
+            out[k * m_channels + ch] = std::max(-32768L, std::min(32767L, sample));
+        }
+        m_position += m_down;
+    }
+
+    // Discard the input samples that will not be used anymore
+    const size_t discard = std::min<size_t>(m_history_len,
+            m_position / m_up + 1 - HALF_TAPS);
+    for (auto& h : m_history) {
+        memmove(h.data(), h.data() + discard, (m_history_len - discard) * sizeof(float));
+    }
+    m_history_len -= discard;
+    m_position -= discard * m_up;
+}
+
@@ -0,0 +1,81 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+/*! \file SampleRateConverter.h
+ *
+ * A rational polyphase sample rate converter for interleaved 16-bit
+ * samples, used by the file, ALSA and JACK inputs when the rate of the
+ * source differs from the encoder sample rate.
+ *
+ * Unlike the Resampler used for drift compensation, the ratio is fixed and
+ * exact: with L/M the reduced ratio of output to input rate, the filter has
+ * exactly L phases and each output sample uses one of them, without
+ * interpolation. The filter cutoff follows the lower of the two rates, so
+ * that downsampling does not alias. The inner products are computed with
+ * SSE or NEON when available.
+ */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class SampleRateConverter {
+    public:
+        /*! Number of filter taps, i.e. input samples used per output sample */
+        static constexpr size_t TAPS = 64;
+
+        SampleRateConverter(unsigned int channels,
+                unsigned int input_rate, unsigned int output_rate);
+
+        /*! Return how many input frames must be given to process() so
+         * that it produces at least num_out frames. */
+        size_t input_frames_needed(size_t num_out) const;
+
+        /*! Convert num_in interleaved input frames, and replace the content
+         * of out by all output frames that can be computed. The capacity of
+         * out is reused, so that no allocation happens once it has reached
+         * its steady-state size. */
+        void process(const int16_t *in, size_t num_in, std::vector<int16_t>& out);
+
+        unsigned int input_rate() const { return m_input_rate; }
+        unsigned int output_rate() const { return m_output_rate; }
+
+    private:
+        float dot_product(const float *history, const float *coeffs) const;
+
+        unsigned int m_channels;
+        unsigned int m_input_rate;
+        unsigned int m_output_rate;
+
+        // Reduced ratio: L output frames for every M input frames
+        uint64_t m_up;
+        uint64_t m_down;
+
+        /* m_up * TAPS coefficients, TAPS for every phase */
+        std::vector<float> m_coeffs;
+
+        /* One history buffer per channel, m_history_len valid samples each */
+        std::vector<std::vector<float> > m_history;
+        size_t m_history_len = 0;
+
+        /* Position of the next output sample in the history, in units of
+         * 1/m_up input samples */
+        uint64_t m_position = 0;
+};
+
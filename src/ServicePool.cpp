@@ -0,0 +1,288 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+
+#include "ServicePool.h"
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <cctype>
+#include <cstdio>
+
+using namespace std;
+
+vector<string> split_service_definition(const string& line)
+{
+    vector<string> args;
+    string current;
+    bool in_argument = false;
+    bool escaped = false;
+    char quote = '\0';
+
+    for (const char c : line) {
+        if (escaped) {
+            current += c;
+            escaped = false;
+        }
+        else if (c == '\\' and quote != '\'') {
+            escaped = true;
+            in_argument = true;
+        }
+        else if (quote != '\0') {
+            if (c == quote) {
+                quote = '\0';
+            }
+            else {
+                current += c;
+            }
+        }
+        else if (c == '\'' or c == '"') {
+            quote = c;
+            in_argument = true;
+        }
+        else if (isspace((unsigned char)c)) {
+            if (in_argument) {
+                args.push_back(current);
+                current.clear();
+                in_argument = false;
+            }
+        }
+        else {
+            current += c;
+            in_argument = true;
+        }
+    }
+
+    if (quote != '\0' or escaped) {
+        throw runtime_error("Unterminated quote in service definition");
+    }
+
+    if (in_argument) {
+        args.push_back(current);
+    }
+
+    return args;
+}
+
+ServicePool::ServicePool(size_t num_workers) :
+    m_num_workers(num_workers)
+{
+    if (m_num_workers == 0) {
+        throw invalid_argument("ServicePool needs at least one worker");
+    }
+}
+
+void ServicePool::add_service(const string& name, shared_ptr<PoolService> service)
+{
+    service_t s;
+    s.name = name;
+    s.service = service;
+    m_services.push_back(move(s));
+}
+
+int ServicePool::run()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_num_running = m_services.size();
+
+        // Every service is checked once at startup
+        for (size_t ix = 0; ix < m_services.size(); ix++) {
+            enqueue(ix);
+        }
+    }
+
+    for (size_t ix = 0; ix < m_services.size(); ix++) {
+        m_services[ix].service->set_notify([this, ix]() { notify(ix); });
+    }
+
+    const size_t num_workers = std::min(m_num_workers, m_services.size());
+    fprintf(stderr, "Running %zu services on %zu workers\n",
+            m_services.size(), num_workers);
+
+    vector<thread> workers;
+    for (size_t i = 0; i < num_workers; i++) {
+        workers.emplace_back(&ServicePool::worker, this);
+    }
+
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    print_stats();
+
+    return m_retval;
+}
+
+void ServicePool::notify(size_t ix)
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (m_services[ix].queued) {
+        return;
+    }
+
+    enqueue(ix);
+    m_cond.notify_one();
+}
+
+void ServicePool::enqueue(size_t ix)
+{
+    auto& s = m_services[ix];
+    if (not s.queued and not s.terminated) {
+        s.queued = true;
+        m_candidates.push_back(ix);
+    }
+}
+
+void ServicePool::worker()
+{
+    unique_lock<mutex> lock(m_mutex);
+
+    while (m_num_running > 0) {
+        const auto now = chrono::steady_clock::now();
+
+        while (not m_deadlines.empty() and m_deadlines.begin()->first <= now) {
+            const size_t ix = m_deadlines.begin()->second;
+            m_deadlines.erase(m_deadlines.begin());
+            m_services[ix].has_deadline = false;
+            enqueue(ix);
+        }
+
+        if (m_candidates.empty()) {
+            if (m_deadlines.empty()) {
+                m_cond.wait(lock);
+            }
+            else {
+                m_cond.wait_until(lock, m_deadlines.begin()->first);
+            }
+            continue;
+        }
+
+        const size_t ix = m_candidates.front();
+        m_candidates.pop_front();
+
+        service_t& s = m_services[ix];
+        s.queued = false;
+
+        // A busy service is checked again when its step is done
+        if (s.busy or s.terminated) {
+            continue;
+        }
+
+        if (s.has_deadline) {
+            m_deadlines.erase(s.deadline);
+            s.has_deadline = false;
+        }
+
+        bool ready = true;
+        auto wake_at = chrono::steady_clock::time_point::max();
+        s.num_ready_checks++;
+        try {
+            ready = s.service->ready(now, wake_at);
+        }
+        catch (const exception&) {
+            // Let step() report the error
+        }
+
+        if (not ready) {
+            if (wake_at != chrono::steady_clock::time_point::max()) {
+                s.deadline = m_deadlines.emplace(wake_at, ix);
+                s.has_deadline = true;
+
+                // The other workers might be sleeping until a later time
+                if (s.deadline == m_deadlines.begin()) {
+                    m_cond.notify_one();
+                }
+            }
+            continue;
+        }
+
+        s.busy = true;
+        lock.unlock();
+
+        int retval = 0;
+        bool running = false;
+        const auto time_start = chrono::steady_clock::now();
+        try {
+            running = s.service->step(retval);
+        }
+        catch (const exception& e) {
+            fprintf(stderr, "Service %s failed: %s\n",
+                    s.name.c_str(), e.what());
+            retval = 1;
+        }
+        const auto step_time = chrono::steady_clock::now() - time_start;
+
+        lock.lock();
+        s.busy = false;
+        s.num_steps++;
+        s.step_time_total += step_time;
+        s.step_time_max = std::max(s.step_time_max, step_time);
+
+        if (running) {
+            // Behind the services that are already waiting for a worker
+            enqueue(ix);
+        }
+        else {
+            fprintf(stderr, "Service %s terminated with code %d\n",
+                    s.name.c_str(), retval);
+            s.terminated = true;
+            s.retval = retval;
+            m_num_running--;
+
+            if (m_retval == 0) {
+                m_retval = retval;
+            }
+
+            m_cond.notify_all();
+        }
+    }
+}
+
+vector<ServicePool::service_stats_t> ServicePool::stats()
+{
+    lock_guard<mutex> lock(m_mutex);
+
+    vector<service_stats_t> stats;
+    for (const auto& s : m_services) {
+        service_stats_t st;
+        st.name = s.name;
+        st.num_steps = s.num_steps;
+        st.num_ready_checks = s.num_ready_checks;
+        if (s.num_steps > 0) {
+            st.step_time_avg = s.step_time_total / s.num_steps;
+        }
+        st.step_time_max = s.step_time_max;
+        st.retval = s.retval;
+        stats.push_back(st);
+    }
+    return stats;
+}
+
+void ServicePool::print_stats()
+{
+    using namespace std::chrono;
+
+    fprintf(stderr, "Service statistics:\n");
+    for (const auto& s : stats()) {
+        fprintf(stderr, "  %-32s frames: %zu, checks: %zu, avg: %ld us, max: %ld us, exit code: %d\n",
+                s.name.c_str(), s.num_steps, s.num_ready_checks,
+                (long)duration_cast<microseconds>(s.step_time_avg).count(),
+                (long)duration_cast<microseconds>(s.step_time_max).count(),
+                s.retval);
+    }
+}
@@ -0,0 +1,157 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+/*! \file ServicePool.h
+ *
+ * Runs several independent encoder services inside one process, on a
+ * fixed number of worker threads. Each service is stepped one frame at a
+ * time by whichever worker is free, and only once it can make progress
+ * without blocking.
+ *
+ * Idle workers sleep until a service signals that it might have become
+ * ready, or until the earliest time a waiting service asked to be checked
+ * again. They never poll the services.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+/*! The interface a service must implement to be run by the ServicePool */
+class PoolService {
+    public:
+        virtual ~PoolService() {}
+
+        /*! Called once before the pool starts. The service must call notify,
+         *  from any thread, when it might have become ready after ready()
+         *  returned false, e.g. when its input data arrived.
+         */
+        virtual void set_notify(std::function<void()> notify) = 0;
+
+        /*! Return true if step() can be called now without having to wait
+         *  for input data or for the drift compensation throttling.
+         *
+         *  Otherwise, the service is checked again once it calls notify, or
+         *  at wake_at if it sets it, e.g. for a throttling period or a
+         *  timeout.
+         */
+        virtual bool ready(std::chrono::steady_clock::time_point now,
+                std::chrono::steady_clock::time_point& wake_at) = 0;
+
+        /*! Encode one frame. Returns false when the service terminated,
+         *  in which case retval contains its exit code.
+         */
+        virtual bool step(int& retval) = 0;
+};
+
+/*! Split one line of the services file into arguments. Arguments are
+ * separated by whitespace, and can be quoted using ' or ". Outside of
+ * single quotes, a backslash escapes the next character.
+ *
+ * Throws a runtime_error on an unterminated quote or escape.
+ */
+std::vector<std::string> split_service_definition(const std::string& line);
+
+class ServicePool {
+    public:
+        ServicePool(size_t num_workers);
+        ServicePool(const ServicePool&) = delete;
+        ServicePool& operator=(const ServicePool&) = delete;
+
+        /*! Add a service. Must be called before run() */
+        void add_service(const std::string& name,
+                std::shared_ptr<PoolService> service);
+
+        /*! Step all services until every one of them has terminated.
+         *
+         * \return 0 if all services terminated normally, otherwise the
+         * exit code of the first service that failed.
+         */
+        int run(void);
+
+        struct service_stats_t {
+            std::string name;
+            size_t num_steps = 0;
+            /*! How many times ready() was called */
+            size_t num_ready_checks = 0;
+            std::chrono::steady_clock::duration step_time_avg = {};
+            std::chrono::steady_clock::duration step_time_max = {};
+            int retval = 0;
+        };
+
+        /*! Return the statistics of every service, in the order they were
+         * added. Can be called from any thread. */
+        std::vector<service_stats_t> stats(void);
+
+    private:
+        using deadlines_t =
+            std::multimap<std::chrono::steady_clock::time_point, size_t>;
+
+        struct service_t {
+            std::string name;
+            std::shared_ptr<PoolService> service;
+
+            bool busy = false;
+            bool terminated = false;
+            int retval = 0;
+
+            /* In m_candidates */
+            bool queued = false;
+
+            /* In m_deadlines */
+            bool has_deadline = false;
+            deadlines_t::iterator deadline;
+
+            size_t num_steps = 0;
+            size_t num_ready_checks = 0;
+            std::chrono::steady_clock::duration step_time_total = {};
+            std::chrono::steady_clock::duration step_time_max = {};
+        };
+
+        void worker(void);
+        void notify(size_t ix);
+        void enqueue(size_t ix);
+        void print_stats(void);
+
+        size_t m_num_workers;
+        std::vector<service_t> m_services;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+
+        /* All below are protected by m_mutex */
+
+        /* The services to check with ready(), in the order they were
+         * notified. Stepped services go to the back, so that no service can
+         * starve the others. */
+        std::deque<size_t> m_candidates;
+
+        /* The services waiting for a time */
+        deadlines_t m_deadlines;
+
+        size_t m_num_running = 0;
+        int m_retval = 0;
+};
+
@@ -19,10 +19,13 @@
 #include "config.h"
 #include "StatsPublish.h"
 #include <stdexcept>
-#include <sstream>
+#include <cstdarg>
+#include <atomic>
+#include <algorithm>
 #include <cstring>
 #include <cerrno>
 #include <cassert>
+#include <cmath>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -30,9 +33,31 @@
 
 using namespace std;
 
-StatsPublisher::StatsPublisher(const string& socket_path) :
-    m_socket_path(socket_path)
+// When several services run in the same process, each one has its own
+// StatsPublisher and needs its own client socket.
+static atomic<unsigned int> num_publishers_created(0);
+
+// Room for the JSON without the identifier and the EDI destinations
+static const size_t JSON_BASE_SIZE = 4096;
+// Room for one EDI destination, without its name
+static const size_t JSON_DESTINATION_SIZE = 256;
+
+StatsPublisher::StatsPublisher(const string& socket_path, const string& identifier) :
+    m_socket_path(socket_path),
+    m_time_last_send(chrono::steady_clock::now())
 {
+    // Escape the user-supplied identifier once for the JSON
+    for (const char c : identifier) {
+        if (c == '"' or c == '\\') {
+            m_identifier += '\\';
+        }
+        m_identifier += c;
+    }
+    size_json_buffer();
+
+    // Room for all stages of the pipeline
+    m_pipeline_stages.reserve(4);
+
     // The client socket binds to a socket whose name depends on PID, and connects to
     // `socket_path`
 
@@ -55,7 +80,14 @@ StatsPublisher::StatsPublisher(const string& socket_path) :
     struct sockaddr_un claddr;
     memset(&claddr, 0, sizeof(struct sockaddr_un));
     claddr.sun_family = AF_UNIX;
-    snprintf(claddr.sun_path, sizeof(claddr.sun_path), "/tmp/odr-audioenc.%ld", (long) getpid());
+    const unsigned int publisher_index = num_publishers_created.fetch_add(1);
+    if (publisher_index == 0) {
+        snprintf(claddr.sun_path, sizeof(claddr.sun_path), "/tmp/odr-audioenc.%ld", (long) getpid());
+    }
+    else {
+        snprintf(claddr.sun_path, sizeof(claddr.sun_path), "/tmp/odr-audioenc.%ld.%u",
+                (long) getpid(), publisher_index);
+    }
 
     int ret = ::bind(m_sock, (const struct sockaddr *) &claddr, sizeof(struct sockaddr_un));
     if (ret == -1) {
@@ -76,6 +108,24 @@ void StatsPublisher::update_audio_levels(int16_t audiolevel_left, int16_t audiol
     m_audio_right = audiolevel_right;
 }
 
+void StatsPublisher::update_loudness(const loudness_levels_t& levels)
+{
+    const float true_peak = m_loudness_available ?
+        std::max(m_loudness.true_peak, levels.true_peak) : levels.true_peak;
+    m_loudness = levels;
+    m_loudness.true_peak = true_peak;
+    m_loudness_available = true;
+}
+
+void StatsPublisher::update_dynamics(const dynamics_levels_t& levels)
+{
+    const float limiter_reduction = std::max(m_dynamics.limiter_reduction,
+            levels.limiter_reduction);
+    m_dynamics = levels;
+    m_dynamics.limiter_reduction = limiter_reduction;
+    m_dynamics_available = true;
+}
+
 void StatsPublisher::notify_underrun()
 {
     m_num_underruns++;
@@ -86,32 +136,300 @@ void StatsPublisher::notify_overrun()
     m_num_overruns++;
 }
 
+void StatsPublisher::update_processing_time(chrono::steady_clock::duration frame_time)
+{
+    m_num_frames_processed++;
+    m_processing_time_total += frame_time;
+    m_processing_time_max = std::max(m_processing_time_max, frame_time);
+}
+
+void StatsPublisher::update_pipeline_stage(size_t index, const char *name, size_t queue_depth,
+        chrono::steady_clock::duration avg_latency,
+        chrono::steady_clock::duration max_latency)
+{
+    if (m_pipeline_stages.size() <= index) {
+        m_pipeline_stages.resize(index + 1);
+    }
+
+    auto& stage = m_pipeline_stages[index];
+    stage.name = name;
+    stage.queue_depth = queue_depth;
+    stage.avg_latency = avg_latency;
+    stage.max_latency = max_latency;
+}
+
+void StatsPublisher::update_drift_ratio(double ratio)
+{
+    m_drift_ratio_valid = true;
+    m_drift_ratio = ratio;
+}
+
+void StatsPublisher::update_input_wakeups(size_t num_wakeups,
+        chrono::steady_clock::duration avg_handover_latency,
+        chrono::steady_clock::duration max_handover_latency)
+{
+    m_num_input_wakeups = num_wakeups;
+    m_handover_latency_avg = avg_handover_latency;
+    m_handover_latency_max = max_handover_latency;
+}
+
+void StatsPublisher::update_psy_model(size_t num_runs, size_t num_transients)
+{
+    m_psy_model_available = true;
+    m_num_psy_runs += num_runs;
+    m_num_psy_transients += num_transients;
+}
+
+void StatsPublisher::update_edi_scheduler(const edi::FragmentScheduler::stats_t& stats)
+{
+    m_edi_scheduler_available = true;
+    m_edi_scheduler.num_sent += stats.num_sent;
+    m_edi_scheduler.num_dropped += stats.num_dropped;
+    for (size_t i = 0; i < stats.jitter_histogram.size(); i++) {
+        m_edi_scheduler.jitter_histogram[i] += stats.jitter_histogram[i];
+    }
+    m_edi_scheduler.max_jitter = std::max(m_edi_scheduler.max_jitter, stats.max_jitter);
+}
+
+void StatsPublisher::update_edi_udp(const edi::UDPBatchSender::stats_t& stats)
+{
+    m_edi_udp_available = true;
+    m_edi_udp.num_syscalls += stats.num_syscalls;
+    m_edi_udp.num_packets += stats.num_packets;
+}
+
+void StatsPublisher::update_edi_destinations(const std::vector<edi::destination_stats_t>& stats)
+{
+    bool destinations_changed = m_edi_destinations.size() != stats.size();
+    if (destinations_changed) {
+        m_edi_destinations.resize(stats.size());
+    }
+
+    for (size_t i = 0; i < stats.size(); i++) {
+        auto& dest = m_edi_destinations[i];
+        const auto& s = stats[i].stats;
+        if (dest.name != stats[i].name) {
+            dest.name = stats[i].name;
+            destinations_changed = true;
+        }
+        dest.stats.queue_depth = s.queue_depth;
+        dest.stats.num_sent += s.num_sent;
+        dest.stats.num_dropped += s.num_dropped;
+        dest.stats.num_reconnects += s.num_reconnects;
+        dest.stats.latency_total += s.latency_total;
+        dest.stats.latency_max = std::max(dest.stats.latency_max, s.latency_max);
+    }
+
+    // The destinations are configured once, this only allocates when the
+    // EDI output sends its first stats
+    if (destinations_changed) {
+        size_json_buffer();
+    }
+}
+
+void StatsPublisher::size_json_buffer()
+{
+    size_t size = JSON_BASE_SIZE + m_identifier.size();
+    for (const auto& dest : m_edi_destinations) {
+        size += JSON_DESTINATION_SIZE + dest.name.size();
+    }
+
+    if (m_json.size() < size) {
+        m_json.resize(size);
+    }
+}
+
+void StatsPublisher::append(const char *format, ...)
+{
+    if (m_json_overflow) {
+        return;
+    }
+
+    // Keep the room for the closing brace
+    const size_t available = m_json.size() - 1 - m_json_len;
+
+    va_list ap;
+    va_start(ap, format);
+    const int ret = vsnprintf(m_json.data() + m_json_len, available, format, ap);
+    va_end(ap);
+
+    if (ret < 0 or (size_t)ret >= available) {
+        m_json_overflow = true;
+    }
+    else {
+        m_json_len += ret;
+    }
+}
+
+void StatsPublisher::begin_section()
+{
+    m_section_start = m_json_len;
+}
+
+void StatsPublisher::end_section(const char *name)
+{
+    if (m_json_overflow) {
+        m_json_len = m_section_start;
+        m_json_overflow = false;
+
+        if (not m_overflow_reported) {
+            fprintf(stderr, "Statistics larger than %zu bytes, leaving out %s\n",
+                    m_json.size(), name);
+            m_overflow_reported = true;
+        }
+    }
+}
+
+/* JSON has no representation for infinity */
+void StatsPublisher::append_number(float value)
+{
+    if (not std::isfinite(value)) {
+        append("null");
+    }
+    else {
+        append("%.1f", value);
+    }
+}
+
 void StatsPublisher::send_stats()
 {
-    // Manually build JSON. We can be certain that
-    // our fields don't contain quotes
-    stringstream json;
-    json << "{ ";
-    json << "\"program\": \"" << PACKAGE_NAME << "\", ";
-    json << "\"version\": \"" <<
+    // Manually build JSON into the preallocated buffer, so that sending the
+    // stats does not allocate. We can be certain that our fields don't
+    // contain quotes, the user-supplied identifier was escaped in the
+    // constructor
+    m_json_len = 0;
+    m_json_overflow = false;
+    append("{ \"program\": \"%s\", \"version\": \"%s\", ", PACKAGE_NAME,
 #if defined(GITVERSION)
             GITVERSION
 #else
             PACKAGE_VERSION
 #endif
-        << "\", ";
-    json << "\"audiolevels\": { \"left\": " << m_audio_left << ", \"right\": " << m_audio_right << "}, ";
-    json << "\"driftcompensation\": { \"underruns\": " << m_num_underruns << ", \"overruns\": " << m_num_overruns << "} ";
-    json << "}";
+            );
+    if (not m_identifier.empty()) {
+        append("\"identifier\": \"%s\", ", m_identifier.c_str());
+    }
+    append("\"audiolevels\": { \"left\": %d, \"right\": %d}, ", m_audio_left, m_audio_right);
+    if (m_loudness_available) {
+        begin_section();
+        append("\"loudness\": { \"momentary\": ");
+        append_number(m_loudness.momentary);
+        append(", \"shortterm\": ");
+        append_number(m_loudness.short_term);
+        append(", \"integrated\": ");
+        append_number(m_loudness.integrated);
+        append(", \"range\": ");
+        append_number(m_loudness.range);
+        append(", \"truepeak\": ");
+        append_number(m_loudness.true_peak);
+        append("}, ");
+        end_section("loudness");
+    }
+    if (m_dynamics_available) {
+        begin_section();
+        append("\"dynamics\": { \"agc_gain_db\": ");
+        append_number(m_dynamics.agc_gain);
+        append(", \"limiter_reduction_db\": ");
+        append_number(m_dynamics.limiter_reduction);
+        append("}, ");
+        end_section("dynamics");
+    }
+    append("\"driftcompensation\": { \"underruns\": %zu, \"overruns\": %zu",
+            m_num_underruns, m_num_overruns);
+    if (m_drift_ratio_valid) {
+        append(", \"ratio_ppm\": %ld", lrint((m_drift_ratio - 1.0) * 1e6));
+    }
+    append("}, ");
+
+    using namespace std::chrono;
+    const long avg_us = m_num_frames_processed == 0 ? 0 :
+        duration_cast<microseconds>(m_processing_time_total).count() / (long)m_num_frames_processed;
+    append("\"processing\": { \"frames\": %zu, \"avg_us\": %ld, \"max_us\": %ld}, ",
+            m_num_frames_processed, avg_us,
+            (long)duration_cast<microseconds>(m_processing_time_max).count());
+
+    const auto now = steady_clock::now();
+    const double interval_s = duration<double>(now - m_time_last_send).count();
+    m_time_last_send = now;
+    append("\"input\": { \"wakeups_per_s\": %ld, \"handover_avg_us\": %ld, \"handover_max_us\": %ld} ",
+            (interval_s > 0 ? (long)(m_num_input_wakeups / interval_s + 0.5) : 0),
+            (long)duration_cast<microseconds>(m_handover_latency_avg).count(),
+            (long)duration_cast<microseconds>(m_handover_latency_max).count());
+
+    if (m_psy_model_available) {
+        begin_section();
+        append(", \"psymodel\": { \"runs_per_s\": %ld, \"transients_per_s\": %ld} ",
+                (interval_s > 0 ? (long)(m_num_psy_runs / interval_s + 0.5) : 0),
+                (interval_s > 0 ? (long)(m_num_psy_transients / interval_s + 0.5) : 0));
+        end_section("psymodel");
+    }
+
+    if (m_edi_scheduler_available) {
+        // Bucket k of the jitter histogram counts the fragments sent
+        // between 2^(k-1) and 2^k us late
+        begin_section();
+        append(", \"edi\": { \"fragments_per_s\": %ld, \"dropped\": %zu, \"jitter_max_us\": %ld, "
+                "\"jitter_histogram\": [",
+                (interval_s > 0 ? (long)(m_edi_scheduler.num_sent / interval_s + 0.5) : 0),
+                m_edi_scheduler.num_dropped,
+                (long)duration_cast<microseconds>(m_edi_scheduler.max_jitter).count());
+        for (size_t i = 0; i < m_edi_scheduler.jitter_histogram.size(); i++) {
+            append("%s%zu", (i > 0 ? ", " : ""), m_edi_scheduler.jitter_histogram[i]);
+        }
+        append("]} ");
+        end_section("edi");
+    }
+
+    if (m_edi_udp_available) {
+        begin_section();
+        append(", \"edi_udp\": { \"syscalls_per_s\": %ld, \"packets_per_syscall\": ",
+                (interval_s > 0 ? (long)(m_edi_udp.num_syscalls / interval_s + 0.5) : 0));
+        append_number(m_edi_udp.num_syscalls > 0 ?
+                (double)m_edi_udp.num_packets / m_edi_udp.num_syscalls : 0.0);
+        append("} ");
+        end_section("edi_udp");
+    }
+
+    if (not m_edi_destinations.empty()) {
+        begin_section();
+        append(", \"edi_destinations\": [ ");
+        for (size_t i = 0; i < m_edi_destinations.size(); i++) {
+            const auto& dest = m_edi_destinations[i];
+            append("%s{ \"destination\": \"%s\", \"queue\": %zu, \"sent\": %zu, "
+                    "\"dropped\": %zu, \"reconnects\": %zu, \"avg_us\": %ld, \"max_us\": %ld}",
+                    (i > 0 ? ", " : ""), dest.name.c_str(), dest.stats.queue_depth,
+                    dest.stats.num_sent, dest.stats.num_dropped, dest.stats.num_reconnects,
+                    (long)duration_cast<microseconds>(dest.stats.latency_avg()).count(),
+                    (long)duration_cast<microseconds>(dest.stats.latency_max).count());
+        }
+        append(" ] ");
+        end_section("edi_destinations");
+    }
 
-    const auto jsonstr = json.str();
+    if (not m_pipeline_stages.empty()) {
+        begin_section();
+        append(", \"pipeline\": [ ");
+        for (size_t i = 0; i < m_pipeline_stages.size(); i++) {
+            const auto& stage = m_pipeline_stages[i];
+            append("%s{ \"stage\": \"%s\", \"queue\": %zu, \"avg_us\": %ld, \"max_us\": %ld}",
+                    (i > 0 ? ", " : ""), (stage.name ? stage.name : ""), stage.queue_depth,
+                    (long)duration_cast<microseconds>(stage.avg_latency).count(),
+                    (long)duration_cast<microseconds>(stage.max_latency).count());
+        }
+        append(" ] ");
+        end_section("pipeline");
+    }
+
+    // The fields outside of the sections always fit into JSON_BASE_SIZE
+    assert(not m_json_overflow);
+    m_json[m_json_len++] = '}';
 
     struct sockaddr_un claddr;
     memset(&claddr, 0, sizeof(struct sockaddr_un));
     claddr.sun_family = AF_UNIX;
     snprintf(claddr.sun_path, sizeof(claddr.sun_path), "%s", m_socket_path.c_str());
 
-    int ret = ::sendto(m_sock, jsonstr.data(), jsonstr.size(), 0,
+    int ret = ::sendto(m_sock, m_json.data(), m_json_len, 0,
             (struct sockaddr *) &claddr, sizeof(struct sockaddr_un));
     if (ret == -1) {
         // This suppresses the -Wlogical-op warning
@@ -130,9 +448,9 @@ void StatsPublisher::send_stats()
             fprintf(stderr, "Statistics send failed: %s\n", strerror(errno));
         }
     }
-    else if (ret != (ssize_t)jsonstr.size()) {
+    else if (ret != (ssize_t)m_json_len) {
         fprintf(stderr, "Statistics send incorrect length: %d bytes of %zu transmitted\n",
-                ret, jsonstr.size());
+                ret, m_json_len);
     }
     else if (not m_destination_available) {
         fprintf(stderr, "Stats destination is now available at %s\n", m_socket_path.c_str());
@@ -141,4 +459,21 @@ void StatsPublisher::send_stats()
 
     m_audio_left = 0;
     m_audio_right = 0;
+    m_loudness.true_peak = -INFINITY;
+    m_dynamics.limiter_reduction = 0.0f;
+
+    m_num_frames_processed = 0;
+    m_processing_time_total = {};
+    m_processing_time_max = {};
+
+    m_num_input_wakeups = 0;
+    m_handover_latency_avg = {};
+    m_num_psy_runs = 0;
+    m_num_psy_transients = 0;
+    m_edi_scheduler = edi::FragmentScheduler::stats_t();
+    m_edi_udp = edi::UDPBatchSender::stats_t();
+    for (auto& dest : m_edi_destinations) {
+        dest.stats = Socket::SendStats();
+    }
+    m_handover_latency_max = {};
 }
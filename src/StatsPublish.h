@@ -18,22 +18,33 @@
 
 #pragma once
 #include <string>
+#include <vector>
+#include <chrono>
 #include <cstdint>
 #include <cstddef>
 #include <cstdio>
+#include "LoudnessMeter.h"
+#include "DynamicsProcessor.h"
+#include "edioutput/FragmentScheduler.h"
+#include "edioutput/UDPBatchSender.h"
+#include "edioutput/Transport.h"
 
 /*! \file StatsPublish.h
  *
  * Collects and sends some stats to a UNIX DGRAM socket so that an external tool
  * like ODR-EncoderManager can display it.
  *
- * Currently, only audio levels are collected.
+ * Collected are audio levels and loudness, buffer and processing statistics.
  *
  * Output is formatted in JSON
  */
 class StatsPublisher {
     public:
-        StatsPublisher(const std::string& socket_path);
+        /*! The identifier is included in the JSON, so that several services
+         * running in the same process can use the same stats socket.
+         */
+        StatsPublisher(const std::string& socket_path,
+                const std::string& identifier = "");
         StatsPublisher(const StatsPublisher& other) = delete;
         StatsPublisher& operator=(const StatsPublisher& other) = delete;
         ~StatsPublisher();
@@ -41,12 +52,57 @@ class StatsPublisher {
         /*! Update peak audio level information */
         void update_audio_levels(int16_t audiolevel_left, int16_t audiolevel_right);
 
+        /*! Update the loudness measurement. The true peak published is the
+         * largest one received since the previous send_stats(). */
+        void update_loudness(const loudness_levels_t& levels);
+
+        /*! Update the state of the AGC and limiter. The limiter gain
+         * reduction published is the largest one received since the previous
+         * send_stats(). */
+        void update_dynamics(const dynamics_levels_t& levels);
+
         /*! Increments the underrun counter */
         void notify_underrun();
 
         /*! Increments the overrun counter */
         void notify_overrun();
 
+        /*! Account the time it took to encode one frame */
+        void update_processing_time(std::chrono::steady_clock::duration frame_time);
+
+        /*! Update the queue depth and latency of one stage of the encoding
+         * pipeline. The index gives the position of the stage in the JSON.
+         * The name must be a string literal. */
+        void update_pipeline_stage(size_t index, const char *name, size_t queue_depth,
+                std::chrono::steady_clock::duration avg_latency,
+                std::chrono::steady_clock::duration max_latency);
+
+        /*! Update the resampling ratio used by the drift compensation */
+        void update_drift_ratio(double ratio);
+
+        /*! Update the statistics of the input queue: how many times the
+         * encoder woke up waiting for samples, and how long it took from the
+         * input delivering a complete frame to the encoder getting it. */
+        void update_input_wakeups(size_t num_wakeups,
+                std::chrono::steady_clock::duration avg_handover_latency,
+                std::chrono::steady_clock::duration max_handover_latency);
+
+        /*! Account runs of the DAB psychoacoustic model since the previous
+         * call, and how many of them were caused by an attack in quick mode */
+        void update_psy_model(size_t num_runs, size_t num_transients);
+
+        /*! Account the PFT fragments the EDI output sent since the previous
+         * call, and how late they were sent */
+        void update_edi_scheduler(const edi::FragmentScheduler::stats_t& stats);
+
+        /*! Account the UDP packets the EDI output sent since the previous
+         * call, and the system calls it needed for them */
+        void update_edi_udp(const edi::UDPBatchSender::stats_t& stats);
+
+        /*! Account what the EDI output sent to each destination since the
+         * previous call. The queue depth is the most recent one. */
+        void update_edi_destinations(const std::vector<edi::destination_stats_t>& stats);
+
         /*! Send the collected stats to the socket, doesn't block. If the socket is
          * not connected, the data is lost.
          *
@@ -54,14 +110,74 @@ class StatsPublisher {
         void send_stats();
 
     private:
+        /*! Append to the JSON being built, printf-style. If it does not
+         * fit, nothing is appended and m_json_overflow is set. */
+        void append(const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+        void append_number(float value);
+
+        /*! The JSON appended between begin_section() and end_section() is
+         * left out if it did not fit entirely, so that the JSON sent stays
+         * valid. */
+        void begin_section();
+        void end_section(const char *name);
+
+        /*! Make the JSON buffer large enough for the identifier and the
+         * EDI destinations. */
+        void size_json_buffer();
+
         std::string m_socket_path;
+        std::string m_identifier; // escaped for JSON
         int m_sock = -1;
 
+        // Preallocated buffer for the JSON
+        std::vector<char> m_json;
+        size_t m_json_len = 0;
+        bool m_json_overflow = false;
+        size_t m_section_start = 0;
+        bool m_overflow_reported = false;
+
         int16_t m_audio_left = 0;
         int16_t m_audio_right = 0;
 
+        bool m_loudness_available = false;
+        loudness_levels_t m_loudness;
+
+        bool m_dynamics_available = false;
+        dynamics_levels_t m_dynamics;
+
         size_t m_num_underruns = 0;
         size_t m_num_overruns = 0;
+        bool m_drift_ratio_valid = false;
+        double m_drift_ratio = 1.0;
+
+        size_t m_num_frames_processed = 0;
+        std::chrono::steady_clock::duration m_processing_time_total = {};
+        std::chrono::steady_clock::duration m_processing_time_max = {};
+
+        struct pipeline_stage_t {
+            const char *name = nullptr;
+            size_t queue_depth = 0;
+            std::chrono::steady_clock::duration avg_latency = {};
+            std::chrono::steady_clock::duration max_latency = {};
+        };
+        std::vector<pipeline_stage_t> m_pipeline_stages;
+
+        size_t m_num_input_wakeups = 0;
+        std::chrono::steady_clock::duration m_handover_latency_avg = {};
+        std::chrono::steady_clock::duration m_handover_latency_max = {};
+        std::chrono::steady_clock::time_point m_time_last_send;
+
+        bool m_psy_model_available = false;
+        size_t m_num_psy_runs = 0;
+        size_t m_num_psy_transients = 0;
+
+        bool m_edi_scheduler_available = false;
+        edi::FragmentScheduler::stats_t m_edi_scheduler;
+
+        bool m_edi_udp_available = false;
+        edi::UDPBatchSender::stats_t m_edi_udp;
+
+        std::vector<edi::destination_stats_t> m_edi_destinations;
 
         bool m_destination_available = true;
 };
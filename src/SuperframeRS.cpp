@@ -0,0 +1,280 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+
+#include "SuperframeRS.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#  include <arm_neon.h>
+#endif
+
+using namespace std;
+
+using nibble_table_t = uint8_t[16];
+
+/* Multiplication in GF(2^8) with the polynomial 0x11d */
+static uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    uint8_t product = 0;
+    while (b) {
+        if (b & 1) {
+            product ^= a;
+        }
+        a = (a << 1) ^ ((a & 0x80) ? 0x1d : 0);
+        b >>= 1;
+    }
+    return product;
+}
+
+/* Encode the rows of one block of rows with the per-row feedback tables. The
+ * parity is kept in the bytes of lo and hi, and each data byte shifts it by
+ * one byte. */
+static void encode_rows_scalar(uint8_t *superframe, size_t stride, size_t num_rows,
+        const uint64_t *feedback_lo, const uint16_t *feedback_hi)
+{
+    for (size_t row = 0; row < num_rows; row++) {
+        uint64_t lo = 0;
+        uint16_t hi = 0;
+        for (size_t col = 0; col < SuperframeRS::NUM_DATA; col++) {
+            const uint8_t fb = superframe[stride * col + row] ^ (lo & 0xff);
+            lo = ((lo >> 8) | ((uint64_t)(hi & 0xff) << 56)) ^ feedback_lo[fb];
+            hi = (hi >> 8) ^ feedback_hi[fb];
+        }
+
+        for (size_t k = 0; k < 8; k++) {
+            superframe[stride * (SuperframeRS::NUM_DATA + k) + row] = lo >> (8 * k);
+        }
+        superframe[stride * (SuperframeRS::NUM_DATA + 8) + row] = hi & 0xff;
+        superframe[stride * (SuperframeRS::NUM_DATA + 9) + row] = hi >> 8;
+    }
+}
+
+/* The SIMD kernels encode width rows starting at base, whose bytes are
+ * stride apart. */
+using kernel_t = void (*)(uint8_t *base, size_t stride,
+        const nibble_table_t *mul_lo, const nibble_table_t *mul_hi);
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("ssse3")))
+static void kernel_ssse3(uint8_t *base, size_t stride,
+        const nibble_table_t *mul_lo, const nibble_table_t *mul_hi)
+{
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i lo[SuperframeRS::NUM_PARITY], hi[SuperframeRS::NUM_PARITY];
+    __m128i p[SuperframeRS::NUM_PARITY];
+    for (size_t k = 0; k < SuperframeRS::NUM_PARITY; k++) {
+        lo[k] = _mm_load_si128((const __m128i*)mul_lo[k]);
+        hi[k] = _mm_load_si128((const __m128i*)mul_hi[k]);
+        p[k] = _mm_setzero_si128();
+    }
+
+    for (size_t col = 0; col < SuperframeRS::NUM_DATA; col++) {
+        const __m128i fb = _mm_xor_si128(
+                _mm_loadu_si128((const __m128i*)(base + stride * col)), p[0]);
+        const __m128i fb_lo = _mm_and_si128(fb, mask);
+        const __m128i fb_hi = _mm_and_si128(_mm_srli_epi16(fb, 4), mask);
+        for (size_t k = 0; k < SuperframeRS::NUM_PARITY; k++) {
+            const __m128i product = _mm_xor_si128(
+                    _mm_shuffle_epi8(lo[k], fb_lo), _mm_shuffle_epi8(hi[k], fb_hi));
+            p[k] = k + 1 < SuperframeRS::NUM_PARITY ?
+                _mm_xor_si128(p[k + 1], product) : product;
+        }
+    }
+
+    for (size_t k = 0; k < SuperframeRS::NUM_PARITY; k++) {
+        _mm_storeu_si128((__m128i*)(base + stride * (SuperframeRS::NUM_DATA + k)), p[k]);
+    }
+}
+
+__attribute__((target("avx2")))
+static void kernel_avx2(uint8_t *base, size_t stride,
+        const nibble_table_t *mul_lo, const nibble_table_t *mul_hi)
+{
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    __m256i lo[SuperframeRS::NUM_PARITY], hi[SuperframeRS::NUM_PARITY];
+    __m256i p[SuperframeRS::NUM_PARITY];
+    for (size_t k = 0; k < SuperframeRS::NUM_PARITY; k++) {
+        lo[k] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)mul_lo[k]));
+        hi[k] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)mul_hi[k]));
+        p[k] = _mm256_setzero_si256();
+    }
+
+    for (size_t col = 0; col < SuperframeRS::NUM_DATA; col++) {
+        const __m256i fb = _mm256_xor_si256(
+                _mm256_loadu_si256((const __m256i*)(base + stride * col)), p[0]);
+        const __m256i fb_lo = _mm256_and_si256(fb, mask);
+        const __m256i fb_hi = _mm256_and_si256(_mm256_srli_epi16(fb, 4), mask);
+        for (size_t k = 0; k < SuperframeRS::NUM_PARITY; k++) {
+            const __m256i product = _mm256_xor_si256(
+                    _mm256_shuffle_epi8(lo[k], fb_lo), _mm256_shuffle_epi8(hi[k], fb_hi));
+            p[k] = k + 1 < SuperframeRS::NUM_PARITY ?
+                _mm256_xor_si256(p[k + 1], product) : product;
+        }
+    }
+
+    for (size_t k = 0; k < SuperframeRS::NUM_PARITY; k++) {
+        _mm256_storeu_si256((__m256i*)(base + stride * (SuperframeRS::NUM_DATA + k)), p[k]);
+    }
+}
+#endif
+
+#if defined(__aarch64__)
+static void kernel_neon(uint8_t *base, size_t stride,
+        const nibble_table_t *mul_lo, const nibble_table_t *mul_hi)
+{
+    const uint8x16_t mask = vdupq_n_u8(0x0f);
+    uint8x16_t lo[SuperframeRS::NUM_PARITY], hi[SuperframeRS::NUM_PARITY];
+    uint8x16_t p[SuperframeRS::NUM_PARITY];
+    for (size_t k = 0; k < SuperframeRS::NUM_PARITY; k++) {
+        lo[k] = vld1q_u8(mul_lo[k]);
+        hi[k] = vld1q_u8(mul_hi[k]);
+        p[k] = vdupq_n_u8(0);
+    }
+
+    for (size_t col = 0; col < SuperframeRS::NUM_DATA; col++) {
+        const uint8x16_t fb = veorq_u8(vld1q_u8(base + stride * col), p[0]);
+        const uint8x16_t fb_lo = vandq_u8(fb, mask);
+        const uint8x16_t fb_hi = vshrq_n_u8(fb, 4);
+        for (size_t k = 0; k < SuperframeRS::NUM_PARITY; k++) {
+            const uint8x16_t product = veorq_u8(
+                    vqtbl1q_u8(lo[k], fb_lo), vqtbl1q_u8(hi[k], fb_hi));
+            p[k] = k + 1 < SuperframeRS::NUM_PARITY ? veorq_u8(p[k + 1], product) : product;
+        }
+    }
+
+    for (size_t k = 0; k < SuperframeRS::NUM_PARITY; k++) {
+        vst1q_u8(base + stride * (SuperframeRS::NUM_DATA + k), p[k]);
+    }
+}
+#endif
+
+/* Encode all rows with a kernel that encodes width rows at once. The last
+ * block overlaps the previous one if the number of rows is not a multiple of
+ * width, which gives the same parity for the rows encoded twice. With fewer
+ * rows than width, the rows are copied to a block padded to width. */
+static void encode_blocks(uint8_t *superframe, size_t subchannel_index, size_t width,
+        kernel_t kernel, const nibble_table_t *mul_lo, const nibble_table_t *mul_hi)
+{
+    const size_t num_cols = SuperframeRS::NUM_DATA + SuperframeRS::NUM_PARITY;
+
+    if (subchannel_index >= width) {
+        for (size_t row = 0; row < subchannel_index; row += width) {
+            kernel(superframe + std::min(row, subchannel_index - width), subchannel_index,
+                    mul_lo, mul_hi);
+        }
+    }
+    else {
+        uint8_t block[num_cols * 32] = {};
+        for (size_t col = 0; col < SuperframeRS::NUM_DATA; col++) {
+            memcpy(block + width * col, superframe + subchannel_index * col, subchannel_index);
+        }
+        kernel(block, width, mul_lo, mul_hi);
+        for (size_t col = SuperframeRS::NUM_DATA; col < num_cols; col++) {
+            memcpy(superframe + subchannel_index * col, block + width * col, subchannel_index);
+        }
+    }
+}
+
+SuperframeRS::SuperframeRS() :
+    SuperframeRS(best_variant())
+{ }
+
+SuperframeRS::SuperframeRS(variant_t variant) :
+    m_variant(variant)
+{
+    if (variant != variant_t::scalar and
+            variant != best_variant() and
+            not (variant == variant_t::ssse3 and best_variant() == variant_t::avx2)) {
+        throw invalid_argument("SuperframeRS variant not supported by this CPU");
+    }
+
+    // The generator polynomial has the roots alpha^0 to alpha^9, with
+    // alpha = 2. Multiply (x + alpha^i) into it, lowest coefficient first.
+    uint8_t genpoly[NUM_PARITY + 1] = {1};
+    uint8_t root = 1;
+    for (size_t i = 0; i < NUM_PARITY; i++) {
+        for (size_t j = i + 1; j > 0; j--) {
+            genpoly[j] = genpoly[j - 1] ^ gf_mul(genpoly[j], root);
+        }
+        genpoly[0] = gf_mul(genpoly[0], root);
+        root = gf_mul(root, 2);
+    }
+    std::copy(genpoly, genpoly + NUM_PARITY, m_genpoly);
+
+    for (size_t k = 0; k < NUM_PARITY; k++) {
+        const uint8_t coef = m_genpoly[NUM_PARITY - 1 - k];
+        for (uint8_t n = 0; n < 16; n++) {
+            m_mul_lo[k][n] = gf_mul(coef, n);
+            m_mul_hi[k][n] = gf_mul(coef, n << 4);
+        }
+    }
+
+    for (size_t fb = 0; fb < 256; fb++) {
+        uint64_t lo = 0;
+        for (size_t k = 0; k < 8; k++) {
+            lo |= (uint64_t)gf_mul(fb, m_genpoly[NUM_PARITY - 1 - k]) << (8 * k);
+        }
+        m_feedback_lo[fb] = lo;
+        m_feedback_hi[fb] = gf_mul(fb, m_genpoly[1]) | (gf_mul(fb, m_genpoly[0]) << 8);
+    }
+}
+
+SuperframeRS::variant_t SuperframeRS::best_variant()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+        return variant_t::avx2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return variant_t::ssse3;
+    }
+#elif defined(__aarch64__)
+    return variant_t::neon;
+#endif
+    return variant_t::scalar;
+}
+
+void SuperframeRS::encode(uint8_t *superframe, size_t subchannel_index) const
+{
+    switch (m_variant) {
+#if defined(__x86_64__) || defined(__i386__)
+        case variant_t::avx2:
+            // Blocks of 32 rows only pay off when they are mostly used
+            if (subchannel_index > 16) {
+                encode_blocks(superframe, subchannel_index, 32, kernel_avx2, m_mul_lo, m_mul_hi);
+                break;
+            }
+            // fall through
+        case variant_t::ssse3:
+            encode_blocks(superframe, subchannel_index, 16, kernel_ssse3, m_mul_lo, m_mul_hi);
+            break;
+#endif
+#if defined(__aarch64__)
+        case variant_t::neon:
+            encode_blocks(superframe, subchannel_index, 16, kernel_neon, m_mul_lo, m_mul_hi);
+            break;
+#endif
+        default:
+            encode_rows_scalar(superframe, subchannel_index, subchannel_index,
+                    m_feedback_lo, m_feedback_hi);
+    }
+}
@@ -0,0 +1,77 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+/*! \file SuperframeRS.h
+ *
+ * The RS(120, 110) outer code of the DAB+ superframes, ETSI TS 102 563
+ * Clause 6. It is the RS(255, 245) code with GF(2^8) polynomial 0x11d,
+ * shortened to 120 bytes, applied to the rows of the virtual interleaver:
+ * byte col of row is at superframe[subchannel_index * col + row].
+ *
+ * Byte col of all rows is contiguous, so the rows are encoded in parallel,
+ * 16 or 32 at a time with PSHUFB or NEON TBL: the multiplications with the
+ * coefficients of the generator polynomial use one table for the low and
+ * one for the high nibble of the feedback byte. Without SIMD, every row is
+ * encoded with a table giving the contribution of a feedback byte to all
+ * ten parity bytes. All variants give the same parity as encode_rs_char().
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+class SuperframeRS {
+    public:
+        static constexpr size_t NUM_PARITY = 10;
+        static constexpr size_t NUM_DATA = 110;
+
+        enum class variant_t { scalar, ssse3, avx2, neon };
+
+        /*! Use the fastest variant this CPU supports */
+        SuperframeRS();
+
+        /*! Use the given variant, which the CPU must support */
+        explicit SuperframeRS(variant_t variant);
+
+        static variant_t best_variant();
+
+        variant_t variant() const { return m_variant; }
+
+        /*! Write the parity of the subchannel_index rows of the superframe,
+         * which is 120 * subchannel_index bytes long. The first 110 bytes of
+         * each row are the data, the last 10 get the parity. */
+        void encode(uint8_t *superframe, size_t subchannel_index) const;
+
+    private:
+        variant_t m_variant;
+
+        /* The coefficients of x^0 to x^9 of the generator polynomial, the
+         * coefficient of x^10 is 1 */
+        uint8_t m_genpoly[NUM_PARITY];
+
+        /* Products of coefficient NUM_PARITY - 1 - k of the generator
+         * polynomial with the low and with the high nibbles, for parity
+         * byte k */
+        alignas(16) uint8_t m_mul_lo[NUM_PARITY][16];
+        alignas(16) uint8_t m_mul_hi[NUM_PARITY][16];
+
+        /* Contribution of every feedback byte to the parity bytes, stored
+         * as the bytes 0 to 7 and 8 to 9 of the parity */
+        uint64_t m_feedback_lo[256];
+        uint16_t m_feedback_hi[256];
+};
@@ -59,6 +59,16 @@
 #include "SampleQueue.h"
 #include "AACDecoder.h"
 #include "StatsPublish.h"
+#include "ServicePool.h"
+#include "FrameRing.h"
+#include "ByteRing.h"
+#include "SuperframeRS.h"
+#include "Resampler.h"
+#include "DriftController.h"
+#include "LoudnessMeter.h"
+#include "DynamicsProcessor.h"
+#include "AllocationCounter.h"
+#include "security_utils.h"
 #include "Outputs.h"
 #include "common.h"
 #include "wavfile.h"
@@ -70,10 +80,13 @@ extern "C" {
 
 #include <algorithm>
 #include <vector>
-#include <deque>
 #include <chrono>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
 #include <string>
+#include <fstream>
 #include <getopt.h>
 #include <cstdio>
 #include <stdint.h>
@@ -87,7 +100,6 @@ extern "C" {
 #include "aacenc_lib.h"
 
 extern "C" {
-#include "fec/fec.h"
 #include "libtoolame-dab/toolame.h"
 }
 
@@ -121,6 +133,10 @@ static void usage(const char* name)
     "by sound card clock drift. When sparse, they should not create audible\n"
     "artifacts.\n"
     "\n"
+    "With --drift-comp-resample, the drift is compensated instead by\n"
+    "resampling the input slightly, so that the input buffer stays at the\n"
+    "given latency. This avoids the repeated and dropped samples.\n"
+    "\n"
     "This encoder is able to insert PAD (DLS and MOT Slideshow)\n"
     "generated by ODR-PadEnc, and communicates using a UNIX socket.\n"
     "\nUsage:\n"
@@ -172,19 +188,33 @@ static void usage(const char* name)
     "     -W, --write-icy-text-dl-plus         When writing the ICY Text into the file, add DL Plus information.\n"
     "   Drift compensation\n"
     "     -D, --drift-comp                     Enable ALSA/VLC sound card drift compensation.\n"
+    "         --drift-comp-resample=LATENCY_MS Enable drift compensation by resampling, keeping LATENCY_MS\n"
+    "                                          milliseconds of audio in the input buffer.\n"
     "   Encoder parameters:\n"
     "     -b, --bitrate={ 8, 16, ..., 192 }    Output bitrate in kbps. Must be a multiple of 8.\n"
     "     -c, --channels={ 1, 2 }              Nb of input channels (default: 2).\n"
-    "     -r, --rate={ 24000, 32000, 48000 }   Input sample rate (default: 48000).\n"
+    "     -r, --rate={ 24000, 32000, 48000 }   Encoder sample rate (default: 48000). WAV, ALSA and JACK inputs\n"
+    "                                          at other rates are converted.\n"
     "     -g, --audio-gain=dB                  Apply audio gain correction in dB to source, negative values allowed.\n"
     "                                          Use this as a workaround to correct the gain for streams that are\n"
     "                                          much too loud.\n"
+    "         --agc=TARGET_DBFS                Enable the automatic gain control, which slowly adjusts the gain\n"
+    "                                          by up to 12dB to bring the RMS level to TARGET_DBFS (e.g. -20).\n"
+    "                                          Enables the limiter.\n"
+    "         --limiter=THRESHOLD_DBFS         Enable the look-ahead limiter, which keeps the peaks below\n"
+    "                                          THRESHOLD_DBFS (default when enabled by --agc: -1). This adds 5ms\n"
+    "                                          of delay, which is compensated in the EDI TIST.\n"
     "   DAB specific options\n"
     "     -a, --dab                            Encode in DAB and not in DAB+.\n"
     "         --dabmode=MODE                   Channel mode: s/d/j/m\n"
     "                                          (default: j if stereo, m if mono).\n"
     "         --dabpsy=PSY                     Psychoacoustic model 0/1/2/3\n"
     "                                          (default: 1).\n"
+    "         --dab-fast-alloc                 Use the faster bit allocation, which gives the same bitstream.\n"
+    "         --dab-speed=PRESET               Trade audio quality for encoding speed: quality runs the psychoacoustic\n"
+    "                                          model on every frame, balanced on every third frame, fast on every\n"
+    "                                          tenth frame. The model also runs on every attack. balanced and fast\n"
+    "                                          enable --dab-fast-alloc. (default: quality).\n"
     "   DAB+ specific options\n"
     "     -A, --no-afterburner                 Disable AAC encoder quality increaser.\n"
     "         --aaclc                          Force the usage of AAC-LC (no SBR, no PS)\n"
@@ -210,9 +240,21 @@ static void usage(const char* name)
     "     -P, --pad-socket=IDENTIFIER          Use the given identifier to communicate with ODR-PadEnc.\n"
     "     -l, --level                          Show peak audio level indication.\n"
     "     -S, --stats=SOCKET_NAME              Connect to the specified UNIX Datagram socket and send statistics.\n"
-    "                                          This allows external tools to collect audio and drift compensation stats.\n"
+    "                                          This allows external tools to collect audio, loudness and drift compensation stats.\n"
     "     -s, --silence=TIMEOUT                Abort encoding after TIMEOUT seconds of silence.\n"
+    "         --pipeline                       Run the input, the encoder and the outputs in separate threads, so that\n"
+    "                                          slow outputs do not delay the encoder.\n"
     "         --version                        Show version and quit.\n"
+#if HAVE_ALLOCATION_CHECK
+    "         --check-allocations=FRAMES       Test mode: abort if the encoder allocates memory after the first FRAMES\n"
+    "                                          encoded frames, and show where the allocation came from.\n"
+#endif
+    "   Multi-service mode:\n"
+    "         --services=FILE                  Encode several services in one process. Every non-empty line of FILE\n"
+    "                                          that does not start with # defines one service using the options above.\n"
+    "                                          Options given on the command line apply to all services.\n"
+    "         --workers=N                      Number of worker threads shared by all services\n"
+    "                                          (default: number of CPU cores).\n"
     "\n"
     );
 
@@ -330,7 +372,14 @@ static int prepare_aac_encoder(
     return 0;
 }
 
-chrono::steady_clock::time_point timepoint_last_compensation;
+/*! The RS(120, 110) encoder state is not modified while encoding,
+ * and is therefore shared between all services.
+ */
+static const SuperframeRS& get_superframe_rs()
+{
+    static const SuperframeRS rs;
+    return rs;
+}
 
 /*! Do drift compensation by distributing the missing samples over
  *  the whole input buffer instead of having a bunch of missing samples
@@ -372,31 +421,16 @@ static void expand_missing_samples(vec_u8& buf, int channels, size_t valid_bytes
     }
 }
 
-/*! Wait the proper amount of time to throttle down to nominal encoding
- * rate, if drift compensation is enabled.
+/*! Return how long it takes to play back the given number of bytes
+ * at nominal rate.
  */
-static void drift_compensation_delay(int sample_rate, int channels, size_t bytes)
+static chrono::milliseconds audio_duration(int sample_rate, int channels, size_t bytes)
 {
     const size_t bytes_per_second = sample_rate * BYTES_PER_SAMPLE * channels;
-
-    size_t bytes_compensate = bytes;
-    const auto wait_time = std::chrono::milliseconds(1000ul * bytes_compensate / bytes_per_second);
-    assert(1000ul * bytes_compensate % bytes_per_second == 0);
-
-    const auto curTime = std::chrono::steady_clock::now();
-
-    const auto diff = curTime - timepoint_last_compensation;
-
-    if (diff < wait_time) {
-        auto waiting = wait_time - diff;
-        std::this_thread::sleep_for(waiting);
-    }
-
-    timepoint_last_compensation += wait_time;
+    assert(1000ul * bytes % bytes_per_second == 0);
+    return chrono::milliseconds(1000ul * bytes / bytes_per_second);
 }
 
-
-
 #define no_argument 0
 #define required_argument 1
 #define optional_argument 2
@@ -405,11 +439,62 @@ static void drift_compensation_delay(int sample_rate, int channels, size_t bytes
 #define STATUS_OVERRUN 0x2
 #define STATUS_UNDERRUN 0x4
 
-struct AudioEnc {
+/*! One frame of audio, handed from the input stage to the encoder stage */
+struct pcm_frame_t {
+    vec_u8 samples;
+    vec_u8 pad;
+    int calculated_padlen = 0;
+    ssize_t read_bytes = 0;
+    int16_t peak_left = 0;
+    int16_t peak_right = 0;
+    loudness_levels_t loudness;
+    dynamics_levels_t dynamics;
+    double drift_ratio = 1.0; // Resampling ratio of the drift compensation
+    int status = 0; // STATUS_ flags observed while reading this frame
+    chrono::steady_clock::time_point timepoint_start;
+
+    // Set on the last frame going through the pipeline, with the exit code
+    bool end_of_stream = false;
+    int retval = 0;
+};
+
+/*! The encoder output for one pcm_frame_t, handed to the output stage */
+struct encoded_frame_t {
+    vec_u8 data;
+    int num_bytes = 0;
+    int16_t peak_left = 0;
+    int16_t peak_right = 0;
+    loudness_levels_t loudness;
+    dynamics_levels_t dynamics;
+    double drift_ratio = 1.0;
+    // Psy model runs of the DAB encoder since it was created, read by the
+    // encoder stage because the counters are not atomic
+    unsigned long psy_runs = 0;
+    unsigned long psy_transients = 0;
+    int status = 0;
+    chrono::steady_clock::time_point timepoint_start;
+
+    bool end_of_stream = false;
+    int retval = 0;
+};
+
+/*! Number of frames that can be queued between two pipeline stages */
+constexpr size_t PIPELINE_RING_SIZE = 8;
+constexpr size_t NUM_PIPELINE_STAGES = 3;
+
+struct AudioEnc : public PoolService {
 public:
     int sample_rate=48000;
     int channels=2;
     double gain_dB = 0.0;
+    float linear_gain_correction = 1.0f;
+
+    /* AGC and look-ahead limiter before the encoder */
+    bool agc_enabled = false;
+    float agc_target_dBFS = -20.0f;
+    bool limiter_enabled = false;
+    float limiter_threshold_dBFS = -1.0f;
+    unique_ptr<DynamicsProcessor> dynamics;
 
     string icytext_file;
     bool icytext_dlplus = false;
@@ -437,17 +522,36 @@ public:
 
     bool drift_compensation = false;
 
+    /* When nonzero, drift compensation resamples the input so that the
+     * queue stays at this latency, instead of inserting or removing
+     * samples. */
+    int drift_comp_latency_ms = 0;
+    unique_ptr<Resampler> drift_resampler;
+    unique_ptr<DriftController> drift_controller;
+    vector<int16_t> drift_resampler_input;
+
     encoder_selection_t selected_encoder = encoder_selection_t::fdk_dabplus;
     bool afterburner = true;
     uint32_t bandwidth = 0;
     int bitrate = 0; // 0 means default bitrate
 
     int dab_psy_model = 1;
+    bool dab_fast_alloc = false;
+    int dab_psy_interval = 1;
+    /* Psy model runs already published in the stats */
+    unsigned long dab_psy_runs_published = 0;
+    unsigned long dab_psy_transients_published = 0;
 
     bool restart_on_fault = false;
     int fault_counter = 0;
 
-    std::deque<uint8_t> toolame_buffer;
+    toolame_ctx *toolame = nullptr;
+    /* Cuts the toolame output into frames of 3*bitrate bytes */
+    unique_ptr<ByteRing> toolame_ring;
+
+    /* Set when run by the ServicePool, in which case encode_frame() must not
+     * block waiting for the input, because ready() already checked that */
+    bool cooperative = false;
 
     shared_ptr<Output::File> file_output;
     shared_ptr<Output::ZMQ> zmq_output;
@@ -460,7 +564,7 @@ public:
     vector<string> output_uris;
     vector<string> edi_output_uris;
 
-    void *rs_handler = nullptr;
+    const SuperframeRS *superframe_rs = nullptr;
     AACENC_InfoStruct info = { 0 };
     int aot = AOT_NONE;
 
@@ -497,17 +601,200 @@ public:
     unique_ptr<AACDecoder> decoder;
     unique_ptr<StatsPublisher> stats_publisher;
 
+    /* Kept from one stats interval to the next, to not allocate */
+    vector<edi::destination_stats_t> edi_destination_stats;
+
+    /* Loudness measurement for the stats and the EDI output, only
+     * created when one of them is enabled */
+    unique_ptr<LoudnessMeter> loudness_meter;
+
+    /* State of the encoding loop */
+    shared_ptr<InputInterface> input;
+    pcm_frame_t pcm_frame;
+    encoded_frame_t encoded_frame;
+    int outbuf_size = 0;
+    int enc_calls_per_output = 0;
+    int calls = 0; // for checking
+    int send_error_count = 0;
+    chrono::steady_clock::time_point timepoint_last_compensation;
+    chrono::steady_clock::time_point timepoint_last_received_sample;
+
+    /* Run the input, encoder and output in separate threads */
+    bool pipeline = false;
+
+    /* State of the pipeline, see run_pipeline() */
+    struct stage_stats_t {
+        atomic<uint64_t> num_frames = {0};
+        atomic<uint64_t> total_ns = {0};
+        atomic<uint64_t> max_ns = {0};
+
+        void account(chrono::steady_clock::duration d);
+    };
+    stage_stats_t stage_stats[NUM_PIPELINE_STAGES];
+    unique_ptr<FrameRing<pcm_frame_t> > pcm_ring;
+    unique_ptr<FrameRing<encoded_frame_t> > encoded_ring;
+    PipelineControl pipeline_control;
+
+#if HAVE_ALLOCATION_CHECK
+    /* Number of frames after which no allocation must happen anymore, or 0
+     * if the check is disabled */
+    long allocation_check_warmup = 0;
+    long allocation_check_frames = 0;
+    size_t allocation_check_count = 0;
+#endif
+
     AudioEnc() : queue(BYTES_PER_SAMPLE) { }
     AudioEnc(const AudioEnc&) = delete;
     AudioEnc& operator=(const AudioEnc&) = delete;
     ~AudioEnc();
 
+    /*! Run the encoder until the input terminates or an error occurs,
+     * and return the exit code. */
     int run();
+
+    /*! Validate the options, set up the encoder, input and outputs.
+     * \return 0 on success, or the exit code */
+    int prepare();
+
+    /*! Read one input frame, encode it and send the output.
+     * \return false when the encoding must stop, retval is then set to
+     * the exit code */
+    bool encode_frame(int& retval);
+
+    /*! The three steps of encode_frame(). Each returns false when the
+     * encoding must stop, and sets retval to the exit code.
+     *
+     * read_input() gets PAD and audio from the input, and applies gain and
+     * level measurement. It leaves frame.read_bytes at zero if the input
+     * got restarted and no audio is available.
+     */
+    bool read_input(pcm_frame_t& frame, int& retval);
+    /*! Run the AAC or MPEG encoder */
+    bool encode(const pcm_frame_t& in, encoded_frame_t& out, int& retval);
+    /*! RS encoding, send to the outputs, level display and stats */
+    bool write_output(encoded_frame_t& frame, int& retval);
+
+    /*! Run read_input(), encode() and write_output() in three threads
+     * connected by FrameRings, until the input terminates or an error occurs.
+     * \return the exit code */
+    int run_pipeline();
+    void input_stage();
+    void encode_stage();
+    void output_stage();
+    void publish_pipeline_stats();
+
+    virtual void set_notify(function<void()> notify) override;
+    virtual bool ready(chrono::steady_clock::time_point now,
+            chrono::steady_clock::time_point& wake_at) override;
+    virtual bool step(int& retval) override { return encode_frame(retval); }
+
     bool send_frame(const uint8_t *buf, size_t len, int16_t peak_left, int16_t peak_right);
     shared_ptr<InputInterface> initialise_input();
+    void drift_compensation_delay(size_t bytes);
+    bool pop_resampled(vec_u8& buf, size_t *overruns);
 };
 
 int AudioEnc::run()
+{
+    int retval = prepare();
+    if (retval != 0) {
+        return retval;
+    }
+
+    if (pipeline) {
+        retval = run_pipeline();
+    }
+    else {
+        while (encode_frame(retval)) {
+        }
+    }
+
+    fprintf(stderr, "\n");
+    return retval;
+}
+
+/*! Wait the proper amount of time to throttle down to nominal encoding
+ * rate, if drift compensation is enabled.
+ */
+void AudioEnc::drift_compensation_delay(size_t bytes)
+{
+    const auto wait_time = audio_duration(sample_rate, channels, bytes);
+
+    const auto curTime = std::chrono::steady_clock::now();
+
+    const auto diff = curTime - timepoint_last_compensation;
+
+    if (diff < wait_time) {
+        auto waiting = wait_time - diff;
+        std::this_thread::sleep_for(waiting);
+    }
+
+    timepoint_last_compensation += wait_time;
+}
+
+/*! Fill buf with input samples resampled at the ratio chosen by the drift
+ * controller. Missing input samples are replaced by silence.
+ *
+ * \return false if there were not enough samples in the queue
+ */
+bool AudioEnc::pop_resampled(vec_u8& buf, size_t *overruns)
+{
+    const size_t bytes_per_frame = BYTES_PER_SAMPLE * channels;
+    const size_t num_out = buf.size() / bytes_per_frame;
+
+    const double latency = (double)queue.size() / bytes_per_frame / sample_rate;
+    const double frame_duration = (double)num_out / sample_rate;
+    const double ratio = drift_controller->update(latency, frame_duration);
+
+    const size_t num_in = drift_resampler->input_frames_needed(num_out, ratio);
+    const size_t bytes_needed = num_in * bytes_per_frame;
+    const size_t bytes_from_queue = queue.pop(
+            reinterpret_cast<uint8_t*>(drift_resampler_input.data()), bytes_needed, overruns);
+
+    drift_resampler->push_input(drift_resampler_input.data(), num_in);
+    drift_resampler->process(reinterpret_cast<int16_t*>(buf.data()), num_out, ratio);
+
+    return bytes_from_queue == bytes_needed;
+}
+
+void AudioEnc::set_notify(function<void()> notify)
+{
+    queue.set_watermark_callback(notify);
+}
+
+bool AudioEnc::ready(chrono::steady_clock::time_point now,
+        chrono::steady_clock::time_point& wake_at)
+{
+    if (drift_compensation) {
+        // Ready when drift_compensation_delay() would not sleep
+        const auto ready_at = timepoint_last_compensation +
+            audio_duration(sample_rate, channels, pcm_frame.samples.size());
+        if (now >= ready_at) {
+            return true;
+        }
+        wake_at = ready_at;
+        return false;
+    }
+    else if (input->fills_queue_on_read() or input->fault_detected()) {
+        return true;
+    }
+
+    // Also become ready when the input timeout expires, so that
+    // encode_frame() can handle the fault
+    const auto timeout_at = timepoint_last_received_sample + chrono::seconds(10);
+    if (queue.size() >= pcm_frame.samples.size() or now > timeout_at) {
+        return true;
+    }
+
+    // The input thread notifies the pool once the frame is complete
+    if (queue.notify_when_available(pcm_frame.samples.size())) {
+        return true;
+    }
+    wake_at = timeout_at;
+    return false;
+}
+
+int AudioEnc::prepare()
 {
     int num_inputs = 0;
 #if HAVE_ALSA
@@ -573,6 +860,24 @@ int AudioEnc::run()
         return 1;
     }
 
+    linear_gain_correction = pow(10.0, gain_dB / 20.0);
+
+    uint32_t dynamics_delay_ms = 0;
+    if (agc_enabled or limiter_enabled) {
+        try {
+            dynamics.reset(new DynamicsProcessor(sample_rate, channels,
+                        linear_gain_correction, agc_enabled, agc_target_dBFS,
+                        limiter_threshold_dBFS));
+        }
+        catch (const invalid_argument& e) {
+            fprintf(stderr, "Invalid dynamics processing settings: %s\n", e.what());
+            return 1;
+        }
+
+        dynamics_delay_ms = 1000ul * dynamics->delay_frames() / sample_rate;
+        fprintf(stderr, "Dynamics processing adds a delay of %u ms\n", dynamics_delay_ms);
+    }
+
     for (const auto& uri : output_uris) {
         if (uri == "-") {
             if (file_output) {
@@ -631,6 +936,7 @@ int AudioEnc::run()
 
     if (not edi_output_uris.empty()) {
         edi_output.set_tist(tist_enabled, tist_delay_ms);
+        edi_output.set_processing_delay(dynamics_delay_ms);
 
         stringstream ss;
         ss << PACKAGE_NAME << " " <<
@@ -656,8 +962,6 @@ int AudioEnc::run()
         fprintf(stderr, "PAD disabled because neither PAD length nor PAD identifier given\n");
     }
 
-    vec_u8 input_buf;
-
     if (selected_encoder == encoder_selection_t::fdk_dabplus) {
         int subchannel_index = bitrate / 8;
         if (prepare_aac_encoder(&encoder, subchannel_index, channels,
@@ -677,21 +981,31 @@ int AudioEnc::run()
                 info.frameLength,
                 input_size);
 
-        input_buf.resize(input_size);
+        pcm_frame.samples.resize(input_size);
 
         if (not decode_wavfilename.empty()) {
             decoder.reset(new AACDecoder(decode_wavfilename.c_str()));
         }
     }
     else if (selected_encoder == encoder_selection_t::toolame_dab) {
-        int err = toolame_init();
+        toolame = toolame_ctx_create();
+        if (toolame == nullptr) {
+            fprintf(stderr, "libtoolame-dab init failed\n");
+            return 1;
+        }
+
+        int err = toolame_ctx_set_samplerate(toolame, sample_rate);
 
         if (err == 0) {
-            err = toolame_set_samplerate(sample_rate);
+            err = toolame_ctx_set_psy_model(toolame, dab_psy_model);
         }
 
         if (err == 0) {
-            err = toolame_set_psy_model(dab_psy_model);
+            err = toolame_ctx_set_fast_bit_allocation(toolame, dab_fast_alloc);
+        }
+
+        if (err == 0) {
+            err = toolame_ctx_set_psy_interval(toolame, dab_psy_interval);
         }
 
         if (dab_channel_mode.empty()) {
@@ -709,16 +1023,16 @@ int AudioEnc::run()
         }
 
         if (err == 0) {
-            err = toolame_set_channel_mode(dab_channel_mode.c_str()[0]);
+            err = toolame_ctx_set_channel_mode(toolame, dab_channel_mode.c_str()[0]);
         }
 
         // setting the ScF-CRC len here depends on set sample rate/channel mode
         if (err == 0) {
-            err = toolame_set_bitrate(bitrate);
+            err = toolame_ctx_set_bitrate(toolame, bitrate);
         }
 
         if (err == 0) {
-            err = toolame_set_pad(padlen);
+            err = toolame_ctx_set_pad(toolame, padlen);
         }
 
         if (err) {
@@ -726,7 +1040,7 @@ int AudioEnc::run()
             return err;
         }
 
-        input_buf.resize(channels * 1152 * BYTES_PER_SAMPLE);
+        pcm_frame.samples.resize(channels * 1152 * BYTES_PER_SAMPLE);
 
         if (not decode_wavfilename.empty()) {
             fprintf(stderr, "--decode not supported for DAB\n");
@@ -737,7 +1051,7 @@ int AudioEnc::run()
     if (not send_stats_to.empty()) {
         StatsPublisher *s = nullptr;
         try {
-            s = new StatsPublisher(send_stats_to);
+            s = new StatsPublisher(send_stats_to, identifier);
             stats_publisher.reset(s);
         }
         catch (const runtime_error& e) {
@@ -754,25 +1068,40 @@ int AudioEnc::run()
      * frame. This information is used when the alsa drift compensation
      * is active. This is only valid for FDK-AAC.
      */
-    const int enc_calls_per_output = (aot == AOT_DABPLUS_AAC_LC) ?
+    enc_calls_per_output = (aot == AOT_DABPLUS_AAC_LC) ?
         sample_rate / 8000 :
         sample_rate / 16000;
 
-    int max_size = 32*input_buf.size() + NUM_SAMPLES_PER_CALL;
+    int max_size = 32*pcm_frame.samples.size() + NUM_SAMPLES_PER_CALL;
 
     /*! The SampleQueue \c queue is given to the inputs, so that they
      * can fill it.
      */
     queue.configure(max_size, not drift_compensation, channels);
 
-    /* symsize=8, gfpoly=0x11d, fcr=0, prim=1, nroots=10, pad=135 */
-    rs_handler = init_rs_char(8, 0x11d, 0, 1, 10, 135);
-    if (rs_handler == nullptr) {
-        perror("init_rs_char failed");
-        return 1;
+    if (stats_publisher or not edi_output_uris.empty()) {
+        loudness_meter.reset(new LoudnessMeter(sample_rate, channels));
     }
 
-    shared_ptr<InputInterface> input;
+    if (drift_comp_latency_ms > 0) {
+        const size_t bytes_per_frame = BYTES_PER_SAMPLE * channels;
+        const size_t target_bytes = (size_t)drift_comp_latency_ms * sample_rate / 1000 * bytes_per_frame;
+        if (target_bytes > (size_t)max_size / 2) {
+            fprintf(stderr, "Drift compensation latency too large, maximum is %d ms\n",
+                    (int)(1000ul * max_size / 2 / bytes_per_frame / sample_rate));
+            return 1;
+        }
+
+        const double max_deviation = 0.01;
+        const size_t num_out = pcm_frame.samples.size() / bytes_per_frame;
+        drift_resampler.reset(new Resampler(channels, num_out, 1.0 + max_deviation));
+        drift_controller.reset(new DriftController(drift_comp_latency_ms / 1000.0, max_deviation));
+        drift_resampler_input.resize(
+                Resampler::max_input_frames_needed(num_out, 1.0 + max_deviation) * channels);
+    }
+
+    superframe_rs = &get_superframe_rs();
+
     try {
         input = initialise_input();
     }
@@ -785,22 +1114,22 @@ int AudioEnc::run()
         zmq_output->set_encoder_type(selected_encoder, bitrate);
     }
 
-    int outbuf_size = 0;
-    vec_u8 outbuf;
-
     switch (selected_encoder) {
         case encoder_selection_t::fdk_dabplus:
             outbuf_size = bitrate/8*120;
-            outbuf.resize(24*120);
+            encoded_frame.data.resize(24*120);
             break;
         case encoder_selection_t::toolame_dab:
             outbuf_size = 4092;
-            outbuf.resize(outbuf_size);
-            fprintf(stderr, "Setting outbuf size to %zu\n", outbuf.size());
+            encoded_frame.data.resize(outbuf_size);
+            // Room for a few frames, at most one of them stays in the ring
+            // when the encoder output gets added
+            toolame_ring = make_unique<ByteRing>(outbuf_size + 4 * 3 * bitrate, 3 * bitrate);
+            fprintf(stderr, "Setting outbuf size to %zu\n", encoded_frame.data.size());
             break;
     }
 
-    vector<uint8_t> pad_buf(padlen + 1);
+    pcm_frame.pad.resize(padlen + 1);
 
     if (restart_on_fault) {
         fprintf(stderr, "Autorestart has been deprecated and will be removed in the future!\n");
@@ -809,474 +1138,774 @@ int AudioEnc::run()
 
     fprintf(stderr, "Starting encoding\n");
 
-    int retval = 0;
-    int send_error_count = 0;
     timepoint_last_compensation = chrono::steady_clock::now();
-    auto timepoint_last_received_sample = chrono::steady_clock::now();
+    timepoint_last_received_sample = chrono::steady_clock::now();
 
-    int calls = 0; // for checking
-    ssize_t read_bytes = 0;
-    do {
-        // --------------- Read data from the PAD socket
-        int calculated_padlen = 0;
+    return 0;
+}
 
-        if (padlen != 0) {
-            vector<uint8_t> pad_data = pad_intf.request(padlen);
+bool AudioEnc::read_input(pcm_frame_t& frame, int& retval)
+{
+    frame.read_bytes = 0;
+    frame.status = 0;
 
-            if (pad_data.empty()) {
-                /* no PAD available */
-            }
-            else if (pad_data.size() == pad_buf.size()) {
-                calculated_padlen = pad_data[padlen];
+    // --------------- Read data from the PAD socket
+    int& calculated_padlen = frame.calculated_padlen;
+    calculated_padlen = 0;
 
-                if (calculated_padlen < 2) {
-                    throw runtime_error("Invalid X-PAD length " + to_string(calculated_padlen));
-                }
+    if (padlen != 0) {
+        const vector<uint8_t>& pad_data = pad_intf.request(padlen);
 
-                /* AAC: skip PAD if only zero F-PAD (saves four bytes)
-                 * See §5.4.3 in ETSI TS 102 563
-                 */
-                if (    selected_encoder == encoder_selection_t::fdk_dabplus &&
-                        calculated_padlen == 2 &&
-                        pad_data[padlen - 2] == 0x00 &&
-                        pad_data[padlen - 1] == 0x00 ) {
-                    calculated_padlen = 0;
-                }
+        if (pad_data.empty()) {
+            /* no PAD available */
+        }
+        else if (pad_data.size() == frame.pad.size()) {
+            calculated_padlen = pad_data[padlen];
 
-                copy(pad_data.begin(), pad_data.end(), pad_buf.begin());
+            if (calculated_padlen < 2) {
+                throw runtime_error("Invalid X-PAD length " + to_string(calculated_padlen));
             }
-            else {
-                fprintf(stderr, "Incorrect PAD length received: %zu expected %d\n", pad_data.size(), padlen + 1);
-                break;
+
+            /* AAC: skip PAD if only zero F-PAD (saves four bytes)
+             * See §5.4.3 in ETSI TS 102 563
+             */
+            if (    selected_encoder == encoder_selection_t::fdk_dabplus &&
+                    calculated_padlen == 2 &&
+                    pad_data[padlen - 2] == 0x00 &&
+                    pad_data[padlen - 1] == 0x00 ) {
+                calculated_padlen = 0;
             }
-        }
 
-        if (calculated_padlen > 0) {
-            status |= STATUS_PAD_INSERTED;
+            copy(pad_data.begin(), pad_data.end(), frame.pad.begin());
         }
+        else {
+            fprintf(stderr, "Incorrect PAD length received: %zu expected %d\n", pad_data.size(), padlen + 1);
+            return false;
+        }
+    }
 
+    if (calculated_padlen > 0) {
+        frame.status |= STATUS_PAD_INSERTED;
+    }
 
-        // -------------- Read Data
-        memset(outbuf.data(), 0x00, outbuf_size);
-        memset(input_buf.data(), 0x00, input_buf.size());
-
-        /*! \section DataInput
-         * We read data input either in a blocking way (file input, VLC or ALSA
-         * without drift compensation) or in a non-blocking way (VLC or ALSA
-         * with drift compensation, JACK).
-         *
-         * All inputs write samples into the queue, and either use \c pop() or
-         * \c pop_wait() depending on if it's blocking or not
-         *
-         * In non-blocking, the \c queue makes the data available without delay, and the
-         * \c drift_compensation_delay() function handles rate throttling.
-         */
 
-        if (input->fault_detected()) {
-            fprintf(stderr, "Detected fault in input!\n");
+    // -------------- Read Data
+    vec_u8& input_buf = frame.samples;
+    memset(input_buf.data(), 0x00, input_buf.size());
+
+    /*! \section DataInput
+     * We read data input either in a blocking way (file input, VLC or ALSA
+     * without drift compensation) or in a non-blocking way (VLC or ALSA
+     * with drift compensation, JACK).
+     *
+     * All inputs write samples into the queue, and either use \c pop() or
+     * \c pop_wait() depending on if it's blocking or not
+     *
+     * In non-blocking, the \c queue makes the data available without delay, and the
+     * \c drift_compensation_delay() function handles rate throttling.
+     */
 
-            if (restart_on_fault) {
-                fault_counter++;
+    if (input->fault_detected()) {
+        fprintf(stderr, "Detected fault in input!\n");
 
-                if (fault_counter >= MAX_FAULTS_ALLOWED) {
-                    fprintf(stderr, "Maximum number of input faults reached, aborting");
-                    retval = 5;
-                    break;
-                }
+        if (restart_on_fault) {
+            fault_counter++;
 
-                try {
-                    input = initialise_input();
-                }
-                catch (const runtime_error& e) {
-                    fprintf(stderr, "Initialising input triggered exception: %s\n", e.what());
-                    retval = 5;
-                    break;
-                }
+            if (fault_counter >= MAX_FAULTS_ALLOWED) {
+                fprintf(stderr, "Maximum number of input faults reached, aborting");
+                retval = 5;
+                return false;
+            }
 
-                continue;
+            try {
+                input = initialise_input();
             }
-            else {
+            catch (const runtime_error& e) {
+                fprintf(stderr, "Initialising input triggered exception: %s\n", e.what());
                 retval = 5;
-                break;
+                return false;
             }
-        }
 
-        if (not input->read_source(input_buf.size())) {
-            fprintf(stderr, "End of input reached\n");
-            retval = 0;
-            break;
+            return true;
+        }
+        else {
+            retval = 5;
+            return false;
         }
+    }
 
-        if (drift_compensation) {
-            size_t overruns = 0;
+    if (not input->read_source(input_buf.size())) {
+        fprintf(stderr, "End of input reached\n");
+        retval = 0;
+        return false;
+    }
+
+    if (drift_compensation) {
+        size_t overruns = 0;
+        bool underrun = false;
+        if (drift_resampler) {
+            underrun = not pop_resampled(input_buf, &overruns);
+            frame.drift_ratio = drift_controller->ratio();
+        }
+        else {
             size_t bytes_from_queue = queue.pop(input_buf.data(), input_buf.size(), &overruns); // returns bytes
             if (bytes_from_queue != input_buf.size()) {
                 expand_missing_samples(input_buf, channels, bytes_from_queue);
+                underrun = true;
             }
-            read_bytes = input_buf.size();
-            drift_compensation_delay(sample_rate, channels, read_bytes);
-
-            if (bytes_from_queue != input_buf.size()) {
-                status |= STATUS_UNDERRUN;
-                if (stats_publisher) {
-                    stats_publisher->notify_underrun();
-                }
-
-                const auto now = chrono::steady_clock::now();
-                const auto elapsed = chrono::duration_cast<chrono::seconds>(
-                        now - timepoint_last_received_sample);
-                if (elapsed.count() > 60) {
-                    fprintf(stderr, "Underruns for 60s, aborting!\n");
-                    return 1;
-                }
-            }
-            else {
-                timepoint_last_received_sample = chrono::steady_clock::now();
-            }
-
-            if (overruns) {
-                status |= STATUS_OVERRUN;
-                if (stats_publisher) {
-                    stats_publisher->notify_overrun();
-                }
+        }
+        drift_compensation_delay(input_buf.size());
+
+        if (underrun) {
+            frame.status |= STATUS_UNDERRUN;
+
+            const auto now = chrono::steady_clock::now();
+            const auto elapsed = chrono::duration_cast<chrono::seconds>(
+                    now - timepoint_last_received_sample);
+            if (elapsed.count() > 60) {
+                fprintf(stderr, "Underruns for 60s, aborting!\n");
+                retval = 1;
+                return false;
             }
         }
         else {
-            const int timeout_ms = 10000;
-            read_bytes = input_buf.size();
+            timepoint_last_received_sample = chrono::steady_clock::now();
+        }
+
+        if (overruns) {
+            frame.status |= STATUS_OVERRUN;
+        }
+    }
+    else {
+        const int timeout_ms = 10000;
+        const ssize_t read_bytes = input_buf.size();
 
-            size_t overruns = 0;
+        size_t overruns = 0;
+        ssize_t bytes_from_queue = 0;
 
+        if (cooperative) {
+            /* ready() only lets us run once the queue contains enough data, or
+             * once the timeout expired. */
+            bytes_from_queue = queue.pop(input_buf.data(), read_bytes, &overruns);
+        }
+        else {
             /*! pop_wait() must return after a timeout, otherwise the silence detector cannot do
              * its job. */
-            ssize_t bytes_from_queue = queue.pop_wait(input_buf.data(), read_bytes, timeout_ms, &overruns); // returns bytes
-
-            if (overruns) {
-                throw logic_error("Queue overrun in non-drift compensation!");
-            }
+            bytes_from_queue = queue.pop_wait(input_buf.data(), read_bytes, timeout_ms, &overruns); // returns bytes
+        }
+        timepoint_last_received_sample = chrono::steady_clock::now();
 
-            if (bytes_from_queue < read_bytes) {
-                // queue timeout occurred
-                fprintf(stderr, "Detected fault in input! No data in time.\n");
+        if (overruns) {
+            throw logic_error("Queue overrun in non-drift compensation!");
+        }
 
-                if (restart_on_fault) {
-                    fault_counter++;
+        if (bytes_from_queue < read_bytes) {
+            // queue timeout occurred
+            fprintf(stderr, "Detected fault in input! No data in time.\n");
 
-                    if (fault_counter >= MAX_FAULTS_ALLOWED) {
-                        fprintf(stderr, "Maximum number of input faults reached, aborting");
-                        retval = 5;
-                        break;
-                    }
+            if (restart_on_fault) {
+                fault_counter++;
 
-                    try {
-                        input = initialise_input();
-                    }
-                    catch (const runtime_error& e) {
-                        fprintf(stderr, "Initialising input triggered exception: %s\n", e.what());
-                        return 1;
-                    }
+                if (fault_counter >= MAX_FAULTS_ALLOWED) {
+                    fprintf(stderr, "Maximum number of input faults reached, aborting");
+                    retval = 5;
+                    return false;
+                }
 
-                    continue;
+                try {
+                    input = initialise_input();
                 }
-                else {
-                    retval = 5;
-                    break;
+                catch (const runtime_error& e) {
+                    fprintf(stderr, "Initialising input triggered exception: %s\n", e.what());
+                    retval = 1;
+                    return false;
                 }
+
+                return true;
+            }
+            else {
+                retval = 5;
+                return false;
             }
         }
+    }
 
-        /*! \section MetadataFromSource
-         * The VLC input is the only input that can also give us metadata, which
-         * we can hand over to ODR-PadEnc.
-         */
-        if (not icytext_file.empty()) {
-            ICY_TEXT_t text;
+    frame.read_bytes = input_buf.size();
+    frame.timepoint_start = chrono::steady_clock::now();
+    const ssize_t read_bytes = frame.read_bytes;
+
+    /*! \section MetadataFromSource
+     * The VLC input is the only input that can also give us metadata, which
+     * we can hand over to ODR-PadEnc.
+     */
+    if (not icytext_file.empty()) {
+        ICY_TEXT_t text;
 
-            if (false) {}
+        if (false) {}
 #if HAVE_VLC
-            // Using std::dynamic_pointer_cast would be safer, but is C++17
-            else if (not vlc_uri.empty()) {
-                VLCInput *vlc_input = (VLCInput*)(input.get());
-                text = vlc_input->get_icy_text();
-            }
+        // Using std::dynamic_pointer_cast would be safer, but is C++17
+        else if (not vlc_uri.empty()) {
+            VLCInput *vlc_input = (VLCInput*)(input.get());
+            text = vlc_input->get_icy_text();
+        }
 #endif
 #if HAVE_GST
-            else if ((not gst_uri.empty()) or (not gst_pipeline.empty())) {
-                GSTInput *gst_input = (GSTInput*)(input.get());
-                text = gst_input->get_icy_text();
-            }
+        else if ((not gst_uri.empty()) or (not gst_pipeline.empty())) {
+            GSTInput *gst_input = (GSTInput*)(input.get());
+            text = gst_input->get_icy_text();
+        }
 #endif
 
-            if (previous_text != text) {
-                bool success = write_icy_to_file(text, icytext_file, icytext_dlplus);
+        if (previous_text != text) {
+            bool success = write_icy_to_file(text, icytext_file, icytext_dlplus);
 
-                if (not success) {
-                    fprintf(stderr, "Failed to write ICY Text\n");
-                }
+            if (not success) {
+                fprintf(stderr, "Failed to write ICY Text\n");
             }
-
-            previous_text = text;
         }
 
-        /*! \section AudioLevel
-         * Audio level measurement is always done assuming we have two
-         * channels, and is formally wrong in mono, but still gives
-         * numbers one can use.
-         *
-         * At the same time, we apply gain correction.
-         *
-         * \todo fix level measurement in mono
-         */
-        int16_t peak_left  = 0;
-        int16_t peak_right = 0;
+        previous_text = text;
+    }
 
-        const double linear_gain_correction = pow(10.0, gain_dB / 20.0);
+    int16_t *samples = reinterpret_cast<int16_t*>(input_buf.data());
+    const size_t num_frames = read_bytes / (BYTES_PER_SAMPLE * channels);
 
-        for (int i = 0; i < read_bytes; i+=4) {
-            int16_t l = input_buf[i] | (input_buf[i+1] << 8);
-            int16_t r = input_buf[i+2] | (input_buf[i+3] << 8);
+    /*! \section Dynamics
+     * The AGC and limiter also apply the gain correction, before limiting.
+     */
+    if (dynamics) {
+        dynamics->process(samples, num_frames);
+        frame.dynamics = dynamics->levels();
+    }
 
-            if (linear_gain_correction != 1.0) {
-                l *= linear_gain_correction;
-                r *= linear_gain_correction;
+    /*! \section AudioLevel
+     * Audio level measurement gives the absolute peak of each channel. In
+     * mono, both the left and right levels contain the peak of the single
+     * channel.
+     *
+     * At the same time, we apply gain correction, saturating the samples,
+     * unless the dynamics processing already did.
+     */
+    StreamDAB::SIMDProcessor::AudioLevels levels;
+    StreamDAB::SIMDProcessor::gain_and_levels_simd(samples, num_frames, channels,
+            dynamics ? 1.0f : linear_gain_correction, levels);
+
+    int16_t& peak_left  = frame.peak_left;
+    int16_t& peak_right = frame.peak_right;
+    peak_left  = levels.peak[0];
+    peak_right = levels.peak[1];
+
+    /*! \section Loudness
+     * The EBU R 128 loudness and true peak are measured after gain
+     * correction, on what the encoder gets to see.
+     */
+    if (loudness_meter and read_bytes > 0) {
+        loudness_meter->process(samples, num_frames);
+        frame.loudness = loudness_meter->take_levels();
+    }
 
-                input_buf[i] = l & 0x00FF;
-                input_buf[i+1] = (l & 0xFF00) >> 8;
-                input_buf[i+2] = r & 0x00FF;
-                input_buf[i+3] = (r & 0xFF00) >> 8;
-            }
+    /*! \section SilenceDetection
+     * Silence detection looks at the audio level and is
+     * only useful if the connection dropped, or if no data is available. It is not
+     * useful if the source is nearly silent (some noise present), because the
+     * threshold is 0, and not configurable. The rationale is that we want to
+     * guard against connection issues, not source level issues.
+     */
+    if (die_on_silence && std::max(peak_left, peak_right) == 0) {
+        const unsigned int frame_time_msec = 1000ul *
+            read_bytes / (BYTES_PER_SAMPLE * channels * sample_rate);
 
-            peak_left  = std::max(peak_left,  l);
-            peak_right = std::max(peak_right, r);
-        }
+        measured_silence_ms += frame_time_msec;
 
-        if (stats_publisher) {
-            stats_publisher->update_audio_levels(peak_left, peak_right);
+        if (measured_silence_ms > 1000*silence_timeout) {
+            fprintf(stderr, "Silence detected for %d seconds, aborting.\n",
+                    silence_timeout);
+            retval = 2;
+            return false;
         }
+    }
+    else {
+        measured_silence_ms = 0;
+    }
 
-        /*! \section SilenceDetection
-         * Silence detection looks at the audio level and is
-         * only useful if the connection dropped, or if no data is available. It is not
-         * useful if the source is nearly silent (some noise present), because the
-         * threshold is 0, and not configurable. The rationale is that we want to
-         * guard against connection issues, not source level issues.
-         */
-        if (die_on_silence && std::max(peak_left, peak_right) == 0) {
-            const unsigned int frame_time_msec = 1000ul *
-                read_bytes / (BYTES_PER_SAMPLE * channels * sample_rate);
-
-            measured_silence_ms += frame_time_msec;
+    return true;
+}
 
-            if (measured_silence_ms > 1000*silence_timeout) {
-                fprintf(stderr, "Silence detected for %d seconds, aborting.\n",
-                        silence_timeout);
-                retval = 2;
-                break;
+bool AudioEnc::encode(const pcm_frame_t& in, encoded_frame_t& out, int& retval)
+{
+    const vec_u8& input_buf = in.samples;
+    const ssize_t read_bytes = in.read_bytes;
+    const int calculated_padlen = in.calculated_padlen;
+    vec_u8& outbuf = out.data;
+
+    out.peak_left = in.peak_left;
+    out.peak_right = in.peak_right;
+    out.loudness = in.loudness;
+    out.dynamics = in.dynamics;
+    out.drift_ratio = in.drift_ratio;
+    out.status = in.status;
+    out.timepoint_start = in.timepoint_start;
+
+    memset(outbuf.data(), 0x00, outbuf_size);
+
+    int numOutBytes = 0;
+    if (read_bytes and
+            selected_encoder == encoder_selection_t::fdk_dabplus) {
+        AACENC_BufDesc in_buf = { 0 }, out_buf = { 0 };
+        AACENC_InArgs in_args = { 0 };
+        AACENC_OutArgs out_args = { 0 };
+        // -------------- AAC Encoding
+        //
+        int in_identifier[] = {IN_AUDIO_DATA, IN_ANCILLRY_DATA};
+        int out_identifier = OUT_BITSTREAM_DATA;
+
+        void *in_ptr[2], *out_ptr;
+        int in_size[2], in_elem_size[2];
+        int out_size, out_elem_size;
+
+        in_ptr[0] = (void*)input_buf.data();
+        in_ptr[1] = (void*)(in.pad.data() + (padlen - calculated_padlen)); // offset due to unused PAD bytes
+        in_size[0] = read_bytes;
+        in_size[1] = calculated_padlen;
+        in_elem_size[0] = BYTES_PER_SAMPLE;
+        in_elem_size[1] = sizeof(uint8_t);
+        in_args.numInSamples = input_buf.size()/BYTES_PER_SAMPLE;
+        in_args.numAncBytes = calculated_padlen;
+
+        in_buf.numBufs = calculated_padlen ? 2 : 1;    // Samples + Data / Samples
+        in_buf.bufs = (void**)&in_ptr;
+        in_buf.bufferIdentifiers = in_identifier;
+        in_buf.bufSizes = in_size;
+        in_buf.bufElSizes = in_elem_size;
+
+        out_ptr = outbuf.data();
+        out_size = outbuf.size();
+        out_elem_size = 1;
+        out_buf.numBufs = 1;
+        out_buf.bufs = &out_ptr;
+        out_buf.bufferIdentifiers = &out_identifier;
+        out_buf.bufSizes = &out_size;
+        out_buf.bufElSizes = &out_elem_size;
+
+        AACENC_ERROR err;
+        if ((err = aacEncEncode(encoder, &in_buf, &out_buf, &in_args, &out_args))
+                != AACENC_OK) {
+            if (err == AACENC_ENCODE_EOF) {
+                fprintf(stderr, "encoder error: EOF reached\n");
+                return false;
             }
+            fprintf(stderr, "Encoding failed (%d)\n", err);
+            retval = 3;
+            return false;
         }
-        else {
-            measured_silence_ms = 0;
-        }
-
-        int numOutBytes = 0;
-        if (read_bytes and
-                selected_encoder == encoder_selection_t::fdk_dabplus) {
-            AACENC_BufDesc in_buf = { 0 }, out_buf = { 0 };
-            AACENC_InArgs in_args = { 0 };
-            AACENC_OutArgs out_args = { 0 };
-            // -------------- AAC Encoding
-            //
-            int in_identifier[] = {IN_AUDIO_DATA, IN_ANCILLRY_DATA};
-            int out_identifier = OUT_BITSTREAM_DATA;
-
-            void *in_ptr[2], *out_ptr;
-            int in_size[2], in_elem_size[2];
-            int out_size, out_elem_size;
-
-            in_ptr[0] = input_buf.data();
-            in_ptr[1] = pad_buf.data() + (padlen - calculated_padlen); // offset due to unused PAD bytes
-            in_size[0] = read_bytes;
-            in_size[1] = calculated_padlen;
-            in_elem_size[0] = BYTES_PER_SAMPLE;
-            in_elem_size[1] = sizeof(uint8_t);
-            in_args.numInSamples = input_buf.size()/BYTES_PER_SAMPLE;
-            in_args.numAncBytes = calculated_padlen;
-
-            in_buf.numBufs = calculated_padlen ? 2 : 1;    // Samples + Data / Samples
-            in_buf.bufs = (void**)&in_ptr;
-            in_buf.bufferIdentifiers = in_identifier;
-            in_buf.bufSizes = in_size;
-            in_buf.bufElSizes = in_elem_size;
-
-            out_ptr = outbuf.data();
-            out_size = outbuf.size();
-            out_elem_size = 1;
-            out_buf.numBufs = 1;
-            out_buf.bufs = &out_ptr;
-            out_buf.bufferIdentifiers = &out_identifier;
-            out_buf.bufSizes = &out_size;
-            out_buf.bufElSizes = &out_elem_size;
-
-            AACENC_ERROR err;
-            if ((err = aacEncEncode(encoder, &in_buf, &out_buf, &in_args, &out_args))
-                    != AACENC_OK) {
-                if (err == AACENC_ENCODE_EOF) {
-                    fprintf(stderr, "encoder error: EOF reached\n");
-                    break;
-                }
-                fprintf(stderr, "Encoding failed (%d)\n", err);
-                retval = 3;
-                break;
-            }
-            calls++;
+        calls++;
 
-            numOutBytes = out_args.numOutBytes;
+        numOutBytes = out_args.numOutBytes;
+    }
+    else if (selected_encoder == encoder_selection_t::toolame_dab) {
+        /*! \note toolame deinterleaves the samples in input_buf itself,
+         * while it reads them into the filterbank
+         */
+        if (channels != 1 and channels != 2) {
+            fprintf(stderr, "INTERNAL ERROR! invalid number of channels\n");
         }
-        else if (selected_encoder == encoder_selection_t::toolame_dab) {
-            /*! \note toolame expects the audio to be in another shape as
-             * we have in input_buf, and we need to convert first
-             */
-            short input_buffers[2][1152];
 
+        if (read_bytes) {
+            numOutBytes = toolame_ctx_encode_frame_interleaved(toolame,
+                    reinterpret_cast<const short*>(input_buf.data()), channels,
+                    (unsigned char*)in.pad.data(), calculated_padlen, outbuf.data(), outbuf.size());
+        }
+        else {
+            numOutBytes = toolame_ctx_finish(toolame, outbuf.data(), outbuf.size());
+        }
+
+        toolame_ctx_get_psy_stats(toolame, &out.psy_runs, &out.psy_transients);
+    }
+
+    if (numOutBytes != 0 and
+        selected_encoder == encoder_selection_t::fdk_dabplus) {
+        // Our timing code depends on this
+        if (calls != enc_calls_per_output) {
+            fprintf(stderr, "INTERNAL ERROR! calls=%d, expected %d\n",
+                    calls, enc_calls_per_output);
+        }
+        calls = 0;
+    }
+
+    out.num_bytes = numOutBytes;
+    return true;
+}
+
+bool AudioEnc::write_output(encoded_frame_t& frame, int& retval)
+{
+    vec_u8& outbuf = frame.data;
+    int numOutBytes = frame.num_bytes;
+    const int16_t peak_left = frame.peak_left;
+    const int16_t peak_right = frame.peak_right;
+
+    status |= frame.status;
+    if (stats_publisher) {
+        stats_publisher->update_audio_levels(peak_left, peak_right);
+
+        if (loudness_meter) {
+            stats_publisher->update_loudness(frame.loudness);
+        }
+
+        if (dynamics) {
+            stats_publisher->update_dynamics(frame.dynamics);
+        }
+
+        if (frame.status & STATUS_UNDERRUN) {
+            stats_publisher->notify_underrun();
+        }
+
+        if (frame.status & STATUS_OVERRUN) {
+            stats_publisher->notify_overrun();
+        }
+    }
+
+    if (loudness_meter and edi_output.enabled()) {
+        edi_output.update_loudness(frame.loudness);
+    }
+
+    if (numOutBytes != 0 and decoder) {
+        try {
+            decoder->decode_frame(outbuf.data(), numOutBytes);
+        }
+        catch (runtime_error &e) {
+            fprintf(stderr, "Decoding failed with: %s\n", e.what());
+            retval = 1;
+            return false;
+        }
+    }
+
+    /* Check if the encoder has generated output data.
+     * DAB+ requires RS encoding, which is not done in ODR-DabMux and not necessary
+     * for DAB.
+     */
+    if (numOutBytes != 0 and
+        selected_encoder == encoder_selection_t::fdk_dabplus) {
+
+        const size_t subchannel_index = bitrate / 8;
+        if (outbuf.size() < 120 * subchannel_index) {
+            throw logic_error("Superframe buffer too small for RS");
+        }
+        superframe_rs->encode(outbuf.data(), subchannel_index);
+
+        numOutBytes = outbuf_size;
+    }
+
+    if (numOutBytes > 0 and selected_encoder == encoder_selection_t::toolame_dab) {
+        if (not toolame_ring->write(outbuf.data(), numOutBytes)) {
+            throw logic_error("toolame output ring overflow");
+        }
+
+        // ODR-DabMux expects frames of length 3*bitrate
+        const size_t frame_len = 3 * bitrate;
+        while (toolame_ring->size() > frame_len) {
+            bool success = send_frame(toolame_ring->read_ptr(), frame_len, peak_left, peak_right);
+            if (not success) {
+                fprintf(stderr, "Send error !\n");
+                send_error_count ++;
+            }
+
+            toolame_ring->consume(frame_len);
+        }
+    }
+    else if (numOutBytes > 0 and selected_encoder == encoder_selection_t::fdk_dabplus) {
+        bool success = send_frame(outbuf.data(), numOutBytes, peak_left, peak_right);
+        if (not success) {
+            fprintf(stderr, "Send error !\n");
+            send_error_count ++;
+        }
+    }
+
+    if (send_error_count > 10) {
+        fprintf(stderr, "Send failed ten times, aborting!\n");
+        retval = 4;
+        return false;
+    }
+
+    if (stats_publisher) {
+        stats_publisher->update_processing_time(
+                chrono::steady_clock::now() - frame.timepoint_start);
+    }
+
+    if (numOutBytes != 0) {
+        if (show_level) {
             if (channels == 1) {
-                memcpy(input_buffers[0], input_buf.data(), 1152 * BYTES_PER_SAMPLE);
+                fprintf(stderr, "\rIn: [%-6s] %1s %1s %1s",
+                        level(1, std::max(peak_right, peak_left)),
+                        status & STATUS_PAD_INSERTED ? "P" : " ",
+                        status & STATUS_UNDERRUN ? "U" : " ",
+                        status & STATUS_OVERRUN ? "O" : " ");
             }
             else if (channels == 2) {
-                for (int i = 0; i < 1152; i++) {
-                    int16_t l = input_buf[4*i]   | (input_buf[4*i+1] << 8);
-                    int16_t r = input_buf[4*i+2] | (input_buf[4*i+3] << 8);
-
-                    input_buffers[0][i] = l;
-                    input_buffers[1][i] = r;
-                }
+                fprintf(stderr, "\rIn: [%6s|%-6s] %1s %1s %1s",
+                        level(0, peak_left),
+                        level(1, peak_right),
+                        status & STATUS_PAD_INSERTED ? "P" : " ",
+                        status & STATUS_UNDERRUN ? "U" : " ",
+                        status & STATUS_OVERRUN ? "O" : " ");
             }
-            else {
-                fprintf(stderr, "INTERNAL ERROR! invalid number of channels\n");
+        }
+        else {
+            if (status & STATUS_OVERRUN) {
+                fprintf(stderr, "O");
             }
 
-            if (read_bytes) {
-                numOutBytes = toolame_encode_frame(input_buffers, pad_buf.data(), calculated_padlen, outbuf.data(), outbuf.size());
-            }
-            else {
-                numOutBytes = toolame_finish(outbuf.data(), outbuf.size());
+            if (status & STATUS_UNDERRUN) {
+                fprintf(stderr, "U");
             }
         }
 
-        if (numOutBytes != 0 and decoder) {
-            try {
-                decoder->decode_frame(outbuf.data(), numOutBytes);
+        if (stats_publisher) {
+            if (pipeline_control.running()) {
+                publish_pipeline_stats();
             }
-            catch (runtime_error &e) {
-                fprintf(stderr, "Decoding failed with: %s\n", e.what());
-                return 1;
+
+            if (drift_controller) {
+                stats_publisher->update_drift_ratio(frame.drift_ratio);
             }
-        }
 
-        /* Check if the encoder has generated output data.
-         * DAB+ requires RS encoding, which is not done in ODR-DabMux and not necessary
-         * for DAB.
-         */
-        if (numOutBytes != 0 and
-            selected_encoder == encoder_selection_t::fdk_dabplus) {
+            if (toolame) {
+                stats_publisher->update_psy_model(
+                        frame.psy_runs - dab_psy_runs_published,
+                        frame.psy_transients - dab_psy_transients_published);
+                dab_psy_runs_published = frame.psy_runs;
+                dab_psy_transients_published = frame.psy_transients;
+            }
 
-            // Our timing code depends on this
-            if (calls != enc_calls_per_output) {
-                fprintf(stderr, "INTERNAL ERROR! calls=%d, expected %d\n",
-                        calls, enc_calls_per_output);
+            edi::FragmentScheduler::stats_t edi_scheduler_stats;
+            if (edi_output.collect_scheduler_stats(edi_scheduler_stats)) {
+                stats_publisher->update_edi_scheduler(edi_scheduler_stats);
             }
-            calls = 0;
-
-            int row, col;
-            unsigned char buf_to_rs_enc[110];
-            unsigned char rs_enc[10];
-            const int subchannel_index = bitrate / 8;
-            for(row=0; row < subchannel_index; row++) {
-                for(col=0;col < 110; col++) {
-                    buf_to_rs_enc[col] = outbuf[subchannel_index * col + row];
-                }
 
-                encode_rs_char(rs_handler, buf_to_rs_enc, rs_enc);
+            edi::UDPBatchSender::stats_t edi_udp_stats;
+            if (edi_output.collect_udp_stats(edi_udp_stats)) {
+                stats_publisher->update_edi_udp(edi_udp_stats);
+            }
 
-                for(col=110; col<120; col++) {
-                    outbuf.at(subchannel_index * col + row) = rs_enc[col-110];
-                }
+            if (edi_output.collect_destination_stats(edi_destination_stats)) {
+                stats_publisher->update_edi_destinations(edi_destination_stats);
             }
 
-            numOutBytes = outbuf_size;
+            const auto wait_stats = queue.collect_wait_stats();
+            stats_publisher->update_input_wakeups(wait_stats.num_wakeups,
+                    wait_stats.num_handovers == 0 ? chrono::steady_clock::duration() :
+                        wait_stats.handover_latency_total / (long)wait_stats.num_handovers,
+                    wait_stats.handover_latency_max);
+
+            stats_publisher->send_stats();
         }
 
-        if (numOutBytes > 0 and selected_encoder == encoder_selection_t::toolame_dab) {
-            toolame_buffer.insert(toolame_buffer.end(), outbuf.begin(), outbuf.begin() + numOutBytes);
+        status = 0;
+    }
 
-            // ODR-DabMux expects frames of length 3*bitrate
-            const size_t frame_len = 3 * bitrate;
-            while (toolame_buffer.size() > frame_len) {
-                vec_u8 frame(frame_len);
-                // this is probably not very efficient
-                std::copy(toolame_buffer.begin(), toolame_buffer.begin() + frame_len, frame.begin());
-                toolame_buffer.erase(toolame_buffer.begin(), toolame_buffer.begin() + frame_len);
+    fflush(stdout);
+
+#if HAVE_ALLOCATION_CHECK
+    if (allocation_check_warmup > 0) {
+        allocation_check_frames++;
+        const size_t count = allocation_count();
+        if (allocation_check_frames > allocation_check_warmup and
+                count != allocation_check_count) {
+            fprintf(stderr, "Allocation check: %zu allocations during frame %ld\n",
+                    count - allocation_check_count, allocation_check_frames);
+            retval = 6;
+            return false;
+        }
+        else if (allocation_check_frames == allocation_check_warmup) {
+            fprintf(stderr, "Allocation check: warm-up done after %ld frames\n",
+                    allocation_check_frames);
+            allocation_trace_enable(true);
+        }
+        allocation_check_count = allocation_count();
+    }
+#endif
 
-                bool success = send_frame(frame.data(), frame.size(), peak_left, peak_right);
-                if (not success) {
-                    fprintf(stderr, "Send error !\n");
-                    send_error_count ++;
-                }
+    return true;
+}
+
+
+bool AudioEnc::encode_frame(int& retval)
+{
+    if (not read_input(pcm_frame, retval)) {
+        return false;
+    }
+
+    if (pcm_frame.read_bytes == 0) {
+        // The input got restarted, nothing to encode
+        return true;
+    }
+
+    if (not encode(pcm_frame, encoded_frame, retval)) {
+        return false;
+    }
+
+    return write_output(encoded_frame, retval);
+}
+
+void AudioEnc::stage_stats_t::account(chrono::steady_clock::duration d)
+{
+    const uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(d).count();
+    num_frames.fetch_add(1, memory_order_relaxed);
+    total_ns.fetch_add(ns, memory_order_relaxed);
+
+    uint64_t prev_max = max_ns.load(memory_order_relaxed);
+    while (prev_max < ns and
+            not max_ns.compare_exchange_weak(prev_max, ns, memory_order_relaxed)) {
+    }
+}
+
+void AudioEnc::publish_pipeline_stats()
+{
+    const size_t frame_size = pcm_frame.samples.size();
+    const size_t queue_depths[NUM_PIPELINE_STAGES] = {
+        queue.size() / frame_size,
+        pcm_ring->size(),
+        encoded_ring->size() };
+    const char *names[NUM_PIPELINE_STAGES] = { "input", "encode", "output" };
+
+    for (size_t i = 0; i < NUM_PIPELINE_STAGES; i++) {
+        const uint64_t num_frames = stage_stats[i].num_frames.exchange(0);
+        const uint64_t total_ns = stage_stats[i].total_ns.exchange(0);
+        const uint64_t max_ns = stage_stats[i].max_ns.exchange(0);
+
+        stats_publisher->update_pipeline_stage(i, names[i], queue_depths[i],
+                chrono::nanoseconds(num_frames ? total_ns / num_frames : 0),
+                chrono::nanoseconds(max_ns));
+    }
+}
+
+/* How long a pipeline stage waits on its rings before checking if the
+ * pipeline got stopped */
+static const auto PIPELINE_POLL_TIMEOUT = chrono::milliseconds(100);
+
+void AudioEnc::input_stage()
+{
+    try {
+        while (pipeline_control.running()) {
+            pcm_frame_t *frame = pcm_ring->wait_write_slot(PIPELINE_POLL_TIMEOUT);
+            if (frame == nullptr) {
+                continue;
             }
-        }
-        else if (numOutBytes > 0 and selected_encoder == encoder_selection_t::fdk_dabplus) {
-            bool success = send_frame(outbuf.data(), numOutBytes, peak_left, peak_right);
-            if (not success) {
-                fprintf(stderr, "Send error !\n");
-                send_error_count ++;
+
+            frame->retval = 0;
+            frame->end_of_stream = not read_input(*frame, frame->retval);
+
+            if (frame->end_of_stream) {
+                // Let the other stages process the frames still in the rings
+                pcm_ring->commit_write();
+                return;
+            }
+            else if (frame->read_bytes > 0) {
+                stage_stats[0].account(chrono::steady_clock::now() - frame->timepoint_start);
+                pcm_ring->commit_write();
             }
         }
+    }
+    catch (...) {
+        pipeline_control.stop(current_exception());
+    }
+}
 
-        if (send_error_count > 10) {
-            fprintf(stderr, "Send failed ten times, aborting!\n");
-            retval = 4;
-            break;
-        }
+void AudioEnc::encode_stage()
+{
+    try {
+        while (pipeline_control.running()) {
+            pcm_frame_t *in = pcm_ring->wait_read_slot(PIPELINE_POLL_TIMEOUT);
+            if (in == nullptr) {
+                continue;
+            }
 
-        if (numOutBytes != 0) {
-            if (show_level) {
-                if (channels == 1) {
-                    fprintf(stderr, "\rIn: [%-6s] %1s %1s %1s",
-                            level(1, std::max(peak_right, peak_left)),
-                            status & STATUS_PAD_INSERTED ? "P" : " ",
-                            status & STATUS_UNDERRUN ? "U" : " ",
-                            status & STATUS_OVERRUN ? "O" : " ");
-                }
-                else if (channels == 2) {
-                    fprintf(stderr, "\rIn: [%6s|%-6s] %1s %1s %1s",
-                            level(0, peak_left),
-                            level(1, peak_right),
-                            status & STATUS_PAD_INSERTED ? "P" : " ",
-                            status & STATUS_UNDERRUN ? "U" : " ",
-                            status & STATUS_OVERRUN ? "O" : " ");
-                }
+            encoded_frame_t *out = nullptr;
+            while (out == nullptr and pipeline_control.running()) {
+                out = encoded_ring->wait_write_slot(PIPELINE_POLL_TIMEOUT);
             }
-            else {
-                if (status & STATUS_OVERRUN) {
-                    fprintf(stderr, "O");
-                }
+            if (out == nullptr) {
+                return;
+            }
+
+            const auto time_start = chrono::steady_clock::now();
+            out->end_of_stream = in->end_of_stream;
+            out->retval = in->retval;
 
-                if (status & STATUS_UNDERRUN) {
-                    fprintf(stderr, "U");
+            if (not in->end_of_stream) {
+                if (not encode(*in, *out, out->retval)) {
+                    out->end_of_stream = true;
                 }
+                stage_stats[1].account(chrono::steady_clock::now() - time_start);
             }
 
-            if (stats_publisher) {
-                stats_publisher->send_stats();
+            pcm_ring->commit_read();
+            encoded_ring->commit_write();
+
+            if (out->end_of_stream) {
+                return;
             }
+        }
+    }
+    catch (...) {
+        pipeline_control.stop(current_exception());
+    }
+}
 
-            status = 0;
+void AudioEnc::output_stage()
+{
+    try {
+        while (pipeline_control.running()) {
+            encoded_frame_t *frame = encoded_ring->wait_read_slot(PIPELINE_POLL_TIMEOUT);
+            if (frame == nullptr) {
+                continue;
+            }
+
+            if (frame->end_of_stream) {
+                pipeline_control.stop(frame->retval);
+                return;
+            }
+
+            const auto time_start = chrono::steady_clock::now();
+            int retval = 0;
+            const bool success = write_output(*frame, retval);
+            stage_stats[2].account(chrono::steady_clock::now() - time_start);
+            encoded_ring->commit_read();
+
+            if (not success) {
+                pipeline_control.stop(retval);
+                return;
+            }
         }
+    }
+    catch (...) {
+        pipeline_control.stop(current_exception());
+    }
+}
 
-        fflush(stdout);
-    } while (read_bytes > 0);
+int AudioEnc::run_pipeline()
+{
+    pcm_ring = make_unique<FrameRing<pcm_frame_t> >(PIPELINE_RING_SIZE);
+    encoded_ring = make_unique<FrameRing<encoded_frame_t> >(PIPELINE_RING_SIZE);
 
-    fprintf(stderr, "\n");
-    return retval;
+    // Allocate all buffers before the stages start
+    for (auto& f : pcm_ring->slots()) {
+        f = pcm_frame;
+    }
+    for (auto& f : encoded_ring->slots()) {
+        f = encoded_frame;
+    }
+
+    pipeline_control.start();
+
+    thread input_thread(&AudioEnc::input_stage, this);
+    thread encode_thread(&AudioEnc::encode_stage, this);
+    thread output_thread(&AudioEnc::output_stage, this);
+
+    output_thread.join();
+    encode_thread.join();
+    input_thread.join();
+
+    return pipeline_control.result();
 }
 
 bool AudioEnc::send_frame(const uint8_t *buf, size_t len, int16_t peak_left, int16_t peak_right)
@@ -1326,13 +1955,11 @@ AudioEnc::~AudioEnc()
     file_output.reset();
     zmq_output.reset();
 
-    if (rs_handler != nullptr) {
-        free_rs_char(rs_handler);
-    }
-
     if (encoder != nullptr and selected_encoder == encoder_selection_t::fdk_dabplus) {
         aacEncClose(&encoder);
     }
+
+    toolame_ctx_destroy(toolame);
 }
 
 shared_ptr<InputInterface> AudioEnc::initialise_input()
@@ -1359,11 +1986,15 @@ shared_ptr<InputInterface> AudioEnc::initialise_input()
     }
 #endif
 #if HAVE_ALSA
-    else if (drift_compensation) {
+    /* In the ServicePool, encode_frame() must not block in snd_pcm_readi()
+     * on a shared worker. The thread fills the queue, and the watermark
+     * tells the pool when a frame is ready. */
+    else if (drift_compensation or cooperative) {
         input = make_shared<AlsaInputThreaded>(alsa_device, channels, sample_rate, queue);
     }
     else {
-        input = make_shared<AlsaInputDirect>(alsa_device, channels, sample_rate, queue);
+        input = make_shared<AlsaInputDirect>(alsa_device, channels, sample_rate, queue,
+                pcm_frame.samples.size());
     }
 #endif
 
@@ -1376,87 +2007,81 @@ shared_ptr<InputInterface> AudioEnc::initialise_input()
     return input;
 }
 
-int main(int argc, char *argv[])
-{
-    const struct option longopts[] = {
-        {"bitrate",                required_argument,  0, 'b'},
-        {"bandwidth",              required_argument,  0, 'B'},
-        {"audio-gain",             required_argument,  0, 'g'},
-        {"vlc-gain",               required_argument,  0, 10 }, // backward-compatibility to v3
-        {"channels",               required_argument,  0, 'c'},
-        {"dabmode",                required_argument,  0,  4 },
-        {"dabpsy",                 required_argument,  0,  5 },
-        {"device",                 required_argument,  0, 'd'},
-        {"edi",                    required_argument,  0, 'e'},
-        {"fec",                    required_argument,  0,  8 },
-        {"timestamp-delay",        required_argument,  0, 'T'},
-        {"decode",                 required_argument,  0,  6 },
-        {"format",                 required_argument,  0, 'f'},
-        {"gst-uri",                required_argument,  0, 'G'},
-        {"gst-pipeline",           required_argument,  0, 11 },
-        {"identifier",             required_argument,  0,  7 },
-        {"input",                  required_argument,  0, 'i'},
-        {"jack",                   required_argument,  0, 'j'},
-        {"output",                 required_argument,  0, 'o'},
-        {"pad",                    required_argument,  0, 'p'},
-        {"pad-socket",             required_argument,  0, 'P'},
-        {"rate",                   required_argument,  0, 'r'},
-        {"secret-key",             required_argument,  0, 'k'},
-        {"silence",                required_argument,  0, 's'},
-        {"startup-check",          required_argument,  0,  9 },
-        {"stats",                  required_argument,  0, 'S'},
-        {"vlc-cache",              required_argument,  0, 'C'},
-        {"vlc-uri",                required_argument,  0, 'v'},
-        {"vlc-opt",                required_argument,  0, 'L'},
-        {"write-icy-text",         required_argument,  0, 'w'},
-        {"write-icy-text-dl-plus", no_argument,        0, 'W'},
-        {"aaclc",                  no_argument,        0,  0 },
-        {"dab",                    no_argument,        0, 'a'},
-        {"drift-comp",             no_argument,        0, 'D'},
-        {"edi-verbose",            no_argument,        0, 12 },
-        {"fifo-silence",           no_argument,        0,  3 },
-        {"help",                   no_argument,        0, 'h'},
-        {"level",                  no_argument,        0, 'l'},
-        {"no-afterburner",         no_argument,        0, 'A'},
-        {"ps",                     no_argument,        0,  2 },
-        {"restart",                no_argument,        0, 'R'},
-        {"sbr",                    no_argument,        0,  1 },
-        {"verbosity",              no_argument,        0, 'V'},
-        {0, 0, 0, 0},
-    };
-
-    if (argc == 2 and strcmp(argv[1], "--version") == 0) {
-        fprintf(stdout, "%s\n",
-#if defined(GITVERSION)
-                GITVERSION
-#else
-                PACKAGE_VERSION
-#endif
-               );
-        return 0;
-    }
-
-    fprintf(stderr,
-            "Welcome to %s %s, compiled at %s, %s",
-            PACKAGE_NAME,
-#if defined(GITVERSION)
-            GITVERSION,
-#else
-            PACKAGE_VERSION,
+static const struct option longopts[] = {
+    {"bitrate",                required_argument,  0, 'b'},
+    {"bandwidth",              required_argument,  0, 'B'},
+    {"audio-gain",             required_argument,  0, 'g'},
+    {"vlc-gain",               required_argument,  0, 10 }, // backward-compatibility to v3
+    {"channels",               required_argument,  0, 'c'},
+    {"dabmode",                required_argument,  0,  4 },
+    {"dabpsy",                 required_argument,  0,  5 },
+    {"device",                 required_argument,  0, 'd'},
+    {"edi",                    required_argument,  0, 'e'},
+    {"fec",                    required_argument,  0,  8 },
+    {"timestamp-delay",        required_argument,  0, 'T'},
+    {"decode",                 required_argument,  0,  6 },
+    {"format",                 required_argument,  0, 'f'},
+    {"gst-uri",                required_argument,  0, 'G'},
+    {"gst-pipeline",           required_argument,  0, 11 },
+    {"identifier",             required_argument,  0,  7 },
+    {"input",                  required_argument,  0, 'i'},
+    {"jack",                   required_argument,  0, 'j'},
+    {"output",                 required_argument,  0, 'o'},
+    {"pad",                    required_argument,  0, 'p'},
+    {"pad-socket",             required_argument,  0, 'P'},
+    {"rate",                   required_argument,  0, 'r'},
+    {"secret-key",             required_argument,  0, 'k'},
+    {"silence",                required_argument,  0, 's'},
+    {"startup-check",          required_argument,  0,  9 },
+    {"stats",                  required_argument,  0, 'S'},
+    {"vlc-cache",              required_argument,  0, 'C'},
+    {"vlc-uri",                required_argument,  0, 'v'},
+    {"vlc-opt",                required_argument,  0, 'L'},
+    {"write-icy-text",         required_argument,  0, 'w'},
+    {"write-icy-text-dl-plus", no_argument,        0, 'W'},
+    {"aaclc",                  no_argument,        0,  0 },
+    {"dab",                    no_argument,        0, 'a'},
+    {"drift-comp",             no_argument,        0, 'D'},
+    {"edi-verbose",            no_argument,        0, 12 },
+    {"fifo-silence",           no_argument,        0,  3 },
+    {"help",                   no_argument,        0, 'h'},
+    {"level",                  no_argument,        0, 'l'},
+    {"no-afterburner",         no_argument,        0, 'A'},
+    {"ps",                     no_argument,        0,  2 },
+    {"restart",                no_argument,        0, 'R'},
+    {"sbr",                    no_argument,        0,  1 },
+    {"verbosity",              no_argument,        0, 'V'},
+    {"services",               required_argument,  0, 13 },
+    {"workers",                required_argument,  0, 14 },
+    {"pipeline",               no_argument,        0, 15 },
+    {"drift-comp-resample",    required_argument,  0, 16 },
+    {"agc",                    required_argument,  0, 17 },
+    {"limiter",                required_argument,  0, 18 },
+    {"dab-fast-alloc",         no_argument,        0, 20 },
+    {"dab-speed",              required_argument,  0, 21 },
+#if HAVE_ALLOCATION_CHECK
+    {"check-allocations",      required_argument,  0, 19 },
 #endif
-            __DATE__, __TIME__);
-    fprintf(stderr, "\n");
-    fprintf(stderr, "  http://opendigitalradio.org\n\n");
-
-
-    if (argc < 2) {
-        usage(argv[0]);
-        return 1;
-    }
+    {0, 0, 0, 0},
+};
 
-    AudioEnc audio_enc;
+/*! Options that apply to the whole process and not to one service */
+struct process_options_t {
+    string startupcheck;
+    string services_file;
+    int num_workers = 0;
+};
 
-    std::string startupcheck;
+/*! Parse the command line options into audio_enc and process_opts.
+ *
+ * \return false if the options were invalid, in which case an error
+ * message was already printed.
+ */
+static bool parse_args(AudioEnc& audio_enc, process_options_t& process_opts,
+        int argc, char *argv[])
+{
+    // Reinitialise getopt, as we parse several argument lists in multi-service mode
+    optind = 0;
 
     int ch=0;
     int index;
@@ -1485,7 +2110,7 @@ int main(int argc, char *argv[])
                         audio_enc.dab_channel_mode == "m")) {
                 fprintf(stderr, "Invalid DAB channel mode\n");
                 usage(argv[0]);
-                return 1;
+                return false;
             }
             break;
         case 5: // DAB psy model
@@ -1501,7 +2126,7 @@ int main(int argc, char *argv[])
             if (audio_enc.identifier.size() > 32) {
                 fprintf(stderr, "Output Identifier too long!\n");
                 usage(argv[0]);
-                return 1;
+                return false;
             }
             break;
         case 8: // EDI output FEC
@@ -1511,7 +2136,69 @@ int main(int argc, char *argv[])
             audio_enc.edi_output.set_verbose(true);
             break;
         case 9: // --startup-check
-            startupcheck = optarg;
+            process_opts.startupcheck = optarg;
+            break;
+        case 13: // --services
+            process_opts.services_file = optarg;
+            break;
+        case 15: // --pipeline
+            audio_enc.pipeline = true;
+            break;
+        case 16: // --drift-comp-resample
+            audio_enc.drift_compensation = true;
+            audio_enc.drift_comp_latency_ms = std::stoi(optarg);
+            if (audio_enc.drift_comp_latency_ms < 1) {
+                fprintf(stderr, "Invalid drift compensation latency!\n");
+                return false;
+            }
+            break;
+        case 17: // --agc
+            audio_enc.agc_enabled = true;
+            audio_enc.limiter_enabled = true;
+            audio_enc.agc_target_dBFS = std::stof(optarg);
+            break;
+        case 18: // --limiter
+            audio_enc.limiter_enabled = true;
+            audio_enc.limiter_threshold_dBFS = std::stof(optarg);
+            break;
+#if HAVE_ALLOCATION_CHECK
+        case 19: // --check-allocations
+            audio_enc.allocation_check_warmup = std::stol(optarg);
+            if (audio_enc.allocation_check_warmup < 1) {
+                fprintf(stderr, "Invalid number of warm-up frames!\n");
+                return false;
+            }
+            break;
+#endif
+        case 20: // --dab-fast-alloc
+            audio_enc.dab_fast_alloc = true;
+            break;
+        case 21: // --dab-speed
+        {
+            const string preset(optarg);
+            if (preset == "quality") {
+                audio_enc.dab_psy_interval = 1;
+            }
+            else if (preset == "balanced") {
+                audio_enc.dab_psy_interval = 3;
+                audio_enc.dab_fast_alloc = true;
+            }
+            else if (preset == "fast") {
+                audio_enc.dab_psy_interval = 10;
+                audio_enc.dab_fast_alloc = true;
+            }
+            else {
+                fprintf(stderr, "Invalid DAB speed preset %s\n", optarg);
+                return false;
+            }
+            break;
+        }
+        case 14: // --workers
+            process_opts.num_workers = std::stoi(optarg);
+            if (process_opts.num_workers < 1) {
+                fprintf(stderr, "Invalid number of workers!\n");
+                return false;
+            }
             break;
         case 'a':
             audio_enc.selected_encoder = encoder_selection_t::toolame_dab;
@@ -1547,7 +2234,7 @@ int main(int argc, char *argv[])
             }
             else if (strcmp(optarg, "wav") != 0) {
                 usage(argv[0]);
-                return 1;
+                return false;
             }
             break;
         case 10:
@@ -1572,7 +2259,7 @@ int main(int argc, char *argv[])
             audio_enc.jack_name = optarg;
 #else
             fprintf(stderr, "JACK disabled at compile time!\n");
-            return 1;
+            return false;
 #endif
             break;
         case 'k':
@@ -1603,7 +2290,7 @@ int main(int argc, char *argv[])
             }
             else {
                 fprintf(stderr, "Invalid silence timeout (%d) given!\n", audio_enc.silence_timeout);
-                return 1;
+                return false;
             }
 
             break;
@@ -1629,7 +2316,7 @@ int main(int argc, char *argv[])
 #else
         case 'v':
             fprintf(stderr, "VLC input not enabled at compile time!\n");
-            return 1;
+            return false;
 #endif
         case 'V':
             audio_enc.verbosity++;
@@ -1637,13 +2324,161 @@ int main(int argc, char *argv[])
         case '?':
         case 'h':
             usage(argv[0]);
+            return false;
+        }
+    }
+
+
+    return true;
+}
+
+/*! Run all services defined in the services file in a ServicePool.
+ * The options given on the command line are used as defaults for every
+ * service.
+ */
+static int run_services(const process_options_t& process_opts, int argc, char *argv[])
+{
+    ifstream services_fs(process_opts.services_file);
+    if (not services_fs) {
+        fprintf(stderr, "Could not open services file %s\n",
+                process_opts.services_file.c_str());
+        return 1;
+    }
+
+    const size_t num_workers = process_opts.num_workers > 0 ?
+        process_opts.num_workers :
+        std::max(thread::hardware_concurrency(), 1u);
+    ServicePool pool(num_workers);
+
+    /* The services must stay alive until the pool terminates */
+    vector<shared_ptr<AudioEnc> > services;
+
+    string line;
+    int line_number = 0;
+    while (getline(services_fs, line)) {
+        line_number++;
+
+        vector<string> args;
+        try {
+            args = split_service_definition(line);
+        }
+        catch (const runtime_error& e) {
+            fprintf(stderr, "Services file line %d: %s\n", line_number, e.what());
+            return 1;
+        }
+
+        if (args.empty() or args[0][0] == '#') {
+            continue;
+        }
+
+        auto audio_enc = make_shared<AudioEnc>();
+        audio_enc->cooperative = true;
+
+        process_options_t global_opts;
+        if (not parse_args(*audio_enc, global_opts, argc, argv)) {
+            return 1;
+        }
+
+        /* getopt expects the program name as first argument */
+        args.insert(args.begin(), argv[0]);
+        vector<char*> service_argv;
+        for (auto& arg : args) {
+            service_argv.push_back(&arg[0]);
+        }
+        service_argv.push_back(nullptr);
+
+        process_options_t service_opts;
+        if (not parse_args(*audio_enc, service_opts, service_argv.size() - 1, service_argv.data())) {
+            fprintf(stderr, "Invalid service definition on line %d of %s\n",
+                    line_number, process_opts.services_file.c_str());
+            return 1;
+        }
+
+        if (not (service_opts.startupcheck.empty() and
+                 service_opts.services_file.empty() and
+                 service_opts.num_workers == 0)) {
+            fprintf(stderr, "Services file line %d: --startup-check, --services and --workers "
+                    "can only be given on the command line\n", line_number);
+            return 1;
+        }
+
+        if (audio_enc->show_level or audio_enc->pipeline) {
+            fprintf(stderr, "Services file line %d: -l and --pipeline are not supported in multi-service mode\n",
+                    line_number);
             return 1;
         }
+
+        const string name = audio_enc->identifier.empty() ?
+            "line " + to_string(line_number) :
+            audio_enc->identifier;
+
+        fprintf(stderr, "Preparing service %s\n", name.c_str());
+        int ret = 0;
+        try {
+            ret = audio_enc->prepare();
+        }
+        catch (const std::runtime_error& e) {
+            fprintf(stderr, "Service %s failed to start: %s\n", name.c_str(), e.what());
+            ret = 1;
+        }
+
+        if (ret != 0) {
+            return ret;
+        }
+
+        pool.add_service(name, audio_enc);
+        services.push_back(audio_enc);
     }
 
-    if (not startupcheck.empty()) {
-        etiLog.level(info) << "Running startup check '" << startupcheck << "'";
-        int wstatus = system(startupcheck.c_str());
+    if (services.empty()) {
+        fprintf(stderr, "No service defined in %s\n", process_opts.services_file.c_str());
+        return 1;
+    }
+
+    return pool.run();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 2 and strcmp(argv[1], "--version") == 0) {
+        fprintf(stdout, "%s\n",
+#if defined(GITVERSION)
+                GITVERSION
+#else
+                PACKAGE_VERSION
+#endif
+               );
+        return 0;
+    }
+
+    fprintf(stderr,
+            "Welcome to %s %s, compiled at %s, %s",
+            PACKAGE_NAME,
+#if defined(GITVERSION)
+            GITVERSION,
+#else
+            PACKAGE_VERSION,
+#endif
+            __DATE__, __TIME__);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  http://opendigitalradio.org\n\n");
+
+
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    AudioEnc audio_enc;
+    process_options_t process_opts;
+
+    if (not parse_args(audio_enc, process_opts, argc, argv)) {
+        return 1;
+    }
+
+    if (not process_opts.startupcheck.empty()) {
+        etiLog.level(info) << "Running startup check '" << process_opts.startupcheck << "'";
+        int wstatus = system(process_opts.startupcheck.c_str());
 
         if (WIFEXITED(wstatus)) {
             if (WEXITSTATUS(wstatus) == 0) {
@@ -1660,6 +2495,10 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (not process_opts.services_file.empty()) {
+        return run_services(process_opts, argc, argv);
+    }
+
     try {
         return audio_enc.run();
     }
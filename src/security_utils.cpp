@@ -26,8 +26,6 @@
 #include <sstream>
 #include <sys/resource.h>
 #include <unistd.h>
-#include <immintrin.h>  // For SIMD intrinsics
-#include <arm_neon.h>   // For ARM NEON (conditionally compiled)
 
 using namespace std;
 using namespace std::chrono;
@@ -594,136 +592,4 @@ void PerformanceMonitor::check_performance_thresholds() {
     }
 }
 
-// SIMD processor implementation
-bool SIMDProcessor::cpu_capabilities_detected_ = false;
-bool SIMDProcessor::has_sse2_ = false;
-bool SIMDProcessor::has_avx2_ = false;
-bool SIMDProcessor::has_neon_ = false;
-
-void SIMDProcessor::detect_cpu_capabilities() {
-    if (cpu_capabilities_detected_) return;
-    
-#ifdef __x86_64__
-    // x86-64 CPU capability detection
-    uint32_t eax, ebx, ecx, edx;
-    
-    // Check for SSE2 support
-    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
-    has_sse2_ = (edx & (1 << 26)) != 0;
-    
-    // Check for AVX2 support
-    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(7), "c"(0));
-    has_avx2_ = (ebx & (1 << 5)) != 0;
-#endif
-
-#ifdef __ARM_NEON__
-    has_neon_ = true;
-#endif
-    
-    cpu_capabilities_detected_ = true;
-}
-
-void SIMDProcessor::normalize_samples_simd(int16_t* samples, size_t count, float gain) {
-    detect_cpu_capabilities();
-    
-#ifdef __x86_64__
-    if (has_sse2_ && count >= 8) {
-        __m128 gain_vec = _mm_set1_ps(gain);
-        size_t simd_count = count & ~7; // Process in chunks of 8
-        
-        for (size_t i = 0; i < simd_count; i += 8) {
-            // Load 8 int16_t samples
-            __m128i samples_i16 = _mm_loadu_si128(reinterpret_cast<__m128i*>(&samples[i]));
-            
-            // Convert to float (lower 4 samples)
-            __m128i samples_low = _mm_unpacklo_epi16(samples_i16, _mm_setzero_si128());
-            __m128 samples_f_low = _mm_cvtepi32_ps(_mm_unpacklo_epi16(samples_low, _mm_setzero_si128()));
-            
-            // Apply gain
-            samples_f_low = _mm_mul_ps(samples_f_low, gain_vec);
-            
-            // Convert back to int16_t and store
-            __m128i result_low = _mm_cvtps_epi32(samples_f_low);
-            result_low = _mm_packs_epi32(result_low, result_low);
-            
-            _mm_storel_epi64(reinterpret_cast<__m128i*>(&samples[i]), result_low);
-        }
-        
-        // Process remaining samples
-        for (size_t i = simd_count; i < count; ++i) {
-            samples[i] = static_cast<int16_t>(samples[i] * gain);
-        }
-        return;
-    }
-#endif
-
-    // Fallback to scalar implementation
-    for (size_t i = 0; i < count; ++i) {
-        samples[i] = static_cast<int16_t>(samples[i] * gain);
-    }
-}
-
-double SIMDProcessor::calculate_rms_simd(const int16_t* samples, size_t count) {
-    detect_cpu_capabilities();
-    
-    if (count == 0) return 0.0;
-    
-    double sum_squares = 0.0;
-    
-#ifdef __x86_64__
-    if (has_sse2_ && count >= 8) {
-        __m128d sum_vec = _mm_setzero_pd();
-        size_t simd_count = count & ~7;
-        
-        for (size_t i = 0; i < simd_count; i += 8) {
-            __m128i samples_i16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&samples[i]));
-            
-            // Convert to 32-bit and then to double for better precision
-            __m128i samples_low = _mm_unpacklo_epi16(samples_i16, _mm_setzero_si128());
-            __m128d samples_d_low = _mm_cvtepi32_pd(samples_low);
-            
-            // Square and accumulate
-            samples_d_low = _mm_mul_pd(samples_d_low, samples_d_low);
-            sum_vec = _mm_add_pd(sum_vec, samples_d_low);
-        }
-        
-        // Extract sum from vector
-        double temp[2];
-        _mm_storeu_pd(temp, sum_vec);
-        sum_squares = temp[0] + temp[1];
-        
-        // Process remaining samples
-        for (size_t i = simd_count; i < count; ++i) {
-            double sample = samples[i];
-            sum_squares += sample * sample;
-        }
-    }
-    else
-#endif
-    {
-        // Scalar fallback
-        for (size_t i = 0; i < count; ++i) {
-            double sample = samples[i];
-            sum_squares += sample * sample;
-        }
-    }
-    
-    return sqrt(sum_squares / count);
-}
-
-bool SIMDProcessor::has_sse2_support() {
-    detect_cpu_capabilities();
-    return has_sse2_;
-}
-
-bool SIMDProcessor::has_avx2_support() {
-    detect_cpu_capabilities();
-    return has_avx2_;
-}
-
-bool SIMDProcessor::has_neon_support() {
-    detect_cpu_capabilities();
-    return has_neon_;
-}
-
 } // namespace StreamDAB
\ No newline at end of file
@@ -24,6 +24,8 @@
 #include <memory>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <fstream>
 #include <chrono>
 #include <thread>
 #include <map>
@@ -156,7 +158,7 @@ private:
     };
     
     std::map<void*, AllocationInfo> allocations_;
-    std::mutex allocations_mutex_;
+    mutable std::mutex allocations_mutex_;
     std::atomic<size_t> total_allocated_{0};
     std::atomic<size_t> peak_allocated_{0};
     std::atomic<size_t> allocation_count_{0};
@@ -392,12 +394,27 @@ private:
 // SIMD optimization utilities
 class SIMDProcessor {
 public:
+    // Per-channel levels measured by gain_and_levels_simd()
+    struct AudioLevels {
+        int16_t peak[2] = {0, 0};           // Absolute peak, saturated to 32767
+        uint64_t sum_squares[2] = {0, 0};   // Only filled if requested
+    };
+
     // Audio processing optimizations
     static void normalize_samples_simd(int16_t* samples, size_t count, float gain);
     static void mix_stereo_samples_simd(const int16_t* left, const int16_t* right, 
                                        int16_t* output, size_t count);
     static double calculate_rms_simd(const int16_t* samples, size_t count);
     static void apply_gain_simd(int16_t* samples, size_t count, float gain);
+
+    // Apply a saturating gain to interleaved samples of 1 or 2 channels and
+    // measure the per-channel peak, and optionally the sum of squares, in
+    // the same pass. A gain of exactly 1 leaves the samples untouched. In
+    // mono, both entries of levels contain the same values. Dispatches at
+    // runtime to AVX2, SSE2 or scalar code.
+    static void gain_and_levels_simd(int16_t* samples, size_t num_frames,
+                                     unsigned int channels, float gain,
+                                     AudioLevels& levels, bool compute_sum_squares = false);
     
     // Memory operations
     static void secure_memcpy(void* dest, const void* src, size_t count);
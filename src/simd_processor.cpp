@@ -0,0 +1,341 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2024 StreamDAB Project
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * ------------------------------------------------------------------- */
+
+// The SIMDProcessor is kept apart from the rest of security_utils, so that
+// the encoder can use it without the other utilities.
+
+#include "security_utils.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#if defined(__x86_64__)
+#  include <immintrin.h>  // For SIMD intrinsics
+#endif
+#if defined(__ARM_NEON__)
+#  include <arm_neon.h>   // For ARM NEON
+#endif
+
+using namespace std;
+
+namespace StreamDAB {
+
+// SIMD processor implementation
+bool SIMDProcessor::cpu_capabilities_detected_ = false;
+bool SIMDProcessor::has_sse2_ = false;
+bool SIMDProcessor::has_avx2_ = false;
+bool SIMDProcessor::has_neon_ = false;
+
+void SIMDProcessor::detect_cpu_capabilities() {
+    if (cpu_capabilities_detected_) return;
+    
+#ifdef __x86_64__
+    // x86-64 CPU capability detection
+    uint32_t eax, ebx, ecx, edx;
+    
+    // Check for SSE2 support
+    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    has_sse2_ = (edx & (1 << 26)) != 0;
+    
+    // Check for AVX2 support, including OS support for the YMM registers
+    has_avx2_ = __builtin_cpu_supports("avx2");
+#endif
+
+#ifdef __ARM_NEON__
+    has_neon_ = true;
+#endif
+    
+    cpu_capabilities_detected_ = true;
+}
+
+void SIMDProcessor::normalize_samples_simd(int16_t* samples, size_t count, float gain) {
+    // The gain kernel sign-extends and saturates properly, and handles
+    // all samples of each vector
+    apply_gain_simd(samples, count, gain);
+}
+
+double SIMDProcessor::calculate_rms_simd(const int16_t* samples, size_t count) {
+    detect_cpu_capabilities();
+    
+    if (count == 0) return 0.0;
+    
+    double sum_squares = 0.0;
+    
+#ifdef __x86_64__
+    if (has_sse2_ && count >= 8) {
+        __m128d sum_vec = _mm_setzero_pd();
+        size_t simd_count = count & ~7;
+        
+        for (size_t i = 0; i < simd_count; i += 8) {
+            __m128i samples_i16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&samples[i]));
+            
+            // Convert to 32-bit and then to double for better precision
+            __m128i samples_low = _mm_unpacklo_epi16(samples_i16, _mm_setzero_si128());
+            __m128d samples_d_low = _mm_cvtepi32_pd(samples_low);
+            
+            // Square and accumulate
+            samples_d_low = _mm_mul_pd(samples_d_low, samples_d_low);
+            sum_vec = _mm_add_pd(sum_vec, samples_d_low);
+        }
+        
+        // Extract sum from vector
+        double temp[2];
+        _mm_storeu_pd(temp, sum_vec);
+        sum_squares = temp[0] + temp[1];
+        
+        // Process remaining samples
+        for (size_t i = simd_count; i < count; ++i) {
+            double sample = samples[i];
+            sum_squares += sample * sample;
+        }
+    }
+    else
+#endif
+    {
+        // Scalar fallback
+        for (size_t i = 0; i < count; ++i) {
+            double sample = samples[i];
+            sum_squares += sample * sample;
+        }
+    }
+    
+    return sqrt(sum_squares / count);
+}
+
+// Gain and level measurement kernels. They process the samples from
+// index 0 up to a multiple of their vector width, and accumulate into
+// per-lane levels that gain_and_levels_simd() merges per channel.
+namespace {
+
+struct LevelAccumulator {
+    int peak[2] = {0, 0};
+    uint64_t sum_squares[2] = {0, 0};
+};
+
+inline void gain_and_levels_scalar(int16_t* samples, size_t begin, size_t end,
+                                   unsigned int channels, float gain, bool apply_gain,
+                                   bool compute_sum_squares, LevelAccumulator& acc) {
+    for (size_t i = begin; i < end; ++i) {
+        const size_t ch = (channels == 2) ? (i & 1) : 0;
+        int value = samples[i];
+
+        if (apply_gain) {
+            const float scaled = std::min(32767.0f, std::max(-32768.0f, value * gain));
+            value = static_cast<int>(lrintf(scaled));
+            samples[i] = static_cast<int16_t>(value);
+        }
+
+        acc.peak[ch] = std::max(acc.peak[ch], value < 0 ? -value : value);
+        if (compute_sum_squares) {
+            acc.sum_squares[ch] += static_cast<int64_t>(value) * value;
+        }
+    }
+}
+
+#ifdef __x86_64__
+// Squares of the even and odd 16-bit lanes, in four 32-bit lanes each
+inline void add_squares_sse2(__m128i x, __m128i& even_acc, __m128i& odd_acc) {
+    const __m128i even_mask = _mm_set1_epi32(0x0000FFFF);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i even = _mm_madd_epi16(x, _mm_and_si128(x, even_mask));
+    const __m128i odd = _mm_madd_epi16(x, _mm_andnot_si128(even_mask, x));
+    even_acc = _mm_add_epi64(even_acc, _mm_unpacklo_epi32(even, zero));
+    even_acc = _mm_add_epi64(even_acc, _mm_unpackhi_epi32(even, zero));
+    odd_acc = _mm_add_epi64(odd_acc, _mm_unpacklo_epi32(odd, zero));
+    odd_acc = _mm_add_epi64(odd_acc, _mm_unpackhi_epi32(odd, zero));
+}
+
+inline __m128i apply_gain_sse2(__m128i x, __m128 gain) {
+    const __m128 lower = _mm_set1_ps(-32768.0f);
+    const __m128 upper = _mm_set1_ps(32767.0f);
+    // Sign-extend to 32 bits
+    const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+    const __m128 flo = _mm_min_ps(upper, _mm_max_ps(lower, _mm_mul_ps(_mm_cvtepi32_ps(lo), gain)));
+    const __m128 fhi = _mm_min_ps(upper, _mm_max_ps(lower, _mm_mul_ps(_mm_cvtepi32_ps(hi), gain)));
+    return _mm_packs_epi32(_mm_cvtps_epi32(flo), _mm_cvtps_epi32(fhi));
+}
+
+// Merge 16-bit peak lanes and 64-bit square sums into the per-channel
+// accumulator. Even lanes hold the left channel in stereo.
+inline void merge_lanes(const int16_t* peaks, size_t num_peaks,
+                        const uint64_t* even_sums, const uint64_t* odd_sums, size_t num_sums,
+                        unsigned int channels, LevelAccumulator& acc) {
+    for (size_t i = 0; i < num_peaks; ++i) {
+        const size_t ch = (channels == 2) ? (i & 1) : 0;
+        acc.peak[ch] = std::max<int>(acc.peak[ch], peaks[i]);
+    }
+    for (size_t i = 0; i < num_sums; ++i) {
+        acc.sum_squares[0] += even_sums[i];
+        acc.sum_squares[channels == 2 ? 1 : 0] += odd_sums[i];
+    }
+}
+
+size_t gain_and_levels_sse2(int16_t* samples, size_t count, unsigned int channels,
+                            float gain, bool apply_gain, bool compute_sum_squares,
+                            LevelAccumulator& acc) {
+    const size_t simd_count = count & ~static_cast<size_t>(7);
+    const __m128 gain_vec = _mm_set1_ps(gain);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i peak = zero;
+    __m128i even_acc = zero;
+    __m128i odd_acc = zero;
+
+    for (size_t i = 0; i < simd_count; i += 8) {
+        __m128i* p = reinterpret_cast<__m128i*>(&samples[i]);
+        __m128i x = _mm_loadu_si128(p);
+        if (apply_gain) {
+            x = apply_gain_sse2(x, gain_vec);
+            _mm_storeu_si128(p, x);
+        }
+        // Saturating negation, so that -32768 gives 32767
+        peak = _mm_max_epi16(peak, _mm_max_epi16(x, _mm_subs_epi16(zero, x)));
+        if (compute_sum_squares) {
+            add_squares_sse2(x, even_acc, odd_acc);
+        }
+    }
+
+    alignas(16) int16_t peaks[8];
+    alignas(16) uint64_t even_sums[2];
+    alignas(16) uint64_t odd_sums[2];
+    _mm_store_si128(reinterpret_cast<__m128i*>(peaks), peak);
+    _mm_store_si128(reinterpret_cast<__m128i*>(even_sums), even_acc);
+    _mm_store_si128(reinterpret_cast<__m128i*>(odd_sums), odd_acc);
+    merge_lanes(peaks, 8, even_sums, odd_sums, 2, channels, acc);
+    return simd_count;
+}
+
+__attribute__((target("avx2")))
+size_t gain_and_levels_avx2(int16_t* samples, size_t count, unsigned int channels,
+                            float gain, bool apply_gain, bool compute_sum_squares,
+                            LevelAccumulator& acc) {
+    const size_t simd_count = count & ~static_cast<size_t>(15);
+    const __m256 gain_vec = _mm256_set1_ps(gain);
+    const __m256 lower = _mm256_set1_ps(-32768.0f);
+    const __m256 upper = _mm256_set1_ps(32767.0f);
+    const __m256i even_mask = _mm256_set1_epi32(0x0000FFFF);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i peak = zero;
+    __m256i even_acc = zero;
+    __m256i odd_acc = zero;
+
+    for (size_t i = 0; i < simd_count; i += 16) {
+        __m256i* p = reinterpret_cast<__m256i*>(&samples[i]);
+        __m256i x = _mm256_loadu_si256(p);
+        if (apply_gain) {
+            // unpack and pack both work within 128-bit lanes, so the
+            // sample order is preserved
+            const __m256i lo = _mm256_srai_epi32(_mm256_unpacklo_epi16(x, x), 16);
+            const __m256i hi = _mm256_srai_epi32(_mm256_unpackhi_epi16(x, x), 16);
+            const __m256 flo = _mm256_min_ps(upper, _mm256_max_ps(lower,
+                        _mm256_mul_ps(_mm256_cvtepi32_ps(lo), gain_vec)));
+            const __m256 fhi = _mm256_min_ps(upper, _mm256_max_ps(lower,
+                        _mm256_mul_ps(_mm256_cvtepi32_ps(hi), gain_vec)));
+            x = _mm256_packs_epi32(_mm256_cvtps_epi32(flo), _mm256_cvtps_epi32(fhi));
+            _mm256_storeu_si256(p, x);
+        }
+        peak = _mm256_max_epi16(peak, _mm256_max_epi16(x, _mm256_subs_epi16(zero, x)));
+        if (compute_sum_squares) {
+            const __m256i even = _mm256_madd_epi16(x, _mm256_and_si256(x, even_mask));
+            const __m256i odd = _mm256_madd_epi16(x, _mm256_andnot_si256(even_mask, x));
+            even_acc = _mm256_add_epi64(even_acc, _mm256_unpacklo_epi32(even, zero));
+            even_acc = _mm256_add_epi64(even_acc, _mm256_unpackhi_epi32(even, zero));
+            odd_acc = _mm256_add_epi64(odd_acc, _mm256_unpacklo_epi32(odd, zero));
+            odd_acc = _mm256_add_epi64(odd_acc, _mm256_unpackhi_epi32(odd, zero));
+        }
+    }
+
+    alignas(32) int16_t peaks[16];
+    alignas(32) uint64_t even_sums[4];
+    alignas(32) uint64_t odd_sums[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(peaks), peak);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(even_sums), even_acc);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(odd_sums), odd_acc);
+    merge_lanes(peaks, 16, even_sums, odd_sums, 4, channels, acc);
+    return simd_count;
+}
+#endif
+
+using LevelKernel = size_t (*)(int16_t*, size_t, unsigned int, float, bool, bool,
+                               LevelAccumulator&);
+
+size_t gain_and_levels_none(int16_t*, size_t, unsigned int, float, bool, bool,
+                            LevelAccumulator&) {
+    return 0;
+}
+
+LevelKernel select_level_kernel() {
+#ifdef __x86_64__
+    if (SIMDProcessor::has_avx2_support()) {
+        return gain_and_levels_avx2;
+    }
+    if (SIMDProcessor::has_sse2_support()) {
+        return gain_and_levels_sse2;
+    }
+#endif
+    return gain_and_levels_none;
+}
+
+} // namespace
+
+void SIMDProcessor::gain_and_levels_simd(int16_t* samples, size_t num_frames,
+                                         unsigned int channels, float gain,
+                                         AudioLevels& levels, bool compute_sum_squares) {
+    if (channels != 1 && channels != 2) {
+        throw std::invalid_argument("gain_and_levels_simd supports 1 or 2 channels");
+    }
+
+    // Selected once, so that concurrent callers do not race on detection
+    static const LevelKernel kernel = select_level_kernel();
+
+    const size_t count = num_frames * channels;
+    const bool apply_gain = (gain != 1.0f);
+    LevelAccumulator acc;
+
+    const size_t done = kernel(samples, count, channels, gain, apply_gain,
+                               compute_sum_squares, acc);
+    gain_and_levels_scalar(samples, done, count, channels, gain, apply_gain,
+                           compute_sum_squares, acc);
+
+    for (size_t ch = 0; ch < 2; ++ch) {
+        const size_t src = (channels == 2) ? ch : 0;
+        levels.peak[ch] = static_cast<int16_t>(std::min(acc.peak[src], 32767));
+        levels.sum_squares[ch] = acc.sum_squares[src];
+    }
+}
+
+void SIMDProcessor::apply_gain_simd(int16_t* samples, size_t count, float gain) {
+    AudioLevels levels;
+    gain_and_levels_simd(samples, count, 1, gain, levels);
+}
+
+bool SIMDProcessor::has_sse2_support() {
+    detect_cpu_capabilities();
+    return has_sse2_;
+}
+
+bool SIMDProcessor::has_avx2_support() {
+    detect_cpu_capabilities();
+    return has_avx2_;
+}
+
+bool SIMDProcessor::has_neon_support() {
+    detect_cpu_capabilities();
+    return has_neon_;
+}
+
+} // namespace StreamDAB
@@ -0,0 +1,187 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * ------------------------------------------------------------------- */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "../libtoolame-dab/common.h"
+#include "../libtoolame-dab/options.h"
+#include "../libtoolame-dab/encode_new.h"
+}
+
+namespace {
+
+struct alloc_config_t {
+    int tab_num;
+    int sblimit;
+    int nch;
+    int jsbound;
+    int adb;
+};
+
+/* 48kHz frames at 192kbps stereo, 128kbps joint stereo, 64kbps mono, and
+ * 24kHz at 64kbps */
+const alloc_config_t CONFIGS[] = {
+    {0, 27, 2, 27, 4608},
+    {0, 27, 2, 8, 3072},
+    {0, 27, 1, 27, 1536},
+    {4, 30, 2, 30, 3072},
+};
+
+struct alloc_input_t {
+    double smr[2][SBLIMIT];
+    unsigned int scfsi[2][SBLIMIT];
+};
+
+/* Random SMRs, rounded to 1dB on one of every two inputs so that there are
+ * many subbands with equal MNRs */
+alloc_input_t make_input(unsigned seed)
+{
+    alloc_input_t in;
+    uint32_t noise = seed;
+    for (int ch = 0; ch < 2; ch++) {
+        for (int sb = 0; sb < SBLIMIT; sb++) {
+            noise = noise * 1103515245 + 12345;
+            double smr = ((noise >> 16) & 0x7fff) / 32768.0 * 60.0 - 20.0 - sb;
+            if (seed % 2) {
+                smr = (int)smr;
+            }
+            in.smr[ch][sb] = smr;
+            in.scfsi[ch][sb] = (noise >> 8) & 3;
+        }
+    }
+    return in;
+}
+
+struct alloc_result_t {
+    unsigned int bit_alloc[2][SBLIMIT];
+    int adb;
+};
+
+alloc_result_t allocate(const alloc_config_t& config, alloc_input_t in, int fast)
+{
+    frame_header header = {};
+    header.error_protection = 1;
+    frame_info frame = {};
+    frame.header = &header;
+    frame.tab_num = config.tab_num;
+    frame.sblimit = config.sblimit;
+    frame.nch = config.nch;
+    frame.jsbound = config.jsbound;
+
+    alloc_result_t result;
+    result.adb = config.adb;
+    a_bit_allocation_new(in.smr, in.scfsi, result.bit_alloc, &result.adb, &frame, fast);
+    return result;
+}
+
+} // namespace
+
+TEST(BitAllocationTest, QueueMatchesScan)
+{
+    for (const auto& config : CONFIGS) {
+        for (unsigned seed = 1; seed < 500; seed++) {
+            const auto in = make_input(seed);
+            const auto expected = allocate(config, in, 0);
+            const auto result = allocate(config, in, 1);
+            ASSERT_EQ(memcmp(result.bit_alloc, expected.bit_alloc, sizeof(expected.bit_alloc)), 0)
+                << "table " << config.tab_num << " nch " << config.nch << " seed " << seed;
+            ASSERT_EQ(result.adb, expected.adb);
+        }
+    }
+}
+
+TEST(BitAllocationTest, QueueOrder)
+{
+    double mnr[2][SBLIMIT] = {};
+    char used[2][SBLIMIT] = {};
+    for (int sb = 0; sb < SBLIMIT; sb++) {
+        mnr[0][sb] = 10.0 - (sb % 4);
+        mnr[1][sb] = 7.0;
+    }
+
+    mnr_queue queue;
+    mnr_queue_init(&queue, mnr, used, SBLIMIT, 2);
+
+    // Ties go to the lowest channel, then to the lowest subband
+    int sb, ch;
+    mnr_queue_min(&queue, &sb, &ch);
+    EXPECT_EQ(sb, 3);
+    EXPECT_EQ(ch, 0);
+
+    used[0][3] = 2;
+    mnr_queue_update(&queue, mnr, used, 3, 0);
+    mnr_queue_min(&queue, &sb, &ch);
+    EXPECT_EQ(sb, 7);
+    EXPECT_EQ(ch, 0);
+
+    mnr[0][7] = 12.0;
+    mnr_queue_update(&queue, mnr, used, 7, 0);
+    mnr_queue_min(&queue, &sb, &ch);
+    EXPECT_EQ(sb, 11);
+    EXPECT_EQ(ch, 0);
+
+    for (int s = 0; s < SBLIMIT; s++) {
+        used[0][s] = 2;
+        mnr_queue_update(&queue, mnr, used, s, 0);
+    }
+    mnr_queue_min(&queue, &sb, &ch);
+    EXPECT_EQ(sb, 0);
+    EXPECT_EQ(ch, 1);
+
+    for (int s = 0; s < SBLIMIT; s++) {
+        used[1][s] = 2;
+        mnr_queue_update(&queue, mnr, used, s, 1);
+    }
+    mnr_queue_min(&queue, &sb, &ch);
+    EXPECT_EQ(sb, -1);
+    EXPECT_EQ(ch, -1);
+}
+
+TEST(BitAllocationTest, Benchmark)
+{
+    std::vector<alloc_input_t> inputs;
+    for (unsigned seed = 1; seed <= 100; seed++) {
+        inputs.push_back(make_input(seed));
+    }
+
+    const size_t iterations = 200;
+    for (const auto& config : CONFIGS) {
+        double elapsed[2];
+        for (int fast = 0; fast < 2; fast++) {
+            int sum = 0;
+            const auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < iterations; i++) {
+                for (const auto& in : inputs) {
+                    sum += allocate(config, in, fast).adb;
+                }
+            }
+            const std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+            elapsed[fast] = d.count() / (iterations * inputs.size());
+            EXPECT_NE(sum, 0);
+        }
+
+        printf("Bit allocation table %d, %d channels, %d bits: "
+                "scan %.2f us, queue %.2f us per frame, %.1fx\n",
+                config.tab_num, config.nch, config.adb,
+                elapsed[0] * 1e6, elapsed[1] * 1e6, elapsed[0] / elapsed[1]);
+    }
+}
@@ -0,0 +1,237 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * ------------------------------------------------------------------- */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+extern "C" {
+#include "../libtoolame-dab/common.h"
+#include "../libtoolame-dab/bitstream.h"
+}
+
+namespace {
+
+struct field_t {
+    unsigned int val;
+    int bits;
+};
+
+/* The bit by bit writer that bitstream.c used before the accumulator,
+ * writing forward into a vector. Not inlined, to compare it fairly with the
+ * library function. */
+class ReferenceBitWriter {
+    public:
+        __attribute__((noinline)) void putbits(unsigned int val, int N)
+        {
+            static const int putmask[9] = { 0x0, 0x1, 0x3, 0x7, 0xf, 0x1f, 0x3f, 0x7f, 0xff };
+            int j = N;
+            while (j > 0) {
+                const int k = std::min(j, bit_idx);
+                const unsigned int tmp = val >> (j - k);
+                current |= (tmp & putmask[k]) << (bit_idx - k);
+                bit_idx -= k;
+                if (bit_idx == 0) {
+                    out.push_back(current);
+                    current = 0;
+                    bit_idx = 8;
+                }
+                j -= k;
+            }
+        }
+
+        std::vector<uint8_t> out;
+
+    private:
+        uint8_t current = 0;
+        int bit_idx = 8;
+};
+
+/* Drives a Bit_stream_struc and collects what it emits in its output
+ * buffer */
+class BitstreamWriter {
+    public:
+        BitstreamWriter(int size, int minimum) : output(size)
+        {
+            open_bit_stream_w(&bs, size);
+            bs_set_minimum(&bs, minimum);
+            bs.output_buffer = output.data();
+            bs.output_buffer_size = output.size();
+            bs.output_buffer_written = 0;
+        }
+
+        void putbits(unsigned int val, int N)
+        {
+            ::putbits(&bs, val, N);
+            collect();
+        }
+
+        void flush()
+        {
+            bs_flush(&bs);
+            collect();
+        }
+
+        /* Write a whole frame, the buffer gets emptied at most once */
+        void put_frame(const std::vector<field_t>& fields)
+        {
+            for (const auto& f : fields) {
+                ::putbits(&bs, f.val, f.bits);
+            }
+            flush();
+        }
+
+        void close()
+        {
+            close_bit_stream_w(&bs);
+            collect();
+        }
+
+        std::vector<uint8_t> out;
+        Bit_stream_struc bs = {};
+
+    private:
+        void collect()
+        {
+            out.insert(out.end(), output.begin(), output.begin() + bs.output_buffer_written);
+            bs.output_buffer_written = 0;
+        }
+
+        std::vector<uint8_t> output;
+};
+
+std::vector<field_t> random_fields(size_t num_fields)
+{
+    std::vector<field_t> fields;
+    uint32_t noise = 1;
+    for (size_t i = 0; i < num_fields; i++) {
+        noise = noise * 1103515245 + 12345;
+        const int bits = 1 + (noise >> 16) % 32;
+        noise = noise * 1103515245 + 12345;
+        // The value may have more bits than written, they must be ignored
+        fields.push_back({noise ^ (noise << 13), bits});
+    }
+    return fields;
+}
+
+/* The fields of one Layer II frame of frame_bytes bytes: the header, then
+ * fields with the widths of bit allocations, scalefactors and samples */
+std::vector<field_t> frame_fields(size_t frame_bytes)
+{
+    std::vector<field_t> fields = {
+        {0xfff, 12}, {1, 1}, {2, 2}, {0, 1}, {10, 4}, {1, 2}, {0, 1},
+        {0, 1}, {1, 2}, {0, 2}, {0, 1}, {0, 1}, {0, 2}, {0x1234, 16}};
+    const int widths[] = {4, 4, 3, 2, 6, 6, 6, 5, 7, 3, 10, 4, 5, 6, 7, 8, 9, 12, 16};
+
+    int remaining = frame_bytes * 8 - 48;
+    uint32_t noise = 7;
+    for (size_t i = 0; remaining > 0; i++) {
+        noise = noise * 1103515245 + 12345;
+        const int bits = std::min(remaining, widths[i % std::size(widths)]);
+        fields.push_back({noise >> 8, bits});
+        remaining -= bits;
+    }
+    return fields;
+}
+
+} // namespace
+
+TEST(BitstreamTest, MatchesReferenceWriter)
+{
+    const auto fields = random_fields(20000);
+
+    ReferenceBitWriter ref;
+    for (const auto& f : fields) {
+        ref.putbits(f.val, f.bits);
+    }
+    ref.putbits(0, 7);
+
+    // A small buffer, so that words often straddle the point where the
+    // buffer gets emptied
+    for (int size : {64, 67, BUFFER_SIZE}) {
+        BitstreamWriter writer(size, MINIMUM);
+        for (const auto& f : fields) {
+            writer.putbits(f.val, f.bits);
+        }
+        writer.close();
+
+        EXPECT_EQ(writer.out, ref.out) << "Buffer size " << size;
+    }
+}
+
+TEST(BitstreamTest, FlushWritesCompleteBytes)
+{
+    BitstreamWriter writer(BUFFER_SIZE, MINIMUM);
+    writer.putbits(0xabc, 12);
+    EXPECT_EQ(writer.bs.buf_byte_idx, BUFFER_SIZE - 1);
+    EXPECT_EQ(writer.bs.totbit, 12);
+
+    writer.flush();
+    EXPECT_EQ(writer.bs.buf_byte_idx, BUFFER_SIZE - 2);
+    EXPECT_EQ(writer.bs.buf[BUFFER_SIZE - 1], 0xab);
+    EXPECT_EQ(writer.bs.acc_bits, 4);
+
+    writer.putbits(0xd, 4);
+    writer.flush();
+    EXPECT_EQ(writer.bs.buf[BUFFER_SIZE - 2], 0xcd);
+    EXPECT_EQ(writer.bs.acc_bits, 0);
+    writer.close();
+}
+
+TEST(BitstreamTest, Benchmark)
+{
+    const size_t num_frames = 20000;
+
+    for (int bitrate : {192, 256, 384}) {
+        // 24ms frames at 48kHz
+        const size_t frame_bytes = 144 * bitrate / 48;
+        const auto fields = frame_fields(frame_bytes);
+
+        const auto start_ref = std::chrono::steady_clock::now();
+        ReferenceBitWriter ref;
+        for (size_t i = 0; i < num_frames; i++) {
+            for (const auto& f : fields) {
+                ref.putbits(f.val, f.bits);
+            }
+        }
+        const std::chrono::duration<double> elapsed_ref =
+            std::chrono::steady_clock::now() - start_ref;
+
+        // The encoder keeps one frame in the buffer for the DAB ScF-CRC
+        const auto start = std::chrono::steady_clock::now();
+        BitstreamWriter writer(BUFFER_SIZE, frame_bytes + MINIMUM);
+        for (size_t i = 0; i < num_frames; i++) {
+            writer.put_frame(fields);
+        }
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        writer.close();
+
+        EXPECT_EQ(writer.out, ref.out);
+
+        const double realtime_factor = num_frames * 0.024 / elapsed.count();
+        printf("Bitstream packing %d kbps: bit by bit %.0f Mbit/s, "
+                "accumulator %.0f Mbit/s, %.0fx realtime\n",
+                bitrate,
+                num_frames * frame_bytes * 8 / elapsed_ref.count() / 1e6,
+                num_frames * frame_bytes * 8 / elapsed.count() / 1e6,
+                realtime_factor);
+        EXPECT_GT(realtime_factor, 100.0);
+    }
+}
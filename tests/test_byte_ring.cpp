@@ -0,0 +1,120 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * ------------------------------------------------------------------- */
+
+#include <gtest/gtest.h>
+#include "../src/ByteRing.h"
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+TEST(ByteRingTest, ChunksMatchWrittenData)
+{
+    // Sizes like the toolame output at 128kbps: writes of one MPEG frame,
+    // sometimes two, read in chunks of 384 bytes
+    const size_t chunk = 384;
+    ByteRing ring(4092 + 4 * chunk, chunk);
+    std::deque<uint8_t> expected;
+
+    uint32_t noise = 1;
+    uint8_t value = 0;
+    for (size_t i = 0; i < 10000; i++) {
+        noise = noise * 1103515245 + 12345;
+        const size_t len = (noise >> 16) % 800;
+        std::vector<uint8_t> data(len);
+        for (auto& d : data) {
+            d = value++;
+        }
+
+        ASSERT_TRUE(ring.write(data.data(), data.size()));
+        expected.insert(expected.end(), data.begin(), data.end());
+        ASSERT_EQ(ring.size(), expected.size());
+
+        while (ring.size() > chunk) {
+            const uint8_t *p = ring.read_ptr();
+            ASSERT_TRUE(std::equal(p, p + chunk, expected.begin())) << "iteration " << i;
+            ring.consume(chunk);
+            expected.erase(expected.begin(), expected.begin() + chunk);
+        }
+    }
+}
+
+TEST(ByteRingTest, ChunkAcrossEnd)
+{
+    ByteRing ring(10, 4);
+    const uint8_t a[] = {1, 2, 3, 4, 5, 6, 7, 8};
+    ASSERT_TRUE(ring.write(a, 8));
+    ring.consume(4);
+    ring.consume(4);
+
+    // Written to positions 8, 9, 0 and 1, read contiguously
+    const uint8_t b[] = {9, 10, 11, 12};
+    ASSERT_TRUE(ring.write(b, 4));
+    EXPECT_EQ(std::vector<uint8_t>(ring.read_ptr(), ring.read_ptr() + 4),
+            std::vector<uint8_t>(b, b + 4));
+}
+
+TEST(ByteRingTest, RejectsOverflow)
+{
+    ByteRing ring(10, 4);
+    const uint8_t a[11] = {};
+    EXPECT_FALSE(ring.write(a, 11));
+    EXPECT_TRUE(ring.write(a, 6));
+    EXPECT_FALSE(ring.write(a, 5));
+    EXPECT_EQ(ring.size(), 6u);
+    EXPECT_THROW(ring.consume(5), std::logic_error);
+
+    EXPECT_THROW(ByteRing(4, 5), std::invalid_argument);
+}
+
+TEST(ByteRingTest, Benchmark)
+{
+    // 48kHz MPEG frames at 384kbps, 20 minutes
+    const size_t frame_len = 3 * 384;
+    const size_t num_frames = 50000;
+    const std::vector<uint8_t> frame(frame_len, 0x55);
+
+    size_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> buffer;
+    buffer.reserve(4092 + frame_len);
+    for (size_t i = 0; i < num_frames; i++) {
+        buffer.insert(buffer.end(), frame.begin(), frame.end());
+        while (buffer.size() > frame_len) {
+            sum += buffer[i % frame_len];
+            buffer.erase(buffer.begin(), buffer.begin() + frame_len);
+        }
+    }
+    const std::chrono::duration<double> elapsed_erase =
+        std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    ByteRing ring(4092 + 4 * frame_len, frame_len);
+    for (size_t i = 0; i < num_frames; i++) {
+        ASSERT_TRUE(ring.write(frame.data(), frame.size()));
+        while (ring.size() > frame_len) {
+            sum += ring.read_ptr()[i % frame_len];
+            ring.consume(frame_len);
+        }
+    }
+    const std::chrono::duration<double> elapsed_ring =
+        std::chrono::steady_clock::now() - start;
+
+    printf("Chunking %zu byte frames: front erase %.0f ns, ring %.0f ns per frame (sum %zu)\n",
+            frame_len, elapsed_erase.count() / num_frames * 1e9,
+            elapsed_ring.count() / num_frames * 1e9, sum);
+}
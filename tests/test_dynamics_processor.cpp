@@ -0,0 +1,116 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * ------------------------------------------------------------------- */
+
+#include <gtest/gtest.h>
+#include "../src/DynamicsProcessor.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+constexpr unsigned SAMPLE_RATE = 48000;
+constexpr size_t FRAME_LEN = 1152;
+
+/* Run num_blocks blocks of a stereo 1kHz sine of given amplitude through
+ * the processor, return the largest output sample of the last block and
+ * the RMS level in dBFS of the last block */
+std::pair<int, double> run_sine(DynamicsProcessor& dyn, double amplitude,
+        size_t num_blocks)
+{
+    std::vector<int16_t> buf(2 * FRAME_LEN);
+    int peak = 0;
+    double sum_squares = 0.0;
+    for (size_t b = 0; b < num_blocks; b++) {
+        for (size_t i = 0; i < FRAME_LEN; i++) {
+            const double t = (double)(b * FRAME_LEN + i) / SAMPLE_RATE;
+            buf[2 * i] = buf[2 * i + 1] = lrint(amplitude * sin(2 * M_PI * 1000.0 * t));
+        }
+        dyn.process(buf.data(), FRAME_LEN);
+
+        peak = 0;
+        sum_squares = 0.0;
+        for (const int16_t s : buf) {
+            peak = std::max(peak, abs(s));
+            sum_squares += (double)s * s;
+        }
+    }
+    const double rms_dBFS = 10.0 * log10(sum_squares / buf.size() / (32768.0 * 32768.0));
+    return {peak, rms_dBFS};
+}
+
+} // namespace
+
+TEST(DynamicsProcessorTest, DelayIsAttackTime)
+{
+    DynamicsProcessor dyn(SAMPLE_RATE, 2, 1.0f, false, -20.0f, -1.0f);
+    EXPECT_EQ(dyn.delay_frames(),
+            DynamicsProcessor::LIMITER_ATTACK_MS * SAMPLE_RATE / 1000);
+}
+
+TEST(DynamicsProcessorTest, QuietSignalPassesUnchanged)
+{
+    // Without AGC and below the threshold, the limiter only delays
+    DynamicsProcessor dyn(SAMPLE_RATE, 2, 1.0f, false, -20.0f, -1.0f);
+    const size_t delay = dyn.delay_frames();
+
+    std::vector<int16_t> in(2 * FRAME_LEN), out;
+    for (size_t i = 0; i < FRAME_LEN; i++) {
+        in[2 * i] = lrint(10000.0 * sin(0.01 * i));
+        in[2 * i + 1] = -in[2 * i];
+    }
+    out = in;
+    dyn.process(out.data(), FRAME_LEN);
+
+    for (size_t i = delay; i < FRAME_LEN; i++) {
+        EXPECT_NEAR(out[2 * i], in[2 * (i - delay)], 1);
+        EXPECT_NEAR(out[2 * i + 1], in[2 * (i - delay) + 1], 1);
+    }
+    EXPECT_FLOAT_EQ(dyn.levels().limiter_reduction, 0.0f);
+}
+
+TEST(DynamicsProcessorTest, LimiterHoldsThreshold)
+{
+    // A static gain of +6dB on a sine at -3dBFS would clip, the limiter
+    // keeps it at -1dBFS
+    DynamicsProcessor dyn(SAMPLE_RATE, 2, 2.0f, false, -20.0f, -1.0f);
+    const auto result = run_sine(dyn, 23000.0, 20);
+
+    const int threshold = lrint(32768.0 * pow(10.0, -1.0 / 20.0));
+    EXPECT_LE(result.first, threshold + 1);
+    EXPECT_GT(result.first, threshold - 100);
+    EXPECT_NEAR(dyn.levels().limiter_reduction, 4.0, 0.5);
+}
+
+TEST(DynamicsProcessorTest, AgcReachesTarget)
+{
+    // A sine at -30 dBFS RMS gets raised to the -20 dBFS target within
+    // a few time constants
+    DynamicsProcessor dyn(SAMPLE_RATE, 2, 1.0f, true, -20.0f, -1.0f);
+    const double amplitude = 32768.0 * sqrt(2.0) * pow(10.0, -30.0 / 20.0);
+    const auto result = run_sine(dyn, amplitude, 20 * SAMPLE_RATE / FRAME_LEN);
+
+    EXPECT_NEAR(result.second, -20.0, 0.5);
+    EXPECT_NEAR(dyn.levels().agc_gain, 10.0, 0.5);
+}
+
+TEST(DynamicsProcessorTest, AgcIgnoresSilence)
+{
+    DynamicsProcessor dyn(SAMPLE_RATE, 2, 1.0f, true, -20.0f, -1.0f);
+    run_sine(dyn, 0.0, 100);
+    EXPECT_FLOAT_EQ(dyn.levels().agc_gain, 0.0f);
+}
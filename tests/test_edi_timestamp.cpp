@@ -0,0 +1,77 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+
+#include <gtest/gtest.h>
+#include "EDITimestamp.h"
+
+namespace {
+
+const std::time_t now = 1700000000;
+
+/* The offset of the first frame from now, in units of 1/16384 ms */
+int64_t offset(const edi_timestamp_t& t)
+{
+    return (int64_t)(t.seconds - now) * EDI_TIMESTAMP_UNITS_PER_S + t.timestamp;
+}
+
+int64_t ms(int64_t value)
+{
+    return value * EDI_TIMESTAMP_UNITS_PER_MS;
+}
+
+} // namespace
+
+TEST(EDITimestampTest, WholeSecondsDelay)
+{
+    const auto t = initial_edi_timestamp(now, 2000, 0);
+    EXPECT_EQ(t.seconds, now + 2);
+    EXPECT_EQ(t.timestamp, 0u);
+}
+
+TEST(EDITimestampTest, RoundsDelayUpToFrames)
+{
+    EXPECT_EQ(offset(initial_edi_timestamp(now, 1010, 0)), ms(1024));
+    EXPECT_EQ(offset(initial_edi_timestamp(now, 1048, 0)), ms(1048));
+
+    // 42 frames are longer than the 990ms, the timestamp stays below one second
+    const auto t = initial_edi_timestamp(now, 990, 0);
+    EXPECT_EQ(offset(t), ms(1008));
+    EXPECT_EQ(t.seconds, now + 1);
+    EXPECT_EQ(t.timestamp, ms(8));
+}
+
+TEST(EDITimestampTest, SubtractsProcessingDelayExactly)
+{
+    // The 5ms of the limiter look-ahead make the TIST 5ms earlier, it is
+    // not rounded to frames
+    const auto t = initial_edi_timestamp(now, 1000, 5);
+    EXPECT_EQ(offset(t), ms(995));
+    EXPECT_EQ(t.seconds, now);
+    EXPECT_EQ(t.timestamp, ms(995));
+
+    EXPECT_EQ(offset(initial_edi_timestamp(now, 1010, 5)), ms(1019));
+}
+
+TEST(EDITimestampTest, ProcessingDelayLongerThanDelay)
+{
+    const auto t = initial_edi_timestamp(now, 0, 5);
+    EXPECT_EQ(offset(t), -ms(5));
+    EXPECT_EQ(t.seconds, now - 1);
+    EXPECT_EQ(t.timestamp, ms(995));
+    EXPECT_LT(t.timestamp, EDI_TIMESTAMP_UNITS_PER_S);
+}
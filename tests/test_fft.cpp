@@ -0,0 +1,156 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * ------------------------------------------------------------------- */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "../libtoolame-dab/common.h"
+#include "../libtoolame-dab/fft.h"
+#include "../libtoolame-dab/utils.h"
+}
+
+namespace {
+
+std::vector<double> make_block(unsigned seed)
+{
+    std::vector<double> v(FFT_N);
+    uint32_t noise = seed;
+    for (size_t i = 0; i < FFT_N; i++) {
+        noise = noise * 1103515245 + 12345;
+        const double n = (int)((noise >> 16) & 0x7fff) / 16384.0 - 1.0;
+        v[i] = 0.5 * sin(0.05 * i * seed) + 0.2 * cos(1.3 * i) + 0.1 * n;
+    }
+    return v;
+}
+
+/* The SIMD variants this CPU can run, always including the scalar one */
+std::vector<int> available_variants()
+{
+    std::vector<int> variants = {SIMD_NONE};
+    const int best = simd_best();
+    if (best == SIMD_AVX) {
+        variants.push_back(SIMD_SSE2);
+    }
+    if (best != SIMD_NONE) {
+        variants.push_back(best);
+    }
+    return variants;
+}
+
+} // namespace
+
+TEST(FFTTest, MatchesDFT)
+{
+    fft_plan plan;
+    fft_init(&plan);
+
+    for (unsigned seed = 1; seed < 4; seed++) {
+        auto x = make_block(seed);
+        const auto x_copy = x;
+
+        for (int simd : available_variants()) {
+            plan.simd = simd;
+            double re[FFT_N / 2 + 1], im[FFT_N / 2 + 1];
+            fft_real(&plan, x.data(), re, im);
+            EXPECT_EQ(x, x_copy);
+
+            double max_error = 0.0;
+            for (size_t k = 0; k <= FFT_N / 2; k++) {
+                long double dft_re = 0.0, dft_im = 0.0;
+                for (size_t n = 0; n < FFT_N; n++) {
+                    const long double phase = -2.0L * M_PI * ((k * n) % FFT_N) / FFT_N;
+                    dft_re += x[n] * cosl(phase);
+                    dft_im += x[n] * sinl(phase);
+                }
+                max_error = std::max(max_error, (double)fabsl(re[k] - dft_re));
+                max_error = std::max(max_error, (double)fabsl(im[k] - dft_im));
+            }
+            EXPECT_LT(max_error, 1e-10) << "SIMD variant " << simd;
+        }
+    }
+}
+
+TEST(FFTTest, VariantsAreBitIdentical)
+{
+    fft_plan plan;
+    fft_init(&plan);
+    auto x = make_block(7);
+
+    double ref_energy[FFT_N], ref_phi[FFT_N];
+    plan.simd = SIMD_NONE;
+    psycho_2_fft(&plan, x.data(), ref_energy, ref_phi);
+
+    for (int simd : available_variants()) {
+        plan.simd = simd;
+        double energy[FFT_N], phi[FFT_N];
+        psycho_2_fft(&plan, x.data(), energy, phi);
+        EXPECT_EQ(memcmp(energy, ref_energy, (FFT_N / 2 + 1) * sizeof(double)), 0)
+            << "SIMD variant " << simd;
+        EXPECT_EQ(memcmp(phi + 1, ref_phi + 1, (FFT_N / 2) * sizeof(double)), 0)
+            << "SIMD variant " << simd;
+    }
+}
+
+TEST(FFTTest, EnergyOfSine)
+{
+    fft_plan plan;
+    fft_init(&plan);
+
+    // A sine on bin 100 with amplitude 1 has an energy of (N/2)^2 there
+    std::vector<double> x(FFT_N);
+    for (size_t i = 0; i < FFT_N; i++) {
+        x[i] = sin(2 * M_PI * 100 * i / FFT_N);
+    }
+
+    double energy[FFT_N];
+    psycho_1_fft(&plan, x.data(), energy);
+    EXPECT_NEAR(energy[100], (FFT_N / 2.0) * (FFT_N / 2.0), 1e-6);
+    EXPECT_LT(energy[99], 1e-12);
+    EXPECT_LT(energy[101], 1e-12);
+}
+
+TEST(FFTTest, Benchmark)
+{
+    fft_plan plan;
+    fft_init(&plan);
+    auto x = make_block(3);
+    const char *names[] = {"scalar", "SSE2", "AVX", "NEON"};
+
+    const size_t iterations = 100000;
+    for (int simd : available_variants()) {
+        plan.simd = simd;
+        double energy[FFT_N];
+        double sum = 0.0;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            x[i % FFT_N] += 1e-9;
+            psycho_1_fft(&plan, x.data(), energy);
+            sum += energy[1];
+        }
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        printf("FFT %d %s: %.2f us per transform\n",
+                FFT_N, names[simd], elapsed.count() / iterations * 1e6);
+        EXPECT_TRUE(std::isfinite(sum));
+    }
+}
@@ -0,0 +1,281 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+
+#include <gtest/gtest.h>
+#include "edioutput/FragmentScheduler.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+
+using namespace edi;
+using namespace std::chrono;
+using clock_type = FragmentScheduler::clock;
+
+namespace {
+
+/* Fragments whose first byte identifies them */
+struct fragments_t {
+    std::vector<PFTFragment> storage;
+    std::vector<PFTFragmentRef> refs;
+
+    fragments_t(size_t num_fragments, uint8_t first_id, size_t len = 100)
+    {
+        for (size_t i = 0; i < num_fragments; i++) {
+            storage.emplace_back(len, (uint8_t)(first_id + i));
+        }
+        for (const auto& frag : storage) {
+            refs.push_back({frag.data(), frag.size()});
+        }
+    }
+};
+
+/* Records what the scheduler sends, and when */
+struct recorder_t {
+    std::mutex mutex;
+    std::vector<uint8_t> ids;
+    std::vector<clock_type::time_point> times;
+    std::vector<size_t> batch_sizes;
+    std::atomic<size_t> num_sent = {0};
+
+    FragmentScheduler::send_function_t function()
+    {
+        return [this](const std::vector<const PFTFragment*>& frags) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto frag : frags) {
+                times.push_back(clock_type::now());
+                ids.push_back(frag->at(0));
+            }
+            batch_sizes.push_back(frags.size());
+            num_sent += frags.size();
+        };
+    }
+
+    bool wait_for(size_t num_fragments, milliseconds timeout = milliseconds(2000))
+    {
+        const auto deadline = clock_type::now() + timeout;
+        while (num_sent < num_fragments and clock_type::now() < deadline) {
+            std::this_thread::sleep_for(milliseconds(1));
+        }
+        return num_sent >= num_fragments;
+    }
+};
+
+size_t histogram_total(const FragmentScheduler::stats_t& stats)
+{
+    size_t total = 0;
+    for (auto count : stats.jitter_histogram) {
+        total += count;
+    }
+    return total;
+}
+
+} // namespace
+
+TEST(FragmentSchedulerTest, SendsAllFragmentsInOrder)
+{
+    recorder_t recorder;
+    FragmentScheduler scheduler(recorder.function());
+
+    // Two AF packets, the second one after the first
+    const auto start = clock_type::now();
+    fragments_t a(10, 0), b(10, 10);
+    EXPECT_EQ(scheduler.schedule(a.refs, start, milliseconds(2)), 0u);
+    EXPECT_EQ(scheduler.schedule(b.refs, start + milliseconds(2), milliseconds(2)), 0u);
+    ASSERT_TRUE(recorder.wait_for(20));
+
+    std::lock_guard<std::mutex> lock(recorder.mutex);
+    for (size_t i = 0; i < 20; i++) {
+        EXPECT_EQ(recorder.ids[i], i);
+    }
+}
+
+TEST(FragmentSchedulerTest, SendsDueFragmentsTogether)
+{
+    recorder_t recorder;
+    FragmentScheduler scheduler(recorder.function());
+
+    // Without spreading, all fragments of an AF packet are due at once
+    fragments_t frags(10, 0);
+    scheduler.schedule(frags.refs, clock_type::now() + milliseconds(5), microseconds(0));
+    ASSERT_TRUE(recorder.wait_for(10));
+
+    std::lock_guard<std::mutex> lock(recorder.mutex);
+    ASSERT_EQ(recorder.batch_sizes.size(), 1u);
+    EXPECT_EQ(recorder.batch_sizes[0], 10u);
+    for (size_t i = 0; i < 10; i++) {
+        EXPECT_EQ(recorder.ids[i], i);
+    }
+}
+
+TEST(FragmentSchedulerTest, SendsAtPlannedTimes)
+{
+    recorder_t recorder;
+    FragmentScheduler scheduler(recorder.function());
+
+    // 0.95 of an AF packet duration over 7 fragments is not a whole number
+    // of microseconds per fragment
+    const auto spread = microseconds(22800);
+    fragments_t frags(7, 0);
+    const auto start = clock_type::now() + milliseconds(5);
+    scheduler.schedule(frags.refs, start, spread);
+    ASSERT_TRUE(recorder.wait_for(7));
+
+    std::lock_guard<std::mutex> lock(recorder.mutex);
+    for (size_t i = 0; i < 7; i++) {
+        const auto planned = start + microseconds(llrint(22800.0 * i / 7));
+        EXPECT_GE(recorder.times[i], planned) << "fragment " << i;
+        // Generous, the test may run on a loaded machine
+        EXPECT_LT(recorder.times[i], planned + milliseconds(20)) << "fragment " << i;
+    }
+}
+
+TEST(FragmentSchedulerTest, InterleavesOverlappingPackets)
+{
+    recorder_t recorder;
+    FragmentScheduler scheduler(recorder.function());
+
+    // With a spreading factor above 1, the fragments of the next AF packet
+    // start before those of the previous one are all sent
+    const auto start = clock_type::now() + milliseconds(5);
+    fragments_t a(4, 0), b(4, 10);
+    scheduler.schedule(a.refs, start, milliseconds(40));
+    scheduler.schedule(b.refs, start + milliseconds(5), milliseconds(40));
+    ASSERT_TRUE(recorder.wait_for(8));
+
+    std::lock_guard<std::mutex> lock(recorder.mutex);
+    const std::vector<uint8_t> expected = {0, 10, 1, 11, 2, 12, 3, 13};
+    EXPECT_EQ(recorder.ids, expected);
+}
+
+TEST(FragmentSchedulerTest, DropsWhenHandoffIsFull)
+{
+    std::promise<void> release;
+    std::shared_future<void> released(release.get_future());
+    std::atomic<bool> blocked = {false};
+    std::atomic<size_t> num_sent = {0};
+
+    FragmentScheduler scheduler([&](const std::vector<const PFTFragment*>& frags) {
+                blocked = true;
+                released.wait();
+                num_sent += frags.size();
+            }, 16);
+
+    // Keep the scheduler thread busy sending the first fragment
+    fragments_t first(1, 0);
+    scheduler.schedule(first.refs, clock_type::now(), microseconds(1));
+    while (not blocked) {
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+
+    fragments_t more(20, 1);
+    EXPECT_EQ(scheduler.schedule(more.refs, clock_type::now(), microseconds(20)), 4u);
+
+    release.set_value();
+    const auto deadline = clock_type::now() + seconds(2);
+    while (num_sent < 17 and clock_type::now() < deadline) {
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+    EXPECT_EQ(num_sent, 17u);
+
+    const auto stats = scheduler.collect_stats();
+    EXPECT_EQ(stats.num_dropped, 4u);
+    EXPECT_EQ(stats.num_sent, 17u);
+}
+
+TEST(FragmentSchedulerTest, StatsAreCollectedOnce)
+{
+    recorder_t recorder;
+    FragmentScheduler scheduler(recorder.function());
+
+    fragments_t frags(12, 0);
+    scheduler.schedule(frags.refs, clock_type::now(), milliseconds(3));
+    ASSERT_TRUE(recorder.wait_for(12));
+
+    // The stats are updated after the send function returns
+    std::this_thread::sleep_for(milliseconds(10));
+    const auto stats = scheduler.collect_stats();
+    EXPECT_EQ(stats.num_sent, 12u);
+    EXPECT_EQ(histogram_total(stats), 12u);
+    EXPECT_EQ(stats.num_dropped, 0u);
+
+    const auto again = scheduler.collect_stats();
+    EXPECT_EQ(again.num_sent, 0u);
+    EXPECT_EQ(histogram_total(again), 0u);
+}
+
+TEST(FragmentSchedulerTest, Benchmark)
+{
+    std::atomic<size_t> num_sent = {0};
+    FragmentScheduler scheduler([&](const std::vector<const PFTFragment*>& frags) {
+                num_sent += frags.size();
+            });
+
+    // One second of AF packets of 22 fragments, spread with the default
+    // factor of 0.95
+    const size_t num_packets = 42;
+    const size_t num_fragments = 22;
+    fragments_t frags(num_fragments, 0, 700);
+
+    struct rusage usage_start;
+    getrusage(RUSAGE_SELF, &usage_start);
+    const auto start = clock_type::now();
+
+    for (size_t i = 0; i < num_packets; i++) {
+        std::this_thread::sleep_until(start + microseconds(24000 * i));
+        scheduler.schedule(frags.refs, clock_type::now(), microseconds(22800));
+    }
+    while (num_sent < num_packets * num_fragments) {
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+
+    const duration<double> elapsed = clock_type::now() - start;
+    struct rusage usage_end;
+    getrusage(RUSAGE_SELF, &usage_end);
+    const double cpu_s =
+        (usage_end.ru_utime.tv_sec - usage_start.ru_utime.tv_sec) +
+        (usage_end.ru_stime.tv_sec - usage_start.ru_stime.tv_sec) +
+        1e-6 * ((usage_end.ru_utime.tv_usec - usage_start.ru_utime.tv_usec) +
+                (usage_end.ru_stime.tv_usec - usage_start.ru_stime.tv_usec));
+
+    std::this_thread::sleep_for(milliseconds(10));
+    const auto stats = scheduler.collect_stats();
+    EXPECT_EQ(stats.num_sent, num_packets * num_fragments);
+
+    printf("Scheduler: %zu fragments in %.2f s, CPU %.1f%%, max jitter %ld us\n",
+            stats.num_sent, elapsed.count(), 100.0 * cpu_s / elapsed.count(),
+            (long)duration_cast<microseconds>(stats.max_jitter).count());
+    printf("Jitter histogram:");
+    for (size_t i = 0; i < stats.jitter_histogram.size(); i++) {
+        if (stats.jitter_histogram[i] == 0) {
+            continue;
+        }
+        if (i + 1 < stats.jitter_histogram.size()) {
+            printf(" <%ldus: %zu", 1L << i, stats.jitter_histogram[i]);
+        }
+        else {
+            printf(" >=%ldus: %zu", 1L << (i - 1), stats.jitter_histogram[i]);
+        }
+    }
+    printf("\n");
+}
@@ -0,0 +1,373 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+
+#include <gtest/gtest.h>
+#include "FrameRing.h"
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace {
+
+struct frame_t {
+    size_t seq = 0;
+    bool end_of_stream = false;
+    int retval = 0;
+};
+
+const auto POLL_TIMEOUT = milliseconds(10);
+
+/* Three stages connected by two rings, that work like the stages of the
+ * encoder pipeline: the input produces num_frames frames and then an
+ * end-of-stream frame carrying eos_retval. */
+class pipeline_t {
+    public:
+        size_t num_frames = 100;
+        int eos_retval = 0;
+        // The stage throws or fails on this frame
+        size_t encode_throws_at = SIZE_MAX;
+        size_t output_fails_at = SIZE_MAX;
+        int output_fail_retval = 0;
+
+        std::vector<size_t> output;
+
+        int run()
+        {
+            control.start();
+
+            std::thread input_thread(&pipeline_t::input_stage, this);
+            std::thread encode_thread(&pipeline_t::encode_stage, this);
+            std::thread output_thread(&pipeline_t::output_stage, this);
+
+            output_thread.join();
+            encode_thread.join();
+            input_thread.join();
+
+            return control.result();
+        }
+
+    private:
+        void input_stage()
+        {
+            try {
+                size_t seq = 0;
+                while (control.running()) {
+                    frame_t *frame = in_ring.wait_write_slot(POLL_TIMEOUT);
+                    if (frame == nullptr) {
+                        continue;
+                    }
+
+                    frame->seq = seq++;
+                    frame->end_of_stream = frame->seq == num_frames;
+                    frame->retval = frame->end_of_stream ? eos_retval : 0;
+                    in_ring.commit_write();
+
+                    if (frame->end_of_stream) {
+                        return;
+                    }
+                }
+            }
+            catch (...) {
+                control.stop(std::current_exception());
+            }
+        }
+
+        void encode_stage()
+        {
+            try {
+                while (control.running()) {
+                    frame_t *in = in_ring.wait_read_slot(POLL_TIMEOUT);
+                    if (in == nullptr) {
+                        continue;
+                    }
+
+                    frame_t *out = nullptr;
+                    while (out == nullptr and control.running()) {
+                        out = out_ring.wait_write_slot(POLL_TIMEOUT);
+                    }
+                    if (out == nullptr) {
+                        return;
+                    }
+
+                    if (in->seq == encode_throws_at) {
+                        throw std::runtime_error("encoder failed");
+                    }
+
+                    *out = *in;
+                    in_ring.commit_read();
+                    out_ring.commit_write();
+
+                    if (out->end_of_stream) {
+                        return;
+                    }
+                }
+            }
+            catch (...) {
+                control.stop(std::current_exception());
+            }
+        }
+
+        void output_stage()
+        {
+            try {
+                while (control.running()) {
+                    frame_t *frame = out_ring.wait_read_slot(POLL_TIMEOUT);
+                    if (frame == nullptr) {
+                        continue;
+                    }
+
+                    if (frame->end_of_stream) {
+                        control.stop(frame->retval);
+                        return;
+                    }
+
+                    if (frame->seq == output_fails_at) {
+                        control.stop(output_fail_retval);
+                        return;
+                    }
+
+                    output.push_back(frame->seq);
+                    out_ring.commit_read();
+                }
+            }
+            catch (...) {
+                control.stop(std::current_exception());
+            }
+        }
+
+        FrameRing<frame_t> in_ring = FrameRing<frame_t>(8);
+        FrameRing<frame_t> out_ring = FrameRing<frame_t>(8);
+        PipelineControl control;
+};
+
+} // namespace
+
+TEST(FrameRingTest, RejectsInvalidCapacity)
+{
+    EXPECT_THROW(FrameRing<frame_t>(0), std::invalid_argument);
+    EXPECT_THROW(FrameRing<frame_t>(6), std::invalid_argument);
+    EXPECT_NO_THROW(FrameRing<frame_t>(1));
+}
+
+TEST(FrameRingTest, FullAndEmpty)
+{
+    FrameRing<frame_t> ring(4);
+    EXPECT_EQ(ring.capacity(), 4u);
+    EXPECT_EQ(ring.read_slot(), nullptr);
+
+    for (size_t i = 0; i < 4; i++) {
+        frame_t *slot = ring.write_slot();
+        ASSERT_NE(slot, nullptr);
+        slot->seq = i;
+        ring.commit_write();
+        EXPECT_EQ(ring.size(), i + 1);
+    }
+    EXPECT_EQ(ring.write_slot(), nullptr);
+
+    ASSERT_NE(ring.read_slot(), nullptr);
+    EXPECT_EQ(ring.read_slot()->seq, 0u);
+    ring.commit_read();
+    EXPECT_NE(ring.write_slot(), nullptr);
+    EXPECT_EQ(ring.size(), 3u);
+}
+
+TEST(FrameRingTest, WrapsAround)
+{
+    // The slots are reused in place, the indices keep growing
+    FrameRing<frame_t> ring(4);
+    size_t next_write = 0;
+    size_t next_read = 0;
+    for (size_t round = 0; round < 100; round++) {
+        for (size_t i = 0; i < 3; i++) {
+            frame_t *slot = ring.write_slot();
+            ASSERT_NE(slot, nullptr);
+            slot->seq = next_write++;
+            ring.commit_write();
+        }
+
+        for (size_t i = 0; i < 3; i++) {
+            frame_t *slot = ring.read_slot();
+            ASSERT_NE(slot, nullptr);
+            EXPECT_EQ(slot->seq, next_read++);
+            ring.commit_read();
+        }
+        EXPECT_EQ(ring.size(), 0u);
+    }
+}
+
+TEST(FrameRingTest, WaitTimesOut)
+{
+    FrameRing<frame_t> ring(2);
+
+    auto t = steady_clock::now();
+    EXPECT_EQ(ring.wait_read_slot(milliseconds(30)), nullptr);
+    EXPECT_GE(steady_clock::now() - t, milliseconds(30));
+
+    ring.commit_write();
+    ring.commit_write();
+
+    t = steady_clock::now();
+    EXPECT_EQ(ring.wait_write_slot(milliseconds(30)), nullptr);
+    EXPECT_GE(steady_clock::now() - t, milliseconds(30));
+}
+
+TEST(FrameRingTest, WaitWakesOnCommit)
+{
+    FrameRing<frame_t> ring(2);
+
+    std::thread producer([&]() {
+            std::this_thread::sleep_for(milliseconds(20));
+            ring.write_slot()->seq = 42;
+            ring.commit_write();
+        });
+
+    auto t = steady_clock::now();
+    frame_t *frame = ring.wait_read_slot(milliseconds(5000));
+    producer.join();
+    ASSERT_NE(frame, nullptr);
+    EXPECT_EQ(frame->seq, 42u);
+    EXPECT_LT(steady_clock::now() - t, milliseconds(1000));
+
+    // Now full, the producer waits until the consumer releases a slot
+    ring.commit_write();
+    std::thread consumer([&]() {
+            std::this_thread::sleep_for(milliseconds(20));
+            ring.commit_read();
+        });
+
+    t = steady_clock::now();
+    EXPECT_NE(ring.wait_write_slot(milliseconds(5000)), nullptr);
+    consumer.join();
+    EXPECT_LT(steady_clock::now() - t, milliseconds(1000));
+}
+
+TEST(FrameRingTest, TwoThreadsKeepOrder)
+{
+    FrameRing<frame_t> ring(8);
+    const size_t num_frames = 200000;
+
+    std::thread producer([&]() {
+            for (size_t i = 0; i < num_frames; i++) {
+                frame_t *slot = nullptr;
+                while (slot == nullptr) {
+                    slot = ring.wait_write_slot(milliseconds(100));
+                }
+                slot->seq = i;
+                ring.commit_write();
+            }
+        });
+
+    size_t num_errors = 0;
+    for (size_t i = 0; i < num_frames; i++) {
+        frame_t *slot = nullptr;
+        while (slot == nullptr) {
+            slot = ring.wait_read_slot(milliseconds(100));
+        }
+        if (slot->seq != i) {
+            num_errors++;
+        }
+        ring.commit_read();
+    }
+    producer.join();
+
+    EXPECT_EQ(num_errors, 0u);
+    EXPECT_EQ(ring.size(), 0u);
+}
+
+TEST(FrameRingTest, PipelineControlFirstStopWins)
+{
+    PipelineControl control;
+    EXPECT_FALSE(control.running());
+
+    control.start();
+    EXPECT_TRUE(control.running());
+    control.stop(3);
+    control.stop(5);
+    control.stop(std::make_exception_ptr(std::runtime_error("late")));
+    EXPECT_FALSE(control.running());
+    EXPECT_EQ(control.result(), 3);
+
+    // A new start forgets the previous result
+    control.start();
+    control.stop(std::make_exception_ptr(std::runtime_error("failed")));
+    control.stop(7);
+    EXPECT_THROW(control.result(), std::runtime_error);
+
+    control.start();
+    control.stop(0);
+    EXPECT_EQ(control.result(), 0);
+}
+
+TEST(FrameRingTest, PipelineEndOfStreamCarriesRetval)
+{
+    for (const int retval : {0, 5}) {
+        pipeline_t pipeline;
+        pipeline.num_frames = 1000;
+        pipeline.eos_retval = retval;
+        EXPECT_EQ(pipeline.run(), retval);
+
+        // All frames before the end of stream went through, in order
+        ASSERT_EQ(pipeline.output.size(), pipeline.num_frames);
+        for (size_t i = 0; i < pipeline.output.size(); i++) {
+            EXPECT_EQ(pipeline.output[i], i);
+        }
+    }
+}
+
+TEST(FrameRingTest, PipelineRethrowsStageException)
+{
+    pipeline_t pipeline;
+    pipeline.num_frames = 1000;
+    pipeline.encode_throws_at = 50;
+    EXPECT_THROW(pipeline.run(), std::runtime_error);
+
+    // The frames before the failing one might have been written
+    EXPECT_LE(pipeline.output.size(), 50u);
+}
+
+TEST(FrameRingTest, PipelineStopsOnOutputFailure)
+{
+    // The input and encoder stages are blocked on full rings when the
+    // output stops, they must still terminate
+    pipeline_t pipeline;
+    pipeline.num_frames = 1000;
+    pipeline.output_fails_at = 10;
+    pipeline.output_fail_retval = 4;
+
+    const auto t = steady_clock::now();
+    EXPECT_EQ(pipeline.run(), 4);
+    EXPECT_LT(steady_clock::now() - t, milliseconds(2000));
+    EXPECT_EQ(pipeline.output.size(), 10u);
+}
+
+TEST(FrameRingTest, Benchmark)
+{
+    pipeline_t pipeline;
+    pipeline.num_frames = 500000;
+
+    const auto t = steady_clock::now();
+    EXPECT_EQ(pipeline.run(), 0);
+    const duration<double> elapsed = steady_clock::now() - t;
+
+    printf("Three stage pipeline: %.3f us per frame\n",
+            elapsed.count() * 1e6 / pipeline.num_frames);
+}
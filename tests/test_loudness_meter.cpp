@@ -0,0 +1,136 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * ------------------------------------------------------------------- */
+
+#include <gtest/gtest.h>
+#include "../src/LoudnessMeter.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+constexpr unsigned SAMPLE_RATE = 48000;
+
+/* Interleaved stereo sine of given level in dBFS and phase in radians */
+std::vector<int16_t> make_sine(double freq, double level_dbfs, double phase,
+        size_t num_frames)
+{
+    const double amplitude = 32768.0 * pow(10.0, level_dbfs / 20.0);
+    std::vector<int16_t> v(2 * num_frames);
+    for (size_t i = 0; i < num_frames; i++) {
+        const double s = amplitude * sin(2 * M_PI * freq * i / SAMPLE_RATE + phase);
+        v[2 * i] = v[2 * i + 1] = lrint(s);
+    }
+    return v;
+}
+
+} // namespace
+
+TEST(LoudnessMeterTest, SilenceIsUnavailable)
+{
+    LoudnessMeter meter(SAMPLE_RATE, 2);
+    std::vector<int16_t> silence(2 * SAMPLE_RATE * 4);
+    meter.process(silence.data(), SAMPLE_RATE * 4);
+
+    const auto levels = meter.take_levels();
+    EXPECT_TRUE(std::isinf(levels.momentary));
+    EXPECT_TRUE(std::isinf(levels.short_term));
+    EXPECT_TRUE(std::isinf(levels.integrated));
+    EXPECT_TRUE(std::isinf(levels.true_peak));
+    EXPECT_FLOAT_EQ(levels.range, 0.0f);
+}
+
+TEST(LoudnessMeterTest, EbuTech3341SineAtMinus23)
+{
+    // EBU Tech 3341 test case 1: 1kHz stereo sine at -23 dBFS reads
+    // -23.0 LUFS on all meters, with a tolerance of 0.1 LU
+    LoudnessMeter meter(SAMPLE_RATE, 2);
+    const size_t frames = SAMPLE_RATE * 20;
+    const auto sine = make_sine(1000.0, -23.0, 0.0, frames);
+
+    // Feed in irregular pieces, like the encoder does
+    for (size_t pos = 0; pos < frames; ) {
+        const size_t n = std::min<size_t>(1337, frames - pos);
+        meter.process(sine.data() + 2 * pos, n);
+        pos += n;
+    }
+
+    const auto levels = meter.take_levels();
+    EXPECT_NEAR(levels.momentary, -23.0, 0.1);
+    EXPECT_NEAR(levels.short_term, -23.0, 0.1);
+    EXPECT_NEAR(levels.integrated, -23.0, 0.1);
+    EXPECT_NEAR(levels.range, 0.0, 0.2);
+}
+
+TEST(LoudnessMeterTest, LoudnessRangeOfTwoLevels)
+{
+    // EBU Tech 3342 test case 1: 20s at -20 dBFS followed by 20s at
+    // -30 dBFS give a loudness range of 10 LU
+    LoudnessMeter meter(SAMPLE_RATE, 2);
+    const size_t frames = SAMPLE_RATE * 20;
+    const auto loud = make_sine(1000.0, -20.0, 0.0, frames);
+    const auto quiet = make_sine(1000.0, -30.0, 0.0, frames);
+    meter.process(loud.data(), frames);
+    meter.process(quiet.data(), frames);
+
+    EXPECT_NEAR(meter.take_levels().range, 10.0, 1.0);
+}
+
+TEST(LoudnessMeterTest, TruePeakBetweenSamples)
+{
+    // A sine at fs/4 with 45 degrees phase has all its samples at
+    // 1/sqrt(2) of its amplitude. The sample peak underestimates the true
+    // peak by 3dB.
+    LoudnessMeter meter(SAMPLE_RATE, 2);
+    const size_t frames = SAMPLE_RATE;
+    const auto sine = make_sine(SAMPLE_RATE / 4.0, -6.0, M_PI / 4, frames);
+    meter.process(sine.data(), frames);
+
+    auto levels = meter.take_levels();
+    EXPECT_NEAR(levels.true_peak, -6.0, 0.5);
+
+    // The true peak is reset by take_levels(). The first call after the
+    // sine still sees its end in the interpolation filter.
+    std::vector<int16_t> silence(2 * frames);
+    meter.process(silence.data(), frames);
+    meter.take_levels();
+    meter.process(silence.data(), frames);
+    levels = meter.take_levels();
+    EXPECT_TRUE(std::isinf(levels.true_peak));
+}
+
+TEST(LoudnessMeterTest, ProcessingCost)
+{
+    LoudnessMeter meter(SAMPLE_RATE, 2);
+    const size_t frames = SAMPLE_RATE * 10;
+    const auto sine = make_sine(997.0, -12.0, 0.0, frames);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t pos = 0; pos < frames; pos += 1152) {
+        meter.process(sine.data() + 2 * pos, std::min<size_t>(1152, frames - pos));
+        meter.take_levels();
+    }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    // Express the cost as a fraction of real time
+    const double load = elapsed.count() / 10.0;
+    printf("LoudnessMeter: %.1f ms for 10s of stereo audio, %.2f%% of real time\n",
+            elapsed.count() * 1000.0, load * 100.0);
+    EXPECT_LT(load, 0.05);
+}
@@ -0,0 +1,281 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+
+#include <gtest/gtest.h>
+#include "edioutput/PFT.h"
+#include "ReedSolomon.h"
+#include "crc.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace edi;
+
+namespace {
+
+std::vector<uint8_t> make_data(size_t len, unsigned seed)
+{
+    std::vector<uint8_t> data(len);
+    uint32_t noise = seed;
+    for (auto& b : data) {
+        noise = noise * 1103515245 + 12345;
+        b = noise >> 16;
+    }
+    return data;
+}
+
+#define CEIL_DIV(a, b) (a % b == 0  ? a / b : a / b + 1)
+
+/* The PFT layer as it was before the packet arena: protect every chunk with
+ * the ReedSolomon class into an RS block, interleave it into fragments, and
+ * prepend the PF headers */
+class ReferencePFT {
+    public:
+        ReferencePFT(unsigned fec) : m_m(fec) { }
+
+        std::vector<std::vector<uint8_t>> assemble(const AFPacket& af_packet)
+        {
+            std::vector<std::vector<uint8_t>> fragments;
+            size_t chunk_len = 0;
+            size_t zero_pad = 0;
+
+            if (m_m > 0) {
+                const size_t num_chunks = CEIL_DIV(af_packet.size(), 207);
+                chunk_len = CEIL_DIV(af_packet.size(), num_chunks);
+                zero_pad = num_chunks * chunk_len - af_packet.size();
+
+                std::vector<uint8_t> rs_block;
+                for (size_t i = 0; i < num_chunks * chunk_len; i += chunk_len) {
+                    uint8_t chunk[207] = {};
+                    uint8_t protection[48];
+                    const size_t len = i < af_packet.size() ?
+                        std::min(chunk_len, af_packet.size() - i) : 0;
+                    memcpy(chunk, af_packet.data() + i, len);
+                    m_rs.encode(chunk, protection, 207);
+                    rs_block.insert(rs_block.end(), chunk, chunk + chunk_len);
+                    rs_block.insert(rs_block.end(), protection, protection + 48);
+                }
+
+                const size_t max_payload_size = (num_chunks * 48) / (m_m + 1);
+                const size_t num_fragments = CEIL_DIV(rs_block.size(), max_payload_size);
+                const size_t fragment_size = CEIL_DIV(rs_block.size(), num_fragments);
+
+                fragments.resize(num_fragments);
+                for (size_t i = 0; i < num_fragments; i++) {
+                    for (size_t j = 0; j < fragment_size; j++) {
+                        const size_t ix = j * num_fragments + i;
+                        fragments[i].push_back(ix < rs_block.size() ? rs_block[ix] : 0);
+                    }
+                }
+            }
+            else {
+                const size_t num_fragments = CEIL_DIV(af_packet.size(), 1400);
+                const size_t fragment_size = CEIL_DIV(af_packet.size(), num_fragments);
+                fragments.resize(num_fragments);
+                for (size_t i = 0; i < num_fragments; i++) {
+                    const size_t begin = std::min(i * fragment_size, af_packet.size());
+                    const size_t end = std::min(begin + fragment_size, af_packet.size());
+                    fragments[i].assign(af_packet.begin() + begin, af_packet.begin() + end);
+                }
+            }
+
+            const size_t fcount = fragments.size();
+            std::vector<std::vector<uint8_t>> packets(fcount);
+            for (size_t findex = 0; findex < fcount; findex++) {
+                auto& packet = packets[findex];
+                const unsigned plen = fragments[findex].size() | (m_m > 0 ? 0x8000 : 0);
+                packet = {'P', 'F',
+                    (uint8_t)(m_pseq >> 8), (uint8_t)m_pseq,
+                    (uint8_t)(findex >> 16), (uint8_t)(findex >> 8), (uint8_t)findex,
+                    (uint8_t)(fcount >> 16), (uint8_t)(fcount >> 8), (uint8_t)fcount,
+                    (uint8_t)(plen >> 8), (uint8_t)plen};
+                if (m_m > 0) {
+                    packet.push_back(chunk_len);
+                    packet.push_back(zero_pad);
+                }
+                const uint16_t crc = crc16(0xffff, packet.data(), packet.size()) ^ 0xffff;
+                packet.push_back(crc >> 8);
+                packet.push_back(crc & 0xff);
+                packet.insert(packet.end(), fragments[findex].begin(), fragments[findex].end());
+            }
+
+            m_pseq++;
+            return packets;
+        }
+
+    private:
+        unsigned m_m;
+        uint16_t m_pseq = 0;
+        ReedSolomon m_rs{255, 207, false, 0x11d, 1};
+};
+
+configuration_t make_config(unsigned fec)
+{
+    configuration_t conf;
+    conf.enable_pft = true;
+    conf.fec = fec;
+    return conf;
+}
+
+/* The variants this CPU can run, always including the scalar one */
+std::vector<PFTReedSolomon::variant_t> available_variants()
+{
+    using variant_t = PFTReedSolomon::variant_t;
+    std::vector<variant_t> variants = {variant_t::scalar};
+    if (PFTReedSolomon::best_variant() != variant_t::scalar) {
+        variants.push_back(PFTReedSolomon::best_variant());
+    }
+    return variants;
+}
+
+const char *variant_name(PFTReedSolomon::variant_t variant)
+{
+    switch (variant) {
+        case PFTReedSolomon::variant_t::scalar: return "scalar";
+        case PFTReedSolomon::variant_t::ssse3: return "SSSE3";
+        case PFTReedSolomon::variant_t::neon: return "NEON";
+    }
+    return "";
+}
+
+} // namespace
+
+TEST(PFTTest, ReedSolomonMatchesReferenceEncoder)
+{
+    ReedSolomon reference(255, 207, false, 0x11d, 1);
+
+    for (auto variant : available_variants()) {
+        const PFTReedSolomon rs(variant);
+
+        for (size_t chunk_len : {1, 2, 47, 100, 173, 206, 207}) {
+            // Up to nine chunks, to use every kernel width
+            for (size_t num_chunks = 1; num_chunks <= 9; num_chunks++) {
+                const size_t stride = chunk_len + PFTReedSolomon::NUM_PARITY;
+                auto rs_block = make_data(num_chunks * stride, chunk_len + num_chunks);
+
+                auto expected = rs_block;
+                for (size_t c = 0; c < num_chunks; c++) {
+                    uint8_t chunk[207] = {};
+                    memcpy(chunk, &expected[c * stride], chunk_len);
+                    reference.encode(chunk, &expected[c * stride + chunk_len], 207);
+                }
+
+                rs.encode(rs_block.data(), num_chunks, chunk_len);
+                ASSERT_EQ(rs_block, expected) << variant_name(variant) <<
+                    " chunk_len " << chunk_len << " num_chunks " << num_chunks;
+            }
+        }
+    }
+}
+
+TEST(PFTTest, AssembleMatchesReference)
+{
+    for (unsigned fec = 0; fec <= 5; fec++) {
+        PFT pft(make_config(fec));
+        ReferencePFT reference(fec);
+
+        // Sizes around chunk and fragment boundaries, and AF packets larger
+        // than one MTU
+        for (size_t len = 8; len < 3200; len += 41) {
+            const auto af_packet = make_data(len, len + fec);
+            const auto expected = reference.assemble(af_packet);
+            const auto& fragments = pft.Assemble(af_packet);
+
+            ASSERT_EQ(fragments.size(), expected.size()) << "fec " << fec << " len " << len;
+            for (size_t i = 0; i < fragments.size(); i++) {
+                const std::vector<uint8_t> fragment(
+                        fragments[i].data, fragments[i].data + fragments[i].size);
+                ASSERT_EQ(fragment, expected[i]) <<
+                    "fec " << fec << " len " << len << " fragment " << i;
+            }
+        }
+    }
+}
+
+TEST(PFTTest, FragmentsStayValidUntilNextAssemble)
+{
+    PFT pft(make_config(2));
+    ReferencePFT reference(2);
+
+    const auto large = make_data(2000, 1);
+    const auto small = make_data(300, 2);
+    reference.assemble(large);
+    pft.Assemble(large);
+
+    // The arena is large enough already, the fragments must be in it
+    const auto& fragments = pft.Assemble(small);
+    const auto expected = reference.assemble(small);
+    ASSERT_EQ(fragments.size(), expected.size());
+    for (size_t i = 0; i < fragments.size(); i++) {
+        EXPECT_EQ(std::vector<uint8_t>(fragments[i].data,
+                    fragments[i].data + fragments[i].size), expected[i]);
+    }
+}
+
+TEST(PFTTest, Benchmark)
+{
+    const size_t num_packets = 20000;
+
+    // Reed-Solomon alone, with as many chunks as a 96 kbps subchannel
+    for (auto variant : available_variants()) {
+        const PFTReedSolomon rs(variant);
+        const size_t num_chunks = 2;
+        auto rs_block = make_data(num_chunks * 255, 1);
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < num_packets; i++) {
+            rs_block[i % 207]++;
+            rs.encode(rs_block.data(), num_chunks, 207);
+        }
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        printf("RS(255, 207) %s: %.2f us per chunk\n", variant_name(variant),
+                elapsed.count() / (num_packets * num_chunks) * 1e6);
+    }
+
+    // AF packets of a 64 kbps and of a 192 kbps DAB+ subchannel
+    for (size_t len : {250, 640}) {
+        const auto af_packet = make_data(len, 1);
+
+        for (unsigned fec = 0; fec <= 5; fec++) {
+            ReferencePFT reference(fec);
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < num_packets / 10; i++) {
+                reference.assemble(af_packet);
+            }
+            const std::chrono::duration<double> elapsed_ref =
+                std::chrono::steady_clock::now() - start;
+
+            PFT pft(make_config(fec));
+            size_t num_fragments = 0;
+            start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < num_packets; i++) {
+                num_fragments = pft.Assemble(af_packet).size();
+            }
+            const std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+
+            const double us_ref = elapsed_ref.count() / (num_packets / 10) * 1e6;
+            const double us = elapsed.count() / num_packets * 1e6;
+            printf("PFT %zu bytes fec %u, %zu fragments: reference %.2f us, "
+                    "arena %.2f us per AF packet (%.0f MB/s)\n",
+                    len, fec, num_fragments, us_ref, us, len / us);
+        }
+    }
+}
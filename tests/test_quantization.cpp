@@ -0,0 +1,213 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * ------------------------------------------------------------------- */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "../libtoolame-dab/common.h"
+#include "../libtoolame-dab/options.h"
+#include "../libtoolame-dab/encode_new.h"
+#include "../libtoolame-dab/utils.h"
+extern double scalefactor[64];
+}
+
+namespace {
+
+typedef double SBS[2][SBLIMIT][SB_FRAME_SAMPLES];
+typedef double JSBS[SBLIMIT][SB_FRAME_SAMPLES];
+typedef unsigned int SUB[2][SBLIMIT][SB_FRAME_SAMPLES];
+
+/* Subband samples with a different level in each group, and some samples
+ * exactly on a scalefactor or negative zero, the edge cases of the
+ * scalefactor search and of the quantizer */
+void make_samples(unsigned seed, SBS& sb_sample)
+{
+    uint32_t noise = seed;
+    for (int ch = 0; ch < 2; ch++) {
+        for (int sb = 0; sb < SBLIMIT; sb++) {
+            for (int i = 0; i < SB_FRAME_SAMPLES; i++) {
+                noise = noise * 1103515245 + 12345;
+                const double n = (int)((noise >> 16) & 0x7fff) / 16384.0 - 1.0;
+                const double level = scalefactor[(sb * 2 + i / SCALE_BLOCK * 5 + ch) % 60];
+                double x = level * n;
+                if ((noise & 0x1f) == 0) {
+                    x = (noise & 0x20) ? level : -level;
+                }
+                else if ((noise & 0x1f) == 1) {
+                    x = -0.0;
+                }
+                sb_sample[ch][sb][i] = x;
+            }
+        }
+    }
+}
+
+/* The scalefactor search as it was done before the samples of a subband
+ * were contiguous */
+void reference_scalefactors(const SBS& sb_sample, unsigned int sf_index[2][3][SBLIMIT])
+{
+    for (int ch = 0; ch < 2; ch++) {
+        for (int gr = 0; gr < 3; gr++) {
+            for (int sb = 0; sb < SBLIMIT; sb++) {
+                double cur_max = fabs(sb_sample[ch][sb][gr * SCALE_BLOCK + SCALE_BLOCK - 1]);
+                for (int j = SCALE_BLOCK - 1; j--;) {
+                    const double temp = fabs(sb_sample[ch][sb][gr * SCALE_BLOCK + j]);
+                    if (temp > cur_max) {
+                        cur_max = temp;
+                    }
+                }
+                unsigned int scale_fac = 32;
+                for (unsigned int l = 16; l; l >>= 1) {
+                    if (cur_max <= scalefactor[scale_fac]) {
+                        scale_fac += l;
+                    }
+                    else {
+                        scale_fac -= l;
+                    }
+                }
+                if (cur_max > scalefactor[scale_fac]) {
+                    scale_fac--;
+                }
+                sf_index[ch][gr][sb] = scale_fac;
+            }
+        }
+    }
+}
+
+/* The SIMD variants this CPU can run, always including the scalar one */
+std::vector<int> available_variants()
+{
+    std::vector<int> variants = {SIMD_NONE};
+    const int best = simd_best();
+    if (best == SIMD_AVX) {
+        variants.push_back(SIMD_SSE2);
+    }
+    if (best != SIMD_NONE) {
+        variants.push_back(best);
+    }
+    return variants;
+}
+
+/* A joint stereo frame using table 0, with every allocation of every
+ * subband in turn */
+struct test_frame_t {
+    test_frame_t(int offset)
+    {
+        frame.header = &header;
+        frame.nch = 2;
+        frame.tab_num = 0;
+        frame.sblimit = 27;
+        frame.jsbound = 16;
+        for (int ch = 0; ch < 2; ch++) {
+            for (int sb = 0; sb < SBLIMIT; sb++) {
+                // Tables have 2, 3 or 4 bits of allocation per subband
+                const int nbal = sb < 11 ? 4 : (sb < 23 ? 3 : 2);
+                bit_alloc[ch][sb] = (sb + ch + offset) % (1 << nbal);
+            }
+        }
+    }
+
+    frame_header header = {};
+    frame_info frame = {};
+    unsigned int bit_alloc[2][SBLIMIT];
+};
+
+/* Compute the scalefactors and quantize one frame with the given variant */
+void quantize(int simd, SBS& sb_sample, const test_frame_t& t, SUB& sbband)
+{
+    static JSBS j_sample;
+    unsigned int sf_index[2][3][SBLIMIT];
+    unsigned int j_scale[3][SBLIMIT];
+
+    test_frame_t frame = t;
+    frame.frame.header = &frame.header;
+
+    scalefactor_calc_new(sb_sample, sf_index, 2, frame.frame.sblimit, simd);
+    combine_LR_new(sb_sample, j_sample, frame.frame.sblimit);
+    scalefactor_calc_new(&j_sample, &j_scale, 1, frame.frame.sblimit, simd);
+    memset(sbband, 0, sizeof(SUB));
+    subband_quantization_new(sf_index, sb_sample, j_scale, j_sample,
+            frame.bit_alloc, sbband, &frame.frame, simd);
+}
+
+} // namespace
+
+TEST(QuantizationTest, ScalefactorsMatchReference)
+{
+    static SBS sb_sample;
+    for (unsigned seed = 1; seed < 20; seed++) {
+        make_samples(seed, sb_sample);
+
+        unsigned int expected[2][3][SBLIMIT];
+        reference_scalefactors(sb_sample, expected);
+
+        for (int simd : available_variants()) {
+            unsigned int sf_index[2][3][SBLIMIT];
+            scalefactor_calc_new(sb_sample, sf_index, 2, SBLIMIT, simd);
+            EXPECT_EQ(memcmp(sf_index, expected, sizeof(expected)), 0)
+                << "SIMD variant " << simd << " seed " << seed;
+        }
+    }
+}
+
+TEST(QuantizationTest, VariantsAreBitIdentical)
+{
+    static SBS sb_sample;
+    static SUB expected, sbband;
+
+    for (int offset = 0; offset < 16; offset++) {
+        make_samples(offset + 1, sb_sample);
+        const test_frame_t frame(offset);
+        quantize(SIMD_NONE, sb_sample, frame, expected);
+
+        for (int simd : available_variants()) {
+            quantize(simd, sb_sample, frame, sbband);
+            EXPECT_EQ(memcmp(sbband, expected, sizeof(SUB)), 0)
+                << "SIMD variant " << simd << " offset " << offset;
+        }
+    }
+}
+
+TEST(QuantizationTest, Benchmark)
+{
+    static SBS sb_sample;
+    static SUB sbband;
+    const char *names[] = {"scalar", "SSE2", "AVX", "NEON"};
+    make_samples(3, sb_sample);
+    const test_frame_t frame(5);
+
+    const size_t num_frames = 20000;
+    for (int simd : available_variants()) {
+        unsigned int sum = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < num_frames; i++) {
+            quantize(simd, sb_sample, frame, sbband);
+            sum += sbband[0][0][i % SB_FRAME_SAMPLES];
+        }
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        printf("Scalefactors and quantization %s: %.2f us per stereo frame (sum %u)\n",
+                names[simd], elapsed.count() / num_frames * 1e6, sum);
+        EXPECT_LT(elapsed.count() / num_frames, 0.024);
+    }
+}
@@ -0,0 +1,121 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * ------------------------------------------------------------------- */
+
+#include <gtest/gtest.h>
+#include "../src/Resampler.h"
+#include "../src/DriftController.h"
+#include <cmath>
+#include <vector>
+
+namespace {
+
+constexpr double SAMPLE_RATE = 48000.0;
+constexpr size_t FRAME_LEN = 1920;
+
+/* Interleaved stereo sine, the right channel with inverted sign */
+std::vector<int16_t> make_sine(double freq, size_t offset, size_t num_frames)
+{
+    std::vector<int16_t> v(2 * num_frames);
+    for (size_t i = 0; i < num_frames; i++) {
+        const double s = 16000.0 * sin(2 * M_PI * freq * (offset + i) / SAMPLE_RATE);
+        v[2 * i] = lrint(s);
+        v[2 * i + 1] = -lrint(s);
+    }
+    return v;
+}
+
+/* Run the resampler over several frames, and return the output */
+std::vector<int16_t> resample(double freq, double ratio, size_t num_frames)
+{
+    Resampler resampler(2, FRAME_LEN, 1.01);
+    std::vector<int16_t> out(2 * FRAME_LEN * num_frames);
+
+    size_t consumed = 0;
+    for (size_t f = 0; f < num_frames; f++) {
+        const size_t needed = resampler.input_frames_needed(FRAME_LEN, ratio);
+        EXPECT_LE(needed, Resampler::max_input_frames_needed(FRAME_LEN, 1.01));
+        const auto in = make_sine(freq, consumed, needed);
+        resampler.push_input(in.data(), needed);
+        consumed += needed;
+        resampler.process(out.data() + 2 * FRAME_LEN * f, FRAME_LEN, ratio);
+    }
+    return out;
+}
+
+} // namespace
+
+TEST(ResamplerTest, UnityRatioPreservesSignal)
+{
+    const double freq = 1000.0;
+    const auto out = resample(freq, 1.0, 4);
+
+    // The first output sample is centered on the first input sample
+    const auto expected = make_sine(freq, 0, out.size() / 2);
+
+    // Skip the beginning, where the filter still sees the initial silence
+    double max_error = 0;
+    for (size_t i = 2 * Resampler::TAPS; i < out.size(); i++) {
+        max_error = std::max(max_error, fabs((double)out[i] - expected[i]));
+    }
+    EXPECT_LT(max_error, 20.0);
+}
+
+TEST(ResamplerTest, RatioShiftsFrequency)
+{
+    // Consuming the input 0.5% faster raises the frequency by 0.5%
+    const double freq = 1000.0;
+    const double ratio = 1.005;
+    const auto out = resample(freq, ratio, 4);
+
+    const auto expected = make_sine(freq * ratio, 0, out.size() / 2);
+
+    // Skip the beginning, where the filter still sees the initial silence
+    double max_error = 0;
+    for (size_t i = 2 * Resampler::TAPS; i < out.size(); i++) {
+        max_error = std::max(max_error, fabs((double)out[i] - expected[i]));
+    }
+    EXPECT_LT(max_error, 20.0);
+}
+
+TEST(DriftControllerTest, ConvergesToTargetLatency)
+{
+    // The input clock runs 500 ppm fast, and the queue starts empty
+    const double input_rate = SAMPLE_RATE * 1.0005;
+    const double target = 0.1;
+    const double dt = FRAME_LEN / SAMPLE_RATE;
+
+    DriftController controller(target);
+    double queue_level = 0.0; // in seconds
+
+    for (int i = 0; i < 20000; i++) {
+        const double ratio = controller.update(queue_level, dt);
+        queue_level += dt * input_rate / SAMPLE_RATE - dt * ratio;
+        queue_level = std::max(queue_level, 0.0);
+    }
+
+    EXPECT_NEAR(queue_level, target, 0.002);
+    EXPECT_NEAR(controller.ratio(), 1.0005, 1e-5);
+}
+
+TEST(DriftControllerTest, RatioIsLimited)
+{
+    DriftController controller(0.1, 0.01);
+    EXPECT_DOUBLE_EQ(controller.update(10.0, 0.04), 1.01);
+
+    DriftController controller2(0.1, 0.01);
+    EXPECT_DOUBLE_EQ(controller2.update(0.0, 0.04), 0.99);
+}
@@ -0,0 +1,352 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * ------------------------------------------------------------------- */
+
+#include <gtest/gtest.h>
+#include "../src/SampleQueue.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iterator>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace {
+
+constexpr unsigned int BPS = 2;
+constexpr unsigned int CHANNELS = 2;
+constexpr size_t SAMPLE_SIZE = BPS * CHANNELS;
+
+std::vector<uint8_t> make_ramp(size_t len, uint8_t start = 0)
+{
+    std::vector<uint8_t> v(len);
+    std::iota(v.begin(), v.end(), start);
+    return v;
+}
+
+/* The std::deque based queue SampleQueue used before it became a ring
+ * buffer, kept here as reference for the benchmark. */
+class DequeSampleQueue
+{
+public:
+    void configure(size_t max_size, bool push_block)
+    {
+        m_max_size = max_size;
+        m_push_block = push_block;
+    }
+
+    size_t push(const uint8_t *val, size_t len)
+    {
+        size_t new_size = 0;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_push_block) {
+                while (len) {
+                    const size_t available = m_max_size - m_queue.size();
+                    const size_t copy_len = std::min(available, len);
+                    if (copy_len > 0) {
+                        std::copy(val, val + copy_len, std::back_inserter(m_queue));
+                        len -= copy_len;
+                        val += copy_len;
+                    }
+                    else {
+                        m_pop_notification.wait_for(lock, milliseconds(100));
+                    }
+                }
+            }
+            else if (m_queue.size() < m_max_size) {
+                std::copy(val, val + len, std::back_inserter(m_queue));
+            }
+            new_size = m_queue.size();
+        }
+        m_push_notification.notify_all();
+        return new_size;
+    }
+
+    size_t pop_wait(uint8_t *buf, size_t len, int timeout_ms)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        const auto time_start = steady_clock::now();
+        do {
+            m_push_notification.wait_for(lock, milliseconds(10));
+            if (steady_clock::now() - time_start > milliseconds(timeout_ms)) {
+                break;
+            }
+        } while (m_queue.size() < len);
+
+        const size_t num_to_copy = std::min(m_queue.size(), len);
+        std::copy(m_queue.begin(), m_queue.begin() + num_to_copy, buf);
+        m_queue.erase(m_queue.begin(), m_queue.begin() + num_to_copy);
+        lock.unlock();
+        m_pop_notification.notify_all();
+        return num_to_copy;
+    }
+
+private:
+    std::deque<uint8_t> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_push_notification;
+    std::condition_variable m_pop_notification;
+    size_t m_max_size = 1;
+    bool m_push_block = true;
+};
+
+struct bench_result_t {
+    double throughput_mb_s = 0;
+    double push_p50_us = 0;
+    double push_p99_us = 0;
+    double push_max_us = 0;
+};
+
+/* Push JACK-sized chunks from one thread and pop_wait() encoder-sized
+ * frames from another, as the inputs and the encoder do. */
+template<typename Queue>
+bench_result_t run_benchmark(Queue& queue, size_t total_bytes)
+{
+    const size_t chunk_len = 256 * SAMPLE_SIZE;
+    const size_t frame_len = 960 * SAMPLE_SIZE;
+    const auto chunk = make_ramp(chunk_len);
+
+    std::vector<double> push_durations_us;
+    push_durations_us.reserve(total_bytes / chunk_len + 1);
+
+    const auto time_start = steady_clock::now();
+
+    std::thread producer([&]() {
+            for (size_t pushed = 0; pushed < total_bytes; pushed += chunk_len) {
+                const auto t = steady_clock::now();
+                queue.push(chunk.data(), chunk.size());
+                push_durations_us.push_back(
+                        duration<double, std::micro>(steady_clock::now() - t).count());
+            }
+        });
+
+    std::vector<uint8_t> frame(frame_len);
+    size_t popped = 0;
+    while (popped + frame_len <= total_bytes) {
+        popped += queue.pop_wait(frame.data(), frame_len, 1000);
+    }
+
+    producer.join();
+    const double elapsed_s = duration<double>(steady_clock::now() - time_start).count();
+
+    std::sort(push_durations_us.begin(), push_durations_us.end());
+    bench_result_t r;
+    r.throughput_mb_s = popped / elapsed_s / 1e6;
+    r.push_p50_us = push_durations_us[push_durations_us.size() / 2];
+    r.push_p99_us = push_durations_us[push_durations_us.size() * 99 / 100];
+    r.push_max_us = push_durations_us.back();
+    return r;
+}
+
+void print_result(const char *name, const bench_result_t& r)
+{
+    printf("%-12s throughput %8.1f MB/s, push latency p50 %6.2f us, p99 %6.2f us, max %8.2f us\n",
+            name, r.throughput_mb_s, r.push_p50_us, r.push_p99_us, r.push_max_us);
+}
+
+} // namespace
+
+TEST(SampleQueueTest, PushPopKeepsOrder)
+{
+    SampleQueue<uint8_t> queue(BPS);
+    queue.configure(1024, true, CHANNELS);
+
+    const auto data = make_ramp(400);
+    EXPECT_EQ(queue.push(data.data(), data.size()), 400u);
+    EXPECT_EQ(queue.size(), 400u);
+
+    std::vector<uint8_t> out(400);
+    size_t overruns = 0;
+    EXPECT_EQ(queue.pop(out.data(), out.size(), &overruns), 400u);
+    EXPECT_EQ(overruns, 0u);
+    EXPECT_EQ(out, data);
+    EXPECT_EQ(queue.size(), 0u);
+}
+
+TEST(SampleQueueTest, WrapsAround)
+{
+    SampleQueue<uint8_t> queue(BPS);
+    queue.configure(64, true, CHANNELS);
+
+    std::vector<uint8_t> out(48);
+    for (uint8_t i = 0; i < 20; i++) {
+        const auto data = make_ramp(48, i * 7);
+        queue.push(data.data(), data.size());
+        ASSERT_EQ(queue.pop(out.data(), out.size()), 48u);
+        ASSERT_EQ(out, data);
+    }
+}
+
+TEST(SampleQueueTest, ShortPopFillsZeros)
+{
+    SampleQueue<uint8_t> queue(BPS);
+    queue.configure(1024, false, CHANNELS);
+
+    const auto data = make_ramp(8, 1);
+    queue.push(data.data(), data.size());
+
+    std::vector<uint8_t> out(16, 0xFF);
+    size_t overruns = 0;
+    EXPECT_EQ(queue.pop(out.data(), out.size(), &overruns), 8u);
+    EXPECT_TRUE(std::equal(data.begin(), data.end(), out.begin()));
+    EXPECT_TRUE(std::all_of(out.begin() + 8, out.end(), [](uint8_t v) { return v == 0; }));
+    EXPECT_EQ(queue.size(), 0u);
+}
+
+TEST(SampleQueueTest, NonBlockingPushCountsOverruns)
+{
+    SampleQueue<uint8_t> queue(BPS);
+    queue.configure(16, false, CHANNELS);
+
+    const auto data = make_ramp(12);
+    queue.push(data.data(), data.size());
+    queue.push(data.data(), data.size()); // accepted, size was below max
+    queue.push(data.data(), data.size()); // rejected
+    queue.push(data.data(), data.size()); // rejected
+    EXPECT_EQ(queue.size(), 24u);
+
+    std::vector<uint8_t> out(24);
+    size_t overruns = 0;
+    queue.pop(out.data(), out.size(), &overruns);
+    EXPECT_EQ(overruns, 2u);
+
+    queue.pop(out.data(), out.size(), &overruns);
+    EXPECT_EQ(overruns, 0u);
+}
+
+TEST(SampleQueueTest, BlockingPushWaitsForPop)
+{
+    SampleQueue<uint8_t> queue(BPS);
+    queue.configure(16, true, CHANNELS);
+
+    const auto data = make_ramp(32);
+    std::atomic<bool> push_done(false);
+    std::thread producer([&]() {
+            queue.push(data.data(), data.size());
+            push_done = true;
+        });
+
+    std::this_thread::sleep_for(milliseconds(20));
+    EXPECT_FALSE(push_done);
+    EXPECT_EQ(queue.size(), 16u);
+
+    std::vector<uint8_t> out(32);
+    EXPECT_EQ(queue.pop_wait(out.data(), 16, 1000), 16u);
+    EXPECT_EQ(queue.pop_wait(out.data() + 16, 16, 1000), 16u);
+    producer.join();
+    EXPECT_TRUE(push_done);
+    EXPECT_EQ(out, data);
+}
+
+TEST(SampleQueueTest, PopWaitTimesOut)
+{
+    SampleQueue<uint8_t> queue(BPS);
+    queue.configure(1024, true, CHANNELS);
+
+    const auto data = make_ramp(8);
+    queue.push(data.data(), data.size());
+
+    std::vector<uint8_t> out(16);
+    const auto t = steady_clock::now();
+    EXPECT_EQ(queue.pop_wait(out.data(), out.size(), 50), 8u);
+    EXPECT_GE(steady_clock::now() - t, milliseconds(50));
+}
+
+TEST(SampleQueueTest, PopWaitWakesOncePerFrame)
+{
+    SampleQueue<uint8_t> queue(BPS);
+    queue.configure(4096, true, CHANNELS);
+
+    const size_t frame_len = 1024;
+    const auto chunk = make_ramp(64);
+    std::thread producer([&]() {
+            std::this_thread::sleep_for(milliseconds(20));
+            for (size_t pushed = 0; pushed < frame_len; pushed += chunk.size()) {
+                queue.push(chunk.data(), chunk.size());
+                std::this_thread::sleep_for(milliseconds(1));
+            }
+        });
+
+    std::vector<uint8_t> out(frame_len);
+    EXPECT_EQ(queue.pop_wait(out.data(), out.size(), 5000), frame_len);
+    producer.join();
+
+    // The producer wakes the consumer once, when the frame is complete.
+    // Allow for one spurious wakeup of the condition variable.
+    const auto stats = queue.collect_wait_stats();
+    EXPECT_EQ(stats.num_handovers, 1u);
+    EXPECT_GE(stats.num_wakeups, 1u);
+    EXPECT_LE(stats.num_wakeups, 2u);
+    EXPECT_LE(stats.handover_latency_max, stats.handover_latency_total);
+
+    EXPECT_EQ(queue.collect_wait_stats().num_wakeups, 0u);
+}
+
+TEST(SampleQueueTest, WatermarkCallbackOncePerFrame)
+{
+    SampleQueue<uint8_t> queue(BPS);
+    queue.configure(4096, true, CHANNELS);
+
+    size_t num_callbacks = 0;
+    size_t size_at_callback = 0;
+    queue.set_watermark_callback([&]() {
+            num_callbacks++;
+            size_at_callback = queue.size();
+        });
+
+    // Not armed, push() does not call it
+    const auto chunk = make_ramp(64);
+    queue.push(chunk.data(), chunk.size());
+    EXPECT_EQ(num_callbacks, 0u);
+
+    const size_t frame_len = 256;
+    EXPECT_FALSE(queue.notify_when_available(frame_len));
+    for (size_t i = 0; i < 6; i++) {
+        queue.push(chunk.data(), chunk.size());
+    }
+    EXPECT_EQ(num_callbacks, 1u);
+    EXPECT_EQ(size_at_callback, frame_len);
+
+    // Already available, nothing to wait for
+    EXPECT_TRUE(queue.notify_when_available(frame_len));
+    queue.push(chunk.data(), chunk.size());
+    EXPECT_EQ(num_callbacks, 1u);
+}
+
+TEST(SampleQueueTest, BenchmarkAgainstDequeQueue)
+{
+    const size_t total_bytes = 64 * 1024 * 1024;
+    const size_t max_size = 32 * 960 * SAMPLE_SIZE;
+
+    SampleQueue<uint8_t> ring(BPS);
+    ring.configure(max_size, true, CHANNELS);
+    const auto ring_result = run_benchmark(ring, total_bytes);
+
+    DequeSampleQueue deque_queue;
+    deque_queue.configure(max_size, true);
+    const auto deque_result = run_benchmark(deque_queue, total_bytes);
+
+    print_result("ring", ring_result);
+    print_result("deque", deque_result);
+
+    EXPECT_GT(ring_result.throughput_mb_s, 0.0);
+    EXPECT_GT(deque_result.throughput_mb_s, 0.0);
+}
@@ -0,0 +1,155 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * ------------------------------------------------------------------- */
+
+#include <gtest/gtest.h>
+#include "../src/SampleRateConverter.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+/* Interleaved stereo sine, the right channel with inverted sign */
+std::vector<int16_t> make_sine(double freq, double rate, double amplitude,
+        size_t num_frames)
+{
+    std::vector<int16_t> v(2 * num_frames);
+    for (size_t i = 0; i < num_frames; i++) {
+        const double s = amplitude * sin(2 * M_PI * freq * i / rate);
+        v[2 * i] = lrint(s);
+        v[2 * i + 1] = -lrint(s);
+    }
+    return v;
+}
+
+/* Convert the input in blocks of irregular size, and return the output */
+std::vector<int16_t> convert(unsigned in_rate, unsigned out_rate,
+        const std::vector<int16_t>& in)
+{
+    SampleRateConverter src(2, in_rate, out_rate);
+    std::vector<int16_t> out, block;
+
+    const size_t num_frames = in.size() / 2;
+    for (size_t pos = 0; pos < num_frames; ) {
+        const size_t n = std::min<size_t>(1000 + pos % 37, num_frames - pos);
+        src.process(in.data() + 2 * pos, n, block);
+        out.insert(out.end(), block.begin(), block.end());
+        pos += n;
+    }
+    return out;
+}
+
+/* Signal to noise ratio of a converted sine, in dB */
+double sine_snr(unsigned in_rate, unsigned out_rate, double freq)
+{
+    const double amplitude = 29000.0;
+    const auto in = make_sine(freq, in_rate, amplitude, in_rate);
+    const auto out = convert(in_rate, out_rate, in);
+
+    // The first output sample is centered on the first input sample. Skip
+    // the beginning and the end, where the filter sees silence.
+    double signal = 0.0, noise = 0.0;
+    const size_t skip = SampleRateConverter::TAPS * out_rate / in_rate + 1;
+    for (size_t i = skip; i + skip < out.size() / 2; i++) {
+        const double expected = amplitude * sin(2 * M_PI * freq * i / out_rate);
+        signal += expected * expected;
+        noise += (out[2 * i] - expected) * (out[2 * i] - expected);
+        noise += (out[2 * i + 1] + expected) * (out[2 * i + 1] + expected);
+    }
+    return 10.0 * log10(2 * signal / noise);
+}
+
+} // namespace
+
+TEST(SampleRateConverterTest, OutputLength)
+{
+    // Over one second, the output has the output rate, minus the filter
+    // delay which is kept in the history
+    const auto in = make_sine(1000.0, 44100, 10000.0, 44100);
+    const auto out = convert(44100, 48000, in);
+    EXPECT_NEAR(out.size() / 2, 48000, SampleRateConverter::TAPS);
+}
+
+TEST(SampleRateConverterTest, InputFramesNeeded)
+{
+    SampleRateConverter src(2, 44100, 48000);
+    std::vector<int16_t> out;
+    for (int i = 0; i < 50; i++) {
+        const size_t needed = src.input_frames_needed(1152);
+        const auto in = make_sine(1000.0, 44100, 10000.0, needed);
+        src.process(in.data(), needed, out);
+        EXPECT_EQ(out.size(), 2 * 1152u);
+    }
+}
+
+TEST(SampleRateConverterTest, Quality)
+{
+    const unsigned rates[][2] = {
+        {44100, 48000}, {48000, 44100}, {32000, 48000}, {48000, 32000},
+        {24000, 48000}, {48000, 24000}, {44100, 32000}, {44100, 24000} };
+
+    for (const auto& r : rates) {
+        // Up to 60% of the lower Nyquist frequency
+        const double max_freq = 0.3 * std::min(r[0], r[1]);
+        for (const double freq : {1000.0, max_freq}) {
+            const double snr = sine_snr(r[0], r[1], freq);
+            printf("SampleRateConverter %5u -> %5u, %5.0f Hz: SNR %.1f dB\n",
+                    r[0], r[1], freq, snr);
+            EXPECT_GT(snr, 80.0);
+        }
+    }
+}
+
+TEST(SampleRateConverterTest, DownsamplingRejectsAliases)
+{
+    // 20kHz is above the output Nyquist frequency, and must not fold back
+    // to 12kHz
+    const auto in = make_sine(20000.0, 48000, 29000.0, 48000);
+    const auto out = convert(48000, 32000, in);
+
+    double energy = 0.0;
+    const size_t skip = SampleRateConverter::TAPS;
+    for (size_t i = skip; i + skip < out.size(); i++) {
+        energy += (double)out[i] * out[i];
+    }
+    const double rms = sqrt(energy / (out.size() - 2 * skip));
+    const double rejection = 20.0 * log10(rms / (29000.0 / sqrt(2.0)));
+    printf("SampleRateConverter alias rejection: %.1f dB\n", rejection);
+    EXPECT_LT(rejection, -70.0);
+}
+
+TEST(SampleRateConverterTest, Benchmark)
+{
+    const unsigned in_rate = 44100, out_rate = 48000;
+    const size_t seconds = 20;
+    const auto in = make_sine(997.0, in_rate, 20000.0, in_rate * seconds);
+
+    SampleRateConverter src(2, in_rate, out_rate);
+    std::vector<int16_t> out;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t pos = 0; pos < in.size() / 2; pos += 1024) {
+        src.process(in.data() + 2 * pos, std::min<size_t>(1024, in.size() / 2 - pos), out);
+    }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    const double realtime_factor = seconds / elapsed.count();
+    printf("SampleRateConverter 44100 -> 48000 stereo: %.0fx realtime\n",
+            realtime_factor);
+    EXPECT_GT(realtime_factor, 20.0);
+}
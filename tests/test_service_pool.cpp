@@ -0,0 +1,443 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+
+#include <gtest/gtest.h>
+#include "ServicePool.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+using std::vector;
+using std::string;
+
+namespace {
+
+/* Always ready, terminates with retval after num_steps steps */
+class counting_service_t : public PoolService {
+    public:
+        counting_service_t(size_t num_steps, int retval = 0) :
+            m_num_steps(num_steps), m_retval(retval) {}
+
+        virtual void set_notify(std::function<void()>) override {}
+
+        virtual bool ready(steady_clock::time_point, steady_clock::time_point&) override
+        {
+            return true;
+        }
+
+        virtual bool step(int& retval) override
+        {
+            if (++m_steps_done == m_num_steps) {
+                retval = m_retval;
+                return false;
+            }
+            return true;
+        }
+
+        size_t steps_done() const { return m_steps_done; }
+
+    private:
+        size_t m_num_steps;
+        int m_retval;
+        std::atomic<size_t> m_steps_done = {0};
+};
+
+/* Always ready, appends its id to the log at every step */
+class recording_service_t : public PoolService {
+    public:
+        recording_service_t(int id, vector<int>& log, std::mutex& log_mutex) :
+            m_id(id), m_log(log), m_log_mutex(log_mutex) {}
+
+        virtual void set_notify(std::function<void()>) override {}
+
+        virtual bool ready(steady_clock::time_point, steady_clock::time_point&) override
+        {
+            return true;
+        }
+
+        virtual bool step(int& retval) override
+        {
+            std::lock_guard<std::mutex> lock(m_log_mutex);
+            m_log.push_back(m_id);
+            retval = 0;
+            return ++m_steps_done < num_steps;
+        }
+
+        static constexpr size_t num_steps = 100;
+
+    private:
+        int m_id;
+        vector<int>& m_log;
+        std::mutex& m_log_mutex;
+        size_t m_steps_done = 0;
+};
+
+/* Ready when a frame was delivered by another thread, which notifies the
+ * pool the way the SampleQueue watermark does */
+class input_service_t : public PoolService {
+    public:
+        virtual void set_notify(std::function<void()> notify) override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_notify = notify;
+        }
+
+        virtual bool ready(steady_clock::time_point, steady_clock::time_point&) override
+        {
+            return m_available.load() > 0;
+        }
+
+        virtual bool step(int& retval) override
+        {
+            m_available--;
+            retval = 0;
+            return ++m_steps_done < num_frames;
+        }
+
+        /* Input thread */
+        void deliver()
+        {
+            m_available++;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_notify) {
+                m_notify();
+            }
+        }
+
+        static constexpr size_t num_frames = 20;
+
+    private:
+        std::mutex m_mutex;
+        std::function<void()> m_notify;
+        std::atomic<size_t> m_available = {0};
+        size_t m_steps_done = 0;
+};
+
+/* Throttled like the drift compensation: ready once every period */
+class periodic_service_t : public PoolService {
+    public:
+        periodic_service_t(milliseconds period, size_t num_steps) :
+            m_period(period), m_num_steps(num_steps) {}
+
+        virtual void set_notify(std::function<void()>) override {}
+
+        virtual bool ready(steady_clock::time_point now,
+                steady_clock::time_point& wake_at) override
+        {
+            if (m_steps_done == 0) {
+                m_next = now;
+            }
+
+            if (now >= m_next) {
+                return true;
+            }
+            wake_at = m_next;
+            return false;
+        }
+
+        virtual bool step(int& retval) override
+        {
+            m_lateness_max = std::max(m_lateness_max, steady_clock::now() - m_next);
+            m_next += m_period;
+            retval = 0;
+            return ++m_steps_done < m_num_steps;
+        }
+
+        /* How much later than its period a step ran */
+        steady_clock::duration m_lateness_max = {};
+
+    private:
+        milliseconds m_period;
+        size_t m_num_steps;
+        size_t m_steps_done = 0;
+        steady_clock::time_point m_next;
+};
+
+/* Never ready, terminates once the flag is set and it was notified */
+class waiting_service_t : public PoolService {
+    public:
+        virtual void set_notify(std::function<void()> notify) override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_notify = notify;
+        }
+
+        virtual bool ready(steady_clock::time_point, steady_clock::time_point&) override
+        {
+            return m_stop.load();
+        }
+
+        virtual bool step(int& retval) override
+        {
+            retval = 0;
+            return false;
+        }
+
+        void stop()
+        {
+            m_stop = true;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_notify();
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::function<void()> m_notify;
+        std::atomic<bool> m_stop = {false};
+};
+
+/* Ready, but blocks inside step() for a while, like an input that reads
+ * from a device in encode_frame() */
+class blocking_service_t : public PoolService {
+    public:
+        blocking_service_t(milliseconds block_time, size_t num_steps) :
+            m_block_time(block_time), m_num_steps(num_steps) {}
+
+        virtual void set_notify(std::function<void()>) override {}
+
+        virtual bool ready(steady_clock::time_point, steady_clock::time_point&) override
+        {
+            return true;
+        }
+
+        virtual bool step(int& retval) override
+        {
+            if (m_in_step.exchange(true)) {
+                m_num_concurrent_steps++;
+            }
+            std::this_thread::sleep_for(m_block_time);
+            m_in_step = false;
+
+            retval = 0;
+            return ++m_steps_done < m_num_steps;
+        }
+
+        std::atomic<size_t> m_num_concurrent_steps = {0};
+
+    private:
+        milliseconds m_block_time;
+        size_t m_num_steps;
+        std::atomic<bool> m_in_step = {false};
+        size_t m_steps_done = 0;
+};
+
+} // namespace
+
+TEST(ServicePoolTest, RejectsZeroWorkers)
+{
+    EXPECT_THROW(ServicePool(0), std::invalid_argument);
+}
+
+TEST(ServicePoolTest, StepsAllServicesUntilTerminated)
+{
+    ServicePool pool(2);
+    vector<std::shared_ptr<counting_service_t>> services;
+    for (size_t i = 0; i < 5; i++) {
+        services.push_back(std::make_shared<counting_service_t>(100 + i));
+        pool.add_service("service" + std::to_string(i), services.back());
+    }
+
+    EXPECT_EQ(pool.run(), 0);
+
+    const auto stats = pool.stats();
+    ASSERT_EQ(stats.size(), services.size());
+    for (size_t i = 0; i < services.size(); i++) {
+        EXPECT_EQ(services[i]->steps_done(), 100 + i);
+        EXPECT_EQ(stats[i].name, "service" + std::to_string(i));
+        EXPECT_EQ(stats[i].num_steps, 100 + i);
+        EXPECT_EQ(stats[i].num_ready_checks, 100 + i);
+        EXPECT_EQ(stats[i].retval, 0);
+        EXPECT_GE(stats[i].step_time_max, stats[i].step_time_avg);
+    }
+}
+
+TEST(ServicePoolTest, ReturnsFirstFailure)
+{
+    ServicePool pool(1);
+    pool.add_service("ok", std::make_shared<counting_service_t>(10));
+    pool.add_service("failing", std::make_shared<counting_service_t>(3, 2));
+    pool.add_service("late", std::make_shared<counting_service_t>(20, 5));
+
+    EXPECT_EQ(pool.run(), 2);
+
+    const auto stats = pool.stats();
+    EXPECT_EQ(stats[0].retval, 0);
+    EXPECT_EQ(stats[1].retval, 2);
+    EXPECT_EQ(stats[2].retval, 5);
+}
+
+TEST(ServicePoolTest, SingleWorkerAlternatesBetweenServices)
+{
+    // Services that are always ready are stepped in turn, a service
+    // that is stepped goes behind the other ones
+    vector<int> log;
+    std::mutex log_mutex;
+
+    ServicePool pool(1);
+    for (int id = 0; id < 3; id++) {
+        pool.add_service("service" + std::to_string(id),
+                std::make_shared<recording_service_t>(id, log, log_mutex));
+    }
+
+    EXPECT_EQ(pool.run(), 0);
+
+    ASSERT_EQ(log.size(), 3 * recording_service_t::num_steps);
+    for (size_t i = 0; i < log.size(); i++) {
+        EXPECT_EQ(log[i], (int)(i % 3)) << "at step " << i;
+    }
+}
+
+TEST(ServicePoolTest, WakesServiceOnNotify)
+{
+    ServicePool pool(2);
+    auto service = std::make_shared<input_service_t>();
+    pool.add_service("input", service);
+
+    std::thread input([&]() {
+            for (size_t i = 0; i < input_service_t::num_frames; i++) {
+                std::this_thread::sleep_for(milliseconds(5));
+                service->deliver();
+            }
+        });
+
+    EXPECT_EQ(pool.run(), 0);
+    input.join();
+
+    // A pool polling the services would check them every few ms. The
+    // service is checked once when it is notified, and once after each
+    // step.
+    const auto stats = pool.stats();
+    EXPECT_EQ(stats[0].num_steps, input_service_t::num_frames);
+    EXPECT_LE(stats[0].num_ready_checks, 2 * input_service_t::num_frames + 1);
+}
+
+TEST(ServicePoolTest, WakesServiceAtDeadline)
+{
+    ServicePool pool(2);
+    const size_t num_steps = 10;
+    const auto period = milliseconds(5);
+    pool.add_service("periodic", std::make_shared<periodic_service_t>(period, num_steps));
+
+    const auto start = steady_clock::now();
+    EXPECT_EQ(pool.run(), 0);
+    const auto elapsed = steady_clock::now() - start;
+
+    EXPECT_GE(elapsed, period * (num_steps - 1));
+    EXPECT_LT(elapsed, period * (num_steps - 1) + milliseconds(40));
+
+    // Checked after each step, and once when its deadline expired
+    const auto stats = pool.stats();
+    EXPECT_EQ(stats[0].num_steps, num_steps);
+    EXPECT_LE(stats[0].num_ready_checks, 2 * num_steps);
+}
+
+TEST(ServicePoolTest, BlockingServiceOnlyTakesItsWorker)
+{
+    // While one worker is blocked inside the step() of a service, the
+    // other worker keeps stepping the remaining services, and the blocked
+    // service is never stepped twice at the same time
+    ServicePool pool(2);
+    auto blocking = std::make_shared<blocking_service_t>(milliseconds(50), 4);
+    auto periodic = std::make_shared<periodic_service_t>(milliseconds(2), 50);
+    pool.add_service("blocking", blocking);
+    pool.add_service("periodic", periodic);
+    pool.add_service("counting", std::make_shared<counting_service_t>(1000));
+
+    EXPECT_EQ(pool.run(), 0);
+
+    const auto stats = pool.stats();
+    EXPECT_EQ(stats[0].num_steps, 4u);
+    EXPECT_EQ(stats[1].num_steps, 50u);
+    EXPECT_EQ(stats[2].num_steps, 1000u);
+    EXPECT_EQ(blocking->m_num_concurrent_steps, 0u);
+
+    // The periodic service was not held up by the 50ms steps
+    EXPECT_LT(periodic->m_lateness_max, milliseconds(20));
+}
+
+TEST(ServicePoolTest, IdleServiceIsNotChecked)
+{
+    // While one service runs, the service waiting for its input is only
+    // checked at startup and when it is notified
+    ServicePool pool(1);
+    auto waiting = std::make_shared<waiting_service_t>();
+    auto periodic = std::make_shared<periodic_service_t>(milliseconds(2), 20);
+    pool.add_service("waiting", waiting);
+    pool.add_service("periodic", periodic);
+
+    std::thread stopper([&]() {
+            std::this_thread::sleep_for(milliseconds(60));
+            waiting->stop();
+        });
+
+    EXPECT_EQ(pool.run(), 0);
+    stopper.join();
+
+    const auto stats = pool.stats();
+    EXPECT_EQ(stats[0].num_ready_checks, 2u);
+    EXPECT_EQ(stats[1].num_steps, 20u);
+}
+
+TEST(ServicePoolTest, SplitServiceDefinition)
+{
+    EXPECT_EQ(split_service_definition("-b 96  -r 48000\t-o out.mp2"),
+            (vector<string>{"-b", "96", "-r", "48000", "-o", "out.mp2"}));
+    EXPECT_TRUE(split_service_definition("").empty());
+    EXPECT_TRUE(split_service_definition("   ").empty());
+
+    EXPECT_EQ(split_service_definition("-i \"my file.wav\" -o 'a b'"),
+            (vector<string>{"-i", "my file.wav", "-o", "a b"}));
+    EXPECT_EQ(split_service_definition("--dls=\"a\"'b' \"\""),
+            (vector<string>{"--dls=ab", ""}));
+
+    // A backslash escapes outside of single quotes only
+    EXPECT_EQ(split_service_definition("a\\ b \"c\\\"d\" 'e\\f'"),
+            (vector<string>{"a b", "c\"d", "e\\f"}));
+
+    EXPECT_THROW(split_service_definition("-i \"file"), std::runtime_error);
+    EXPECT_THROW(split_service_definition("-i 'file"), std::runtime_error);
+    EXPECT_THROW(split_service_definition("-i file\\"), std::runtime_error);
+}
+
+TEST(ServicePoolTest, Benchmark)
+{
+    // Overhead of the pool for many services that are always ready
+    const size_t num_services = 16;
+    const size_t num_steps = 20000;
+
+    ServicePool pool(4);
+    for (size_t i = 0; i < num_services; i++) {
+        pool.add_service("service" + std::to_string(i),
+                std::make_shared<counting_service_t>(num_steps));
+    }
+
+    const auto start = steady_clock::now();
+    EXPECT_EQ(pool.run(), 0);
+    const duration<double> elapsed = steady_clock::now() - start;
+
+    printf("Service pool: %.2f us per step with %zu services on 4 workers\n",
+            elapsed.count() * 1e6 / (num_services * num_steps), num_services);
+}
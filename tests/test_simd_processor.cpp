@@ -0,0 +1,149 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2024 StreamDAB Project
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * ------------------------------------------------------------------- */
+
+#include <gtest/gtest.h>
+#include "../src/security_utils.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#ifdef __x86_64__
+#  include <x86intrin.h>
+#endif
+
+using namespace StreamDAB;
+
+// Random samples over the full range, with a fixed seed so that failures
+// can be reproduced
+class SIMDProcessorTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        test_samples_.resize(1000);
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<int16_t> dis(-32768, 32767);
+
+        for (auto& sample : test_samples_) {
+            sample = dis(gen);
+        }
+    }
+
+    std::vector<int16_t> test_samples_;
+};
+
+// Straightforward reference for gain_and_levels_simd()
+static void reference_gain_and_levels(std::vector<int16_t>& samples, unsigned int channels,
+                                      float gain, SIMDProcessor::AudioLevels& levels) {
+    int peak[2] = {0, 0};
+    uint64_t sum_squares[2] = {0, 0};
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const size_t ch = (channels == 2) ? (i % 2) : 0;
+        int value = samples[i];
+        if (gain != 1.0f) {
+            value = lrintf(std::min(32767.0f, std::max(-32768.0f, value * gain)));
+            samples[i] = value;
+        }
+        peak[ch] = std::max(peak[ch], std::abs(value));
+        sum_squares[ch] += static_cast<int64_t>(value) * value;
+    }
+    for (size_t ch = 0; ch < 2; ++ch) {
+        const size_t src = (channels == 2) ? ch : 0;
+        levels.peak[ch] = std::min(peak[src], 32767);
+        levels.sum_squares[ch] = sum_squares[src];
+    }
+}
+
+TEST_F(SIMDProcessorTest, GainAndLevelsMatchesReference) {
+    for (unsigned int channels : {1u, 2u}) {
+        for (float gain : {1.0f, 0.5f, 1.41f, 4.0f}) {
+            // Odd number of frames, so that the scalar tail is used
+            const size_t num_frames = 333;
+            std::vector<int16_t> expected(test_samples_.begin(),
+                                          test_samples_.begin() + num_frames * channels);
+            std::vector<int16_t> actual = expected;
+
+            SIMDProcessor::AudioLevels expected_levels;
+            reference_gain_and_levels(expected, channels, gain, expected_levels);
+
+            SIMDProcessor::AudioLevels levels;
+            SIMDProcessor::gain_and_levels_simd(actual.data(), num_frames, channels, gain, levels, true);
+
+            EXPECT_EQ(actual, expected) << channels << " channels, gain " << gain;
+            for (size_t ch = 0; ch < 2; ++ch) {
+                EXPECT_EQ(levels.peak[ch], expected_levels.peak[ch]);
+                EXPECT_EQ(levels.sum_squares[ch], expected_levels.sum_squares[ch]);
+            }
+        }
+    }
+}
+
+TEST_F(SIMDProcessorTest, GainAndLevelsSeparatesChannels) {
+    // Left is loud and negative, right is quiet
+    std::vector<int16_t> samples;
+    for (int i = 0; i < 64; ++i) {
+        samples.push_back(-32768);
+        samples.push_back(100);
+    }
+
+    SIMDProcessor::AudioLevels levels;
+    SIMDProcessor::gain_and_levels_simd(samples.data(), 64, 2, 1.0f, levels, true);
+    EXPECT_EQ(levels.peak[0], 32767);
+    EXPECT_EQ(levels.peak[1], 100);
+    EXPECT_EQ(levels.sum_squares[0], 64ull * 32768 * 32768);
+    EXPECT_EQ(levels.sum_squares[1], 64ull * 100 * 100);
+
+    // Gain saturates instead of wrapping around
+    SIMDProcessor::gain_and_levels_simd(samples.data(), 64, 2, 1000.0f, levels);
+    EXPECT_EQ(samples[0], -32768);
+    EXPECT_EQ(samples[1], 32767);
+
+    // In mono, both channels report the same level
+    std::vector<int16_t> mono = {0, 10, -20, 30, -40, 5, 6, 7, 8};
+    SIMDProcessor::gain_and_levels_simd(mono.data(), mono.size(), 1, 1.0f, levels);
+    EXPECT_EQ(levels.peak[0], 40);
+    EXPECT_EQ(levels.peak[1], 40);
+}
+
+TEST_F(SIMDProcessorTest, GainAndLevelsBenchmark) {
+#ifdef __x86_64__
+    // One second of stereo audio at 48kHz
+    const size_t num_frames = 48000;
+    std::vector<int16_t> samples(num_frames * 2);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        samples[i] = test_samples_[i % test_samples_.size()] / 4;
+    }
+
+    for (float gain : {1.0f, 1.41f}) {
+        const int iterations = 200;
+        SIMDProcessor::AudioLevels levels;
+        const uint64_t start = __rdtsc();
+        for (int i = 0; i < iterations; ++i) {
+            SIMDProcessor::gain_and_levels_simd(samples.data(), num_frames, 2,
+                                                gain, levels, false);
+        }
+        const uint64_t cycles = __rdtsc() - start;
+        const double cycles_per_sample = static_cast<double>(cycles) / (iterations * samples.size());
+        printf("gain_and_levels_simd gain %.2f: %.3f cycles/sample (AVX2: %d)\n",
+               gain, cycles_per_sample, SIMDProcessor::has_avx2_support());
+        EXPECT_GT(cycles_per_sample, 0.0);
+    }
+#else
+    GTEST_SKIP() << "cycle counter only available on x86-64";
+#endif
+}
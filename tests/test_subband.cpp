@@ -0,0 +1,297 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * ------------------------------------------------------------------- */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "../libtoolame-dab/common.h"
+#include "../libtoolame-dab/subband.h"
+#include "../libtoolame-dab/utils.h"
+extern double enwindow[512];
+}
+
+namespace {
+
+/* The analysis filterbank as in the REFERENCECODE path of subband.c:
+ * window_subband() followed by filter_subband() */
+class ReferenceFilterbank {
+    public:
+        ReferenceFilterbank() { create_dct_matrix(m); }
+
+        void process(const short *samples, double s[SBLIMIT])
+        {
+            for (int i = 0; i < 32; i++) {
+                x[31 - i + off] = (double)samples[i] / SCALE;
+            }
+
+            double z[64];
+            for (int i = 0; i < 64; i++) {
+                double t = 0.0;
+                for (int k = 0; k < 8; k++) {
+                    t += x[(i + 64 * k + off) & (HAN_SIZE - 1)] * enwindow[i + 64 * k];
+                }
+                z[i] = t;
+            }
+            off = (off + 480) & (HAN_SIZE - 1);
+
+            double yprime[32];
+            yprime[0] = z[16];
+            for (int i = 1; i <= 16; i++) {
+                yprime[i] = z[i + 16] + z[16 - i];
+            }
+            for (int i = 17; i <= 31; i++) {
+                yprime[i] = z[i + 16] - z[80 - i];
+            }
+
+            for (int i = 15; i >= 0; i--) {
+                double s0 = 0.0, s1 = 0.0;
+                for (int j = 0; j < 32; j += 2) {
+                    s0 += m[i][j] * yprime[j];
+                    s1 += m[i][j + 1] * yprime[j + 1];
+                }
+                s[i] = s0 + s1;
+                s[31 - i] = s0 - s1;
+            }
+        }
+
+    private:
+        double x[HAN_SIZE] = {};
+        double m[16][32];
+        int off = 0;
+};
+
+std::vector<short> make_signal(size_t num_samples)
+{
+    std::vector<short> v(num_samples);
+    uint32_t noise = 1;
+    for (size_t i = 0; i < num_samples; i++) {
+        noise = noise * 1103515245 + 12345;
+        const double n = (int)((noise >> 16) & 0x7fff) - 16384;
+        v[i] = lrint(12000 * sin(0.013 * i) + 5000 * sin(1.9 * i) + 0.5 * n);
+    }
+    return v;
+}
+
+/* The SIMD variants this CPU can run, always including the scalar one */
+std::vector<int> available_variants()
+{
+    std::vector<int> variants = {SIMD_NONE};
+    const int best = simd_best();
+    if (best == SIMD_AVX) {
+        variants.push_back(SIMD_SSE2);
+    }
+    if (best != SIMD_NONE) {
+        variants.push_back(best);
+    }
+    return variants;
+}
+
+/* Run the filterbank on one channel with the given variant */
+std::vector<double> analyse(int simd, const std::vector<short>& signal)
+{
+    subband_mem smem;
+    subband_init(&smem);
+    smem.simd = simd;
+
+    std::vector<double> out(signal.size());
+    for (size_t pos = 0; pos + 32 <= signal.size(); pos += 32) {
+        WindowFilterSubband(&smem, const_cast<short*>(&signal[pos]), 0, &out[pos]);
+    }
+    return out;
+}
+
+} // namespace
+
+TEST(SubbandTest, MatchesReferenceCode)
+{
+    const auto signal = make_signal(32 * 2000);
+
+    ReferenceFilterbank ref;
+    std::vector<double> expected(signal.size());
+    for (size_t pos = 0; pos < signal.size(); pos += 32) {
+        ref.process(&signal[pos], &expected[pos]);
+    }
+
+    for (int simd : available_variants()) {
+        const auto out = analyse(simd, signal);
+        double max_error = 0.0;
+        for (size_t i = 0; i < out.size(); i++) {
+            max_error = std::max(max_error, fabs(out[i] - expected[i]));
+        }
+        EXPECT_LT(max_error, 1e-12) << "SIMD variant " << simd;
+    }
+}
+
+TEST(SubbandTest, VariantsAreBitIdentical)
+{
+    const auto signal = make_signal(32 * 2000);
+    const auto scalar = analyse(SIMD_NONE, signal);
+
+    for (int simd : available_variants()) {
+        const auto out = analyse(simd, signal);
+        EXPECT_EQ(memcmp(out.data(), scalar.data(), out.size() * sizeof(double)), 0)
+            << "SIMD variant " << simd;
+    }
+}
+
+TEST(SubbandTest, ChannelsAreIndependent)
+{
+    const auto signal = make_signal(32 * 200);
+    const auto mono = analyse(simd_best(), signal);
+
+    subband_mem smem;
+    subband_init(&smem);
+    std::vector<short> silence(32);
+    std::vector<double> out(signal.size()), other(SBLIMIT);
+    for (size_t pos = 0; pos < signal.size(); pos += 32) {
+        WindowFilterSubband(&smem, silence.data(), 0, other.data());
+        WindowFilterSubband(&smem, const_cast<short*>(&signal[pos]), 1, &out[pos]);
+    }
+    EXPECT_EQ(out, mono);
+}
+
+TEST(SubbandTest, InterleavedMatchesPlanar)
+{
+    const auto left = make_signal(32 * 200);
+    std::vector<short> right(left.size()), interleaved(2 * left.size());
+    for (size_t i = 0; i < left.size(); i++) {
+        right[i] = -left[(i * 7) % left.size()] / 2;
+        interleaved[2 * i] = left[i];
+        interleaved[2 * i + 1] = right[i];
+    }
+    const auto expected_left = analyse(SIMD_NONE, left);
+    const auto expected_right = analyse(SIMD_NONE, right);
+
+    for (int simd : available_variants()) {
+        subband_mem smem;
+        subband_init(&smem);
+        smem.simd = simd;
+
+        std::vector<double> out_left(left.size()), out_right(left.size());
+        for (size_t pos = 0; pos < left.size(); pos += 32) {
+            double s[2][SBLIMIT];
+            WindowFilterSubbandInterleaved(&smem, &interleaved[2 * pos], 2, 2, s);
+            std::copy(s[0], s[0] + SBLIMIT, &out_left[pos]);
+            std::copy(s[1], s[1] + SBLIMIT, &out_right[pos]);
+        }
+        EXPECT_EQ(out_left, expected_left) << "SIMD variant " << simd;
+        EXPECT_EQ(out_right, expected_right) << "SIMD variant " << simd;
+
+        // A mono input encoded as stereo gets the same signal on both channels
+        subband_init(&smem);
+        smem.simd = simd;
+        for (size_t pos = 0; pos < left.size(); pos += 32) {
+            double s[2][SBLIMIT];
+            WindowFilterSubbandInterleaved(&smem, &left[pos], 1, 2, s);
+            std::copy(s[0], s[0] + SBLIMIT, &out_left[pos]);
+            std::copy(s[1], s[1] + SBLIMIT, &out_right[pos]);
+        }
+        EXPECT_EQ(out_left, expected_left) << "SIMD variant " << simd;
+        EXPECT_EQ(out_right, expected_left) << "SIMD variant " << simd;
+    }
+}
+
+TEST(SubbandTest, DeinterleaveMatchesScalar)
+{
+    const auto signal = make_signal(2 * 1152);
+    for (int simd : available_variants()) {
+        short buffer[2][1152];
+        deinterleave_pcm(simd, signal.data(), 2, 2, buffer);
+        for (size_t i = 0; i < 1152; i++) {
+            ASSERT_EQ(buffer[0][i], signal[2 * i]) << "SIMD variant " << simd;
+            ASSERT_EQ(buffer[1][i], signal[2 * i + 1]) << "SIMD variant " << simd;
+        }
+    }
+}
+
+TEST(SubbandTest, Benchmark)
+{
+    const size_t seconds = 20;
+    const auto signal = make_signal(48000 * seconds);
+    const char *names[] = {"scalar", "SSE2", "AVX", "NEON"};
+
+    for (int simd : available_variants()) {
+        subband_mem smem;
+        subband_init(&smem);
+        smem.simd = simd;
+
+        double s[SBLIMIT];
+        double sum = 0.0;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t pos = 0; pos + 32 <= signal.size(); pos += 32) {
+            WindowFilterSubband(&smem, const_cast<short*>(&signal[pos]), 0, s);
+            sum += s[0];
+        }
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        const double realtime_factor = seconds / elapsed.count();
+        printf("Subband analysis %s: %.1f Msamples/s, %.0fx realtime per 48kHz channel\n",
+                names[simd], signal.size() / elapsed.count() / 1e6, realtime_factor);
+        EXPECT_TRUE(std::isfinite(sum));
+        EXPECT_GT(realtime_factor, 20.0);
+    }
+
+    // A stereo frame, deinterleaved before the filterbank or while it reads
+    // the samples
+    const size_t num_frames = 5000;
+    const auto interleaved = make_signal(2 * 1152);
+    for (int simd : available_variants()) {
+        subband_mem smem;
+        subband_init(&smem);
+        smem.simd = simd;
+
+        short buffer[2][1152];
+        double s[2][SBLIMIT];
+        double sum = 0.0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < num_frames; i++) {
+            for (size_t j = 0; j < 1152; j++) {
+                buffer[0][j] = interleaved[2 * j];
+                buffer[1][j] = interleaved[2 * j + 1];
+            }
+            for (size_t pos = 0; pos < 1152; pos += 32) {
+                WindowFilterSubband(&smem, &buffer[0][pos], 0, s[0]);
+                WindowFilterSubband(&smem, &buffer[1][pos], 1, s[1]);
+                sum += s[0][1] + s[1][1];
+            }
+        }
+        const std::chrono::duration<double> elapsed_planar =
+            std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < num_frames; i++) {
+            for (size_t pos = 0; pos < 1152; pos += 32) {
+                WindowFilterSubbandInterleaved(&smem, &interleaved[2 * pos], 2, 2, s);
+                sum += s[0][1] + s[1][1];
+            }
+        }
+        const std::chrono::duration<double> elapsed_interleaved =
+            std::chrono::steady_clock::now() - start;
+
+        printf("Subband analysis %s of a stereo frame: deinterleaved first %.2f us, "
+                "interleaved %.2f us\n", names[simd],
+                elapsed_planar.count() / num_frames * 1e6,
+                elapsed_interleaved.count() / num_frames * 1e6);
+        EXPECT_TRUE(std::isfinite(sum));
+    }
+}
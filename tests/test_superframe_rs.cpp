@@ -0,0 +1,151 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * ------------------------------------------------------------------- */
+
+#include <gtest/gtest.h>
+#include "../src/SuperframeRS.h"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+extern "C" {
+#include "fec/fec.h"
+}
+
+namespace {
+
+std::vector<uint8_t> make_superframe(size_t subchannel_index, unsigned seed)
+{
+    std::vector<uint8_t> superframe(120 * subchannel_index);
+    uint32_t noise = seed;
+    for (auto& b : superframe) {
+        noise = noise * 1103515245 + 12345;
+        b = noise >> 16;
+    }
+    return superframe;
+}
+
+/* Encode the superframe as odr-audioenc did, one row after the other with
+ * encode_rs_char() */
+void reference_encode(std::vector<uint8_t>& superframe, size_t subchannel_index)
+{
+    static void *rs = init_rs_char(8, 0x11d, 0, 1, 10, 135);
+    ASSERT_NE(rs, nullptr);
+
+    unsigned char data[110];
+    unsigned char parity[10];
+    for (size_t row = 0; row < subchannel_index; row++) {
+        for (size_t col = 0; col < 110; col++) {
+            data[col] = superframe[subchannel_index * col + row];
+        }
+
+        encode_rs_char(rs, data, parity);
+
+        for (size_t col = 110; col < 120; col++) {
+            superframe[subchannel_index * col + row] = parity[col - 110];
+        }
+    }
+}
+
+/* The variants this CPU can run, always including the scalar one */
+std::vector<SuperframeRS::variant_t> available_variants()
+{
+    using variant_t = SuperframeRS::variant_t;
+    std::vector<variant_t> variants = {variant_t::scalar};
+    const auto best = SuperframeRS::best_variant();
+    if (best == variant_t::avx2) {
+        variants.push_back(variant_t::ssse3);
+    }
+    if (best != variant_t::scalar) {
+        variants.push_back(best);
+    }
+    return variants;
+}
+
+const char *variant_name(SuperframeRS::variant_t variant)
+{
+    switch (variant) {
+        case SuperframeRS::variant_t::scalar: return "scalar";
+        case SuperframeRS::variant_t::ssse3: return "SSSE3";
+        case SuperframeRS::variant_t::avx2: return "AVX2";
+        case SuperframeRS::variant_t::neon: return "NEON";
+    }
+    return "";
+}
+
+} // namespace
+
+TEST(SuperframeRSTest, MatchesReferenceEncoder)
+{
+    // All DAB+ bitrates from 8 to 192 kbps, and a few above to use full
+    // blocks of 32 rows
+    for (size_t subchannel_index = 1; subchannel_index <= 72; subchannel_index++) {
+        auto expected = make_superframe(subchannel_index, subchannel_index);
+        reference_encode(expected, subchannel_index);
+
+        for (auto variant : available_variants()) {
+            const SuperframeRS rs(variant);
+            auto superframe = make_superframe(subchannel_index, subchannel_index);
+            rs.encode(superframe.data(), subchannel_index);
+            ASSERT_EQ(superframe, expected) << variant_name(variant) <<
+                " subchannel index " << subchannel_index;
+        }
+    }
+}
+
+TEST(SuperframeRSTest, ParityOfZeroIsZero)
+{
+    for (auto variant : available_variants()) {
+        const SuperframeRS rs(variant);
+        std::vector<uint8_t> superframe(120 * 12, 0xaa);
+        std::fill(superframe.begin(), superframe.begin() + 110 * 12, 0);
+        rs.encode(superframe.data(), 12);
+        EXPECT_EQ(superframe, std::vector<uint8_t>(120 * 12, 0)) << variant_name(variant);
+    }
+}
+
+TEST(SuperframeRSTest, Benchmark)
+{
+    const size_t num_superframes = 20000;
+
+    for (size_t subchannel_index : {6, 12, 24}) {
+        auto superframe = make_superframe(subchannel_index, 1);
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < num_superframes / 10; i++) {
+            superframe[i % (110 * subchannel_index)]++;
+            reference_encode(superframe, subchannel_index);
+        }
+        const std::chrono::duration<double> elapsed_ref =
+            std::chrono::steady_clock::now() - start;
+        printf("RS(120, 110) %zu kbps: encode_rs_char %.2f us", subchannel_index * 8,
+                elapsed_ref.count() / (num_superframes / 10) * 1e6);
+
+        for (auto variant : available_variants()) {
+            const SuperframeRS rs(variant);
+            start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < num_superframes; i++) {
+                superframe[i % (110 * subchannel_index)]++;
+                rs.encode(superframe.data(), subchannel_index);
+            }
+            const std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+            printf(", %s %.2f us", variant_name(variant),
+                    elapsed.count() / num_superframes * 1e6);
+        }
+        printf(" per superframe\n");
+    }
+}
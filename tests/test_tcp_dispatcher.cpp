@@ -0,0 +1,279 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+
+#include <gtest/gtest.h>
+#include "Socket.h"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace Socket;
+using namespace std::chrono;
+
+namespace {
+
+/* A free TCP port on the loopback interface */
+int free_port()
+{
+    const int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(sock, (struct sockaddr*)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(sock, (struct sockaddr*)&addr, &len);
+    close(sock);
+    return ntohs(addr.sin_port);
+}
+
+/* A destination connecting to the dispatcher */
+class client_t {
+    public:
+        client_t(int port, int rcvbuf = 0)
+        {
+            m_sock = socket(AF_INET, SOCK_STREAM, 0);
+            if (rcvbuf > 0) {
+                setsockopt(m_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+            }
+            struct sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = htons(port);
+            connected = connect(m_sock, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+        }
+        client_t(const client_t&) = delete;
+        client_t& operator=(const client_t&) = delete;
+        ~client_t() { close(m_sock); }
+
+        /* Receive until len bytes arrived, the connection closes, or
+         * nothing arrives for timeout */
+        std::vector<uint8_t> receive(size_t len, milliseconds timeout = milliseconds(1000))
+        {
+            std::vector<uint8_t> data(len);
+            size_t received = 0;
+            struct pollfd fds = { m_sock, POLLIN, 0 };
+            while (received < len and poll(&fds, 1, timeout.count()) == 1) {
+                const ssize_t ret = recv(m_sock, data.data() + received, len - received, 0);
+                if (ret <= 0) {
+                    break;
+                }
+                received += ret;
+            }
+            data.resize(received);
+            return data;
+        }
+
+        bool connected = false;
+
+    private:
+        int m_sock = -1;
+};
+
+bool wait_for_connections(TCPDataDispatcher& dispatcher, size_t num_connections)
+{
+    const auto deadline = steady_clock::now() + seconds(2);
+    while (dispatcher.num_connections() != num_connections and steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+    return dispatcher.num_connections() == num_connections;
+}
+
+/* Buffers of different sizes, and their concatenation */
+struct buffers_t {
+    std::vector<std::vector<uint8_t>> buffers;
+    std::vector<uint8_t> stream;
+
+    buffers_t(size_t num_buffers, size_t first = 0)
+    {
+        for (size_t i = first; i < first + num_buffers; i++) {
+            std::vector<uint8_t> buffer(1 + (i * 337) % 3000);
+            for (size_t j = 0; j < buffer.size(); j++) {
+                buffer[j] = i + j;
+            }
+            stream.insert(stream.end(), buffer.begin(), buffer.end());
+            buffers.push_back(buffer);
+        }
+    }
+};
+
+} // namespace
+
+TEST(TCPDispatcherTest, SendsToAllConnections)
+{
+    const int port = free_port();
+    TCPDataDispatcher dispatcher(1000, 0);
+    dispatcher.start(port, "127.0.0.1");
+
+    std::vector<std::unique_ptr<client_t>> clients;
+    for (size_t i = 0; i < 5; i++) {
+        clients.push_back(std::make_unique<client_t>(port));
+        ASSERT_TRUE(clients.back()->connected);
+    }
+    ASSERT_TRUE(wait_for_connections(dispatcher, 5));
+
+    buffers_t data(100);
+    for (const auto& buffer : data.buffers) {
+        dispatcher.write(buffer);
+    }
+
+    for (auto& client : clients) {
+        EXPECT_EQ(client->receive(data.stream.size()), data.stream);
+    }
+}
+
+TEST(TCPDispatcherTest, PrerollsBuffersForNewConnections)
+{
+    const int port = free_port();
+    TCPDataDispatcher dispatcher(1000, 3);
+    dispatcher.start(port, "127.0.0.1");
+
+    buffers_t before(5);
+    for (const auto& buffer : before.buffers) {
+        dispatcher.write(buffer);
+    }
+
+    client_t client(port);
+    ASSERT_TRUE(wait_for_connections(dispatcher, 1));
+
+    buffers_t after(1, 5);
+    dispatcher.write(after.buffers[0]);
+
+    // The last three buffers written before the connection, then the new one
+    std::vector<uint8_t> expected;
+    for (size_t i = 2; i < 5; i++) {
+        expected.insert(expected.end(), before.buffers[i].begin(), before.buffers[i].end());
+    }
+    expected.insert(expected.end(), after.stream.begin(), after.stream.end());
+    EXPECT_EQ(client.receive(expected.size()), expected);
+}
+
+TEST(TCPDispatcherTest, SharesBuffersBetweenConnections)
+{
+    const int port = free_port();
+    TCPDataDispatcher dispatcher(1000, 2);
+    dispatcher.start(port, "127.0.0.1");
+
+    client_t a(port), b(port);
+    ASSERT_TRUE(wait_for_connections(dispatcher, 2));
+
+    auto buffer = std::make_shared<const std::vector<uint8_t>>(1000, 42);
+    dispatcher.write(buffer);
+    EXPECT_EQ(a.receive(1000), *buffer);
+    EXPECT_EQ(b.receive(1000), *buffer);
+
+    // Once sent, only the preroll queue keeps a reference. The dispatcher
+    // releases the buffer after sendmsg() returns, which can be after the
+    // data arrived.
+    const auto deadline = steady_clock::now() + seconds(1);
+    while (buffer.use_count() > 2 and steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+    EXPECT_EQ(buffer.use_count(), 2);
+}
+
+TEST(TCPDispatcherTest, EvictsSlowConnections)
+{
+    const int port = free_port();
+    const size_t max_frames_queued = 50;
+    TCPDataDispatcher dispatcher(max_frames_queued, 0);
+    dispatcher.start(port, "127.0.0.1");
+
+    // The slow client never reads, and has a small receive buffer
+    client_t fast(port);
+    client_t slow(port, 4096);
+    ASSERT_TRUE(wait_for_connections(dispatcher, 2));
+
+    const size_t num_buffers = 3000;
+    const std::vector<uint8_t> buffer(10000, 1);
+    size_t fast_received = 0;
+    std::thread reader([&]() {
+            fast_received = fast.receive(num_buffers * buffer.size()).size();
+        });
+
+    for (size_t i = 0; i < num_buffers; i++) {
+        dispatcher.write(buffer);
+        std::this_thread::sleep_for(microseconds(200));
+    }
+    reader.join();
+
+    EXPECT_EQ(fast_received, num_buffers * buffer.size());
+    EXPECT_EQ(dispatcher.num_connections(), 1u);
+
+    // Both connections were accepted, the slow one lost what was queued
+    // for it when it was disconnected
+    const auto stats = dispatcher.collect_stats();
+    EXPECT_EQ(stats.num_reconnects, 2u);
+    EXPECT_GT(stats.num_dropped, max_frames_queued);
+    EXPECT_GE(stats.num_sent, num_buffers);
+}
+
+TEST(TCPDispatcherTest, Benchmark)
+{
+    // AF packets of a 96 kbps subchannel, sent to a growing number of
+    // destinations that each read in their own thread
+    const size_t num_buffers = 2000;
+    const std::vector<uint8_t> buffer(300, 1);
+
+    for (size_t num_clients : {1, 10, 50}) {
+        const int port = free_port();
+        TCPDataDispatcher dispatcher(num_buffers, 0);
+        dispatcher.start(port, "127.0.0.1");
+
+        std::vector<std::unique_ptr<client_t>> clients;
+        for (size_t i = 0; i < num_clients; i++) {
+            clients.push_back(std::make_unique<client_t>(port));
+        }
+        ASSERT_TRUE(wait_for_connections(dispatcher, num_clients));
+
+        std::vector<std::thread> readers;
+        std::vector<size_t> received(num_clients);
+        for (size_t i = 0; i < num_clients; i++) {
+            readers.emplace_back([&, i]() {
+                    received[i] = clients[i]->receive(num_buffers * buffer.size()).size();
+                });
+        }
+
+        const auto start = steady_clock::now();
+        steady_clock::duration write_time = {};
+        for (size_t i = 0; i < num_buffers; i++) {
+            const auto write_start = steady_clock::now();
+            dispatcher.write(buffer);
+            write_time += steady_clock::now() - write_start;
+        }
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        const duration<double> elapsed = steady_clock::now() - start;
+
+        for (size_t r : received) {
+            EXPECT_EQ(r, num_buffers * buffer.size());
+        }
+
+        printf("TCP %zu clients: write() %.2f us, %zu buffers delivered to all in %.1f ms\n",
+                num_clients,
+                duration<double, std::micro>(write_time).count() / num_buffers,
+                num_buffers, elapsed.count() * 1e3);
+    }
+}
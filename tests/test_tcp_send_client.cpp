@@ -0,0 +1,243 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+
+#include <gtest/gtest.h>
+#include "Socket.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace Socket;
+using namespace std::chrono;
+
+namespace {
+
+/* The destination the TCPSendClient connects to, on a free port of the
+ * loopback interface. It only reads when asked to. */
+class server_t {
+    public:
+        server_t()
+        {
+            m_listener = socket(AF_INET, SOCK_STREAM, 0);
+
+            // Inherited by the accepted connection, so that the client
+            // stalls quickly when nothing is read
+            const int rcvbuf = 4096;
+            setsockopt(m_listener, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+            struct sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            bind(m_listener, (struct sockaddr*)&addr, sizeof(addr));
+            listen(m_listener, 1);
+
+            socklen_t len = sizeof(addr);
+            getsockname(m_listener, (struct sockaddr*)&addr, &len);
+            m_port = ntohs(addr.sin_port);
+        }
+        server_t(const server_t&) = delete;
+        server_t& operator=(const server_t&) = delete;
+        ~server_t()
+        {
+            close(m_sock);
+            close(m_listener);
+        }
+
+        int port() const { return m_port; }
+
+        bool accept_client()
+        {
+            struct pollfd fds = { m_listener, POLLIN, 0 };
+            if (poll(&fds, 1, 2000) != 1) {
+                return false;
+            }
+            m_sock = accept(m_listener, nullptr, nullptr);
+            return m_sock != -1;
+        }
+
+        /* Receive until nothing arrives for timeout */
+        std::vector<uint8_t> receive(milliseconds timeout = milliseconds(200))
+        {
+            std::vector<uint8_t> data;
+            std::vector<uint8_t> buf(65536);
+            struct pollfd fds = { m_sock, POLLIN, 0 };
+            while (poll(&fds, 1, timeout.count()) == 1) {
+                const ssize_t ret = recv(m_sock, buf.data(), buf.size(), 0);
+                if (ret <= 0) {
+                    break;
+                }
+                data.insert(data.end(), buf.begin(), buf.begin() + ret);
+            }
+            return data;
+        }
+
+    private:
+        int m_listener = -1;
+        int m_sock = -1;
+        int m_port = 0;
+};
+
+/* Large buffers whose content identifies them */
+std::vector<shared_buffer_t> make_buffers(size_t num_buffers, size_t len)
+{
+    std::vector<shared_buffer_t> buffers;
+    for (size_t i = 0; i < num_buffers; i++) {
+        auto buffer = std::make_shared<std::vector<uint8_t>>(len);
+        for (size_t j = 0; j < len; j++) {
+            (*buffer)[j] = i * 7 + j;
+        }
+        buffers.push_back(buffer);
+    }
+    return buffers;
+}
+
+std::vector<uint8_t> concatenate(const std::vector<shared_buffer_t>& buffers, size_t first, size_t last)
+{
+    std::vector<uint8_t> stream;
+    for (size_t i = first; i < last; i++) {
+        stream.insert(stream.end(), buffers[i]->begin(), buffers[i]->end());
+    }
+    return stream;
+}
+
+/* Write the buffers to the client whose destination does not read, and
+ * return the longest time a sendall() call took */
+steady_clock::duration write_to_stalled(TCPSendClient& client,
+        const std::vector<shared_buffer_t>& buffers)
+{
+    steady_clock::duration max_time = {};
+    for (const auto& buffer : buffers) {
+        const auto start = steady_clock::now();
+        client.sendall(buffer);
+        max_time = std::max(max_time, steady_clock::now() - start);
+        std::this_thread::sleep_for(microseconds(500));
+    }
+    return max_time;
+}
+
+} // namespace
+
+TEST(TCPSendClientTest, SendsAllBuffersInOrder)
+{
+    server_t server;
+    TCPSendClient client("127.0.0.1", server.port());
+    ASSERT_TRUE(server.accept_client());
+
+    const auto buffers = make_buffers(100, 1000);
+    for (const auto& buffer : buffers) {
+        client.sendall(buffer);
+    }
+    EXPECT_EQ(server.receive(), concatenate(buffers, 0, buffers.size()));
+
+    const auto stats = client.collect_stats();
+    EXPECT_EQ(stats.num_sent, buffers.size());
+    EXPECT_EQ(stats.num_dropped, 0u);
+    EXPECT_EQ(stats.queue_depth, 0u);
+    EXPECT_GE(stats.latency_max, stats.latency_avg());
+
+    const auto again = client.collect_stats();
+    EXPECT_EQ(again.num_sent, 0u);
+    EXPECT_EQ(again.num_reconnects, 0u);
+}
+
+TEST(TCPSendClientTest, DropsNewestWhenStalled)
+{
+    server_t server;
+    const size_t max_queue_size = 10;
+    TCPSendClient client("127.0.0.1", server.port(), max_queue_size,
+            TCPSendClient::OverflowPolicy::DropNewest);
+    ASSERT_TRUE(server.accept_client());
+
+    // Much more than what the socket buffers can hold
+    const auto buffers = make_buffers(200, 100000);
+    const auto max_time = write_to_stalled(client, buffers);
+    EXPECT_LT(max_time, milliseconds(10));
+
+    const auto stats = client.collect_stats();
+    EXPECT_EQ(stats.queue_depth, max_queue_size);
+    EXPECT_GT(stats.num_dropped, 0u);
+
+    // The destination gets the stream without gap up to where the queue
+    // was full, the buffers written later were dropped
+    const auto received = server.receive();
+    ASSERT_EQ(received.size() % buffers[0]->size(), 0u);
+    const size_t num_received = received.size() / buffers[0]->size();
+    EXPECT_EQ(received, concatenate(buffers, 0, num_received));
+    EXPECT_EQ(num_received + stats.num_dropped, buffers.size());
+}
+
+TEST(TCPSendClientTest, DropsOldestWhenStalled)
+{
+    server_t server;
+    const size_t max_queue_size = 10;
+    TCPSendClient client("127.0.0.1", server.port(), max_queue_size,
+            TCPSendClient::OverflowPolicy::DropOldest);
+    ASSERT_TRUE(server.accept_client());
+
+    const auto buffers = make_buffers(200, 100000);
+    const auto max_time = write_to_stalled(client, buffers);
+    EXPECT_LT(max_time, milliseconds(10));
+
+    const auto stats = client.collect_stats();
+    EXPECT_EQ(stats.queue_depth, max_queue_size);
+    EXPECT_GT(stats.num_dropped, 0u);
+
+    // The queue kept the most recent buffers
+    const auto received = server.receive();
+    const auto latest = concatenate(buffers, buffers.size() - max_queue_size, buffers.size());
+    ASSERT_GE(received.size(), latest.size());
+    EXPECT_TRUE(std::equal(latest.begin(), latest.end(), received.end() - latest.size()));
+}
+
+TEST(TCPSendClientTest, Benchmark)
+{
+    // AF packets of a 96 kbps subchannel, queued for a destination that
+    // does not read
+    server_t server;
+    TCPSendClient client("127.0.0.1", server.port(), 512);
+    ASSERT_TRUE(server.accept_client());
+
+    const size_t num_buffers = 20000;
+    const auto buffer = std::make_shared<const std::vector<uint8_t>>(300, 1);
+
+    steady_clock::duration max_time = {};
+    const auto start = steady_clock::now();
+    for (size_t i = 0; i < num_buffers; i++) {
+        const auto write_start = steady_clock::now();
+        client.sendall(buffer);
+        max_time = std::max(max_time, steady_clock::now() - write_start);
+    }
+    const duration<double> elapsed = steady_clock::now() - start;
+
+    const auto stats = client.collect_stats();
+    printf("TCP client to stalled destination: sendall() %.2f us, max %.1f us, "
+            "%zu sent, %zu dropped, queue %zu\n",
+            elapsed.count() * 1e6 / num_buffers,
+            duration<double, std::micro>(max_time).count(),
+            stats.num_sent, stats.num_dropped, stats.queue_depth);
+
+    server.receive();
+}
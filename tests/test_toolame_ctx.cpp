@@ -0,0 +1,276 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * ------------------------------------------------------------------- */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "../libtoolame-dab/toolame.h"
+}
+
+namespace {
+
+struct service_config_t {
+    long sample_rate;
+    int bitrate;
+    int psy_model;
+    char mode;
+    int psy_interval = 1;
+};
+
+const size_t NUM_FRAMES = 100;
+
+/* A deterministic signal with some tones and noise, so that the psy models
+ * and the bit allocation have something to do */
+void make_frame(size_t frame_index, short buffer[2][1152])
+{
+    uint32_t noise = 12345 + frame_index;
+    for (size_t i = 0; i < 1152; i++) {
+        const double t = frame_index * 1152 + i;
+        noise = noise * 1103515245 + 12345;
+        const double n = (int)((noise >> 16) & 0x7fff) - 16384;
+        buffer[0][i] = lrint(8000 * sin(0.031 * t) + 3000 * sin(0.47 * t) + 0.1 * n);
+        buffer[1][i] = lrint(6000 * sin(0.057 * t + 1.0) + 0.2 * n);
+    }
+}
+
+/* The test signal, silent until attack_frame */
+void make_frame_with_attack(size_t frame_index, size_t attack_frame, short buffer[2][1152])
+{
+    make_frame(frame_index, buffer);
+    if (frame_index < attack_frame) {
+        for (size_t i = 0; i < 1152; i++) {
+            buffer[0][i] /= 1000;
+            buffer[1][i] /= 1000;
+        }
+    }
+}
+
+/* Encode NUM_FRAMES frames with a new context, and return the output.
+ * The signal gets an attack at attack_frame, if given. With interleaved,
+ * the samples are given to toolame in the order an audio input delivers
+ * them. */
+std::vector<uint8_t> encode(const service_config_t& config,
+        size_t attack_frame = 0,
+        unsigned long *psy_runs = nullptr,
+        unsigned long *psy_transients = nullptr,
+        bool interleaved = false)
+{
+    toolame_ctx *ctx = toolame_ctx_create();
+    EXPECT_NE(ctx, nullptr);
+
+    EXPECT_EQ(toolame_ctx_set_samplerate(ctx, config.sample_rate), 0);
+    EXPECT_EQ(toolame_ctx_set_psy_model(ctx, config.psy_model), 0);
+    EXPECT_EQ(toolame_ctx_set_psy_interval(ctx, config.psy_interval), 0);
+    EXPECT_EQ(toolame_ctx_set_channel_mode(ctx, config.mode), 0);
+    EXPECT_EQ(toolame_ctx_set_bitrate(ctx, config.bitrate), 0);
+    EXPECT_EQ(toolame_ctx_set_pad(ctx, 0), 0);
+
+    std::vector<uint8_t> out;
+    std::vector<uint8_t> outbuf(16384);
+    short buffer[2][1152];
+    for (size_t i = 0; i < NUM_FRAMES; i++) {
+        make_frame_with_attack(i, attack_frame, buffer);
+        int n = 0;
+        if (interleaved) {
+            const int channels = config.mode == 'm' ? 1 : 2;
+            short pcm[2 * 1152];
+            for (size_t j = 0; j < 1152; j++) {
+                for (int ch = 0; ch < channels; ch++) {
+                    pcm[channels * j + ch] = buffer[ch][j];
+                }
+            }
+            n = toolame_ctx_encode_frame_interleaved(ctx, pcm, channels, nullptr, 0,
+                    outbuf.data(), outbuf.size());
+        }
+        else {
+            n = toolame_ctx_encode_frame(ctx, buffer, nullptr, 0,
+                    outbuf.data(), outbuf.size());
+        }
+        EXPECT_GE(n, 0);
+        out.insert(out.end(), outbuf.begin(), outbuf.begin() + n);
+    }
+
+    const int n = toolame_ctx_finish(ctx, outbuf.data(), outbuf.size());
+    out.insert(out.end(), outbuf.begin(), outbuf.begin() + n);
+
+    if (psy_runs and psy_transients) {
+        EXPECT_EQ(toolame_ctx_get_psy_stats(ctx, psy_runs, psy_transients), 0);
+    }
+
+    toolame_ctx_destroy(ctx);
+    return out;
+}
+
+const service_config_t CONFIGS[] = {
+    {48000, 128, 1, 'j'},
+    {48000, 192, 2, 's'},
+    {24000, 64, 3, 'm'},
+    {48000, 96, 0, 'd'},
+};
+
+} // namespace
+
+TEST(ToolameCtxTest, ProducesOutput)
+{
+    const auto out = encode(CONFIGS[0]);
+
+    // 24ms frames at 128kbps
+    EXPECT_GT(out.size(), (NUM_FRAMES - 2) * 384u);
+}
+
+TEST(ToolameCtxTest, ConcurrentEncodersMatchSequential)
+{
+    std::vector<std::vector<uint8_t> > sequential;
+    for (const auto& config : CONFIGS) {
+        sequential.push_back(encode(config));
+    }
+
+    std::vector<std::vector<uint8_t> > concurrent(std::size(CONFIGS));
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::size(CONFIGS); i++) {
+        threads.emplace_back([&, i]() { concurrent[i] = encode(CONFIGS[i]); });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    for (size_t i = 0; i < std::size(CONFIGS); i++) {
+        EXPECT_EQ(concurrent[i], sequential[i]) << "Service " << i;
+    }
+}
+
+TEST(ToolameCtxTest, InterleavedEncodersMatchSequential)
+{
+    // Two encoders used alternately from the same thread must not see each
+    // other's state either
+    const auto a_ref = encode(CONFIGS[0]);
+    const auto b_ref = encode(CONFIGS[1]);
+
+    toolame_ctx *ctx[2] = { toolame_ctx_create(), toolame_ctx_create() };
+    for (size_t c = 0; c < 2; c++) {
+        ASSERT_NE(ctx[c], nullptr);
+        toolame_ctx_set_samplerate(ctx[c], CONFIGS[c].sample_rate);
+        toolame_ctx_set_psy_model(ctx[c], CONFIGS[c].psy_model);
+        toolame_ctx_set_channel_mode(ctx[c], CONFIGS[c].mode);
+        toolame_ctx_set_bitrate(ctx[c], CONFIGS[c].bitrate);
+        toolame_ctx_set_pad(ctx[c], 0);
+    }
+
+    std::vector<uint8_t> out[2];
+    std::vector<uint8_t> outbuf(16384);
+    short buffer[2][1152];
+    for (size_t i = 0; i < NUM_FRAMES; i++) {
+        make_frame(i, buffer);
+        for (size_t c = 0; c < 2; c++) {
+            const int n = toolame_ctx_encode_frame(ctx[c], buffer, nullptr, 0,
+                    outbuf.data(), outbuf.size());
+            out[c].insert(out[c].end(), outbuf.begin(), outbuf.begin() + n);
+        }
+    }
+    for (size_t c = 0; c < 2; c++) {
+        const int n = toolame_ctx_finish(ctx[c], outbuf.data(), outbuf.size());
+        out[c].insert(out[c].end(), outbuf.begin(), outbuf.begin() + n);
+        toolame_ctx_destroy(ctx[c]);
+    }
+
+    EXPECT_EQ(out[0], a_ref);
+    EXPECT_EQ(out[1], b_ref);
+}
+
+TEST(ToolameCtxTest, InterleavedInputMatchesPlanar)
+{
+    for (auto config : CONFIGS) {
+        for (int psy_interval : {1, 10}) {
+            config.psy_interval = psy_interval;
+            const auto expected = encode(config);
+            const auto out = encode(config, 0, nullptr, nullptr, true);
+            EXPECT_EQ(out, expected) << "psy model " << config.psy_model <<
+                " interval " << psy_interval;
+        }
+    }
+}
+
+TEST(ToolameCtxTest, PsyIntervalSkipsModel)
+{
+    for (auto config : CONFIGS) {
+        unsigned long runs = 0, transients = 0;
+        encode(config, 0, &runs, &transients);
+        EXPECT_EQ(runs, NUM_FRAMES);
+        EXPECT_EQ(transients, 0u);
+
+        config.psy_interval = 10;
+        const auto out = encode(config, 0, &runs, &transients);
+        EXPECT_EQ(runs, NUM_FRAMES / 10 + transients);
+        EXPECT_EQ(transients, 0u) << "psy model " << config.psy_model;
+        EXPECT_GT(out.size(), 0u);
+    }
+}
+
+TEST(ToolameCtxTest, PsyIntervalRunsModelOnAttack)
+{
+    service_config_t config = CONFIGS[0];
+    config.psy_interval = 10;
+
+    // The model runs on frames 0, 10, 20, 30, then on the attack at 35
+    unsigned long runs = 0, transients = 0;
+    encode(config, 35, &runs, &transients);
+    EXPECT_EQ(transients, 1u);
+    EXPECT_EQ(runs, NUM_FRAMES / 10 + 1);
+}
+
+TEST(ToolameCtxTest, PsyModelBenchmark)
+{
+    // CPU time per frame of a complete stereo encode for every psy model, to
+    // help choosing --psy-model by cost
+    for (int psy_model = 0; psy_model <= 3; psy_model++) {
+        const service_config_t config = {48000, 192, psy_model, 'j'};
+        const auto start = std::chrono::steady_clock::now();
+        const auto out = encode(config);
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        // A frame covers 24ms of audio
+        const double ms_per_frame = elapsed.count() * 1000.0 / NUM_FRAMES;
+        printf("Psy model %d: %.3f ms CPU per frame, %.0fx realtime\n",
+                psy_model, ms_per_frame, 24.0 / ms_per_frame);
+        EXPECT_FALSE(out.empty());
+        EXPECT_LT(ms_per_frame, 24.0);
+    }
+
+    // The same with the model running only every third and every tenth frame
+    for (int psy_interval : {3, 10}) {
+        for (int psy_model = 0; psy_model <= 3; psy_model++) {
+            service_config_t config = {48000, 192, psy_model, 'j'};
+            config.psy_interval = psy_interval;
+            const auto start = std::chrono::steady_clock::now();
+            const auto out = encode(config);
+            const std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+
+            const double ms_per_frame = elapsed.count() * 1000.0 / NUM_FRAMES;
+            printf("Psy model %d every %d frames: %.3f ms CPU per frame, %.0fx realtime\n",
+                    psy_model, psy_interval, ms_per_frame, 24.0 / ms_per_frame);
+            EXPECT_FALSE(out.empty());
+        }
+    }
+}
@@ -0,0 +1,266 @@
+/* ------------------------------------------------------------------
+ * Copyright (C) 2022 Matthias P. Braendli
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ * -------------------------------------------------------------------
+ */
+
+#include <gtest/gtest.h>
+#include "edioutput/UDPBatchSender.h"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace edi;
+
+namespace {
+
+/* A UDP socket on a free port of the loopback interface */
+class receiver_t {
+    public:
+        receiver_t()
+        {
+            m_sock = socket(AF_INET, SOCK_DGRAM, 0);
+            struct sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            bind(m_sock, (struct sockaddr*)&addr, sizeof(addr));
+
+            socklen_t len = sizeof(addr);
+            getsockname(m_sock, (struct sockaddr*)&addr, &len);
+            m_port = ntohs(addr.sin_port);
+        }
+        receiver_t(const receiver_t&) = delete;
+        receiver_t& operator=(const receiver_t&) = delete;
+        ~receiver_t() { close(m_sock); }
+
+        unsigned int port() const { return m_port; }
+
+        /* Receive the packets until none arrives for 100ms, and remember
+         * the source port of the last one */
+        std::vector<std::vector<uint8_t>> receive()
+        {
+            std::vector<std::vector<uint8_t>> packets;
+            struct pollfd fds = { m_sock, POLLIN, 0 };
+            while (poll(&fds, 1, 100) == 1) {
+                std::vector<uint8_t> packet(2048);
+                struct sockaddr_in from = {};
+                socklen_t len = sizeof(from);
+                const ssize_t ret = recvfrom(m_sock, packet.data(), packet.size(), 0,
+                        (struct sockaddr*)&from, &len);
+                if (ret < 0) {
+                    break;
+                }
+                packet.resize(ret);
+                packets.push_back(packet);
+                source_port = ntohs(from.sin_port);
+            }
+            return packets;
+        }
+
+        unsigned int source_port = 0;
+
+    private:
+        int m_sock = -1;
+        unsigned int m_port = 0;
+};
+
+std::shared_ptr<udp_destination_t> make_destination(unsigned int port, unsigned int ttl = 10)
+{
+    auto dest = std::make_shared<udp_destination_t>();
+    dest->dest_addr = "127.0.0.1";
+    dest->dest_port = port;
+    dest->ttl = ttl;
+    return dest;
+}
+
+/* Packets whose first byte identifies them */
+struct packets_t {
+    std::vector<std::vector<uint8_t>> storage;
+    std::vector<const std::vector<uint8_t>*> pointers;
+
+    packets_t(size_t num_packets, size_t len = 100)
+    {
+        for (size_t i = 0; i < num_packets; i++) {
+            storage.emplace_back(len, (uint8_t)i);
+        }
+        for (const auto& packet : storage) {
+            pointers.push_back(&packet);
+        }
+    }
+};
+
+} // namespace
+
+TEST(UDPBatchSenderTest, SendsAllPacketsToAllDestinations)
+{
+    receiver_t receivers[3];
+    std::vector<std::shared_ptr<udp_destination_t>> dests;
+    for (auto& receiver : receivers) {
+        dests.push_back(make_destination(receiver.port()));
+    }
+
+    UDPBatchSender sender(dests);
+    packets_t packets(5);
+    sender.send(packets.pointers);
+
+    for (auto& receiver : receivers) {
+        const auto received = receiver.receive();
+        EXPECT_EQ(received, packets.storage);
+    }
+
+    // The destinations share one socket, all packets go out at once
+    const auto stats = sender.collect_stats();
+    EXPECT_EQ(stats.num_syscalls, 1u);
+    EXPECT_EQ(stats.num_packets, 15u);
+
+    const auto again = sender.collect_stats();
+    EXPECT_EQ(again.num_syscalls, 0u);
+    EXPECT_EQ(again.num_packets, 0u);
+}
+
+TEST(UDPBatchSenderTest, GroupsDestinationsBySourceConfiguration)
+{
+    receiver_t receivers[3];
+    std::vector<std::shared_ptr<udp_destination_t>> dests = {
+        make_destination(receivers[0].port(), 10),
+        make_destination(receivers[1].port(), 20),
+        make_destination(receivers[2].port(), 10) };
+
+    UDPBatchSender sender(dests);
+    packets_t packets(4);
+    sender.send(packets.pointers);
+
+    for (auto& receiver : receivers) {
+        EXPECT_EQ(receiver.receive(), packets.storage);
+    }
+
+    // One socket per distinct configuration
+    EXPECT_EQ(receivers[0].source_port, receivers[2].source_port);
+    EXPECT_NE(receivers[0].source_port, receivers[1].source_port);
+
+    const auto stats = sender.collect_stats();
+    EXPECT_EQ(stats.num_syscalls, 2u);
+    EXPECT_EQ(stats.num_packets, 12u);
+}
+
+TEST(UDPBatchSenderTest, ResolvesDestinationsOnRefresh)
+{
+    receiver_t before, after;
+    auto dest = make_destination(before.port());
+    UDPBatchSender sender({dest});
+    packets_t packets(2);
+
+    // The address is only resolved again on request
+    dest->dest_port = after.port();
+    sender.send(packets.pointers);
+    EXPECT_EQ(before.receive().size(), 2u);
+    EXPECT_EQ(after.receive().size(), 0u);
+
+    sender.resolve_destinations();
+    sender.send(packets.pointers);
+    EXPECT_EQ(before.receive().size(), 0u);
+    EXPECT_EQ(after.receive().size(), 2u);
+}
+
+TEST(UDPBatchSenderTest, CountsPacketsPerDestination)
+{
+    receiver_t receivers[2];
+    std::vector<std::shared_ptr<udp_destination_t>> dests = {
+        make_destination(receivers[0].port(), 10),
+        make_destination(receivers[1].port(), 20) };
+
+    UDPBatchSender sender(dests);
+    packets_t packets(3);
+    sender.send(packets.pointers);
+    sender.send(packets.pointers);
+
+    std::vector<Socket::SendStats> stats;
+    sender.collect_destination_stats(stats);
+    ASSERT_EQ(stats.size(), 2u);
+    for (const auto& s : stats) {
+        EXPECT_EQ(s.num_sent, 6u);
+        EXPECT_EQ(s.num_dropped, 0u);
+        EXPECT_GE(s.latency_max, s.latency_avg());
+    }
+
+    sender.collect_destination_stats(stats);
+    EXPECT_EQ(stats[0].num_sent, 0u);
+    EXPECT_EQ(stats[1].num_sent, 0u);
+}
+
+TEST(UDPBatchSenderTest, Benchmark)
+{
+    // The PFT fragments of one AF packet of a 96 kbps subchannel with
+    // fec=3, sent to many destinations. The receiver does not keep up, the
+    // kernel drops what does not fit in its buffer.
+    receiver_t receiver;
+    const size_t num_fragments = 21;
+    const size_t num_rounds = 200;
+    packets_t packets(num_fragments, 80);
+
+    for (size_t num_dests : {1, 10, 100}) {
+        std::vector<std::shared_ptr<udp_destination_t>> dests;
+        for (size_t d = 0; d < num_dests; d++) {
+            dests.push_back(make_destination(receiver.port()));
+        }
+
+        // Before the UDPBatchSender: resolve and send every packet
+        // separately, with one socket per destination
+        std::vector<std::unique_ptr<Socket::UDPSocket>> sockets;
+        for (size_t d = 0; d < num_dests; d++) {
+            sockets.push_back(std::make_unique<Socket::UDPSocket>(0));
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t round = 0; round < num_rounds; round++) {
+            for (const auto packet : packets.pointers) {
+                for (size_t d = 0; d < num_dests; d++) {
+                    Socket::InetAddress addr;
+                    addr.resolveUdpDestination(dests[d]->dest_addr, dests[d]->dest_port);
+                    sockets[d]->send(*packet, addr);
+                }
+            }
+        }
+        const std::chrono::duration<double> elapsed_ref =
+            std::chrono::steady_clock::now() - start;
+        receiver.receive();
+
+        UDPBatchSender sender(dests);
+        start = std::chrono::steady_clock::now();
+        for (size_t round = 0; round < num_rounds; round++) {
+            sender.send(packets.pointers);
+        }
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        const auto stats = sender.collect_stats();
+        EXPECT_EQ(stats.num_packets, num_rounds * num_fragments * num_dests);
+
+        printf("UDP %zu destinations: %zu packets in %zu syscalls, "
+                "%.1f packets per syscall, per AF packet: reference %.1f us, "
+                "sendmmsg %.1f us\n",
+                num_dests, stats.num_packets, stats.num_syscalls,
+                (double)stats.num_packets / stats.num_syscalls,
+                elapsed_ref.count() / num_rounds * 1e6,
+                elapsed.count() / num_rounds * 1e6);
+        receiver.receive();
+    }
+}